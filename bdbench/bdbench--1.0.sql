@@ -52,6 +52,37 @@ RETURNS void
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT VOLATILE;
 
+CREATE FUNCTION prepare_zipf(
+maxblk bigint,
+ndeadtuples bigint,
+skew float8 default 1.0,
+hot_chain_len int default 0,
+maxoff int default 100,
+shuffle bool default true)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION prepare_bursty(
+maxblk bigint,
+burst_pages int default 16,
+gap_pages int default 64,
+dt_per_page int default 10,
+hot_chain_len int default 0,
+maxoff int default 100,
+shuffle bool default true)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION prepare_from_relation(
+rel regclass,
+index regclass default NULL,
+shuffle bool default false)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
 CREATE FUNCTION prepare_dead_tuples2_packed(
 ntuples bigint default 1000000000,
 tuple_size int default 100,
@@ -61,7 +92,11 @@ AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT VOLATILE;
 
 CREATE FUNCTION attach_dead_tuples(
-mode text)
+mode text,
+shared bool default false,
+spill bool default false,
+mem_limit int default 0,
+partitions int default 0)
 RETURNS void
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT VOLATILE;
@@ -76,16 +111,151 @@ SELECT attach_dead_tuples('dtstore_r');
 END;
 
 CREATE FUNCTION bench(
+mode text default 'array',
+warmup int default 1,
+iterations int default 5,
+OUT structure text,
+OUT run int,
+OUT lookup text,
+OUT ndeadtuples bigint,
+OUT nindextuples bigint,
+OUT matched bigint,
+OUT total_ms float8,
+OUT ns_per_lookup float8,
+OUT p50_ns float8,
+OUT p99_ns float8,
+OUT load_ms float8,
+OUT bytes_per_tid float8,
+OUT hit_ratio float8,
+OUT cache_misses bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+-- Run bench() over the combinations of the prepare() parameters, for
+-- example to store the results in a table:
+--   CREATE TABLE results AS SELECT now() AS ts, * FROM bench_sweep();
+-- The combinations having more than 291 (MaxHeapTuplesPerPage) offsets
+-- in a block are skipped.
+CREATE FUNCTION bench_sweep(
+modes text[] default '{array,intset,tbm,rtbm,svtm,radix,radix_tree}',
+maxblks bigint[] default '{100000,1000000}',
+dt_per_pages int[] default '{1,10,20}',
+dt_intervals_in_page int[] default '{1,10}',
+dt_consecutives int[] default '{1}',
+dt_intervals int[] default '{1,20}',
+warmup int default 1,
+iterations int default 5)
+RETURNS TABLE (
+server_version_num int,
+maxblk bigint,
+dt_per_page int,
+dt_interval_in_page int,
+dt_consecutive int,
+dt_interval int,
+structure text,
+run int,
+lookup text,
+ndeadtuples bigint,
+nindextuples bigint,
+matched bigint,
+total_ms float8,
+ns_per_lookup float8,
+p50_ns float8,
+p99_ns float8,
+load_ms float8,
+bytes_per_tid float8,
+hit_ratio float8,
+cache_misses bigint)
+AS $$
+DECLARE
+  v_maxblk bigint;
+  v_dt int;
+  v_off_interval int;
+  v_consecutive int;
+  v_interval int;
+  v_mode text;
+BEGIN
+  FOREACH v_maxblk IN ARRAY maxblks LOOP
+  FOREACH v_dt IN ARRAY dt_per_pages LOOP
+  FOREACH v_off_interval IN ARRAY dt_intervals_in_page LOOP
+  FOREACH v_consecutive IN ARRAY dt_consecutives LOOP
+  FOREACH v_interval IN ARRAY dt_intervals LOOP
+    CONTINUE WHEN v_dt * v_off_interval > 291 OR v_consecutive > v_interval;
+
+    PERFORM prepare(v_maxblk, v_dt, v_off_interval, v_consecutive, v_interval);
+
+    FOREACH v_mode IN ARRAY modes LOOP
+      PERFORM attach_dead_tuples(v_mode);
+
+      RETURN QUERY
+        SELECT current_setting('server_version_num')::int,
+               v_maxblk, v_dt, v_off_interval, v_consecutive, v_interval, b.*
+        FROM bench(v_mode, warmup, iterations) b;
+    END LOOP;
+  END LOOP;
+  END LOOP;
+  END LOOP;
+  END LOOP;
+  END LOOP;
+END;
+$$ LANGUAGE plpgsql VOLATILE;
+
+CREATE FUNCTION bench_parallel(
+mode text default 'array',
+nworkers int default 2)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION itereate_bench(
 mode text default 'array')
 RETURNS text
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT VOLATILE;
 
---CREATE FUNCTION itereate_bench(
---mode text default 'array')
---RETURNS text
---AS 'MODULE_PATHNAME'
---LANGUAGE C STRICT VOLATILE;
+-- Check every method against a binary search of the dead tuples on rounds
+-- of randomized workloads, and time the loading and the lookups. modes is
+-- all methods if NULL.
+CREATE FUNCTION bench_fuzz(
+seed bigint default 0,
+rounds int default 8,
+ndead bigint default 100000,
+modes text[] default NULL,
+OUT round int,
+OUT structure text,
+OUT workload text,
+OUT sorted bool,
+OUT lookup text,
+OUT ndeadtuples bigint,
+OUT nindextuples bigint,
+OUT load_ms float8,
+OUT ns_per_lookup float8,
+OUT bytes_per_tid float8,
+OUT mismatches bigint,
+OUT first_mismatch tid,
+OUT error text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- lookup counters of this backend, counted while bdbench.stats is on
+CREATE FUNCTION bdbench_stats(
+OUT structure text,
+OUT level int,
+OUT counter text,
+OUT count bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW bdbench_stats AS
+SELECT * FROM bdbench_stats();
+
+CREATE FUNCTION bdbench_reset_stats()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
 
 CREATE FUNCTION test_generate_tid(
 nitems bigint,
@@ -8,28 +8,90 @@
 #include "postgres.h"
 
 #include <math.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/itup.h"
+#include "access/nbtree.h"
+#include "access/relation.h"
+#include "access/xact.h"
 #include "catalog/index.h"
+#include "catalog/pg_am_d.h"
+#include "catalog/pg_type.h"
 #include "fmgr.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/tidbitmap.h"
 #include "lib/integerset.h"
+#include "lib/qunique.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "storage/bufmgr.h"
+#include "storage/dsm.h"
+#include "storage/fd.h"
+#include "storage/latch.h"
+#include "storage/procarray.h"
+#include "storage/shm_toc.h"
+#include "tcop/tcopprot.h"
 #include "tcop/utility.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "common/file_utils.h"
 #include "common/pg_prng.h"
 #include "lib/radixtree.h"
+#include "portability/instr_time.h"
 
 #include "vtbm.h"
 #include "rtbm.h"
 #include "radix.h"
 #include "svtm.h"
+#include "bdbench_stats.h"
+
+/*
+ * The radix tree template specialized for radix_tree_tid, mapping 32-bit keys
+ * of a block and the upper bits of the offsets to 64-bit bitmaps of the lower
+ * bits. Counting the nodes costs a bit on every insertion, so it's done only
+ * in assert-enabled builds.
+ */
+#define RT_PREFIX rt_tid
+#define RT_VALUE_TYPE uint64
+#define RT_KEY_BITS 32
+#ifdef USE_ASSERT_CHECKING
+#define RT_USE_STATS
+#endif
+#define RT_SCOPE static inline
+#define RT_DECLARE
+#define RT_DEFINE
+#include "../radix_tree/radix_tree_template.h"
 //#include "radix_tree.h"
 
 //#define DEBUG_DUMP_MATCHED 1
 
 PG_MODULE_MAGIC;
 
+/*
+ * The number of TIDs passed to reaped_batch_fn at once. We hand over as many
+ * TIDs as an index page can have, like a bulk-delete callback working on a
+ * whole index page would.
+ */
+#define BENCH_BATCH_SIZE	MaxIndexTuplesPerPage
+
+/* bench() times at most this many batches of a round for the percentiles */
+#define BENCH_MAX_SAMPLES	65536
+
 #define MAX_TUPLES_PER_PAGE  MaxHeapTuplesPerPage
 #define PAGES_PER_CHUNK  (BLCKSZ / 32)
 
@@ -80,12 +142,148 @@ typedef struct LVTestType
 					   BlockNumber maxblk, OffsetNumber maxoff);
 	bool (*reaped_fn) (struct LVTestType *lvtt, ItemPointer itemptr);
 	Size (*mem_usage_fn) (struct LVTestType *lvtt);
+
+	/*
+	 * Optional. Look up nitems TIDs at once, setting the i'th bit of result
+	 * for each dead itemptrs[i]. Returns the number of dead TIDs.
+	 */
+	int (*reaped_batch_fn) (struct LVTestType *lvtt, ItemPointer itemptrs,
+							int nitems, uint64 *result);
+
+	/*
+	 * Optional. Same as reaped_batch_fn, but overlapping the cache misses of
+	 * the TIDs by prefetching in stages.
+	 */
+	int (*reaped_pipelined_fn) (struct LVTestType *lvtt, ItemPointer itemptrs,
+								int nitems, uint64 *result);
+
+	/*
+	 * Optional. Same as reaped_batch_fn, but itemptrs are in TID order, as in
+	 * a btree index page of a clustered index, and looked up in a single pass
+	 * along with the dead tuples.
+	 */
+	int (*intersect_fn) (struct LVTestType *lvtt, ItemPointer itemptrs,
+						 int nitems, uint64 *result);
+
+	/*
+	 * Optional. Write the dead tuples in a flat form without pointers, and
+	 * set up private to look up TIDs directly in such a form, which can be
+	 * in a shared memory segment. Required by bench_parallel().
+	 */
+	Size (*export_size_fn) (struct LVTestType *lvtt);
+	void (*export_fn) (struct LVTestType *lvtt, char *dest);
+	void (*import_fn) (struct LVTestType *lvtt, char *src);
+
+	/*
+	 * Optional. Iterate over the dead tuples in TID order, a block at a time.
+	 * iterate_next_fn decodes the offsets of the next block into offsets,
+	 * which has room for MaxHeapTuplesPerPage offsets. Required by
+	 * itereate_bench().
+	 */
+	void *(*begin_iterate_fn) (struct LVTestType *lvtt);
+	bool (*iterate_next_fn) (struct LVTestType *lvtt, void *iter,
+							 BlockNumber *blkno, OffsetNumber *offsets,
+							 int *noffsets);
+	void (*end_iterate_fn) (struct LVTestType *lvtt, void *iter);
+
+	/* the exported copy of the dead tuples, see attach_dead_tuples() */
+	dsm_segment *shared_seg;
+
+	/*
+	 * Optional. build_part_fn builds the nitems dead tuples of a block range,
+	 * in TID order, into a store of its own, as a parallel worker scanning
+	 * the range would. merge_part_fn moves the dead tuples of such a store
+	 * to private, the blocks of the store being after the ones merged
+	 * before, and frees it. Required by attach_partitioned().
+	 */
+	void *(*build_part_fn) (struct LVTestType *lvtt, ItemPointer itemptrs,
+							uint64 nitems);
+	void (*merge_part_fn) (struct LVTestType *lvtt, void *part);
+
+	/*
+	 * Optional. Return the bytes used by the dead tuples, as counted by the
+	 * method itself. Subjects having this stop loading the dead tuples once
+	 * the method tells that mem_limit is about to be crossed.
+	 */
+	Size (*used_bytes_fn) (struct LVTestType *lvtt);
+
+	/* the mapping of the spilled copy, see attach_spilled() */
+	char	   *spill_map;
+	Size		spill_size;
+
+	/* the memory limit in bytes, 0 if unlimited, see attach_dead_tuples() */
+	Size		mem_limit;
+	bool		mem_limit_reached;
+	uint64		nloaded;	/* dead tuples loaded before the limit */
+
+	/* the number of block ranges built separately, see attach_partitioned() */
+	int			npartitions;
+
+	double		load_ms;	/* time taken by attach_fn */
 } LVTestType;
 
+/* reaped_batch_fn, reaped_pipelined_fn or intersect_fn */
+typedef int (*BenchBatchFn) (LVTestType *lvtt, ItemPointer itemptrs,
+							 int nitems, uint64 *result);
+
+/* The measurements of a round of lookups of bench() */
+typedef struct BenchRunResult
+{
+	uint64		matched;
+	double		total_ms;
+	double		p50_ns;		/* ns/lookup of the sampled batches */
+	double		p99_ns;
+	int64		cache_misses;	/* -1 if not available */
+} BenchRunResult;
+
+/*
+ * Shared state of bench_parallel(). Each worker probes its slice of the index
+ * tuple TIDs copied to the same segment, and looks up the dead tuples
+ * exported to the segment of store_handle.
+ */
+#define BDBENCH_PARALLEL_MAGIC		0x6264626e
+#define BDBENCH_KEY_SHARED			1
+#define BDBENCH_KEY_INDEX_TIDS		2
+
+typedef struct BDBenchWorkerResult
+{
+	bool		done;
+	uint64		nlookups;
+	uint64		matched;
+	double		elapsed_ms;
+} BDBenchWorkerResult;
+
+typedef struct BDBenchParallelShared
+{
+	char		mode[NAMEDATALEN];
+	dsm_handle	store_handle;
+	DeadTupleInfo dtinfo;		/* of the dead tuples */
+	uint64		nitems;			/* the number of index tuples */
+	int			nworkers;
+
+	/* workers start looking up together once all of them are ready */
+	pg_atomic_uint32 nready;
+	pg_atomic_uint32 start;
+
+	BDBenchWorkerResult results[FLEXIBLE_ARRAY_MEMBER];
+} BDBenchParallelShared;
+
 /* Simulated index tuples always uses an simple array */
 static DeadTuplesArray *IndexTids_cache = NULL;
 static DeadTuplesArray *DeadTuples_orig = NULL;
 
+/* bdbench.stats, see bdbench_stats.h */
+bool bdbench_stats_enabled = false;
+
+/* The structures whose lookups bdbench_stats() shows */
+static BdbenchStatsSet *const BdbenchStatsSets[] = {
+	&bfm_lookup_stats,
+	&rtbm_lookup_stats,
+	&svtm_lookup_stats,
+};
+
+void _PG_init(void);
+
 PG_FUNCTION_INFO_V1(prepare_index_tuples);
 PG_FUNCTION_INFO_V1(prepare_dead_tuples);
 PG_FUNCTION_INFO_V1(prepare_index_tuples2);
@@ -93,15 +291,22 @@ PG_FUNCTION_INFO_V1(prepare_dead_tuples2);
 PG_FUNCTION_INFO_V1(prepare_dead_tuples2_packed);
 PG_FUNCTION_INFO_V1(attach_dead_tuples);
 PG_FUNCTION_INFO_V1(bench);
+PG_FUNCTION_INFO_V1(bench_parallel);
 PG_FUNCTION_INFO_V1(test_generate_tid);
 PG_FUNCTION_INFO_V1(rtbm_test);
+PG_FUNCTION_INFO_V1(itereate_bench);
 PG_FUNCTION_INFO_V1(radix_run_tests);
 PG_FUNCTION_INFO_V1(prepare);
+PG_FUNCTION_INFO_V1(prepare_zipf);
+PG_FUNCTION_INFO_V1(prepare_bursty);
+PG_FUNCTION_INFO_V1(prepare_from_relation);
+PG_FUNCTION_INFO_V1(bdbench_stats);
+PG_FUNCTION_INFO_V1(bdbench_reset_stats);
+PG_FUNCTION_INFO_V1(bench_fuzz);
 
 /*
 PG_FUNCTION_INFO_V1(tbm_test);
 PG_FUNCTION_INFO_V1(vtbm_test);
-PG_FUNCTION_INFO_V1(itereate_bench);
 */
 
 /* array */
@@ -111,6 +316,13 @@ static void array_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 						 BlockNumber maxblk, OffsetNumber maxoff);
 static bool array_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size array_mem_usage(LVTestType *lvtt);
+static Size array_export_size(LVTestType *lvtt);
+static void array_export(LVTestType *lvtt, char *dest);
+static void array_import(LVTestType *lvtt, char *src);
+static void *array_begin_iter(LVTestType *lvtt);
+static bool array_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+							OffsetNumber *offsets, int *noffsets);
+static void array_end_iter(LVTestType *lvtt, void *iter);
 
 /* tbm */
 static void tbm_init(LVTestType *lvtt, uint64 nitems);
@@ -135,6 +347,8 @@ static void vtbm_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 						 BlockNumber maxblk, OffsetNumber maxoff);
 static bool vtbm_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size vtbm_mem_usage(LVTestType *lvtt);
+static int vtbm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs,
+								 int nitems, uint64 *result);
 
 /* rtbm */
 static void rtbm_init(LVTestType *lvtt, uint64 nitems);
@@ -143,6 +357,28 @@ static void rtbm_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 						 BlockNumber maxblk, OffsetNumber maxoff);
 static bool rtbm_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size rtbm_mem_usage(LVTestType *lvtt);
+static int rtbm_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+							 uint64 *result);
+static int rtbm_reaped_pipelined(LVTestType *lvtt, ItemPointer itemptrs,
+								 int nitems, uint64 *result);
+static int rtbm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs,
+								int nitems, uint64 *result);
+static Size rtbm_export_size(LVTestType *lvtt);
+static void rtbm_export(LVTestType *lvtt, char *dest);
+static void rtbm_import(LVTestType *lvtt, char *src);
+static void *rtbm_begin_iter(LVTestType *lvtt);
+static bool rtbm_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+						   OffsetNumber *offsets, int *noffsets);
+static void rtbm_end_iter(LVTestType *lvtt, void *iter);
+static Size rtbm_used_bytes(LVTestType *lvtt);
+static void *rtbm_build_part(LVTestType *lvtt, ItemPointer itemptrs,
+							 uint64 nitems);
+static void rtbm_merge_part(LVTestType *lvtt, void *part);
+
+/* rtbm_adaptive, rtbm switching to the compact form */
+static void rtbm_adaptive_init(LVTestType *lvtt, uint64 nitems);
+static void *rtbm_adaptive_build_part(LVTestType *lvtt, ItemPointer itemptrs,
+									  uint64 nitems);
 
 /* radix */
 static void radix_init(LVTestType *lvtt, uint64 nitems);
@@ -151,7 +387,13 @@ static void radix_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 						 BlockNumber maxblk, OffsetNumber maxoff);
 static bool radix_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size radix_mem_usage(LVTestType *lvtt);
+static int radix_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+							  uint64 *result);
 static void radix_load(void *tbm, ItemPointerData *itemptrs, int nitems);
+static void *radix_begin_iter(LVTestType *lvtt);
+static bool radix_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+							OffsetNumber *offsets, int *noffsets);
+static void radix_end_iter(LVTestType *lvtt, void *iter);
 
 /* svtm */
 static void svtm_init(LVTestType *lvtt, uint64 nitems);
@@ -160,7 +402,25 @@ static void svtm_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 						 BlockNumber maxblk, OffsetNumber maxoff);
 static bool svtm_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size svtm_mem_usage(LVTestType *lvtt);
-static void svtm_load(SVTm *tbm, ItemPointerData *itemptrs, int nitems);
+static int svtm_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+							 uint64 *result);
+static int svtm_reaped_pipelined(LVTestType *lvtt, ItemPointer itemptrs,
+								 int nitems, uint64 *result);
+static int svtm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs,
+								int nitems, uint64 *result);
+static Size svtm_export_size(LVTestType *lvtt);
+static void svtm_export(LVTestType *lvtt, char *dest);
+static void svtm_import(LVTestType *lvtt, char *src);
+static uint64 svtm_load(SVTm *tbm, ItemPointerData *itemptrs, int nitems,
+						const bool *stop);
+static Size svtm_used_bytes(LVTestType *lvtt);
+static void *svtm_build_part(LVTestType *lvtt, ItemPointer itemptrs,
+							 uint64 nitems);
+static void svtm_merge_part(LVTestType *lvtt, void *part);
+static void *svtm_begin_iter(LVTestType *lvtt);
+static bool svtm_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+						   OffsetNumber *offsets, int *noffsets);
+static void svtm_end_iter(LVTestType *lvtt, void *iter);
 
 /* radix_tree */
 static void radix_tree_init(LVTestType *lvtt, uint64 nitems);
@@ -169,6 +429,8 @@ static void radix_tree_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minbl
 							  BlockNumber maxblk, OffsetNumber maxoff);
 static bool radix_tree_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size radix_tree_mem_usage(LVTestType *lvtt);
+static int radix_tree_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs,
+								   int nitems, uint64 *result);
 static void radix_tree_load(void *tbm, ItemPointerData *itemptrs, int nitems);
 
 /* hash table */
@@ -187,6 +449,33 @@ static void radix_tree_offnum_attach(LVTestType *lvtt, uint64 nitems, BlockNumbe
 static bool radix_tree_offnum_reaped(LVTestType *lvtt, ItemPointer itemptr);
 static Size radix_tree_offnum_mem_usage(LVTestType *lvtt);
 
+/* radix_tree keyed by block number */
+static void radix_tree_block_init(LVTestType *lvtt, uint64 nitems);
+static void radix_tree_block_fini(LVTestType *lvtt);
+static void radix_tree_block_attach(LVTestType *lvtt, uint64 nitems,
+									BlockNumber minblk, BlockNumber maxblk,
+									OffsetNumber maxoff);
+static bool radix_tree_block_reaped(LVTestType *lvtt, ItemPointer itemptr);
+static int radix_tree_block_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs,
+										 int nitems, uint64 *result);
+static Size radix_tree_block_mem_usage(LVTestType *lvtt);
+
+/* radix tree template specialized to TIDs */
+static void radix_tree_tid_init(LVTestType *lvtt, uint64 nitems);
+static void radix_tree_tid_fini(LVTestType *lvtt);
+static void radix_tree_tid_attach(LVTestType *lvtt, uint64 nitems,
+								  BlockNumber minblk, BlockNumber maxblk,
+								  OffsetNumber maxoff);
+static bool radix_tree_tid_reaped(LVTestType *lvtt, ItemPointer itemptr);
+static int radix_tree_tid_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs,
+									   int nitems, uint64 *result);
+static Size radix_tree_tid_mem_usage(LVTestType *lvtt);
+static void radix_tree_tid_load(rt_tid_radix_tree *tree, ItemPointer itemptrs,
+								uint64 nitems);
+static void *radix_tree_tid_build_part(LVTestType *lvtt, ItemPointer itemptrs,
+									   uint64 nitems);
+static void radix_tree_tid_merge_part(LVTestType *lvtt, void *part);
+
 /* Misc functions */
 static void generate_index_tuples(uint64 nitems, BlockNumber minblk,
 								  BlockNumber maxblk, OffsetNumber maxoff);
@@ -197,11 +486,19 @@ static void generate_random_itemptrs(uint64 nitems,
 									 OffsetNumber maxoff, ItemPointer itemptrs_out);
 static void attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk, BlockNumber maxblk,
 				   OffsetNumber maxoff);
+static void attach_shared(LVTestType *lvtt);
+static void attach_spilled(LVTestType *lvtt);
+
+PGDLLEXPORT void bdbench_parallel_main(Datum main_arg);
 static int vac_cmp_itemptr(const void *left, const void *right);
 static void load_vtbm(VTbm *vtbm, ItemPointerData *itemptrs, int nitems);
-static void load_rtbm(RTbm *vtbm, ItemPointerData *itemptrs, int nitems);
+static uint64 load_rtbm(RTbm *vtbm, ItemPointerData *itemptrs, int nitems,
+						const bool *stop);
+static void attach_partitioned(LVTestType *lvtt, uint64 nitems);
+static void mem_limit_reached(void *arg);
 
-#define DECLARE_SUBJECT(n) \
+/* Optional callbacks can be given as designated initializers */
+#define DECLARE_SUBJECT(n, ...) \
 	{ \
 		.dtinfo = {0}, \
 		.name = #n, \
@@ -210,23 +507,94 @@ static void load_rtbm(RTbm *vtbm, ItemPointerData *itemptrs, int nitems);
 		.attach_fn = n##_attach, \
 		.reaped_fn = n##_reaped, \
 		.mem_usage_fn = n##_mem_usage, \
+		__VA_ARGS__ \
 			}
 
-#define TEST_SUBJECT_TYPES 10
+/* Subjects that can be exported to shared memory */
+#define DECLARE_EXPORT(n) \
+	.export_size_fn = n##_export_size, \
+	.export_fn = n##_export, \
+	.import_fn = n##_import
+
+/* Subjects that can stop loading at a memory limit */
+#define DECLARE_MEM_LIMIT(n) \
+	.used_bytes_fn = n##_used_bytes
+
+/* Subjects that can be built by block ranges, see attach_partitioned() */
+#define DECLARE_PARTITION(n) \
+	.build_part_fn = n##_build_part, \
+	.merge_part_fn = n##_merge_part
+
+/* Subjects that can be iterated over in TID order */
+#define DECLARE_ITERATE(n) \
+	.begin_iterate_fn = n##_begin_iter, \
+	.iterate_next_fn = n##_iter_next, \
+	.end_iterate_fn = n##_end_iter
+
+#define TEST_SUBJECT_TYPES 13
 static LVTestType LVTestSubjects[TEST_SUBJECT_TYPES] =
 {
-	DECLARE_SUBJECT(array),
+	DECLARE_SUBJECT(array, DECLARE_EXPORT(array), DECLARE_ITERATE(array)),
 	DECLARE_SUBJECT(tbm),
 	DECLARE_SUBJECT(intset),
-	DECLARE_SUBJECT(vtbm),
-	DECLARE_SUBJECT(rtbm),
-	DECLARE_SUBJECT(radix),
-	DECLARE_SUBJECT(svtm),
-	DECLARE_SUBJECT(radix_tree),
+	DECLARE_SUBJECT(vtbm, .intersect_fn = vtbm_reaped_intersect),
+	DECLARE_SUBJECT(rtbm, .reaped_batch_fn = rtbm_reaped_batch,
+					.reaped_pipelined_fn = rtbm_reaped_pipelined,
+					.intersect_fn = rtbm_reaped_intersect,
+					DECLARE_EXPORT(rtbm), DECLARE_ITERATE(rtbm),
+					DECLARE_MEM_LIMIT(rtbm), DECLARE_PARTITION(rtbm)),
+	DECLARE_SUBJECT(radix, .reaped_batch_fn = radix_reaped_batch,
+					.intersect_fn = radix_reaped_batch,
+					DECLARE_ITERATE(radix)),
+	DECLARE_SUBJECT(svtm, .reaped_batch_fn = svtm_reaped_batch,
+					.reaped_pipelined_fn = svtm_reaped_pipelined,
+					.intersect_fn = svtm_reaped_intersect,
+					DECLARE_EXPORT(svtm), DECLARE_ITERATE(svtm),
+					DECLARE_MEM_LIMIT(svtm), DECLARE_PARTITION(svtm)),
+	DECLARE_SUBJECT(radix_tree, .reaped_batch_fn = radix_tree_reaped_batch,
+					.intersect_fn = radix_tree_reaped_batch),
 	DECLARE_SUBJECT(hash),
 	DECLARE_SUBJECT(radix_tree_offnum),
+	/* rtbm created in adaptive mode, sharing the other callbacks */
+	{
+		.dtinfo = {0},
+		.name = "rtbm_adaptive",
+		.init_fn = rtbm_adaptive_init,
+		.fini_fn = rtbm_fini,
+		.attach_fn = rtbm_attach,
+		.reaped_fn = rtbm_reaped,
+		.mem_usage_fn = rtbm_mem_usage,
+		.reaped_batch_fn = rtbm_reaped_batch,
+		.reaped_pipelined_fn = rtbm_reaped_pipelined,
+		.intersect_fn = rtbm_reaped_intersect,
+		DECLARE_EXPORT(rtbm),
+		DECLARE_ITERATE(rtbm),
+		DECLARE_MEM_LIMIT(rtbm),
+		.build_part_fn = rtbm_adaptive_build_part,
+		.merge_part_fn = rtbm_merge_part,
+	},
+	DECLARE_SUBJECT(radix_tree_block,
+					.reaped_batch_fn = radix_tree_block_reaped_batch,
+					.intersect_fn = radix_tree_block_reaped_batch),
+	DECLARE_SUBJECT(radix_tree_tid,
+					.reaped_batch_fn = radix_tree_tid_reaped_batch,
+					.intersect_fn = radix_tree_tid_reaped_batch,
+					DECLARE_PARTITION(radix_tree_tid)),
 };
 
+/* Return the subject of the name, or NULL if there is no such subject */
+static LVTestType *
+find_subject(const char *name)
+{
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		if (strcmp(name, LVTestSubjects[i].name) == 0)
+			return &(LVTestSubjects[i]);
+	}
+
+	return NULL;
+}
+
 static bool
 is_cached(DeadTupleInfo *info, uint64 nitems, BlockNumber minblk,
 		  BlockNumber maxblk, OffsetNumber maxoff)
@@ -454,6 +822,52 @@ array_mem_usage(LVTestType *lvtt)
 {
 	return MemoryContextMemAllocated(lvtt->mcxt, true);
 }
+static Size
+array_export_size(LVTestType *lvtt)
+{
+	return sizeof(ItemPointerData) * lvtt->dtinfo.nitems;
+}
+static void
+array_export(LVTestType *lvtt, char *dest)
+{
+	memcpy(dest, lvtt->private, sizeof(ItemPointerData) * lvtt->dtinfo.nitems);
+}
+static void
+array_import(LVTestType *lvtt, char *src)
+{
+	lvtt->private = (ItemPointer) src;
+}
+static void *
+array_begin_iter(LVTestType *lvtt)
+{
+	return palloc0(sizeof(uint64));
+}
+static bool
+array_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+				OffsetNumber *offsets, int *noffsets)
+{
+	ItemPointer dead_tuples = (ItemPointer) lvtt->private;
+	uint64 *pos = (uint64 *) iter;
+	BlockNumber blk;
+	int n = 0;
+
+	if (*pos >= lvtt->dtinfo.nitems)
+		return false;
+
+	blk = ItemPointerGetBlockNumber(&(dead_tuples[*pos]));
+	while (*pos < lvtt->dtinfo.nitems &&
+		   ItemPointerGetBlockNumber(&(dead_tuples[*pos])) == blk)
+		offsets[n++] = ItemPointerGetOffsetNumber(&(dead_tuples[(*pos)++]));
+
+	*blkno = blk;
+	*noffsets = n;
+	return true;
+}
+static void
+array_end_iter(LVTestType *lvtt, void *iter)
+{
+	pfree(iter);
+}
 
 /* ---------- TBM ---------- */
 static void
@@ -566,6 +980,13 @@ vtbm_reaped(LVTestType *lvtt, ItemPointer itemptr)
 {
 	return vtbm_lookup((VTbm *) lvtt->private, itemptr);
 }
+static int
+vtbm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+					  uint64 *result)
+{
+	return vtbm_intersect_sorted((VTbm *) lvtt->private, itemptrs, nitems,
+								 result);
+}
 static uint64
 vtbm_mem_usage(LVTestType *lvtt)
 {
@@ -624,24 +1045,129 @@ static void
 rtbm_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 			   BlockNumber maxblk, OffsetNumber maxoff)
 {
-	load_rtbm((RTbm *) lvtt->private,
-				   DeadTuples_orig->itemptrs,
-				   DeadTuples_orig->dtinfo.nitems);
+	if (lvtt->mem_limit > 0)
+		rtbm_set_memory_limit((RTbm *) lvtt->private, lvtt->mem_limit,
+							  mem_limit_reached, lvtt);
+
+	lvtt->nloaded = load_rtbm((RTbm *) lvtt->private,
+							  DeadTuples_orig->itemptrs,
+							  DeadTuples_orig->dtinfo.nitems,
+							  &(lvtt->mem_limit_reached));
 }
 static bool
 rtbm_reaped(LVTestType *lvtt, ItemPointer itemptr)
 {
 	return rtbm_lookup((RTbm *) lvtt->private, itemptr);
 }
+static int
+rtbm_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+				  uint64 *result)
+{
+	return rtbm_lookup_batch((RTbm *) lvtt->private, itemptrs, nitems, result);
+}
+static int
+rtbm_reaped_pipelined(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+					  uint64 *result)
+{
+	return rtbm_lookup_batch_pipelined((RTbm *) lvtt->private, itemptrs,
+									   nitems, result);
+}
+static int
+rtbm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+					  uint64 *result)
+{
+	return rtbm_intersect_sorted((RTbm *) lvtt->private, itemptrs, nitems,
+								 result);
+}
 static uint64
 rtbm_mem_usage(LVTestType *lvtt)
 {
 	rtbm_stats((RTbm *) lvtt->private);
 	return MemoryContextMemAllocated(lvtt->mcxt, true);
 }
+static Size
+rtbm_export_size(LVTestType *lvtt)
+{
+	return rtbm_serialized_size((RTbm *) lvtt->private);
+}
+static void
+rtbm_export(LVTestType *lvtt, char *dest)
+{
+	rtbm_serialize((RTbm *) lvtt->private, dest);
+}
+static void
+rtbm_import(LVTestType *lvtt, char *src)
+{
+	lvtt->private = (void *) rtbm_deserialize(src);
+}
+static void *
+rtbm_begin_iter(LVTestType *lvtt)
+{
+	return rtbm_begin_iterate((RTbm *) lvtt->private);
+}
+static bool
+rtbm_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+			   OffsetNumber *offsets, int *noffsets)
+{
+	return rtbm_iterate_next((RTbmIter *) iter, blkno, offsets, noffsets);
+}
+static void
+rtbm_end_iter(LVTestType *lvtt, void *iter)
+{
+	rtbm_end_iterate((RTbmIter *) iter);
+}
+static Size
+rtbm_used_bytes(LVTestType *lvtt)
+{
+	return rtbm_memory_usage((RTbm *) lvtt->private);
+}
+static void *
+rtbm_build_part(LVTestType *lvtt, ItemPointer itemptrs, uint64 nitems)
+{
+	RTbm	   *part = rtbm_create();
+
+	if (nitems > 0)
+		load_rtbm(part, itemptrs, nitems, NULL);
+
+	return part;
+}
+static void
+rtbm_merge_part(LVTestType *lvtt, void *part)
+{
+	rtbm_merge((RTbm *) lvtt->private, (RTbm *) part);
+}
 
+/* ---------- RTBM (adaptive) ---------- */
 static void
-load_rtbm(RTbm *rtbm, ItemPointerData *itemptrs, int nitems)
+rtbm_adaptive_init(LVTestType *lvtt, uint64 nitems)
+{
+	MemoryContext old_ctx;
+
+	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
+									   "rtbm_adaptive bench",
+									   ALLOCSET_DEFAULT_SIZES);
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+	lvtt->private = (void *) rtbm_create_adaptive();
+	MemoryContextSwitchTo(old_ctx);
+}
+static void *
+rtbm_adaptive_build_part(LVTestType *lvtt, ItemPointer itemptrs, uint64 nitems)
+{
+	RTbm	   *part = rtbm_create_adaptive();
+
+	if (nitems > 0)
+		load_rtbm(part, itemptrs, nitems, NULL);
+
+	return part;
+}
+
+/*
+ * Load the TIDs a block at a time, and return the number of TIDs loaded. If
+ * stop is given, stop once it's set, like the heap scan stops at the memory
+ * limit.
+ */
+static uint64
+load_rtbm(RTbm *rtbm, ItemPointerData *itemptrs, int nitems, const bool *stop)
 {
 	BlockNumber curblkno = InvalidBlockNumber;
 	OffsetNumber offs[1024];
@@ -659,6 +1185,9 @@ load_rtbm(RTbm *rtbm, ItemPointerData *itemptrs, int nitems)
 							   curblkno, offs, noffs);
 			curblkno = blkno;
 			noffs = 0;
+
+			if (stop && *stop)
+				return i;
 		}
 
 		curblkno = blkno;
@@ -666,6 +1195,8 @@ load_rtbm(RTbm *rtbm, ItemPointerData *itemptrs, int nitems)
 	}
 
 	rtbm_add_tuples(rtbm, curblkno, offs, noffs);
+
+	return nitems;
 }
 
 /* ---------- radix ---------- */
@@ -702,10 +1233,10 @@ radix_to_key_off(ItemPointer tid, uint32 *off)
        uint32 shift = pg_ceil_log2_32(MaxHeapTuplesPerPage);
        int64 tid_i;
 
-       Assert(ItemPointerGetOffsetNumber(tid) < MaxHeapTuplesPerPage);
+       Assert(ItemPointerGetOffsetNumber(tid) <= MaxHeapTuplesPerPage);
 
        tid_i = ItemPointerGetOffsetNumber(tid);
-       tid_i |= ItemPointerGetBlockNumber(tid) << shift;
+       tid_i |= (int64) ItemPointerGetBlockNumber(tid) << shift;
 
        *off = tid_i & ((1 << ENCODE_BITS)-1);
        upper = tid_i >> ENCODE_BITS;
@@ -750,6 +1281,20 @@ radix_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 			   DeadTuples_orig->dtinfo.nitems);
 
 	MemoryContextSwitchTo(oldcontext);
+
+#ifdef BFM_STATS
+	{
+		bfm_tree *root = (bfm_tree *) lvtt->private;
+
+		ereport(NOTICE,
+				errmsg("\"%s\": built bottom-up, skipping %zu node grows, %.2f MB of short-lived nodes in the slabs",
+					   lvtt->name,
+					   root->build_skipped_nodes,
+					   (double) root->build_skipped_bytes / (1024 * 1024)),
+				errhidestmt(true),
+				errhidecontext(true));
+	}
+#endif
 }
 
 
@@ -768,6 +1313,43 @@ radix_reaped(LVTestType *lvtt, ItemPointer itemptr)
 	return val & ((bfm_value_type)1 << off);
 }
 
+static int
+radix_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+				   uint64 *result)
+{
+	bfm_tree *root = (bfm_tree *) lvtt->private;
+	bfm_key_type keys[64];
+	bfm_value_type vals[64];
+	bool found[64];
+	uint32 offs[64];
+	int nmatched = 0;
+
+	/* look up the TIDs 64 at a time, i.e. one result word at a time */
+	for (int base = 0; base < nitems; base += 64)
+	{
+		int n = Min(nitems - base, 64);
+		uint64 word = 0;
+
+		for (int i = 0; i < n; i++)
+			keys[i] = radix_to_key_off(&(itemptrs[base + i]), &(offs[i]));
+
+		bfm_lookup_batch(root, keys, n, vals, found);
+
+		for (int i = 0; i < n; i++)
+		{
+			if (found[i] && (vals[i] & ((bfm_value_type) 1 << offs[i])) != 0)
+			{
+				word |= UINT64CONST(1) << i;
+				nmatched++;
+			}
+		}
+
+		result[base / 64] = word;
+	}
+
+	return nmatched;
+}
+
 static uint64
 radix_mem_usage(LVTestType *lvtt)
 {
@@ -790,36 +1372,128 @@ radix_mem_usage(LVTestType *lvtt)
 	return mem;
 }
 
+/*
+ * The dead tuples are sorted, so we collect the keys and their bitmaps in
+ * order and build the tree from them at once.
+ */
 static void
 radix_load(void *tbm, ItemPointerData *itemptrs, int nitems)
 {
 	bfm_tree *root = (bfm_tree *) tbm;
+	bfm_key_type *keys;
+	bfm_value_type *vals;
 	uint64 last_key = PG_UINT64_MAX;
-	uint64 val = 0;
+	int nkeys = 0;
 
+	/* count the keys first, the TIDs of a key are adjacent */
 	for (int i = 0; i < nitems; i++)
 	{
-		ItemPointer tid = &(itemptrs[i]);
 		uint64 key;
 		uint32 off;
 
-		key = radix_to_key_off(tid, &off);
+		key = radix_to_key_off(&(itemptrs[i]), &off);
 
-		if (last_key != PG_UINT64_MAX &&
-			last_key != key)
+		if (key != last_key)
+			nkeys++;
+		last_key = key;
+	}
+
+	keys = MemoryContextAllocHuge(CurrentMemoryContext,
+								  sizeof(bfm_key_type) * Max(nkeys, 1));
+	vals = MemoryContextAllocHuge(CurrentMemoryContext,
+								  sizeof(bfm_value_type) * Max(nkeys, 1));
+
+	last_key = PG_UINT64_MAX;
+	nkeys = 0;
+	for (int i = 0; i < nitems; i++)
+	{
+		uint64 key;
+		uint32 off;
+
+		key = radix_to_key_off(&(itemptrs[i]), &off);
+
+		if (key != last_key)
 		{
-			bfm_set(root, last_key, val);
-			val = 0;
+			keys[nkeys] = key;
+			vals[nkeys] = 0;
+			nkeys++;
 		}
 
 		last_key = key;
-		val |= (uint64)1 << off;
+		vals[nkeys - 1] |= (uint64)1 << off;
 	}
 
-	if (last_key != PG_UINT64_MAX)
+	bfm_build_sorted(root, keys, vals, nkeys);
+
+	pfree(keys);
+	pfree(vals);
+}
+
+/*
+ * Iteration state for radix. The TIDs of a block span several keys, so we
+ * read one key ahead to find where the block ends.
+ */
+typedef struct RadixIterState
+{
+	bfm_iter *iter;
+	bool valid;			/* key and val hold the next entry */
+	bfm_key_type key;
+	bfm_value_type val;
+} RadixIterState;
+
+static void *
+radix_begin_iter(LVTestType *lvtt)
+{
+	RadixIterState *state = palloc(sizeof(RadixIterState));
+
+	state->iter = bfm_begin_iterate((bfm_tree *) lvtt->private);
+	state->valid = bfm_iterate_next(state->iter, &state->key, &state->val);
+
+	return state;
+}
+
+/* Decode the keys and bitmaps back into TIDs, the reverse of radix_to_key_off() */
+static bool
+radix_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+				OffsetNumber *offsets, int *noffsets)
+{
+	RadixIterState *state = (RadixIterState *) iter;
+	uint32 shift = pg_ceil_log2_32(MaxHeapTuplesPerPage);
+	BlockNumber blk;
+	int n = 0;
+
+	if (!state->valid)
+		return false;
+
+	blk = (state->key << ENCODE_BITS) >> shift;
+	do
 	{
-		bfm_set(root, last_key, val);
-	}
+		uint64 tid_i = state->key << ENCODE_BITS;
+		bfm_value_type val = state->val;
+
+		while (val != 0)
+		{
+			uint64 off = tid_i | pg_rightmost_one_pos64(val);
+
+			offsets[n++] = off & ((1 << shift) - 1);
+			val &= val - 1;
+		}
+
+		state->valid = bfm_iterate_next(state->iter, &state->key, &state->val);
+	} while (state->valid && ((state->key << ENCODE_BITS) >> shift) == blk);
+
+	*blkno = blk;
+	*noffsets = n;
+	return true;
+}
+
+static void
+radix_end_iter(LVTestType *lvtt, void *iter)
+{
+	RadixIterState *state = (RadixIterState *) iter;
+
+	bfm_end_iterate(state->iter);
+	pfree(state);
 }
 
 /* ------------ svtm ----------- */
@@ -849,9 +1523,14 @@ svtm_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
 {
 	MemoryContext oldcontext = MemoryContextSwitchTo(lvtt->mcxt);
 
-	svtm_load(lvtt->private,
-			   DeadTuples_orig->itemptrs,
-			   DeadTuples_orig->dtinfo.nitems);
+	if (lvtt->mem_limit > 0)
+		svtm_set_memory_limit(lvtt->private, lvtt->mem_limit,
+							  mem_limit_reached, lvtt);
+
+	lvtt->nloaded = svtm_load(lvtt->private,
+							  DeadTuples_orig->itemptrs,
+							  DeadTuples_orig->dtinfo.nitems,
+							  &(lvtt->mem_limit_reached));
 
 	MemoryContextSwitchTo(oldcontext);
 }
@@ -862,6 +1541,27 @@ svtm_reaped(LVTestType *lvtt, ItemPointer itemptr)
 	return svtm_lookup(lvtt->private, itemptr);
 }
 
+static int
+svtm_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+				  uint64 *result)
+{
+	return svtm_lookup_batch((SVTm *) lvtt->private, itemptrs, nitems, result);
+}
+static int
+svtm_reaped_pipelined(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+					  uint64 *result)
+{
+	return svtm_lookup_batch_pipelined((SVTm *) lvtt->private, itemptrs,
+									   nitems, result);
+}
+static int
+svtm_reaped_intersect(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+					  uint64 *result)
+{
+	return svtm_intersect_sorted((SVTm *) lvtt->private, itemptrs, nitems,
+								 result);
+}
+
 static uint64
 svtm_mem_usage(LVTestType *lvtt)
 {
@@ -869,8 +1569,46 @@ svtm_mem_usage(LVTestType *lvtt)
 	return MemoryContextMemAllocated(lvtt->mcxt, true);
 }
 
+static Size
+svtm_export_size(LVTestType *lvtt)
+{
+	return svtm_serialized_size((SVTm *) lvtt->private);
+}
+
+static void
+svtm_export(LVTestType *lvtt, char *dest)
+{
+	svtm_serialize((SVTm *) lvtt->private, dest);
+}
+
+static void
+svtm_import(LVTestType *lvtt, char *src)
+{
+	lvtt->private = (void *) svtm_deserialize(src);
+}
+
+static void *
+svtm_begin_iter(LVTestType *lvtt)
+{
+	return svtm_begin_iterate((SVTm *) lvtt->private);
+}
+
+static bool
+svtm_iter_next(LVTestType *lvtt, void *iter, BlockNumber *blkno,
+			   OffsetNumber *offsets, int *noffsets)
+{
+	return svtm_iterate_next((SVTmIter *) iter, blkno, offsets, noffsets);
+}
+
 static void
-svtm_load(SVTm *svtm, ItemPointerData *itemptrs, int nitems)
+svtm_end_iter(LVTestType *lvtt, void *iter)
+{
+	svtm_end_iterate((SVTmIter *) iter);
+}
+
+/* Same as load_rtbm() */
+static uint64
+svtm_load(SVTm *svtm, ItemPointerData *itemptrs, int nitems, const bool *stop)
 {
 	BlockNumber curblkno = InvalidBlockNumber;
 	OffsetNumber offs[1024];
@@ -887,6 +1625,12 @@ svtm_load(SVTm *svtm, ItemPointerData *itemptrs, int nitems)
 			svtm_add_page(svtm, curblkno, offs, noffs);
 			curblkno = blkno;
 			noffs = 0;
+
+			if (stop && *stop)
+			{
+				svtm_finalize_addition(svtm);
+				return i;
+			}
 		}
 
 		curblkno = blkno;
@@ -895,6 +1639,30 @@ svtm_load(SVTm *svtm, ItemPointerData *itemptrs, int nitems)
 
 	svtm_add_page(svtm, curblkno, offs, noffs);
 	svtm_finalize_addition(svtm);
+
+	return nitems;
+}
+
+static Size
+svtm_used_bytes(LVTestType *lvtt)
+{
+	return svtm_memory_usage((SVTm *) lvtt->private);
+}
+
+static void *
+svtm_build_part(LVTestType *lvtt, ItemPointer itemptrs, uint64 nitems)
+{
+	SVTm	   *part = svtm_create();
+
+	svtm_load(part, itemptrs, nitems, NULL);
+
+	return part;
+}
+
+static void
+svtm_merge_part(LVTestType *lvtt, void *part)
+{
+	svtm_merge((SVTm *) lvtt->private, (SVTm *) part);
 }
 
 /* ---------- radix_tree ---------- */
@@ -913,10 +1681,9 @@ radix_tree_init(LVTestType *lvtt, uint64 nitems)
 static void
 radix_tree_fini(LVTestType *lvtt)
 {
-#if 0
 	if (lvtt->private)
-		radix_tree_destroy((radix_tree *) llvt->private);
-#endif
+		radix_tree_destroy((radix_tree *) lvtt->private);
+	lvtt->private = NULL;
 }
 
 static void
@@ -939,12 +1706,53 @@ radix_tree_reaped(LVTestType *lvtt, ItemPointer itemptr)
 	uint64 key;
 	uint32 off;
 	bool found = false;
+	uint64 val;
 
 	key = radix_to_key_off(itemptr, &off);
 
-	radix_tree_search((radix_tree *) lvtt->private, key, &found);
+	val = DatumGetInt64(radix_tree_search((radix_tree *) lvtt->private, key,
+										  &found));
 
-	return found;
+	return found && (val & ((uint64) 1 << off)) != 0;
+}
+
+/*
+ * The value found for a key is reused while the following TIDs map to the
+ * same key, which is the case for TIDs of the same heap page.
+ */
+static int
+radix_tree_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs, int nitems,
+						uint64 *result)
+{
+	radix_tree *tree = (radix_tree *) lvtt->private;
+	uint64 curkey = PG_UINT64_MAX;
+	uint64 val = 0;
+	bool found = false;
+	int nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((nitems + 63) / 64));
+
+	for (int i = 0; i < nitems; i++)
+	{
+		uint64 key;
+		uint32 off;
+
+		key = radix_to_key_off(&(itemptrs[i]), &off);
+
+		if (key != curkey)
+		{
+			val = DatumGetInt64(radix_tree_search(tree, key, &found));
+			curkey = key;
+		}
+
+		if (found && (val & ((uint64) 1 << off)) != 0)
+		{
+			result[i / 64] |= UINT64CONST(1) << (i % 64);
+			nmatched++;
+		}
+	}
+
+	return nmatched;
 }
 
 static uint64
@@ -1047,10 +1855,9 @@ radix_tree_offnum_init(LVTestType *lvtt, uint64 nitems)
 static void
 radix_tree_offnum_fini(LVTestType *lvtt)
 {
-#if 0
 	if (lvtt->private)
-		radix_tree_destroy((radix_tree *) llvt->private);
-#endif
+		radix_tree_destroy((radix_tree *) lvtt->private);
+	lvtt->private = NULL;
 }
 
 static void
@@ -1123,405 +1930,3511 @@ radix_tree_offnum_mem_usage(LVTestType *lvtt)
 	return mem;
 }
 
-/* ---------- hash ---------- */
-static void
-hash_init(LVTestType *lvtt, uint64 nitems)
-{
-	MemoryContext old_ctx;
-	static HTAB *h;
-	HASHCTL ctl;
+/* ---------- radix_tree_block ---------- */
 
-	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
-									   "hash bench",
-									   ALLOCSET_DEFAULT_SIZES);
-	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+/*
+ * The radix tree is keyed by block number, and the value of a block answers
+ * for all its offsets. A block with up to RTBLK_INLINE_MAX dead tuples has
+ * them inline in the value, its lowest bit set:
+ *
+ *   bits 0     : 1
+ *   bits 1-2   : the number of offsets
+ *   bits 16-63 : up to 3 16-bit offsets
+ *
+ * Otherwise the value points to a container, the smallest of an array of
+ * offsets, a bitmap and an array of (start, length) runs, as rtbm chooses.
+ * Containers are 2-byte aligned, so the lowest bit of the pointer is clear.
+ * They are never freed individually but carved out of large blocks, so
+ * that they don't pay for the chunk headers of the memory context.
+ */
+#define RTBLK_INLINE_MAX		3
+#define RTBLK_IS_INLINE(v)		(((v) & 1) != 0)
+#define RTBLK_INLINE_COUNT(v)	((int) (((v) >> 1) & 0x03))
+#define RTBLK_INLINE_OFFSET(v, i)	((OffsetNumber) ((v) >> (16 * ((i) + 1))))
 
-	ctl.keysize = sizeof(ItemPointerData);
-	ctl.entrysize = sizeof(ItemPointerData);
-	ctl.hcxt = lvtt->mcxt;
-	h = hash_create("hash bench", nitems, &ctl,
-					HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
-	lvtt->private = (void *) h;
-	MemoryContextSwitchTo(old_ctx);
-}
-static void
-hash_fini(LVTestType *lvtt)
-{
-#if 0
-	if (lvtt->private)
-		radix_tree_destroy((radix_tree *) llvt->private);
-#endif
-}
+#define RTBLK_CONTAINER_ARRAY	1
+#define RTBLK_CONTAINER_BITMAP	2
+#define RTBLK_CONTAINER_RUN		3
 
-static void
-hash_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
-				  BlockNumber maxblk, OffsetNumber maxoff)
+#define RTBLK_SPACE_BLOCK_SIZE	(1024 * 1024)
+
+typedef struct RTBlkContainer
 {
-	MemoryContext oldcontext = MemoryContextSwitchTo(lvtt->mcxt);
-	HTAB *h = (HTAB *) lvtt->private;
-	bool found;
+	uint16		type;
+	uint16		len;		/* offsets, bitmap bytes or runs */
+	uint16		data[FLEXIBLE_ARRAY_MEMBER];
+} RTBlkContainer;
 
-	for (int i = 0; i < nitems; i++)
-	{
-		hash_search(h,
-					(void *) &(DeadTuples_orig->itemptrs[i]),
-					HASH_ENTER, &found);
-	}
+typedef struct RTBlkStore
+{
+	radix_tree *tree;
 
-	MemoryContextSwitchTo(oldcontext);
-}
+	/* the space for containers */
+	char	   *space;
+	Size		space_left;
 
+	/* statistics */
+	uint64		nblocks;
+	uint64		ninline;
+	uint64		ncontainers[RTBLK_CONTAINER_RUN + 1];
+	uint64		container_bytes;
+} RTBlkStore;
 
-static bool
-hash_reaped(LVTestType *lvtt, ItemPointer itemptr)
+static RTBlkContainer *
+radix_tree_block_alloc_container(RTBlkStore *store, Size size)
 {
-	bool found = false;
-	HTAB *h = (HTAB *) lvtt->private;
+	RTBlkContainer *container;
 
-	hash_search(h, (void *) itemptr, HASH_FIND, &found);
+	size = TYPEALIGN(sizeof(uint16), size);
 
-	return found;
-}
+	if (size > store->space_left)
+	{
+		store->space = MemoryContextAlloc(CurrentMemoryContext,
+										  RTBLK_SPACE_BLOCK_SIZE);
+		store->space_left = RTBLK_SPACE_BLOCK_SIZE;
+	}
 
-static uint64
-hash_mem_usage(LVTestType *lvtt)
-{
-	return MemoryContextMemAllocated(lvtt->mcxt, true);
+	container = (RTBlkContainer *) store->space;
+	store->space += size;
+	store->space_left -= size;
+	store->container_bytes += size;
+
+	return container;
 }
 
-static void
-attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk, BlockNumber maxblk,
-	   OffsetNumber maxoff)
+/*
+ * Return the value of a block having the given offsets, which are sorted.
+ */
+static Datum
+radix_tree_block_encode(RTBlkStore *store, const OffsetNumber *offsets,
+						int noffsets)
 {
-	MemoryContext old_ctx;
+	RTBlkContainer *container;
+	Size		array_size, bitmap_size, run_size;
+	int			nruns = 1;
 
-	if (!DeadTuples_orig || DeadTuples_orig->dtinfo.nitems == 0)
-		elog(ERROR, "must prepare dead tuple tids by ");
+	Assert(noffsets > 0);
 
-	/* Return the cached set if the same request comes */
-	if (is_cached((DeadTupleInfo *) &(lvtt->dtinfo), nitems, minblk, maxblk, maxoff))
-		return;
+	if (noffsets <= RTBLK_INLINE_MAX)
+	{
+		uint64		val = 1 | ((uint64) noffsets << 1);
 
-	/* (re) initialize */
-	if (!lvtt->private)
-		lvtt->init_fn(lvtt, nitems);
-	else
+		for (int i = 0; i < noffsets; i++)
+			val |= (uint64) offsets[i] << (16 * (i + 1));
+
+		store->ninline++;
+		return UInt64GetDatum(val);
+	}
+
+	for (int i = 1; i < noffsets; i++)
 	{
-		lvtt->fini_fn(lvtt);
-		lvtt->init_fn(lvtt, nitems);
+		if (offsets[i] != offsets[i - 1] + 1)
+			nruns++;
 	}
 
-	/* update cache information */
-	update_info((DeadTupleInfo *) &(lvtt->dtinfo), nitems, minblk, maxblk, maxoff);
+	array_size = sizeof(uint16) * noffsets;
+	bitmap_size = TYPEALIGN(sizeof(uint16), (offsets[noffsets - 1] - 1) / BITS_PER_BYTE + 1);
+	run_size = sizeof(uint16) * 2 * nruns;
 
-	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+	if (run_size <= array_size && run_size <= bitmap_size)
+	{
+		int			r = 0;
 
-	lvtt->attach_fn(lvtt, nitems, minblk, maxblk, maxoff);
+		container = radix_tree_block_alloc_container(store,
+													 offsetof(RTBlkContainer, data) + run_size);
+		container->type = RTBLK_CONTAINER_RUN;
+		container->len = nruns;
 
-	MemoryContextSwitchTo(old_ctx);
-}
+		container->data[0] = offsets[0];
+		container->data[1] = 1;
+		for (int i = 1; i < noffsets; i++)
+		{
+			if (offsets[i] == offsets[i - 1] + 1)
+				container->data[r * 2 + 1]++;
+			else
+			{
+				r++;
+				container->data[r * 2] = offsets[i];
+				container->data[r * 2 + 1] = 1;
+			}
+		}
+	}
+	else if (array_size <= bitmap_size)
+	{
+		container = radix_tree_block_alloc_container(store,
+													 offsetof(RTBlkContainer, data) + array_size);
+		container->type = RTBLK_CONTAINER_ARRAY;
+		container->len = noffsets;
+		memcpy(container->data, offsets, array_size);
+	}
+	else
+	{
+		uint8	   *bitmap;
 
-static void
-_bench(LVTestType *lvtt)
-{
-	uint64 matched = 0;
-	MemoryContext old_ctx;
+		container = radix_tree_block_alloc_container(store,
+													 offsetof(RTBlkContainer, data) + bitmap_size);
+		container->type = RTBLK_CONTAINER_BITMAP;
+		container->len = (offsets[noffsets - 1] - 1) / BITS_PER_BYTE + 1;
 
-#ifdef DEBUG_DUMP_MATCHED
-	FILE *f = fopen(lvtt->name, "w");
-#endif
+		bitmap = (uint8 *) container->data;
+		memset(bitmap, 0, bitmap_size);
+		for (int i = 0; i < noffsets; i++)
+			bitmap[(offsets[i] - 1) / BITS_PER_BYTE] |= 1 << ((offsets[i] - 1) % BITS_PER_BYTE);
+	}
 
-	if (!lvtt->private)
-		elog(ERROR, "%s dead tuples are not preapred", lvtt->name);
+	store->ncontainers[container->type]++;
+	return PointerGetDatum(container);
+}
 
-	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+/*
+ * Check if the value of a block has the offset.
+ */
+static inline bool
+radix_tree_block_contains(Datum value, OffsetNumber off)
+{
+	uint64		val = DatumGetUInt64(value);
+	RTBlkContainer *container;
 
-	for (int i = 0; i < IndexTids_cache->dtinfo.nitems; i++)
+	if (RTBLK_IS_INLINE(val))
 	{
-		CHECK_FOR_INTERRUPTS();
-		if (lvtt->reaped_fn(lvtt, &(IndexTids_cache->itemptrs[i])))
+		for (int i = 0; i < RTBLK_INLINE_COUNT(val); i++)
 		{
-#ifdef DEBUG_DUMP_MATCHED
-			char buf[128] = {0};
-			sprintf(buf, "(%5u, %5u)\n",
-					 ItemPointerGetBlockNumber(&(IndexTids_cache->itemptrs[i])),
-					 ItemPointerGetOffsetNumber(&(IndexTids_cache->itemptrs[i])));
-			fwrite(buf, strlen(buf), 1, f);
-#endif
-			matched++;
+			if (RTBLK_INLINE_OFFSET(val, i) == off)
+				return true;
 		}
+
+		return false;
 	}
 
-	MemoryContextSwitchTo(old_ctx);
+	container = (RTBlkContainer *) DatumGetPointer(value);
 
-#ifdef DEBUG_DUMP_MATCHED
-	fclose(f);
-#endif
+	switch (container->type)
+	{
+		case RTBLK_CONTAINER_ARRAY:
+			for (int i = 0; i < container->len; i++)
+			{
+				if (container->data[i] >= off)
+					return container->data[i] == off;
+			}
+			return false;
 
-	if (matched != lvtt->dtinfo.nitems)
-		elog(WARNING, "the number of dead tuples found doesn't match the actual dead tuples: got %lu expected %lu",
-			 matched, lvtt->dtinfo.nitems);
+		case RTBLK_CONTAINER_BITMAP:
+			{
+				uint8	   *bitmap = (uint8 *) container->data;
 
-	elog(NOTICE, "\"%s\": dead tuples %lu, index tuples %lu, matched %lu, mem %zu",
-//	elog(NOTICE, "\"%s\": dead tuples %lu, index tuples %lu, matched %lu, mem %.2f",
-		 lvtt->name,
-		 lvtt->dtinfo.nitems,
-		 IndexTids_cache->dtinfo.nitems,
-		 matched,
-		 lvtt->mem_usage_fn(lvtt));
-//		 (double) lvtt->mem_usage_fn(lvtt) / (1024 * 1024));
-}
+				if ((off - 1) / BITS_PER_BYTE >= container->len)
+					return false;
 
-/* SQL-callable functions */
-Datum
-prepare_index_tuples(PG_FUNCTION_ARGS)
-{
-	uint64 nitems = PG_GETARG_INT64(0);
-	BlockNumber minblk = PG_GETARG_INT32(1);
-	BlockNumber maxblk = PG_GETARG_INT32(2);
-	OffsetNumber maxoff = PG_GETARG_INT32(3);
+				return (bitmap[(off - 1) / BITS_PER_BYTE] &
+						(1 << ((off - 1) % BITS_PER_BYTE))) != 0;
+			}
 
-	generate_index_tuples(nitems, minblk, maxblk, maxoff);
+		case RTBLK_CONTAINER_RUN:
+			for (int i = 0; i < container->len; i++)
+			{
+				OffsetNumber start = container->data[i * 2];
 
-	PG_RETURN_NULL();
+				if (off < start)
+					return false;
+				if (off < start + container->data[i * 2 + 1])
+					return true;
+			}
+			return false;
+	}
+
+	Assert(false);
+	return false;
 }
 
-Datum
-prepare_dead_tuples(PG_FUNCTION_ARGS)
+static void
+radix_tree_block_init(LVTestType *lvtt, uint64 nitems)
 {
-	uint64 nitems = PG_GETARG_INT64(0);
-	BlockNumber minblk = PG_GETARG_INT32(1);
-	BlockNumber maxblk = PG_GETARG_INT32(2);
-	OffsetNumber maxoff = PG_GETARG_INT32(3);
-
-	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+	MemoryContext old_ctx;
+	RTBlkStore *store;
 
-	PG_RETURN_NULL();
+	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
+									   "radix_tree_block bench",
+									   ALLOCSET_DEFAULT_SIZES);
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+	store = palloc0(sizeof(RTBlkStore));
+	store->tree = radix_tree_create(lvtt->mcxt);
+	lvtt->private = store;
+	MemoryContextSwitchTo(old_ctx);
+}
+static void
+radix_tree_block_fini(LVTestType *lvtt)
+{
+	/* the tree and the containers are all in the context */
+	MemoryContextReset(lvtt->mcxt);
+	lvtt->private = NULL;
 }
 
-Datum
-prepare_index_tuples2(PG_FUNCTION_ARGS)
+static void
+radix_tree_block_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
+						BlockNumber maxblk, OffsetNumber maxoff)
 {
-	uint64 ntuples = PG_GETARG_INT64(0);
-	int tuple_size = PG_GETARG_INT32(1);
+	RTBlkStore *store = (RTBlkStore *) lvtt->private;
+	ItemPointer itemptrs = DeadTuples_orig->itemptrs;
+	MemoryContext oldcontext = MemoryContextSwitchTo(lvtt->mcxt);
+	OffsetNumber offsets[MaxHeapTuplesPerPage];
+	BlockNumber curblk = InvalidBlockNumber;
+	int			noffsets = 0;
+	bool		found;
 
-	uint64 nitems;
-	BlockNumber minblk = 0, maxblk;
-	OffsetNumber maxoff;
+	/* the dead tuples are sorted, so a block's offsets come together */
+	for (uint64 i = 0; i < nitems; i++)
+	{
+		BlockNumber blkno = ItemPointerGetBlockNumber(&(itemptrs[i]));
 
-	maxblk = ((((uint64) ntuples) * (uint64)(tuple_size)) / 8192) * 1.05;
-	maxoff = 8192 / tuple_size;
-	nitems = ntuples;
+		if (blkno != curblk && noffsets > 0)
+		{
+			radix_tree_insert(store->tree, curblk,
+							  radix_tree_block_encode(store, offsets, noffsets),
+							  &found);
+			store->nblocks++;
+			noffsets = 0;
+		}
 
-	generate_index_tuples(nitems, minblk, maxblk, maxoff);
+		curblk = blkno;
+		offsets[noffsets++] = ItemPointerGetOffsetNumber(&(itemptrs[i]));
+	}
 
-	PG_RETURN_NULL();
+	if (noffsets > 0)
+	{
+		radix_tree_insert(store->tree, curblk,
+						  radix_tree_block_encode(store, offsets, noffsets),
+						  &found);
+		store->nblocks++;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
 }
 
-Datum
-prepare_dead_tuples2(PG_FUNCTION_ARGS)
+static bool
+radix_tree_block_reaped(LVTestType *lvtt, ItemPointer itemptr)
 {
-	uint64 ntuples = PG_GETARG_INT64(0);
-	int tuple_size = PG_GETARG_INT32(1);
-	float8 dt_ratio = PG_GETARG_FLOAT8(2);
-
-	uint64 nitems;
-	BlockNumber minblk = 0, maxblk;
-	OffsetNumber maxoff;
-
-	maxblk = ((((uint64) ntuples) * (uint64)(tuple_size)) / 8192) * 1.05;
-	maxoff = 8192 / tuple_size;
-	nitems = (int) (ntuples * dt_ratio);
+	RTBlkStore *store = (RTBlkStore *) lvtt->private;
+	Datum		value;
+	bool		found;
 
-	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+	value = radix_tree_search(store->tree, ItemPointerGetBlockNumber(itemptr),
+							  &found);
 
-	PG_RETURN_NULL();
+	return found &&
+		radix_tree_block_contains(value, ItemPointerGetOffsetNumber(itemptr));
 }
 
-Datum
-prepare_dead_tuples2_packed(PG_FUNCTION_ARGS)
+/*
+ * The value found for a block is reused for the following TIDs on the same
+ * block.
+ */
+static int
+radix_tree_block_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs,
+							  int nitems, uint64 *result)
+{
+	RTBlkStore *store = (RTBlkStore *) lvtt->private;
+	BlockNumber curblk = InvalidBlockNumber;
+	Datum		value = 0;
+	bool		found = false;
+	int			nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((nitems + 63) / 64));
+
+	for (int i = 0; i < nitems; i++)
+	{
+		BlockNumber blkno = ItemPointerGetBlockNumber(&(itemptrs[i]));
+
+		if (blkno != curblk)
+		{
+			value = radix_tree_search(store->tree, blkno, &found);
+			curblk = blkno;
+		}
+
+		if (found &&
+			radix_tree_block_contains(value, ItemPointerGetOffsetNumber(&(itemptrs[i]))))
+		{
+			result[i / 64] |= UINT64CONST(1) << (i % 64);
+			nmatched++;
+		}
+	}
+
+	return nmatched;
+}
+
+static uint64
+radix_tree_block_mem_usage(LVTestType *lvtt)
+{
+	RTBlkStore *store = (RTBlkStore *) lvtt->private;
+	uint64		tree_mem = radix_tree_memory_usage(store->tree);
+
+	radix_tree_stats(store->tree);
+
+	ereport(NOTICE,
+			errmsg("radix tree of %.2f MB, %lu blocks: %lu inline, %lu array, %lu bitmap, %lu run containers of %.2f MB",
+				   (double) tree_mem / (1024 * 1024),
+				   store->nblocks, store->ninline,
+				   store->ncontainers[RTBLK_CONTAINER_ARRAY],
+				   store->ncontainers[RTBLK_CONTAINER_BITMAP],
+				   store->ncontainers[RTBLK_CONTAINER_RUN],
+				   (double) store->container_bytes / (1024 * 1024)),
+			errhidestmt(true),
+			errhidecontext(true));
+
+	return sizeof(RTBlkStore) + tree_mem + store->container_bytes;
+}
+
+/* ---------- radix_tree_tid ---------- */
+
+/*
+ * The key is the block number and the offset divided by 64, and the offset
+ * modulo 64 is the bit in the value. MaxHeapTuplesPerPage / 64 fits in 3
+ * bits, which leaves 29 bits to the block number.
+ */
+#define RADIX_TREE_TID_OFFSET_BITS	3
+#define RADIX_TREE_TID_MAX_BLOCK \
+	((BlockNumber) (PG_UINT32_MAX >> RADIX_TREE_TID_OFFSET_BITS))
+
+/*
+ * Blocks above RADIX_TREE_TID_MAX_BLOCK are never loaded, and their key
+ * would wrap around onto a lower block, so lookups must not search them.
+ */
+#define RADIX_TREE_TID_KEY_VALID(tid) \
+	(ItemPointerGetBlockNumber(tid) <= RADIX_TREE_TID_MAX_BLOCK)
+
+static inline uint32
+radix_tree_tid_key(ItemPointer tid, uint32 *bit)
+{
+	OffsetNumber off = ItemPointerGetOffsetNumber(tid);
+
+	Assert(off < (1 << (RADIX_TREE_TID_OFFSET_BITS + 6)));
+
+	*bit = off & 63;
+	return (ItemPointerGetBlockNumber(tid) << RADIX_TREE_TID_OFFSET_BITS) |
+		(off >> 6);
+}
+
+static void
+radix_tree_tid_init(LVTestType *lvtt, uint64 nitems)
+{
+	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
+									   "radix_tree_tid bench",
+									   ALLOCSET_DEFAULT_SIZES);
+	lvtt->private = rt_tid_create(lvtt->mcxt);
+}
+static void
+radix_tree_tid_fini(LVTestType *lvtt)
+{
+	if (lvtt->private)
+		rt_tid_free((rt_tid_radix_tree *) lvtt->private);
+	lvtt->private = NULL;
+}
+
+static void
+radix_tree_tid_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
+					  BlockNumber maxblk, OffsetNumber maxoff)
+{
+	radix_tree_tid_load((rt_tid_radix_tree *) lvtt->private,
+						DeadTuples_orig->itemptrs, nitems);
+}
+
+/* Set the bits of the dead tuples, which must be sorted, a key at a time */
+static void
+radix_tree_tid_load(rt_tid_radix_tree *tree, ItemPointer itemptrs,
+					uint64 nitems)
+{
+	uint32		curkey = 0;
+	uint64		val = 0;
+
+	if (nitems == 0)
+		return;
+
+	/* the last one has the highest block */
+	if (!RADIX_TREE_TID_KEY_VALID(&(itemptrs[nitems - 1])))
+		ereport(ERROR,
+				errmsg("radix_tree_tid supports block numbers up to %u",
+					   RADIX_TREE_TID_MAX_BLOCK));
+
+	for (uint64 i = 0; i < nitems; i++)
+	{
+		uint32		bit;
+		uint32		key = radix_tree_tid_key(&(itemptrs[i]), &bit);
+
+		if (key != curkey && val != 0)
+		{
+			rt_tid_set(tree, curkey, val);
+			val = 0;
+		}
+
+		curkey = key;
+		val |= UINT64CONST(1) << bit;
+	}
+
+	rt_tid_set(tree, curkey, val);
+}
+
+static void *
+radix_tree_tid_build_part(LVTestType *lvtt, ItemPointer itemptrs,
+						  uint64 nitems)
+{
+	rt_tid_radix_tree *part = rt_tid_create(lvtt->mcxt);
+
+	radix_tree_tid_load(part, itemptrs, nitems);
+
+	return part;
+}
+
+static void
+radix_tree_tid_merge_part(LVTestType *lvtt, void *part)
+{
+	rt_tid_merge((rt_tid_radix_tree *) lvtt->private,
+				 (rt_tid_radix_tree *) part);
+}
+
+static bool
+radix_tree_tid_reaped(LVTestType *lvtt, ItemPointer itemptr)
+{
+	uint32		bit;
+	uint32		key = radix_tree_tid_key(itemptr, &bit);
+	uint64		val;
+
+	if (!RADIX_TREE_TID_KEY_VALID(itemptr))
+		return false;
+
+	return rt_tid_search((rt_tid_radix_tree *) lvtt->private, key, &val) &&
+		(val & (UINT64CONST(1) << bit)) != 0;
+}
+
+/*
+ * As radix_tree_reaped_batch(), the value found for a key is reused for the
+ * following TIDs mapping to the same key.
+ */
+static int
+radix_tree_tid_reaped_batch(LVTestType *lvtt, ItemPointer itemptrs,
+							int nitems, uint64 *result)
+{
+	rt_tid_radix_tree *tree = (rt_tid_radix_tree *) lvtt->private;
+	uint32		curkey = PG_UINT32_MAX;
+	uint64		val = 0;
+	int			nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((nitems + 63) / 64));
+
+	for (int i = 0; i < nitems; i++)
+	{
+		uint32		bit;
+		uint32		key = radix_tree_tid_key(&(itemptrs[i]), &bit);
+
+		if (!RADIX_TREE_TID_KEY_VALID(&(itemptrs[i])))
+			continue;
+
+		if (key != curkey)
+		{
+			if (!rt_tid_search(tree, key, &val))
+				val = 0;
+			curkey = key;
+		}
+
+		if ((val & (UINT64CONST(1) << bit)) != 0)
+		{
+			result[i / 64] |= UINT64CONST(1) << (i % 64);
+			nmatched++;
+		}
+	}
+
+	return nmatched;
+}
+
+static uint64
+radix_tree_tid_mem_usage(LVTestType *lvtt)
+{
+	rt_tid_radix_tree *tree = (rt_tid_radix_tree *) lvtt->private;
+	uint64		mem = rt_tid_memory_usage(tree);
+
+	rt_tid_stats(tree);
+
+	ereport(NOTICE,
+			errmsg("radix tree of %.2f MB, %lu keys",
+				   (double) mem / (1024 * 1024), rt_tid_num_entries(tree)),
+			errhidestmt(true),
+			errhidecontext(true));
+
+	return mem;
+}
+
+/* ---------- hash ---------- */
+static void
+hash_init(LVTestType *lvtt, uint64 nitems)
+{
+	MemoryContext old_ctx;
+	static HTAB *h;
+	HASHCTL ctl;
+
+	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
+									   "hash bench",
+									   ALLOCSET_DEFAULT_SIZES);
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+
+	ctl.keysize = sizeof(ItemPointerData);
+	ctl.entrysize = sizeof(ItemPointerData);
+	ctl.hcxt = lvtt->mcxt;
+	h = hash_create("hash bench", nitems, &ctl,
+					HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	lvtt->private = (void *) h;
+	MemoryContextSwitchTo(old_ctx);
+}
+static void
+hash_fini(LVTestType *lvtt)
+{
+#if 0
+	if (lvtt->private)
+		radix_tree_destroy((radix_tree *) llvt->private);
+#endif
+}
+
+static void
+hash_attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk,
+				  BlockNumber maxblk, OffsetNumber maxoff)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(lvtt->mcxt);
+	HTAB *h = (HTAB *) lvtt->private;
+	bool found;
+
+	for (int i = 0; i < nitems; i++)
+	{
+		hash_search(h,
+					(void *) &(DeadTuples_orig->itemptrs[i]),
+					HASH_ENTER, &found);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+
+static bool
+hash_reaped(LVTestType *lvtt, ItemPointer itemptr)
+{
+	bool found = false;
+	HTAB *h = (HTAB *) lvtt->private;
+
+	hash_search(h, (void *) itemptr, HASH_FIND, &found);
+
+	return found;
+}
+
+static uint64
+hash_mem_usage(LVTestType *lvtt)
+{
+	return MemoryContextMemAllocated(lvtt->mcxt, true);
+}
+
+static void
+attach(LVTestType *lvtt, uint64 nitems, BlockNumber minblk, BlockNumber maxblk,
+	   OffsetNumber maxoff)
+{
+	MemoryContext old_ctx;
+	instr_time start_time,
+			   load_time;
+
+	if (!DeadTuples_orig || DeadTuples_orig->dtinfo.nitems == 0)
+		elog(ERROR, "must prepare dead tuple tids by ");
+
+	/* Return the cached set if the same request comes */
+	if (is_cached((DeadTupleInfo *) &(lvtt->dtinfo), nitems, minblk, maxblk, maxoff))
+		return;
+
+	/*
+	 * The spilled copy is stale. The read-only private points into it, so
+	 * reset its context rather than calling fini_fn.
+	 */
+	if (lvtt->spill_map)
+	{
+		if (munmap(lvtt->spill_map, lvtt->spill_size) != 0)
+			elog(WARNING, "could not unmap spilled dead tuples: %m");
+		lvtt->spill_map = NULL;
+		MemoryContextReset(lvtt->mcxt);
+		lvtt->private = NULL;
+	}
+
+	/*
+	 * (re) initialize. init_fn creates a new context, so free whatever the
+	 * old one still has, fini_fn not freeing everything.
+	 */
+	if (lvtt->private)
+		lvtt->fini_fn(lvtt);
+	if (lvtt->mcxt)
+		MemoryContextDelete(lvtt->mcxt);
+	lvtt->mcxt = NULL;
+	lvtt->private = NULL;
+	lvtt->init_fn(lvtt, nitems);
+
+	/* the exported copy is stale */
+	if (lvtt->shared_seg)
+	{
+		dsm_detach(lvtt->shared_seg);
+		lvtt->shared_seg = NULL;
+	}
+
+	/* update cache information */
+	update_info((DeadTupleInfo *) &(lvtt->dtinfo), nitems, minblk, maxblk, maxoff);
+
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+
+	lvtt->mem_limit_reached = false;
+	lvtt->nloaded = nitems;
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	if (lvtt->npartitions > 1)
+		attach_partitioned(lvtt, nitems);
+	else
+		lvtt->attach_fn(lvtt, nitems, minblk, maxblk, maxoff);
+	INSTR_TIME_SET_CURRENT(load_time);
+	INSTR_TIME_SUBTRACT(load_time, start_time);
+	lvtt->load_ms = INSTR_TIME_GET_MILLISEC(load_time);
+
+	MemoryContextSwitchTo(old_ctx);
+
+	elog(NOTICE, "\"%s\": loaded %lu dead tuples in %.3f ms, mem %zu",
+		 lvtt->name, lvtt->nloaded,
+		 INSTR_TIME_GET_MILLISEC(load_time),
+		 MemoryContextMemAllocated(lvtt->mcxt, true));
+
+	if (lvtt->mem_limit > 0)
+		elog(NOTICE, "\"%s\": memory limit %zu kB %s after %lu of %lu dead tuples, used %zu bytes",
+			 lvtt->name, lvtt->mem_limit / 1024,
+			 lvtt->mem_limit_reached ? "reached" : "not reached",
+			 lvtt->nloaded, lvtt->dtinfo.nitems,
+			 lvtt->used_bytes_fn(lvtt));
+}
+
+/*
+ * The limit callback of the methods. The load functions stop once it's
+ * called, leaving the rest of the dead tuples to the next round.
+ */
+static void
+mem_limit_reached(void *arg)
+{
+	LVTestType *lvtt = (LVTestType *) arg;
+
+	lvtt->mem_limit_reached = true;
+}
+
+/*
+ * Build the dead tuples by lvtt->npartitions ranges of blocks of about the
+ * same size, as that many parallel workers would, each into a store of its
+ * own, and merge the stores into private in block order, as the leader
+ * would. The partitions are built one after another here, so a parallel
+ * build would take the time of the slowest partition plus the merge, which
+ * are reported separately.
+ */
+static void
+attach_partitioned(LVTestType *lvtt, uint64 nitems)
+{
+	ItemPointer itemptrs = DeadTuples_orig->itemptrs;
+	int			nparts = lvtt->npartitions;
+	void	  **parts = palloc(sizeof(void *) * nparts);
+	BlockNumber firstblk = ItemPointerGetBlockNumber(&(itemptrs[0]));
+	uint64		nblocks = ItemPointerGetBlockNumber(&(itemptrs[nitems - 1])) -
+		firstblk + 1;
+	uint64		start = 0;
+	double		build_ms = 0;
+	double		max_build_ms = 0;
+	instr_time	start_time,
+				elapsed;
+
+	Assert(nitems > 0);
+
+	for (int p = 0; p < nparts; p++)
+	{
+		BlockNumber endblk = firstblk + nblocks * (p + 1) / nparts;
+		uint64		lo = start;
+		uint64		hi = nitems;
+
+		/* the dead tuples are sorted, find the first one after the range */
+		while (lo < hi)
+		{
+			uint64		mid = lo + (hi - lo) / 2;
+
+			if (ItemPointerGetBlockNumber(&(itemptrs[mid])) < endblk)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		parts[p] = lvtt->build_part_fn(lvtt, &(itemptrs[start]), lo - start);
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+		build_ms += INSTR_TIME_GET_MILLISEC(elapsed);
+		max_build_ms = Max(max_build_ms, INSTR_TIME_GET_MILLISEC(elapsed));
+		start = lo;
+	}
+	Assert(start == nitems);
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	for (int p = 0; p < nparts; p++)
+		lvtt->merge_part_fn(lvtt, parts[p]);
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+	pfree(parts);
+
+	elog(NOTICE, "\"%s\": built %d partitions in %.3f ms, the slowest in %.3f ms, merged in %.3f ms",
+		 lvtt->name, nparts, build_ms, max_build_ms,
+		 INSTR_TIME_GET_MILLISEC(elapsed));
+}
+
+/*
+ * Export the dead tuples to a new DSM segment, which lasts until the dead
+ * tuples are rebuilt or the backend exits.
+ */
+static void
+attach_shared(LVTestType *lvtt)
+{
+	dsm_segment *seg;
+	Size		size;
+
+	if (lvtt->shared_seg)
+		return;
+
+	size = lvtt->export_size_fn(lvtt);
+	seg = dsm_create(size, 0);
+	lvtt->export_fn(lvtt, dsm_segment_address(seg));
+	dsm_pin_mapping(seg);
+
+	lvtt->shared_seg = seg;
+
+	elog(NOTICE, "exported %s dead tuples to shared memory, %zu bytes",
+		 lvtt->name, size);
+}
+
+/*
+ * Write the dead tuples to a file in the exported form, and replace them with
+ * a read-only copy working on a mapping of the file. Lookups then page in
+ * only the parts of the file they touch, like a vacuum whose dead tuples
+ * don't fit in maintenance_work_mem would read them from disk.
+ *
+ * The file is removed right after being created, so that an error doesn't
+ * leave it behind. The descriptor and then the mapping keep it until the dead
+ * tuples are rebuilt or the backend exits.
+ */
+static void
+attach_spilled(LVTestType *lvtt)
+{
+	MemoryContext old_ctx;
+	char		path[MAXPGPATH];
+	char	   *map;
+	Size		size;
+	int			fd;
+
+	if (lvtt->spill_map)
+		return;
+
+	snprintf(path, sizeof(path), "base/%s/bdbench_%s.%d",
+			 PG_TEMP_FILES_DIR, lvtt->name, MyProcPid);
+
+	/* The temporary files directory might not exist yet */
+	if (MakePGDirectory("base/" PG_TEMP_FILES_DIR) < 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						"base/" PG_TEMP_FILES_DIR)));
+
+	fd = OpenTransientFile(path, O_RDWR | O_CREAT | O_TRUNC | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+
+	if (unlink(path) != 0)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", path)));
+
+	size = lvtt->export_size_fn(lvtt);
+	if (ftruncate(fd, size) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not resize file \"%s\" to %zu bytes: %m",
+						path, size)));
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not map file \"%s\": %m", path)));
+
+	PG_TRY();
+	{
+		lvtt->export_fn(lvtt, map);
+
+		if (msync(map, size, MS_SYNC) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write file \"%s\": %m", path)));
+	}
+	PG_CATCH();
+	{
+		(void) munmap(map, size);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/*
+	 * Start cold: drop the written pages from our mapping and from the page
+	 * cache. The accesses to the blocks of the dead tuples are random, so
+	 * don't read ahead either.
+	 */
+	(void) madvise(map, size, MADV_DONTNEED);
+#ifdef USE_POSIX_FADVISE
+	(void) posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+#endif
+	(void) madvise(map, size, MADV_RANDOM);
+	(void) mprotect(map, size, PROT_READ);
+
+	CloseTransientFile(fd);
+
+	/* Switch to the read-only copy */
+	lvtt->fini_fn(lvtt);
+	MemoryContextReset(lvtt->mcxt);
+
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+	lvtt->import_fn(lvtt, map);
+	MemoryContextSwitchTo(old_ctx);
+
+	lvtt->spill_map = map;
+	lvtt->spill_size = size;
+
+	elog(NOTICE, "spilled %s dead tuples to disk, %zu bytes mapped, mem %zu",
+		 lvtt->name, size, MemoryContextMemAllocated(lvtt->mcxt, true));
+}
+
+/*
+ * Open a counter of the cache misses of this process, disabled. Returns -1 if
+ * the platform or perf_event_paranoid doesn't let us.
+ */
+static int
+bench_perf_open(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void
+bench_perf_start(int fd)
+{
+#ifdef __linux__
+	if (fd < 0)
+		return;
+
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/* Returns the cache misses since bench_perf_start(), or -1 if unavailable */
+static int64
+bench_perf_stop(int fd)
+{
+#ifdef __linux__
+	uint64 count;
+
+	if (fd < 0)
+		return -1;
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+
+	return (int64) count;
+#else
+	return -1;
+#endif
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	return (da > db) - (da < db);
+}
+
+/*
+ * Look up all index tuples, BENCH_BATCH_SIZE TIDs at a time with batch_fn,
+ * or one by one with reaped_fn if it's NULL, and fill in r. Every stride'th
+ * batch is timed on its own for the percentiles, its ns/lookup going to
+ * samples.
+ */
+static void
+_bench_run(LVTestType *lvtt, BenchBatchFn batch_fn, int perf_fd,
+		   double *samples, uint64 stride, BenchRunResult *r)
+{
+	uint64 result[(BENCH_BATCH_SIZE + 63) / 64];
+	uint64 nsamples = 0;
+	uint64 batchno = 0;
+	instr_time start_time,
+			   total_time;
+
+	r->matched = 0;
+
+	bench_perf_start(perf_fd);
+	INSTR_TIME_SET_CURRENT(start_time);
+	for (uint64 i = 0; i < IndexTids_cache->dtinfo.nitems; i += BENCH_BATCH_SIZE, batchno++)
+	{
+		int n = Min(IndexTids_cache->dtinfo.nitems - i, BENCH_BATCH_SIZE);
+		ItemPointer itemptrs = &(IndexTids_cache->itemptrs[i]);
+		bool sampled = (batchno % stride) == 0;
+		instr_time batch_start,
+				   batch_time;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (sampled)
+			INSTR_TIME_SET_CURRENT(batch_start);
+
+		if (batch_fn)
+			r->matched += batch_fn(lvtt, itemptrs, n, result);
+		else
+		{
+			for (int j = 0; j < n; j++)
+				r->matched += lvtt->reaped_fn(lvtt, &(itemptrs[j]));
+		}
+
+		if (sampled)
+		{
+			INSTR_TIME_SET_CURRENT(batch_time);
+			INSTR_TIME_SUBTRACT(batch_time, batch_start);
+			samples[nsamples++] = (double) INSTR_TIME_GET_NANOSEC(batch_time) / n;
+		}
+	}
+	INSTR_TIME_SET_CURRENT(total_time);
+	INSTR_TIME_SUBTRACT(total_time, start_time);
+	r->cache_misses = bench_perf_stop(perf_fd);
+
+	r->total_ms = INSTR_TIME_GET_MILLISEC(total_time);
+
+	if (nsamples > 0)
+	{
+		qsort(samples, nsamples, sizeof(double), cmp_double);
+		r->p50_ns = samples[(nsamples - 1) / 2];
+		r->p99_ns = samples[(uint64) ((nsamples - 1) * 0.99)];
+	}
+	else
+		r->p50_ns = r->p99_ns = 0;
+}
+
+/*
+ * Are the index tuples of every batch of _bench_run() in TID order, as when
+ * they are prepared with shuffle => false? intersect_fn requires that.
+ */
+static bool
+index_tids_sorted(void)
+{
+	ItemPointer itemptrs = IndexTids_cache->itemptrs;
+
+	for (uint64 i = 1; i < IndexTids_cache->dtinfo.nitems; i++)
+	{
+		if (i % BENCH_BATCH_SIZE != 0 &&
+			ItemPointerCompare(&(itemptrs[i - 1]), &(itemptrs[i])) >= 0)
+			return false;
+	}
+
+	return true;
+}
+
+#ifdef DEBUG_DUMP_MATCHED
+static void
+dump_matched(LVTestType *lvtt)
+{
+	FILE *f = fopen(lvtt->name, "w");
+
+	for (uint64 i = 0; i < IndexTids_cache->dtinfo.nitems; i++)
+	{
+		if (lvtt->reaped_fn(lvtt, &(IndexTids_cache->itemptrs[i])))
+		{
+			char buf[128] = {0};
+			sprintf(buf, "(%5u, %5u)\n",
+					 ItemPointerGetBlockNumber(&(IndexTids_cache->itemptrs[i])),
+					 ItemPointerGetOffsetNumber(&(IndexTids_cache->itemptrs[i])));
+			fwrite(buf, strlen(buf), 1, f);
+		}
+	}
+
+	fclose(f);
+}
+#endif
+
+/*
+ * Run warmup unreported rounds and then iterations measured rounds of the
+ * lookups of all index tuples, scalar and, if supported, batched, pipelined
+ * and intersected, returning a row per measured round and lookup kind to
+ * rsinfo. The intersection is skipped unless the index tuples are sorted.
+ */
+static void
+_bench(LVTestType *lvtt, int warmup, int iterations, ReturnSetInfo *rsinfo)
+{
+	uint64 nbatches;
+	uint64 stride;
+	double *samples;
+	int perf_fd;
+	Size mem;
+	bool sorted;
+	MemoryContext old_ctx;
+
+	if (!lvtt->private)
+		elog(ERROR, "%s dead tuples are not preapred", lvtt->name);
+
+	sorted = index_tids_sorted();
+	if (lvtt->intersect_fn && !sorted)
+		elog(NOTICE, "skipping the intersect lookup of %s since the index tuples are not in TID order",
+			 lvtt->name);
+
+	nbatches = (IndexTids_cache->dtinfo.nitems + BENCH_BATCH_SIZE - 1) / BENCH_BATCH_SIZE;
+	stride = Max((nbatches + BENCH_MAX_SAMPLES - 1) / BENCH_MAX_SAMPLES, 1);
+	samples = palloc(sizeof(double) * Min(Max(nbatches, 1), BENCH_MAX_SAMPLES));
+	mem = lvtt->mem_usage_fn(lvtt);
+
+	perf_fd = bench_perf_open();
+	if (perf_fd < 0)
+		elog(DEBUG1, "cache miss counter is not available: %m");
+
+#ifdef DEBUG_DUMP_MATCHED
+	dump_matched(lvtt);
+#endif
+
+	/* Don't leak the perf counter when cancelled or failed */
+	PG_TRY();
+	{
+		for (int run = 1 - warmup; run <= iterations; run++)
+		{
+			static const char *const lookups[] = {"scalar", "batched",
+												  "pipelined", "intersect"};
+			BenchBatchFn batch_fns[] = {NULL, lvtt->reaped_batch_fn,
+										lvtt->reaped_pipelined_fn,
+										sorted ? lvtt->intersect_fn : NULL};
+
+			for (int k = 0; k < lengthof(lookups); k++)
+			{
+				BenchRunResult r;
+				Datum values[14];
+				bool nulls[14] = {0};
+				uint64 nindex = IndexTids_cache->dtinfo.nitems;
+
+				/* not supported */
+				if (k > 0 && batch_fns[k] == NULL)
+					continue;
+
+				/* the lookups may allocate in the store's context */
+				old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+				_bench_run(lvtt, batch_fns[k], perf_fd, samples, stride, &r);
+				MemoryContextSwitchTo(old_ctx);
+
+				if (r.matched != lvtt->nloaded)
+					elog(WARNING, "the number of dead tuples found doesn't match the actual dead tuples: got %lu expected %lu (%s lookup)",
+						 r.matched, lvtt->nloaded, lookups[k]);
+
+				/* warming up */
+				if (run <= 0)
+					continue;
+
+				values[0] = CStringGetTextDatum(lvtt->name);
+				values[1] = Int32GetDatum(run);
+				values[2] = CStringGetTextDatum(lookups[k]);
+				values[3] = Int64GetDatum(lvtt->nloaded);
+				values[4] = Int64GetDatum(nindex);
+				values[5] = Int64GetDatum(r.matched);
+				values[6] = Float8GetDatum(r.total_ms);
+				values[7] = Float8GetDatum(nindex > 0 ? r.total_ms * 1000000 / nindex : 0);
+				values[8] = Float8GetDatum(r.p50_ns);
+				values[9] = Float8GetDatum(r.p99_ns);
+				values[10] = Float8GetDatum(lvtt->load_ms);
+				values[11] = Float8GetDatum(lvtt->nloaded > 0 ? (double) mem / lvtt->nloaded : 0);
+				values[12] = Float8GetDatum(nindex > 0 ? (double) r.matched / nindex : 0);
+				if (r.cache_misses >= 0)
+					values[13] = Int64GetDatum(r.cache_misses);
+				else
+					nulls[13] = true;
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+			}
+		}
+	}
+	PG_FINALLY();
+	{
+		if (perf_fd >= 0)
+			close(perf_fd);
+	}
+	PG_END_TRY();
+
+	pfree(samples);
+}
+
+/* SQL-callable functions */
+Datum
+prepare_index_tuples(PG_FUNCTION_ARGS)
+{
+	uint64 nitems = PG_GETARG_INT64(0);
+	BlockNumber minblk = PG_GETARG_INT32(1);
+	BlockNumber maxblk = PG_GETARG_INT32(2);
+	OffsetNumber maxoff = PG_GETARG_INT32(3);
+
+	generate_index_tuples(nitems, minblk, maxblk, maxoff);
+
+	PG_RETURN_NULL();
+}
+
+Datum
+prepare_dead_tuples(PG_FUNCTION_ARGS)
+{
+	uint64 nitems = PG_GETARG_INT64(0);
+	BlockNumber minblk = PG_GETARG_INT32(1);
+	BlockNumber maxblk = PG_GETARG_INT32(2);
+	OffsetNumber maxoff = PG_GETARG_INT32(3);
+
+	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+
+	PG_RETURN_NULL();
+}
+
+Datum
+prepare_index_tuples2(PG_FUNCTION_ARGS)
+{
+	uint64 ntuples = PG_GETARG_INT64(0);
+	int tuple_size = PG_GETARG_INT32(1);
+
+	uint64 nitems;
+	BlockNumber minblk = 0, maxblk;
+	OffsetNumber maxoff;
+
+	maxblk = ((((uint64) ntuples) * (uint64)(tuple_size)) / 8192) * 1.05;
+	maxoff = 8192 / tuple_size;
+	nitems = ntuples;
+
+	generate_index_tuples(nitems, minblk, maxblk, maxoff);
+
+	PG_RETURN_NULL();
+}
+
+Datum
+prepare_dead_tuples2(PG_FUNCTION_ARGS)
+{
+	uint64 ntuples = PG_GETARG_INT64(0);
+	int tuple_size = PG_GETARG_INT32(1);
+	float8 dt_ratio = PG_GETARG_FLOAT8(2);
+
+	uint64 nitems;
+	BlockNumber minblk = 0, maxblk;
+	OffsetNumber maxoff;
+
+	maxblk = ((((uint64) ntuples) * (uint64)(tuple_size)) / 8192) * 1.05;
+	maxoff = 8192 / tuple_size;
+	nitems = (int) (ntuples * dt_ratio);
+
+	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+
+	PG_RETURN_NULL();
+}
+
+Datum
+prepare_dead_tuples2_packed(PG_FUNCTION_ARGS)
 {
 	uint64 ntuples = PG_GETARG_INT64(0);
 	int tuple_size = PG_GETARG_INT32(1);
 	float8 dt_ratio = PG_GETARG_FLOAT8(2);
 
-	uint64 nitems;
-	BlockNumber minblk = 0, maxblk;
-	OffsetNumber maxoff;
+	uint64 nitems;
+	BlockNumber minblk = 0, maxblk;
+	OffsetNumber maxoff;
+
+	nitems = (int) (ntuples * dt_ratio);
+	maxblk = (((uint64) nitems) * (uint64)(tuple_size)) / 8192;
+	maxoff = 8192 / tuple_size;
+
+	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+
+	PG_RETURN_NULL();
+}
+
+/*
+ * Free the previous TIDs of arr if any, and allocate room for nitems TIDs.
+ */
+static DeadTuplesArray *
+reset_tid_array(DeadTuplesArray *arr, uint64 nitems)
+{
+	if (!arr)
+		arr = MemoryContextAllocHuge(TopMemoryContext, sizeof(DeadTuplesArray));
+	else
+		pfree(arr->itemptrs);
+
+	arr->itemptrs = (ItemPointer) MemoryContextAllocHuge(TopMemoryContext,
+														 sizeof(ItemPointerData) * Max(nitems, 1));
+	MemSet(&(arr->dtinfo), 0, sizeof(DeadTupleInfo));
+
+	return arr;
+}
+
+/*
+ * The dead tuples prepared so far are gone, so the ones attached to the
+ * subjects are stale even if they happen to have the same number of TIDs.
+ */
+static void
+invalidate_attached_dead_tuples(void)
+{
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+		LVTestSubjects[i].dtinfo.nitems = 0;
+}
+
+Datum
+prepare(PG_FUNCTION_ARGS)
+{
+	BlockNumber maxblk = PG_GETARG_INT64(0);
+	uint64 ndeadtuples_in_page = PG_GETARG_INT32(1);
+	uint64 interval_in_page = PG_GETARG_INT32(2);
+	uint64 page_consecutives = PG_GETARG_INT32(3);
+	uint64 page_interval = PG_GETARG_INT32(4);
+	bool shuffle = PG_GETARG_BOOL(5);
+
+	OffsetNumber maxoff = ndeadtuples_in_page * interval_in_page;
+	uint64 ndts = 0;
+	uint64 nidx = 0;
+	uint64 ndts_tmp = 0;
+	uint64 nidx_tmp = 0;
+
+	if (page_consecutives > page_interval)
+		elog(ERROR, "cannot prepare %lu consecutive dirty pages at %lu pages interval",
+			 page_consecutives, page_interval);
+
+	ndts = ((uint64) ceil((double)maxblk / page_interval) * page_consecutives) * ndeadtuples_in_page;
+	DeadTuples_orig = reset_tid_array(DeadTuples_orig, ndts);
+
+	nidx = ((uint64) maxblk) * ((uint64) maxoff);
+	IndexTids_cache = reset_tid_array(IndexTids_cache, nidx);
+
+	elog(WARNING, "dead tuples: page: total %lu tuples, %lu tuples with interval %lu in page (maxoff %u, shuffle %d), blk: maxblk %u consecutive %lu interval %lu, setting: ndts %lu nidx %lu",
+		 ndts,
+		 ndeadtuples_in_page,
+		 interval_in_page,
+		 maxoff,
+		 shuffle,
+		 maxblk,
+		 page_consecutives,
+		 page_interval,
+		 ndts, nidx);
+
+	for (BlockNumber blkno = 0; blkno < maxblk; blkno++)
+	{
+		uint64 ndt_this_page = 0;
+
+		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+		{
+			ItemPointerData tid;
+
+			ItemPointerSetBlockNumber(&tid, blkno);
+			ItemPointerSetOffsetNumber(&tid, off);
+
+			if ((blkno % page_interval) < page_consecutives &&
+				off % interval_in_page == 0 &&
+				ndt_this_page <= ndeadtuples_in_page)
+			{
+				ndt_this_page++;
+				DeadTuples_orig->itemptrs[ndts_tmp++] = tid;
+			}
+			IndexTids_cache->itemptrs[nidx_tmp++] = tid;
+		}
+	}
+
+	/* sanity checks */
+	if (ndts_tmp > ndts)
+		elog(ERROR, "ndts_tmp %lu ndts %lu", ndts_tmp, ndts);
+	if (nidx_tmp > nidx)
+		elog(ERROR, "nidx_tmp %lu nidx %lu", nidx_tmp, nidx);
+
+	/* Shuffle index tuples */
+	if (shuffle)
+		shuffle_itemptrs(nidx, IndexTids_cache->itemptrs);
+
+	update_info(&(DeadTuples_orig->dtinfo), Min(ndts, ndts_tmp), 0, maxblk, maxoff);
+	update_info(&(IndexTids_cache->dtinfo), Min(nidx, nidx_tmp), 0, maxblk, maxoff);
+	invalidate_attached_dead_tuples();
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Workload generators.
+ *
+ * prepare() places the same number of dead tuples at a fixed stride on every
+ * dirty page. The following generators make the shapes that real tables
+ * tend to have instead:
+ *
+ * - prepare_zipf(): the dead tuples concentrate on hot blocks, the block of
+ *   each dead tuple being drawn from a Zipfian distribution over the blocks.
+ *   The hot blocks are scattered over the table.
+ * - prepare_bursty(): runs of consecutive dirty pages separated by runs of
+ *   clean pages, both of geometrically distributed lengths, as left by bulk
+ *   updates and deletes. The number of dead tuples on a dirty page is
+ *   geometrically distributed too.
+ *
+ * Both take hot_chain_len. If it's greater than 1, the dead tuples of a page
+ * are clustered in runs of consecutive offsets of that mean length, like the
+ * dead versions of a HOT chain, which get the next free line pointers on the
+ * page. Otherwise the offsets are scattered uniformly.
+ *
+ * The index tuples are all line pointers of all blocks, as with prepare().
+ */
+
+/* Return the number of trials up to the first success, whose mean is mean */
+static uint32
+geometric_rand(pg_prng_state *state, double mean)
+{
+	double u;
+
+	if (mean <= 1.0)
+		return 1;
+
+	/* (0, 1] */
+	u = 1.0 - pg_prng_double(state);
+
+	return 1 + (uint32) floor(log(u) / log(1.0 - 1.0 / mean));
+}
+
+/* Consecutive draws of full blocks after which prepare_zipf() probes */
+#define ZIPF_MAX_REJECTS	64
+
+/*
+ * Return a rank from 1 to n, rank r being drawn with a probability
+ * proportional to 1 / r^s. We invert the CDF of the continuous approximation,
+ * which is close enough for the purpose.
+ */
+static uint64
+zipf_rand(pg_prng_state *state, uint64 n, double s)
+{
+	double u = pg_prng_double(state);
+	double x;
+
+	if (fabs(s - 1.0) < 1e-9)
+		x = pow(n + 1.0, u);
+	else
+		x = pow(1.0 + u * (pow(n + 1.0, 1.0 - s) - 1.0), 1.0 / (1.0 - s));
+
+	return Max(Min((uint64) x, n), 1);
+}
+
+/*
+ * Choose ndead distinct offsets among 1 to maxoff into offsets, in ascending
+ * order, clustered in runs of hot_chain_len on average if it's greater than 1.
+ */
+static void
+choose_dead_offsets(pg_prng_state *state, int ndead, OffsetNumber maxoff,
+					int hot_chain_len, OffsetNumber *offsets)
+{
+	bool	isdead[MaxOffsetNumber + 1] = {0};
+	int		n = 0;
+
+	Assert(ndead <= maxoff);
+
+	while (n < ndead)
+	{
+		OffsetNumber off = (OffsetNumber) pg_prng_uint64_range(state, 1, maxoff);
+		int		len = hot_chain_len > 1 ? geometric_rand(state, hot_chain_len) : 1;
+
+		/* the chain continues over the line pointers already dead */
+		for (; off <= maxoff && len > 0 && n < ndead; off++)
+		{
+			if (isdead[off])
+				continue;
+
+			isdead[off] = true;
+			n++;
+			len--;
+		}
+	}
+
+	n = 0;
+	for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+	{
+		if (isdead[off])
+			offsets[n++] = off;
+	}
+}
+
+/*
+ * Generate the dead tuples with ndead[blkno] of them on each block, and the
+ * index tuples pointing to all line pointers of every block.
+ */
+static void
+generate_workload(const uint16 *ndead, BlockNumber maxblk, OffsetNumber maxoff,
+				  int hot_chain_len, bool shuffle, pg_prng_state *state)
+{
+	uint64	ndts = 0;
+	uint64	nidx = (uint64) maxblk * maxoff;
+	uint64	pos = 0;
+	BlockNumber ndirty = 0;
+	uint16	maxdead = 0;
+
+	for (BlockNumber blkno = 0; blkno < maxblk; blkno++)
+	{
+		ndts += ndead[blkno];
+		ndirty += (ndead[blkno] > 0);
+		maxdead = Max(maxdead, ndead[blkno]);
+	}
+
+	DeadTuples_orig = reset_tid_array(DeadTuples_orig, ndts);
+	IndexTids_cache = reset_tid_array(IndexTids_cache, nidx);
+
+	for (BlockNumber blkno = 0; blkno < maxblk; blkno++)
+	{
+		OffsetNumber offsets[MaxOffsetNumber];
+
+		CHECK_FOR_INTERRUPTS();
+
+		choose_dead_offsets(state, ndead[blkno], maxoff, hot_chain_len, offsets);
+		for (int i = 0; i < ndead[blkno]; i++)
+			ItemPointerSet(&(DeadTuples_orig->itemptrs[pos++]), blkno, offsets[i]);
+
+		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+			ItemPointerSet(&(IndexTids_cache->itemptrs[(uint64) blkno * maxoff + off - 1]),
+						   blkno, off);
+	}
+	Assert(pos == ndts);
+
+	if (shuffle)
+		shuffle_itemptrs(nidx, IndexTids_cache->itemptrs);
+
+	update_info(&(DeadTuples_orig->dtinfo), ndts, 0, maxblk, maxoff);
+	update_info(&(IndexTids_cache->dtinfo), nidx, 0, maxblk, maxoff);
+	invalidate_attached_dead_tuples();
+
+	elog(NOTICE, "dead tuples: %lu in %u of %u blocks, at most %u in a block (hot chain length %d), index tuples: %lu (shuffle %d)",
+		 ndts, ndirty, maxblk, maxdead, hot_chain_len, nidx, shuffle);
+}
+
+static void
+check_workload_args(BlockNumber maxblk, int maxoff, int hot_chain_len)
+{
+	if (maxblk == 0 || maxblk > MaxBlockNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("maxblk must be between 1 and %u", MaxBlockNumber)));
+	if (maxoff < 1 || maxoff > MaxHeapTuplesPerPage)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("maxoff must be between 1 and %d", MaxHeapTuplesPerPage)));
+	if (hot_chain_len < 0 || hot_chain_len > maxoff)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("hot_chain_len must be between 0 and maxoff")));
+}
+
+Datum
+prepare_zipf(PG_FUNCTION_ARGS)
+{
+	int64	maxblk = PG_GETARG_INT64(0);
+	int64	ndeadtuples = PG_GETARG_INT64(1);
+	float8	skew = PG_GETARG_FLOAT8(2);
+	int		hot_chain_len = PG_GETARG_INT32(3);
+	int		maxoff = PG_GETARG_INT32(4);
+	bool	shuffle = PG_GETARG_BOOL(5);
+	uint16	*ndead;
+	uint64	step;
+	uint64	ndts = 0;
+	uint64	ndraws = 0;
+	int		nrejected = 0;
+	pg_prng_state state;
+
+	check_workload_args(maxblk, maxoff, hot_chain_len);
+	if (ndeadtuples < 0 || ndeadtuples > maxblk * maxoff)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("ndeadtuples must be between 0 and maxblk * maxoff")));
+	if (skew <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("skew must be positive")));
+
+	/* reproducibility */
+	pg_prng_seed(&state, 0);
+
+	/*
+	 * The rank r block is the (r * step) % maxblk'th, step being coprime to
+	 * maxblk, so that the hot blocks are scattered.
+	 */
+	for (step = (uint64) (maxblk * 0.618033988749895) | 1; ; step++)
+	{
+		uint64 a = maxblk, b = step;
+
+		while (b != 0)
+		{
+			uint64 t = a % b;
+
+			a = b;
+			b = t;
+		}
+		if (a == 1)
+			break;
+	}
+
+	ndead = (uint16 *) MemoryContextAllocExtended(CurrentMemoryContext,
+												  sizeof(uint16) * maxblk,
+												  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+
+	/*
+	 * A full block takes no more dead tuples, draw another one. Once the hot
+	 * blocks are full, the draws rarely land on a block with room left, so
+	 * after a run of them take the next block that has room instead.
+	 */
+	while (ndts < ndeadtuples)
+	{
+		BlockNumber blkno = (BlockNumber) (((zipf_rand(&state, maxblk, skew) - 1) * step) % maxblk);
+
+		if (++ndraws % 0x10000 == 0)
+			CHECK_FOR_INTERRUPTS();
+
+		if (ndead[blkno] >= maxoff)
+		{
+			if (++nrejected < ZIPF_MAX_REJECTS)
+				continue;
+
+			/* there is one, as ndeadtuples is up to maxblk * maxoff */
+			while (ndead[blkno] >= maxoff)
+				blkno = (blkno + 1) % maxblk;
+		}
+
+		ndead[blkno]++;
+		ndts++;
+		nrejected = 0;
+	}
+
+	generate_workload(ndead, maxblk, maxoff, hot_chain_len, shuffle, &state);
+	pfree(ndead);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+prepare_bursty(PG_FUNCTION_ARGS)
+{
+	int64	maxblk = PG_GETARG_INT64(0);
+	int		burst_pages = PG_GETARG_INT32(1);
+	int		gap_pages = PG_GETARG_INT32(2);
+	int		dt_per_page = PG_GETARG_INT32(3);
+	int		hot_chain_len = PG_GETARG_INT32(4);
+	int		maxoff = PG_GETARG_INT32(5);
+	bool	shuffle = PG_GETARG_BOOL(6);
+	uint16	*ndead;
+	BlockNumber blkno = 0;
+	pg_prng_state state;
+
+	check_workload_args(maxblk, maxoff, hot_chain_len);
+	if (burst_pages < 1 || gap_pages < 0 || dt_per_page < 1 || dt_per_page > maxoff)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("burst_pages and dt_per_page must be positive, gap_pages must not be negative, and dt_per_page must be up to maxoff")));
+
+	/* reproducibility */
+	pg_prng_seed(&state, 0);
+
+	ndead = (uint16 *) MemoryContextAllocExtended(CurrentMemoryContext,
+												  sizeof(uint16) * maxblk,
+												  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+
+	while (blkno < maxblk)
+	{
+		uint32	burst = geometric_rand(&state, burst_pages);
+
+		for (; burst > 0 && blkno < maxblk; burst--, blkno++)
+			ndead[blkno] = Min(geometric_rand(&state, dt_per_page), maxoff);
+
+		/* the clean pages in between, if any */
+		if (gap_pages > 0)
+			blkno += Min(geometric_rand(&state, gap_pages), maxblk - blkno);
+	}
+
+	generate_workload(ndead, maxblk, maxoff, hot_chain_len, shuffle, &state);
+	pfree(ndead);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Append a TID to arr, whose room is for *capacity TIDs.
+ */
+static void
+append_tid(DeadTuplesArray *arr, uint64 *capacity, ItemPointer tid)
+{
+	if (arr->dtinfo.nitems >= *capacity)
+	{
+		*capacity *= 2;
+		arr->itemptrs = (ItemPointer) repalloc_huge(arr->itemptrs,
+													sizeof(ItemPointerData) * (*capacity));
+	}
+
+	arr->itemptrs[arr->dtinfo.nitems++] = *tid;
+	arr->dtinfo.maxoff = Max(arr->dtinfo.maxoff, ItemPointerGetOffsetNumber(tid));
+}
+
+/*
+ * Return true if the heap tuple at rootoff and all its HOT-updated successors
+ * are dead, in which case vacuum removes its index tuples. A redirected root
+ * is followed to the rest of the chain, which pruning left. Like
+ * heap_prune_chain(), the chain ends at a member whose xmin doesn't match the
+ * xmax of the previous one.
+ */
+static bool
+heap_chain_is_dead(Relation rel, Buffer buf, OffsetNumber rootoff,
+				   TransactionId oldest_xmin)
+{
+	Page	page = BufferGetPage(buf);
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	OffsetNumber off = rootoff;
+	TransactionId prior_xmax = InvalidTransactionId;
+	ItemId		rootlp = PageGetItemId(page, rootoff);
+
+	if (ItemIdIsRedirected(rootlp))
+		off = ItemIdGetRedirect(rootlp);
+
+	/* a chain cannot be longer than the line pointers on the page */
+	for (int i = 0; i < MaxHeapTuplesPerPage; i++)
+	{
+		ItemId		lp;
+		HeapTupleData tup;
+
+		if (off < FirstOffsetNumber || off > maxoff)
+			break;
+
+		/* the chain ends at a removed member */
+		lp = PageGetItemId(page, off);
+		if (!ItemIdIsNormal(lp))
+			break;
+
+		tup.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+		tup.t_len = ItemIdGetLength(lp);
+		tup.t_tableOid = RelationGetRelid(rel);
+		ItemPointerSet(&(tup.t_self), BufferGetBlockNumber(buf), off);
+
+		/* the successor was removed and the line pointer reused */
+		if (TransactionIdIsValid(prior_xmax) &&
+			!TransactionIdEquals(HeapTupleHeaderGetXmin(tup.t_data), prior_xmax))
+			break;
+
+		if (HeapTupleSatisfiesVacuum(&tup, oldest_xmin, buf) != HEAPTUPLE_DEAD)
+			return false;
+
+		if (!HeapTupleHeaderIsHotUpdated(tup.t_data))
+			break;
+
+		prior_xmax = HeapTupleHeaderGetUpdateXid(tup.t_data);
+		off = ItemPointerGetOffsetNumber(&(tup.t_data->t_ctid));
+	}
+
+	return true;
+}
+
+/*
+ * Collect the TIDs of the index tuples of a btree index, scanning the leaf
+ * pages in physical order as btvacuumscan() does.
+ */
+static void
+collect_btree_tids(Relation index, BufferAccessStrategy bstrategy,
+				   DeadTuplesArray *arr, uint64 *capacity)
+{
+	BlockNumber nblocks = RelationGetNumberOfBlocks(index);
+
+	for (BlockNumber blkno = BTREE_METAPAGE + 1; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		BTPageOpaque opaque;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(index, MAIN_FORKNUM, blkno, RBM_NORMAL, bstrategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+
+		if (PageIsNew(page))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		opaque = BTPageGetOpaque(page);
+		if (P_IGNORE(opaque) || !P_ISLEAF(opaque))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		for (OffsetNumber off = P_FIRSTDATAKEY(opaque);
+			 off <= PageGetMaxOffsetNumber(page);
+			 off++)
+		{
+			IndexTuple	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+
+			if (BTreeTupleIsPosting(itup))
+			{
+				for (int i = 0; i < BTreeTupleGetNPosting(itup); i++)
+					append_tid(arr, capacity, BTreeTupleGetPostingN(itup, i));
+			}
+			else
+				append_tid(arr, capacity, &(itup->t_tid));
+		}
+
+		UnlockReleaseBuffer(buf);
+	}
+}
+
+/*
+ * Capture the dead tuples of a real heap table, i.e. the TIDs that a vacuum
+ * started now would collect: LP_DEAD line pointers and the roots of HOT
+ * chains which are dead as a whole. The index tuples are the TIDs of the
+ * given btree index on the table, in the index order, or lacking it, the TIDs
+ * that any index on the table would have.
+ */
+Datum
+prepare_from_relation(PG_FUNCTION_ARGS)
+{
+	Oid			relid;
+	Oid			indexid = PG_ARGISNULL(1) ? InvalidOid : PG_GETARG_OID(1);
+	bool		shuffle = PG_ARGISNULL(2) ? false : PG_GETARG_BOOL(2);
+	Relation	rel;
+	Relation	index = NULL;
+	BufferAccessStrategy bstrategy;
+	TransactionId oldest_xmin;
+	BlockNumber nblocks;
+	uint64		dt_capacity = 1024;
+	uint64		idx_capacity = 1024;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to use prepare_from_relation()")));
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("relation must not be null")));
+	relid = PG_GETARG_OID(0);
+
+	rel = relation_open(relid, AccessShareLock);
+	if (rel->rd_rel->relam != HEAP_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a heap table",
+						RelationGetRelationName(rel))));
+
+	if (OidIsValid(indexid))
+	{
+		index = index_open(indexid, AccessShareLock);
+		if (index->rd_rel->relam != BTREE_AM_OID)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("\"%s\" is not a btree index",
+							RelationGetRelationName(index))));
+		if (index->rd_index->indrelid != relid)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"%s\" is not an index on \"%s\"",
+							RelationGetRelationName(index),
+							RelationGetRelationName(rel))));
+	}
+
+	DeadTuples_orig = reset_tid_array(DeadTuples_orig, dt_capacity);
+	IndexTids_cache = reset_tid_array(IndexTids_cache, idx_capacity);
+
+	bstrategy = GetAccessStrategy(BAS_BULKREAD);
+	oldest_xmin = GetOldestNonRemovableTransactionId(rel);
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	for (BlockNumber blkno = 0; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, bstrategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+
+		if (PageIsNew(page) || PageIsEmpty(page))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		for (OffsetNumber off = FirstOffsetNumber;
+			 off <= PageGetMaxOffsetNumber(page);
+			 off++)
+		{
+			ItemId		lp = PageGetItemId(page, off);
+			ItemPointerData tid;
+			bool		isdead;
+
+			if (!ItemIdIsUsed(lp))
+				continue;
+
+			if (ItemIdIsDead(lp))
+				isdead = true;
+			else if (ItemIdIsRedirected(lp))
+				isdead = heap_chain_is_dead(rel, buf, off, oldest_xmin);
+			else
+			{
+				HeapTupleHeader htup = (HeapTupleHeader) PageGetItem(page, lp);
+
+				/* no index tuples point to heap-only tuples */
+				if (HeapTupleHeaderIsHeapOnly(htup))
+					continue;
+
+				isdead = heap_chain_is_dead(rel, buf, off, oldest_xmin);
+			}
+
+			ItemPointerSet(&tid, blkno, off);
+			if (isdead)
+				append_tid(DeadTuples_orig, &dt_capacity, &tid);
+			if (!index)
+				append_tid(IndexTids_cache, &idx_capacity, &tid);
+		}
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	DeadTuples_orig->dtinfo.maxblk = nblocks;
+
+	if (index)
+	{
+		collect_btree_tids(index, bstrategy, IndexTids_cache, &idx_capacity);
+		index_close(index, AccessShareLock);
+	}
+	IndexTids_cache->dtinfo.maxblk = nblocks;
+
+	FreeAccessStrategy(bstrategy);
+	relation_close(rel, AccessShareLock);
+
+	if (shuffle)
+		shuffle_itemptrs(IndexTids_cache->dtinfo.nitems, IndexTids_cache->itemptrs);
+
+	invalidate_attached_dead_tuples();
+
+	elog(NOTICE, "dead tuples: %lu in %u blocks of \"%s\", index tuples: %lu (%s, shuffle %d)",
+		 DeadTuples_orig->dtinfo.nitems, nblocks, get_rel_name(relid),
+		 IndexTids_cache->dtinfo.nitems,
+		 index ? get_rel_name(indexid) : "all line pointers", shuffle);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+attach_dead_tuples(PG_FUNCTION_ARGS)
+{
+	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	bool shared = PG_NARGS() > 1 ? PG_GETARG_BOOL(1) : false;
+	bool spill = PG_NARGS() > 2 ? PG_GETARG_BOOL(2) : false;
+	int mem_limit = PG_NARGS() > 3 ? PG_GETARG_INT32(3) : 0;
+	int partitions = PG_NARGS() > 4 ? PG_GETARG_INT32(4) : 0;
+
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		LVTestType *lvtt = &(LVTestSubjects[i]);
+
+		if (strcmp(mode, lvtt->name) == 0)
+		{
+			if (shared && lvtt->export_fn == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("%s dead tuples cannot be placed in shared memory",
+								lvtt->name)));
+
+			if (spill && lvtt->export_fn == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("%s dead tuples cannot be spilled to disk",
+								lvtt->name)));
+
+			if (mem_limit < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("memory limit must not be negative")));
+
+			if (mem_limit > 0 && lvtt->used_bytes_fn == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("%s dead tuples cannot be loaded with a memory limit",
+								lvtt->name)));
+
+			if (partitions < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("the number of partitions must not be negative")));
+
+			if (partitions > 1 && lvtt->build_part_fn == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("%s dead tuples cannot be built by partitions",
+								lvtt->name)));
+
+			if (partitions > 1 && mem_limit > 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("dead tuples cannot be built by partitions with a memory limit")));
+
+			/* the cached set was loaded with another limit */
+			if ((Size) mem_limit * 1024 != lvtt->mem_limit)
+			{
+				lvtt->mem_limit = (Size) mem_limit * 1024;
+				lvtt->dtinfo.nitems = 0;
+			}
+
+			/* or by other partitions */
+			if (Max(partitions, 1) != Max(lvtt->npartitions, 1))
+				lvtt->dtinfo.nitems = 0;
+			lvtt->npartitions = partitions;
+
+			/* attach() may replace the context, and switches to it itself */
+			attach(lvtt,
+				   DeadTuples_orig->dtinfo.nitems,
+				   DeadTuples_orig->dtinfo.minblk,
+				   DeadTuples_orig->dtinfo.maxblk,
+				   DeadTuples_orig->dtinfo.maxoff);
+
+			if (shared)
+				attach_shared(lvtt);
+			if (spill)
+				attach_spilled(lvtt);
+
+			break;
+		}
+	}
+
+	elog(WARNING, "attached dead tuples to %s", mode);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Benchmark the lookups of the index tuples in the dead tuples attached to
+ * mode. Returns a row per measured round, see _bench().
+ */
+Datum
+bench(PG_FUNCTION_ARGS)
+{
+	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int warmup = PG_GETARG_INT32(1);
+	int iterations = PG_GETARG_INT32(2);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	LVTestType *lvtt = NULL;
+
+	if (!IndexTids_cache || !IndexTids_cache->itemptrs)
+		elog(ERROR, "index tuples are not preapred");
+
+	if (warmup < 0 || iterations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("warmup must not be negative and iterations must be positive")));
+
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		if (strcmp(mode, LVTestSubjects[i].name) == 0)
+		{
+			lvtt = &(LVTestSubjects[i]);
+			break;
+		}
+	}
+
+	if (lvtt == NULL)
+		elog(ERROR, "unknown mode \"%s\"", mode);
+
+	InitMaterializedSRF(fcinfo, 0);
+	_bench(lvtt, warmup, iterations, rsinfo);
+
+	return (Datum) 0;
+}
+
+/*
+ * Iterate over all dead tuples in TID order, as heap vacuuming does, and
+ * report the throughput. The TIDs returned are then checked against the
+ * dead tuples outside of the timed loop.
+ */
+Datum
+itereate_bench(PG_FUNCTION_ARGS)
+{
+	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	LVTestType *lvtt = NULL;
+	OffsetNumber offsets[MaxHeapTuplesPerPage];
+	BlockNumber blkno;
+	int noffsets;
+	void *iter;
+	uint64 ntids = 0;
+	uint64 nblocks = 0;
+	uint64 nmismatched = 0;
+	MemoryContext old_ctx;
+	instr_time start_time,
+			   iter_time;
+
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		if (strcmp(mode, LVTestSubjects[i].name) == 0)
+		{
+			lvtt = &(LVTestSubjects[i]);
+			break;
+		}
+	}
+
+	if (lvtt == NULL)
+		elog(ERROR, "unknown mode \"%s\"", mode);
+
+	if (lvtt->begin_iterate_fn == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("%s dead tuples cannot be iterated over", lvtt->name)));
+
+	if (!lvtt->private || lvtt->dtinfo.nitems == 0)
+		elog(ERROR, "%s dead tuples are not preapred", lvtt->name);
+
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	iter = lvtt->begin_iterate_fn(lvtt);
+	while (lvtt->iterate_next_fn(lvtt, iter, &blkno, offsets, &noffsets))
+	{
+		CHECK_FOR_INTERRUPTS();
+		ntids += noffsets;
+		nblocks++;
+	}
+	lvtt->end_iterate_fn(lvtt, iter);
+	INSTR_TIME_SET_CURRENT(iter_time);
+	INSTR_TIME_SUBTRACT(iter_time, start_time);
+
+	/* The dead tuples are sorted, so the TIDs must come in the same order */
+	if (DeadTuples_orig && DeadTuples_orig->dtinfo.nitems == ntids)
+	{
+		ItemPointer dead_tuples = DeadTuples_orig->itemptrs;
+		uint64 pos = 0;
+
+		iter = lvtt->begin_iterate_fn(lvtt);
+		while (lvtt->iterate_next_fn(lvtt, iter, &blkno, offsets, &noffsets))
+		{
+			CHECK_FOR_INTERRUPTS();
+			for (int i = 0; i < noffsets; i++, pos++)
+			{
+				if (ItemPointerGetBlockNumber(&(dead_tuples[pos])) != blkno ||
+					ItemPointerGetOffsetNumber(&(dead_tuples[pos])) != offsets[i])
+					nmismatched++;
+			}
+		}
+		lvtt->end_iterate_fn(lvtt, iter);
+	}
+
+	MemoryContextSwitchTo(old_ctx);
+
+	if (ntids != lvtt->dtinfo.nitems || nmismatched > 0)
+		elog(WARNING, "iteration returned %lu dead tuples, %lu of them unexpected, expected %lu",
+			 ntids, nmismatched, lvtt->dtinfo.nitems);
+
+	elog(NOTICE, "\"%s\": iterated %lu dead tuples in %lu blocks, %.3f ms (%.2f M TIDs/s)",
+		 lvtt->name,
+		 ntids,
+		 nblocks,
+		 INSTR_TIME_GET_MILLISEC(iter_time),
+		 ntids / INSTR_TIME_GET_DOUBLE(iter_time) / 1000000);
+
+	PG_RETURN_NULL();
+}
+
+/*
+ * The shapes of the dead tuples of bench_fuzz(). The dirty pages start at
+ * block 0, except for "high", and end at MaxBlockNumber for "sparse" and
+ * "high".
+ *
+ * - uniform: dirty pages a few blocks apart, with all kinds of pages
+ * - dense: consecutive dirty pages, mostly full of dead tuples
+ * - sparse: a dead tuple on each dirty page, over the whole block range
+ * - high: same as uniform, but ending at MaxBlockNumber
+ */
+typedef enum FuzzShape
+{
+	FUZZ_UNIFORM,
+	FUZZ_DENSE,
+	FUZZ_SPARSE,
+	FUZZ_HIGH,
+} FuzzShape;
+
+static const char *const fuzz_shapes[] = {"uniform", "dense", "sparse", "high"};
+
+/* The outcome of a kind of lookups of a subject in a round of bench_fuzz() */
+typedef struct FuzzResult
+{
+	const char *lookup;
+	BenchRunResult r;
+	uint64		nmismatches;
+	ItemPointerData first_mismatch;
+} FuzzResult;
+
+/*
+ * Choose the dead tuples of a dirty page into offsets, and return how many
+ * there are. The page is one of a single dead tuple, a few, all of them but
+ * a few, all of them, or runs of them.
+ */
+static int
+fuzz_page_offsets(pg_prng_state *state, FuzzShape shape, OffsetNumber maxoff,
+				  OffsetNumber *offsets)
+{
+	int			kind;
+	int			n;
+	int			hot_chain_len = 0;
+
+	if (shape == FUZZ_SPARSE)
+		kind = 0;
+	else if (shape == FUZZ_DENSE)
+		kind = (int) pg_prng_uint64_range(state, 2, 4);
+	else
+		kind = (int) pg_prng_uint64_range(state, 0, 5);
+
+	switch (kind)
+	{
+		case 0:
+			/* mostly the first or the last line pointer */
+			if (pg_prng_bool(state))
+			{
+				offsets[0] = pg_prng_bool(state) ? FirstOffsetNumber : maxoff;
+				return 1;
+			}
+			n = 1;
+			break;
+		case 1:
+			n = (int) pg_prng_uint64_range(state, 1, maxoff / 16 + 1);
+			break;
+		case 2:
+			n = maxoff - (int) pg_prng_uint64_range(state, 0, maxoff / 16);
+			break;
+		case 3:
+			n = maxoff;
+			break;
+		case 4:
+			n = (int) pg_prng_uint64_range(state, 1, maxoff);
+			hot_chain_len = (int) pg_prng_uint64_range(state, 1, Min(maxoff, 16));
+			break;
+		default:
+			n = (int) pg_prng_uint64_range(state, 1, maxoff);
+			break;
+	}
+
+	n = Min(n, maxoff);
+	choose_dead_offsets(state, n, maxoff, hot_chain_len, offsets);
+
+	return n;
+}
+
+/*
+ * Generate about ndead dead tuples of the shape, and the index tuples to look
+ * up: every dead tuple and the line pointer after it, the first, the last and
+ * a random line pointer of every dirty page, a random one of the pages next
+ * to it, and the first and last line pointers of block 0 and
+ * MaxBlockNumber. The index tuples are shuffled unless sorted.
+ */
+static void
+generate_fuzz_workload(pg_prng_state *state, FuzzShape shape, uint64 ndead,
+					   bool sorted)
+{
+	OffsetNumber maxoff;
+	uint64		maxgap;
+	uint64		blkno = 0;
+	uint64		ndts = 0;
+	uint64		npages = 0;
+	uint64		nidx = 0;
+	uint64		shift = 0;
+	ItemPointer dead;
+	ItemPointer idx;
+
+	/* the pages of a table tend to have the same number of line pointers */
+	if (pg_prng_bool(state))
+		maxoff = MaxHeapTuplesPerPage;
+	else
+		maxoff = (OffsetNumber) pg_prng_uint64_range(state, 1, MaxHeapTuplesPerPage);
+
+	if (shape == FUZZ_DENSE)
+		maxgap = 1;
+	else if (shape == FUZZ_SPARSE)
+		maxgap = Max((uint64) MaxBlockNumber / ndead, 1) * 2;
+	else
+		maxgap = 16;
+
+	/* room for the last dirty page, and the one at MaxBlockNumber */
+	DeadTuples_orig = reset_tid_array(DeadTuples_orig,
+									  ndead + 2 * MaxHeapTuplesPerPage);
+	dead = DeadTuples_orig->itemptrs;
+
+	while (ndts < ndead && blkno <= MaxBlockNumber)
+	{
+		OffsetNumber offsets[MaxOffsetNumber];
+		int			n;
+
+		CHECK_FOR_INTERRUPTS();
+
+		n = fuzz_page_offsets(state, shape, maxoff, offsets);
+		for (int i = 0; i < n; i++)
+			ItemPointerSet(&(dead[ndts++]), (BlockNumber) blkno, offsets[i]);
+		npages++;
+
+		blkno += pg_prng_uint64_range(state, 1, maxgap);
+	}
+
+	if (shape == FUZZ_SPARSE &&
+		ItemPointerGetBlockNumber(&(dead[ndts - 1])) < MaxBlockNumber)
+	{
+		ItemPointerSet(&(dead[ndts++]), MaxBlockNumber,
+					   (OffsetNumber) pg_prng_uint64_range(state, 1, maxoff));
+		npages++;
+	}
+
+	/* move the dirty pages to the end of the block range */
+	if (shape == FUZZ_HIGH)
+	{
+		shift = MaxBlockNumber - ItemPointerGetBlockNumber(&(dead[ndts - 1]));
+		for (uint64 i = 0; i < ndts; i++)
+			ItemPointerSetBlockNumber(&(dead[i]),
+									  ItemPointerGetBlockNumber(&(dead[i])) + shift);
+	}
+
+	IndexTids_cache = reset_tid_array(IndexTids_cache, 2 * ndts + 5 * npages + 4);
+	idx = IndexTids_cache->itemptrs;
+
+	ItemPointerSet(&(idx[nidx++]), 0, FirstOffsetNumber);
+	ItemPointerSet(&(idx[nidx++]), 0, MaxHeapTuplesPerPage);
+	ItemPointerSet(&(idx[nidx++]), MaxBlockNumber, FirstOffsetNumber);
+	ItemPointerSet(&(idx[nidx++]), MaxBlockNumber, MaxHeapTuplesPerPage);
+
+	for (uint64 i = 0; i < ndts; i++)
+	{
+		BlockNumber blk = ItemPointerGetBlockNumber(&(dead[i]));
+		OffsetNumber off = ItemPointerGetOffsetNumber(&(dead[i]));
+
+		idx[nidx++] = dead[i];
+		if (off < MaxHeapTuplesPerPage)
+			ItemPointerSet(&(idx[nidx++]), blk, off + 1);
+
+		if (i > 0 && ItemPointerGetBlockNumber(&(dead[i - 1])) == blk)
+			continue;
+
+		/* the first dead tuple of the page, probe the page and around it */
+		ItemPointerSet(&(idx[nidx++]), blk, FirstOffsetNumber);
+		ItemPointerSet(&(idx[nidx++]), blk, MaxHeapTuplesPerPage);
+		ItemPointerSet(&(idx[nidx++]), blk,
+					   (OffsetNumber) pg_prng_uint64_range(state, 1, MaxHeapTuplesPerPage));
+		if (blk > 0)
+			ItemPointerSet(&(idx[nidx++]), blk - 1,
+						   (OffsetNumber) pg_prng_uint64_range(state, 1, MaxHeapTuplesPerPage));
+		if (blk < MaxBlockNumber)
+			ItemPointerSet(&(idx[nidx++]), blk + 1,
+						   (OffsetNumber) pg_prng_uint64_range(state, 1, MaxHeapTuplesPerPage));
+	}
+	Assert(nidx <= 2 * ndts + 5 * npages + 4);
+
+	/* remove the duplicates */
+	qsort(idx, nidx, sizeof(ItemPointerData), vac_cmp_itemptr);
+	nidx = qunique(idx, nidx, sizeof(ItemPointerData), vac_cmp_itemptr);
+
+	if (!sorted)
+		shuffle_itemptrs(nidx, idx);
+
+	update_info(&(DeadTuples_orig->dtinfo), ndts,
+				ItemPointerGetBlockNumber(&(dead[0])),
+				ItemPointerGetBlockNumber(&(dead[ndts - 1])) + 1, maxoff);
+	update_info(&(IndexTids_cache->dtinfo), nidx, 0, MaxBlockNumber + 1,
+				MaxHeapTuplesPerPage);
+	invalidate_attached_dead_tuples();
+
+	elog(NOTICE, "dead tuples: %lu in %lu blocks from %u to %u (%s, maxoff %u), index tuples: %lu (sorted %d)",
+		 ndts, npages, DeadTuples_orig->dtinfo.minblk,
+		 ItemPointerGetBlockNumber(&(dead[ndts - 1])),
+		 fuzz_shapes[shape], maxoff, nidx, sorted);
+}
+
+/*
+ * Look up all index tuples as _bench_run() does, and return the number of
+ * answers differing from expected. The first index tuple answered wrong goes
+ * to first. A batch returning a count that doesn't match its bits counts as
+ * a mismatch too.
+ */
+static uint64
+fuzz_check(LVTestType *lvtt, BenchBatchFn batch_fn, const bool *expected,
+		   ItemPointer first)
+{
+	uint64		result[(BENCH_BATCH_SIZE + 63) / 64];
+	uint64		nmismatches = 0;
+
+	for (uint64 i = 0; i < IndexTids_cache->dtinfo.nitems; i += BENCH_BATCH_SIZE)
+	{
+		int			n = Min(IndexTids_cache->dtinfo.nitems - i, BENCH_BATCH_SIZE);
+		ItemPointer itemptrs = &(IndexTids_cache->itemptrs[i]);
+		int			nmatched = 0;
+		int			nfound = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (batch_fn)
+			nmatched = batch_fn(lvtt, itemptrs, n, result);
+
+		for (int j = 0; j < n; j++)
+		{
+			bool		found;
+
+			if (batch_fn)
+				found = (result[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+			else
+				found = lvtt->reaped_fn(lvtt, &(itemptrs[j]));
+
+			nfound += found;
+			if (found != expected[i + j] && nmismatches++ == 0)
+				*first = itemptrs[j];
+		}
+
+		if (batch_fn && nmatched != nfound && nmismatches++ == 0)
+			*first = itemptrs[0];
+	}
+
+	return nmismatches;
+}
+
+/*
+ * Load the dead tuples to lvtt, which must have no memory limit nor
+ * partitions, and time and check every kind of lookups it supports, into
+ * results. The lookups are timed as bench() does, and then checked in another
+ * pass. Returns the number of results.
+ */
+static int
+fuzz_subject(LVTestType *lvtt, const bool *expected, bool sorted,
+			 FuzzResult *results)
+{
+	static const char *const lookups[] = {"scalar", "batched", "pipelined",
+										  "intersect"};
+	BenchBatchFn batch_fns[] = {NULL, lvtt->reaped_batch_fn,
+								lvtt->reaped_pipelined_fn,
+								sorted ? lvtt->intersect_fn : NULL};
+	uint64		nbatches;
+	uint64		stride;
+	double	   *samples;
+	MemoryContext old_ctx;
+	int			nresults = 0;
+
+	attach(lvtt,
+		   DeadTuples_orig->dtinfo.nitems,
+		   DeadTuples_orig->dtinfo.minblk,
+		   DeadTuples_orig->dtinfo.maxblk,
+		   DeadTuples_orig->dtinfo.maxoff);
+
+	nbatches = (IndexTids_cache->dtinfo.nitems + BENCH_BATCH_SIZE - 1) / BENCH_BATCH_SIZE;
+	stride = Max((nbatches + BENCH_MAX_SAMPLES - 1) / BENCH_MAX_SAMPLES, 1);
+	samples = palloc(sizeof(double) * Min(Max(nbatches, 1), BENCH_MAX_SAMPLES));
+
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+
+	for (int k = 0; k < lengthof(lookups); k++)
+	{
+		FuzzResult *res = &(results[nresults]);
+
+		/* not supported */
+		if (k > 0 && batch_fns[k] == NULL)
+			continue;
+
+		res->lookup = lookups[k];
+		_bench_run(lvtt, batch_fns[k], -1, samples, stride, &(res->r));
+		res->nmismatches = fuzz_check(lvtt, batch_fns[k], expected,
+									  &(res->first_mismatch));
+		nresults++;
+	}
+
+	MemoryContextSwitchTo(old_ctx);
+	pfree(samples);
+
+	return nresults;
+}
+
+/*
+ * Run rounds of randomized workloads, each of about ndead dead tuples of a
+ * shape chosen in turn. In each round, load the dead tuples to every subject
+ * of modes, or all of them if NULL, and check the answers of every kind of
+ * lookups they support against a binary search of the dead tuples, timing
+ * the loading and the lookups. Returns a row per round, subject and kind of
+ * lookups.
+ *
+ * Each subject runs in a subtransaction, so that a subject that can't hold
+ * the dead tuples, e.g. having too high block numbers, returns a row with the
+ * error rather than stopping the others.
+ */
+Datum
+bench_fuzz(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	int64		seed;
+	int			rounds;
+	int64		ndead;
+	bool		selected[TEST_SUBJECT_TYPES];
+	pg_prng_state state;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("seed, rounds and ndead must not be null")));
+
+	seed = PG_GETARG_INT64(0);
+	rounds = PG_GETARG_INT32(1);
+	ndead = PG_GETARG_INT64(2);
+
+	if (rounds < 1 || ndead < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("rounds and ndead must be positive")));
+
+	if (PG_ARGISNULL(3))
+		memset(selected, true, sizeof(selected));
+	else
+	{
+		Datum	   *elems;
+		bool	   *elemnulls;
+		int			nelems;
+
+		memset(selected, false, sizeof(selected));
+		deconstruct_array(PG_GETARG_ARRAYTYPE_P(3), TEXTOID, -1, false,
+						  TYPALIGN_INT, &elems, &elemnulls, &nelems);
+
+		for (int i = 0; i < nelems; i++)
+		{
+			char	   *mode;
+			LVTestType *lvtt;
+
+			if (elemnulls[i])
+				continue;
+
+			mode = TextDatumGetCString(elems[i]);
+			lvtt = find_subject(mode);
+
+			if (lvtt == NULL)
+				elog(ERROR, "unknown mode \"%s\"", mode);
+			selected[lvtt - LVTestSubjects] = true;
+		}
+	}
+
+	InitMaterializedSRF(fcinfo, 0);
+	pg_prng_seed(&state, (uint64) seed);
+
+	for (int round = 1; round <= rounds; round++)
+	{
+		FuzzShape	shape = (FuzzShape) ((round - 1) % lengthof(fuzz_shapes));
+		bool		sorted = pg_prng_bool(&state);
+		bool	   *expected;
+		uint64		nindex;
+
+		generate_fuzz_workload(&state, shape, ndead, sorted);
+		nindex = IndexTids_cache->dtinfo.nitems;
+
+		/* the reference answers */
+		expected = MemoryContextAllocHuge(CurrentMemoryContext,
+										  sizeof(bool) * nindex);
+		for (uint64 i = 0; i < nindex; i++)
+			expected[i] = bsearch(&(IndexTids_cache->itemptrs[i]),
+								  DeadTuples_orig->itemptrs,
+								  DeadTuples_orig->dtinfo.nitems,
+								  sizeof(ItemPointerData),
+								  vac_cmp_itemptr) != NULL;
+
+		for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+		{
+			LVTestType *lvtt = &(LVTestSubjects[i]);
+			MemoryContext oldcontext = CurrentMemoryContext;
+			ResourceOwner oldowner = CurrentResourceOwner;
+			FuzzResult	results[4];
+			int			nresults = 0;
+			char	   *error = NULL;
+			Size		mem = 0;
+			Size		mem_limit = lvtt->mem_limit;
+			int			npartitions = lvtt->npartitions;
+
+			if (!selected[i])
+				continue;
+
+			/*
+			 * Load everything at once, and restore the settings afterwards so
+			 * that later attach_dead_tuples() calls behave as configured.
+			 */
+			lvtt->mem_limit = 0;
+			lvtt->npartitions = 0;
+
+			BeginInternalSubTransaction(NULL);
+			MemoryContextSwitchTo(oldcontext);
+
+			PG_TRY();
+			{
+				nresults = fuzz_subject(lvtt, expected, sorted, results);
+				mem = MemoryContextMemAllocated(lvtt->mcxt, true);
+				lvtt->mem_limit = mem_limit;
+				lvtt->npartitions = npartitions;
+
+				/* the loaded dead tuples don't follow the settings */
+				if (mem_limit > 0 || npartitions > 1)
+					lvtt->dtinfo.nitems = 0;
+
+				ReleaseCurrentSubTransaction();
+				MemoryContextSwitchTo(oldcontext);
+				CurrentResourceOwner = oldowner;
+			}
+			PG_CATCH();
+			{
+				ErrorData  *edata;
+
+				lvtt->mem_limit = mem_limit;
+				lvtt->npartitions = npartitions;
+
+				MemoryContextSwitchTo(oldcontext);
+				edata = CopyErrorData();
+				FlushErrorState();
+
+				RollbackAndReleaseCurrentSubTransaction();
+				MemoryContextSwitchTo(oldcontext);
+				CurrentResourceOwner = oldowner;
+
+				/* the dead tuples may be half loaded, build them again */
+				if (lvtt->mcxt)
+					MemoryContextDelete(lvtt->mcxt);
+				lvtt->mcxt = NULL;
+				lvtt->private = NULL;
+				lvtt->dtinfo.nitems = 0;
+
+				if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+					ReThrowError(edata);
+
+				error = edata->message;
+			}
+			PG_END_TRY();
+
+			if (error)
+			{
+				Datum		values[13] = {0};
+				bool		nulls[13];
+
+				memset(nulls, true, sizeof(nulls));
+				values[0] = Int32GetDatum(round);
+				values[1] = CStringGetTextDatum(lvtt->name);
+				values[2] = CStringGetTextDatum(fuzz_shapes[shape]);
+				values[3] = BoolGetDatum(sorted);
+				values[12] = CStringGetTextDatum(error);
+				nulls[0] = nulls[1] = nulls[2] = nulls[3] = nulls[12] = false;
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+									 values, nulls);
+				continue;
+			}
+
+			for (int k = 0; k < nresults; k++)
+			{
+				FuzzResult *res = &(results[k]);
+				Datum		values[13];
+				bool		nulls[13] = {0};
+
+				if (res->nmismatches > 0)
+					elog(WARNING, "\"%s\": %lu of %lu index tuples answered wrong in round %d (%s lookup), the first one (%u,%u)",
+						 lvtt->name, res->nmismatches, nindex, round, res->lookup,
+						 ItemPointerGetBlockNumber(&(res->first_mismatch)),
+						 ItemPointerGetOffsetNumber(&(res->first_mismatch)));
+
+				values[0] = Int32GetDatum(round);
+				values[1] = CStringGetTextDatum(lvtt->name);
+				values[2] = CStringGetTextDatum(fuzz_shapes[shape]);
+				values[3] = BoolGetDatum(sorted);
+				values[4] = CStringGetTextDatum(res->lookup);
+				values[5] = Int64GetDatum(lvtt->nloaded);
+				values[6] = Int64GetDatum(nindex);
+				values[7] = Float8GetDatum(lvtt->load_ms);
+				values[8] = Float8GetDatum(res->r.total_ms * 1000000 / nindex);
+				values[9] = Float8GetDatum((double) mem / lvtt->nloaded);
+				values[10] = Int64GetDatum(res->nmismatches);
+				if (res->nmismatches > 0)
+					values[11] = ItemPointerGetDatum(&(res->first_mismatch));
+				else
+					nulls[11] = true;
+				nulls[12] = true;
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+									 values, nulls);
+			}
+		}
+
+		pfree(expected);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Look up the index tuples with nworkers background workers sharing the dead
+ * tuples exported to shared memory by attach_dead_tuples(mode, true). Each
+ * worker probes a contiguous slice of the index tuples.
+ */
+Datum
+bench_parallel(PG_FUNCTION_ARGS)
+{
+	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int nworkers = PG_GETARG_INT32(1);
+	LVTestType *lvtt = NULL;
+	BackgroundWorkerHandle **handles;
+	BDBenchParallelShared *shared;
+	ItemPointer itemptrs;
+	dsm_segment *seg;
+	shm_toc_estimator e;
+	shm_toc	   *toc;
+	Size		shared_size;
+	Size		segsize;
+	uint64		nitems;
+	uint64		matched = 0;
+	double		min_ms = 0;
+	double		max_ms = 0;
+
+	if (!IndexTids_cache || !IndexTids_cache->itemptrs)
+		elog(ERROR, "index tuples are not preapred");
+
+	if (nworkers < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers must be at least 1")));
+
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		if (strcmp(mode, LVTestSubjects[i].name) == 0)
+		{
+			lvtt = &(LVTestSubjects[i]);
+			break;
+		}
+	}
+
+	if (lvtt == NULL)
+		elog(ERROR, "unknown mode \"%s\"", mode);
+
+	if (lvtt->shared_seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("%s dead tuples are not in shared memory", lvtt->name),
+				 errhint("Use attach_dead_tuples('%s', shared => true).",
+						 lvtt->name)));
+
+	nitems = IndexTids_cache->dtinfo.nitems;
+
+	/* Set up the segment for the shared state and the index tuples */
+	shared_size = add_size(offsetof(BDBenchParallelShared, results),
+						   mul_size(sizeof(BDBenchWorkerResult), nworkers));
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, shared_size);
+	shm_toc_estimate_chunk(&e, mul_size(sizeof(ItemPointerData), nitems));
+	shm_toc_estimate_keys(&e, 2);
+	segsize = shm_toc_estimate(&e);
+
+	seg = dsm_create(segsize, 0);
+	toc = shm_toc_create(BDBENCH_PARALLEL_MAGIC, dsm_segment_address(seg),
+						 segsize);
+
+	shared = shm_toc_allocate(toc, shared_size);
+	memset(shared, 0, shared_size);
+	strlcpy(shared->mode, lvtt->name, NAMEDATALEN);
+	shared->store_handle = dsm_segment_handle(lvtt->shared_seg);
+	shared->dtinfo = lvtt->dtinfo;
+	shared->nitems = nitems;
+	shared->nworkers = nworkers;
+	pg_atomic_init_u32(&shared->nready, 0);
+	pg_atomic_init_u32(&shared->start, 0);
+	shm_toc_insert(toc, BDBENCH_KEY_SHARED, shared);
+
+	itemptrs = shm_toc_allocate(toc, sizeof(ItemPointerData) * nitems);
+	memcpy(itemptrs, IndexTids_cache->itemptrs,
+		   sizeof(ItemPointerData) * nitems);
+	shm_toc_insert(toc, BDBENCH_KEY_INDEX_TIDS, itemptrs);
+
+	/* Launch workers */
+	handles = palloc0(sizeof(BackgroundWorkerHandle *) * nworkers);
+	PG_TRY();
+	{
+		for (int i = 0; i < nworkers; i++)
+		{
+			BackgroundWorker worker;
+
+			memset(&worker, 0, sizeof(worker));
+			worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+			worker.bgw_start_time = BgWorkerStart_ConsistentState;
+			worker.bgw_restart_time = BGW_NEVER_RESTART;
+			sprintf(worker.bgw_library_name, "bdbench");
+			sprintf(worker.bgw_function_name, "bdbench_parallel_main");
+			snprintf(worker.bgw_name, BGW_MAXLEN,
+					 "bdbench parallel worker %d", i);
+			snprintf(worker.bgw_type, BGW_MAXLEN, "bdbench parallel worker");
+			worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+			memcpy(worker.bgw_extra, &i, sizeof(int));
+			worker.bgw_notify_pid = MyProcPid;
+
+			if (!RegisterDynamicBackgroundWorker(&worker, &handles[i]))
+				ereport(ERROR,
+						(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+						 errmsg("could not register background process"),
+						 errhint("You may need to increase max_worker_processes.")));
+		}
+
+		/* Wait for all workers to set up their view of the dead tuples */
+		while (pg_atomic_read_u32(&shared->nready) < nworkers)
+		{
+			for (int i = 0; i < nworkers; i++)
+			{
+				BgwHandleStatus status;
+				pid_t		pid;
+
+				/* ready workers don't exit until we let them start */
+				status = GetBackgroundWorkerPid(handles[i], &pid);
+				if (status == BGWH_STOPPED || status == BGWH_POSTMASTER_DIED)
+					ereport(ERROR,
+							(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+							 errmsg("bdbench parallel worker %d exited before starting to look up",
+									i)));
+			}
+
+			(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 10L, PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		/* Go */
+		pg_atomic_write_u32(&shared->start, 1);
+
+		for (int i = 0; i < nworkers; i++)
+			WaitForBackgroundWorkerShutdown(handles[i]);
+	}
+	PG_CATCH();
+	{
+		for (int i = 0; i < nworkers; i++)
+		{
+			if (handles[i])
+				TerminateBackgroundWorker(handles[i]);
+		}
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		BDBenchWorkerResult *res = &(shared->results[i]);
+
+		if (!res->done)
+			elog(ERROR, "bdbench parallel worker %d did not finish", i);
+
+		elog(NOTICE, "\"%s\": worker %d: index tuples %lu, matched %lu, %.3f ms (%.2f M lookups/s)",
+			 lvtt->name, i, res->nlookups, res->matched, res->elapsed_ms,
+			 res->nlookups / res->elapsed_ms / 1000);
+
+		matched += res->matched;
+		if (i == 0 || res->elapsed_ms < min_ms)
+			min_ms = res->elapsed_ms;
+		if (i == 0 || res->elapsed_ms > max_ms)
+			max_ms = res->elapsed_ms;
+	}
+
+	if (matched != lvtt->dtinfo.nitems)
+		elog(WARNING, "the number of dead tuples found doesn't match the actual dead tuples: got %lu expected %lu",
+			 matched, lvtt->dtinfo.nitems);
+
+	/* The slowest worker determines the elapsed time */
+	elog(NOTICE, "\"%s\": %d workers, index tuples %lu, matched %lu, %.3f ms (%.2f M lookups/s), skew %.2f",
+		 lvtt->name, nworkers, nitems, matched, max_ms,
+		 nitems / max_ms / 1000, max_ms / min_ms);
+
+	dsm_detach(seg);
+	pfree(handles);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Entry point of the bench_parallel() workers. main_arg is the handle of the
+ * segment set up by bench_parallel() and bgw_extra has the worker number.
+ */
+void
+bdbench_parallel_main(Datum main_arg)
+{
+	BDBenchParallelShared *shared;
+	BDBenchWorkerResult *res;
+	LVTestType *lvtt = NULL;
+	ItemPointer itemptrs;
+	dsm_segment *seg;
+	dsm_segment *store_seg;
+	shm_toc	   *toc;
+	MemoryContext old_ctx;
+	instr_time	start_time,
+				elapsed;
+	uint64		start,
+				end;
+	uint64		matched = 0;
+	int			worker_id;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	memcpy(&worker_id, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "bdbench parallel worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	toc = shm_toc_attach(BDBENCH_PARALLEL_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("bad magic number in dynamic shared memory segment")));
+	shared = shm_toc_lookup(toc, BDBENCH_KEY_SHARED, false);
+	itemptrs = shm_toc_lookup(toc, BDBENCH_KEY_INDEX_TIDS, false);
+
+	store_seg = dsm_attach(shared->store_handle);
+	if (store_seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	{
+		if (strcmp(shared->mode, LVTestSubjects[i].name) == 0)
+		{
+			lvtt = &(LVTestSubjects[i]);
+			break;
+		}
+	}
+	Assert(lvtt && lvtt->import_fn);
+
+	lvtt->mcxt = AllocSetContextCreate(TopMemoryContext,
+									   "bdbench parallel worker",
+									   ALLOCSET_DEFAULT_SIZES);
+	lvtt->dtinfo = shared->dtinfo;
+
+	old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+	lvtt->import_fn(lvtt, dsm_segment_address(store_seg));
+
+	start = shared->nitems * worker_id / shared->nworkers;
+	end = shared->nitems * (worker_id + 1) / shared->nworkers;
+
+	/* Tell the leader we're ready, and wait for the others */
+	pg_atomic_fetch_add_u32(&shared->nready, 1);
+	while (pg_atomic_read_u32(&shared->start) == 0)
+	{
+		CHECK_FOR_INTERRUPTS();
+		pg_usleep(100L);
+	}
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	for (uint64 i = start; i < end; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
+		if (lvtt->reaped_fn(lvtt, &(itemptrs[i])))
+			matched++;
+	}
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+	MemoryContextSwitchTo(old_ctx);
+
+	res = &(shared->results[worker_id]);
+	res->nlookups = end - start;
+	res->matched = matched;
+	res->elapsed_ms = INSTR_TIME_GET_MILLISEC(elapsed);
+	res->done = true;
+
+	dsm_detach(store_seg);
+	dsm_detach(seg);
+}
+
+void
+_PG_init(void)
+{
+	DefineCustomBoolVariable("bdbench.stats",
+							 "count the branches the lookups take",
+							 "The counters are shown by bdbench_stats().",
+							 &bdbench_stats_enabled,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	MarkGUCPrefixReserved("bdbench");
+}
+
+/*
+ * Return the lookup counters of this backend, a row per counter of each
+ * structure, with the level for the per-level counters of the trees. The
+ * per-level counters that are zero are omitted.
+ */
+Datum
+bdbench_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Datum		values[4];
+	bool		nulls[4];
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	for (int i = 0; i < lengthof(BdbenchStatsSets); i++)
+	{
+		BdbenchStatsSet *set = BdbenchStatsSets[i];
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = CStringGetTextDatum(set->structure);
+
+		nulls[1] = true;
+		for (int j = 0; j < set->ncounters; j++)
+		{
+			values[2] = CStringGetTextDatum(set->names[j]);
+			values[3] = Int64GetDatum((int64) set->counters[j]);
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+								 values, nulls);
+		}
+
+		nulls[1] = false;
+		for (int level = 0; level < set->nlevels; level++)
+		{
+			for (int j = 0; j < set->nlevel_counters; j++)
+			{
+				uint64		count = set->level_counters[level * set->nlevel_counters + j];
+
+				if (count == 0)
+					continue;
+
+				values[1] = Int32GetDatum(level);
+				values[2] = CStringGetTextDatum(set->level_names[j]);
+				values[3] = Int64GetDatum((int64) count);
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+									 values, nulls);
+			}
+		}
+	}
+
+	return (Datum) 0;
+}
+
+Datum
+bdbench_reset_stats(PG_FUNCTION_ARGS)
+{
+	for (int i = 0; i < lengthof(BdbenchStatsSets); i++)
+	{
+		BdbenchStatsSet *set = BdbenchStatsSets[i];
+
+		memset(set->counters, 0, sizeof(uint64) * set->ncounters);
+		if (set->level_counters != NULL)
+			memset(set->level_counters, 0,
+				   sizeof(uint64) * set->nlevels * set->nlevel_counters);
+	}
+
+	PG_RETURN_VOID();
+}
+
+Datum
+test_generate_tid(PG_FUNCTION_ARGS)
+{
+	uint64 nitems = PG_GETARG_INT32(0);
+	BlockNumber minblk = PG_GETARG_INT32(1);
+	BlockNumber maxblk = PG_GETARG_INT32(2);
+	OffsetNumber maxoff = PG_GETARG_INT32(3);
+	ItemPointer itemptrs = palloc(sizeof(ItemPointer) * nitems);
+	StringInfoData buf;
 
-	nitems = (int) (ntuples * dt_ratio);
-	maxblk = (((uint64) nitems) * (uint64)(tuple_size)) / 8192;
-	maxoff = 8192 / tuple_size;
+	generate_random_itemptrs(nitems, minblk, maxblk, maxoff, itemptrs);
 
-	generate_dead_tuples_orig(nitems, minblk, maxblk, maxoff);
+	initStringInfo(&buf);
+	for (int i = 0; i < nitems; i++)
+	{
+		appendStringInfo(&buf, "(%u %u) ",
+						 ItemPointerGetBlockNumber(&itemptrs[i]),
+						 ItemPointerGetOffsetNumber(&itemptrs[i]));
+	}
+	elog(NOTICE, "%s", buf.data);
 
 	PG_RETURN_NULL();
 }
 
-Datum
-prepare(PG_FUNCTION_ARGS)
+/*
+ * Check that merging the rtbms, adaptive rtbms, svtms and radix_tree_tid
+ * trees built for nparts consecutive ranges of the blocks of the dead tuples,
+ * which must be sorted, gives the same answers as rtbm built at once.
+ */
+static void
+rtbm_test_merge(RTbm *rtbm, ItemPointer dead_tuples, int nitems_dead,
+				ItemPointer index_tuples, int nitems_index, int nparts)
 {
-	BlockNumber maxblk = PG_GETARG_INT64(0);
-	uint64 ndeadtuples_in_page = PG_GETARG_INT32(1);
-	uint64 interval_in_page = PG_GETARG_INT32(2);
-	uint64 page_consecutives = PG_GETARG_INT32(3);
-	uint64 page_interval = PG_GETARG_INT32(4);
-	bool shuffle = PG_GETARG_BOOL(5);
+	RTbm *merged = NULL;
+	RTbm *merged_adaptive = NULL;
+	SVTm *svtm = NULL;
+	rt_tid_radix_tree *tree = NULL;
+	int start = 0;
 
-	OffsetNumber maxoff = ndeadtuples_in_page * interval_in_page;
-	uint64 ndts = 0;
-	uint64 nidx = 0;
-	uint64 ndts_tmp = 0;
-	uint64 nidx_tmp = 0;
+	for (int p = 0; p < nparts; p++)
+	{
+		int end = (int) ((int64) nitems_dead * (p + 1) / nparts);
+		RTbm *part;
+		RTbm *part_adaptive;
+		SVTm *svtm_part;
+		rt_tid_radix_tree *tree_part;
+
+		/* the parts must not share a block */
+		while (end > start && end < nitems_dead &&
+			   ItemPointerGetBlockNumber(&(dead_tuples[end])) ==
+			   ItemPointerGetBlockNumber(&(dead_tuples[end - 1])))
+			end++;
+
+		/* the previous part took all of the blocks of this one */
+		if (end <= start)
+			continue;
+
+		part = rtbm_create();
+		part_adaptive = rtbm_create_adaptive();
+		svtm_part = svtm_create();
+		tree_part = rt_tid_create(CurrentMemoryContext);
+
+		load_rtbm(part, &(dead_tuples[start]), end - start, NULL);
+		load_rtbm(part_adaptive, &(dead_tuples[start]), end - start, NULL);
+		svtm_load(svtm_part, &(dead_tuples[start]), end - start, NULL);
+		radix_tree_tid_load(tree_part, &(dead_tuples[start]), end - start);
+
+		if (merged == NULL)
+		{
+			merged = part;
+			merged_adaptive = part_adaptive;
+			svtm = svtm_part;
+			tree = tree_part;
+		}
+		else
+		{
+			rtbm_merge(merged, part);
+			rtbm_merge(merged_adaptive, part_adaptive);
+			svtm_merge(svtm, svtm_part);
+			rt_tid_merge(tree, tree_part);
+		}
 
-	if (page_consecutives > page_interval)
-		elog(ERROR, "cannot prepare %lu consecutive dirty pages at %lu pages interval",
-			 page_consecutives, page_interval);
+		start = end;
+	}
 
-	ndts = ((uint64) ceil((double)maxblk / page_interval) * page_consecutives) * ndeadtuples_in_page;
-	DeadTuples_orig = MemoryContextAllocHuge(TopMemoryContext,
-											 sizeof(DeadTuplesArray));
-	DeadTuples_orig->itemptrs =
-		(ItemPointer) MemoryContextAllocHuge(TopMemoryContext,
-											 sizeof(ItemPointerData) * ndts);
+	for (int i = 0; i < nitems_index; i++)
+	{
+		uint32 bit;
+		uint32 key = radix_tree_tid_key(&(index_tuples[i]), &bit);
+		uint64 val;
+		bool ret1 = rtbm_lookup(rtbm, &(index_tuples[i]));
+		bool ret2 = rtbm_lookup(merged, &(index_tuples[i]));
+		bool ret3 = rtbm_lookup(merged_adaptive, &(index_tuples[i]));
+		bool ret4 = svtm_lookup(svtm, &(index_tuples[i]));
+		bool ret5 = rt_tid_search(tree, key, &val) &&
+			(val & (UINT64CONST(1) << bit)) != 0;
+
+		if (ret1 != ret2 || ret1 != ret3 || ret1 != ret4 || ret1 != ret5)
+			elog(ERROR, "failed (%d, %d) : rtbm %d merged rtbm %d merged adaptive rtbm %d merged svtm %d merged radix_tree_tid %d",
+				 ItemPointerGetBlockNumber(&(index_tuples[i])),
+				 ItemPointerGetOffsetNumber(&(index_tuples[i])),
+				 ret1, ret2, ret3, ret4, ret5);
+	}
 
-	nidx = ((uint64) maxblk) * ((uint64) maxoff);
-	IndexTids_cache = MemoryContextAllocHuge(TopMemoryContext,
-											 sizeof(DeadTuplesArray));
-	IndexTids_cache->itemptrs =
-		(ItemPointer) MemoryContextAllocHuge(TopMemoryContext,
-											 sizeof(ItemPointerData) * nidx);
+	rtbm_free(merged);
+	rtbm_free(merged_adaptive);
+	svtm_free(svtm);
+	rt_tid_free(tree);
+}
 
-	elog(WARNING, "dead tuples: page: total %lu tuples, %lu tuples with interval %lu in page (maxoff %u, shuffle %d), blk: maxblk %u consecutive %lu interval %lu, setting: ndts %lu nidx %lu",
-		 ndts,
-		 ndeadtuples_in_page,
-		 interval_in_page,
-		 maxoff,
-		 shuffle,
-		 maxblk,
-		 page_consecutives,
-		 page_interval,
-		 ndts, nidx);
+/*
+ * Check that merging adaptive rtbms in the compact form appends them while
+ * their blocks are in order, and converts to the hash table for a part in
+ * the hash table or out of order, answering the same in both forms.
+ */
+static void
+rtbm_test_merge_compact(void)
+{
+	const BlockNumber nblocks = 4096;
+	const int nparts = 4;
+	RTbm *merged = NULL;
+	OffsetNumber offsets[MaxHeapTuplesPerPage];
 
-	for (BlockNumber blkno = 0; blkno < maxblk; blkno++)
+	/* every other block of each part has one dead tuple */
+	for (int p = 0; p < nparts; p++)
 	{
-		uint64 ndt_this_page = 0;
+		RTbm *part = rtbm_create_adaptive();
 
-		for (OffsetNumber off = FirstOffsetNumber; off <= maxoff; off++)
+		for (BlockNumber blk = p * nblocks; blk < (p + 1) * nblocks; blk += 2)
 		{
-			ItemPointerData tid;
+			offsets[0] = blk % 100 + 1;
+			rtbm_add_tuples(part, blk, offsets, 1);
+		}
 
-			ItemPointerSetBlockNumber(&tid, blkno);
-			ItemPointerSetOffsetNumber(&tid, off);
+		if (!rtbm_is_compact(part))
+			elog(ERROR, "rtbm part %d with single dead tuple blocks is not compact", p);
 
-			if ((blkno % page_interval) < page_consecutives &&
-				off % interval_in_page == 0 &&
-				ndt_this_page <= ndeadtuples_in_page)
-			{
-				ndt_this_page++;
-				DeadTuples_orig->itemptrs[ndts_tmp++] = tid;
-			}
-			IndexTids_cache->itemptrs[nidx_tmp++] = tid;
+		if (p == 0)
+			merged = part;
+		else
+			rtbm_merge(merged, part);
+
+		if (!rtbm_is_compact(merged))
+			elog(ERROR, "rtbm is not compact after appending compact part %d", p);
+	}
+
+	/* a dense part in the hash table */
+	{
+		RTbm *part = rtbm_create_adaptive();
+
+		for (BlockNumber blk = nparts * nblocks; blk < (nparts + 1) * nblocks; blk++)
+		{
+			for (int i = 0; i < 100; i++)
+				offsets[i] = i + 1;
+			rtbm_add_tuples(part, blk, offsets, 100);
 		}
+		rtbm_merge(merged, part);
 	}
 
-	/* sanity checks */
-	if (ndts_tmp > ndts)
-		elog(ERROR, "ndts_tmp %lu ndts %lu", ndts_tmp, ndts);
-	if (nidx_tmp > nidx)
-		elog(ERROR, "nidx_tmp %lu nidx %lu", nidx_tmp, nidx);
+	/* a compact part before the others, in the odd blocks */
+	{
+		RTbm *part = rtbm_create_adaptive();
 
-	/* Shuffle index tuples */
-	if (shuffle)
-		shuffle_itemptrs(nidx, IndexTids_cache->itemptrs);
+		for (BlockNumber blk = 1; blk < nblocks; blk += 2)
+		{
+			offsets[0] = 1;
+			rtbm_add_tuples(part, blk, offsets, 1);
+		}
+		if (!rtbm_is_compact(part))
+			elog(ERROR, "rtbm part with single dead tuple odd blocks is not compact");
+		rtbm_merge(merged, part);
+	}
 
-	DeadTuples_orig->dtinfo.nitems = Min(ndts, ndts_tmp);
-	IndexTids_cache->dtinfo.nitems = Min(nidx, nidx_tmp);
+	for (BlockNumber blk = 0; blk < (nparts + 1) * nblocks; blk++)
+	{
+		for (OffsetNumber off = 1; off <= 100; off++)
+		{
+			ItemPointerData tid;
+			bool expected;
+
+			ItemPointerSet(&tid, blk, off);
+			if (blk >= nparts * nblocks)
+				expected = true;
+			else if (blk % 2 == 0)
+				expected = (off == blk % 100 + 1);
+			else
+				expected = (blk < nblocks && off == 1);
+
+			if (rtbm_lookup(merged, &tid) != expected)
+				elog(ERROR, "failed (%u, %u) : merged adaptive rtbm %d, expected %d",
+					 blk, off, !expected, expected);
+		}
+	}
 
-	PG_RETURN_VOID();
+	rtbm_free(merged);
 }
 
-Datum
-attach_dead_tuples(PG_FUNCTION_ARGS)
+/*
+ * Check that an adaptive rtbm switches to the compact form when there are
+ * many blocks with a single dead tuple and back when the blocks get dense,
+ * answering the same in both forms.
+ */
+static void
+rtbm_test_adaptive(void)
 {
-	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	RTbm *rtbm = rtbm_create_adaptive();
+	const BlockNumber nblocks = 8192;
+	OffsetNumber offsets[MaxHeapTuplesPerPage];
+	int noffsets;
 
-	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	/* every other block has one dead tuple */
+	for (BlockNumber blk = 0; blk < nblocks; blk += 2)
 	{
-		LVTestType *lvtt = &(LVTestSubjects[i]);
+		offsets[0] = blk % 100 + 1;
+		rtbm_add_tuples(rtbm, blk, offsets, 1);
+	}
 
-		if (strcmp(mode, lvtt->name) == 0)
+	if (!rtbm_is_compact(rtbm))
+		elog(ERROR, "rtbm with single dead tuple blocks is not compact");
+
+	/* the intersection merges with the compact form */
+	for (BlockNumber blk = 0; blk < nblocks; blk += 4)
+	{
+		ItemPointerData tids[4 * 100];
+		uint64 result[(4 * 100 + 63) / 64];
+		int n = 0;
+
+		for (BlockNumber b = blk; b < blk + 4; b++)
 		{
-			MemoryContext old_ctx;
+			for (OffsetNumber off = 1; off <= 100; off++)
+				ItemPointerSet(&(tids[n++]), b, off);
+		}
 
-			old_ctx = MemoryContextSwitchTo(lvtt->mcxt);
+		if (rtbm_intersect_sorted(rtbm, tids, n, result) != 2)
+			elog(ERROR, "failed (%u) : compact rtbm intersection count", blk);
 
-			attach(lvtt,
-				   DeadTuples_orig->dtinfo.nitems,
-				   DeadTuples_orig->dtinfo.minblk,
-				   DeadTuples_orig->dtinfo.maxblk,
-				   DeadTuples_orig->dtinfo.maxoff);
+		for (int i = 0; i < n; i++)
+		{
+			bool expected = rtbm_lookup(rtbm, &(tids[i]));
 
-			MemoryContextSwitchTo(old_ctx);
+			if (((result[i / 64] & (UINT64CONST(1) << (i % 64))) != 0) != expected)
+				elog(ERROR, "failed (%u, %u) : compact rtbm intersection %d, expected %d",
+					 ItemPointerGetBlockNumber(&(tids[i])),
+					 ItemPointerGetOffsetNumber(&(tids[i])),
+					 !expected, expected);
+		}
+	}
 
-			break;
+	/* then the blocks are full of dead tuples */
+	for (BlockNumber blk = nblocks; blk < nblocks * 2; blk++)
+	{
+		for (int i = 0; i < 100; i++)
+			offsets[i] = i + 1;
+		rtbm_add_tuples(rtbm, blk, offsets, 100);
+	}
+
+	if (rtbm_is_compact(rtbm))
+		elog(ERROR, "rtbm with dense blocks is still compact");
+
+	for (BlockNumber blk = 0; blk < nblocks * 2; blk++)
+	{
+		for (OffsetNumber off = 1; off <= 100; off++)
+		{
+			ItemPointerData tid;
+			bool expected;
+
+			ItemPointerSet(&tid, blk, off);
+			expected = blk >= nblocks || (blk % 2 == 0 && off == blk % 100 + 1);
+
+			if (rtbm_lookup(rtbm, &tid) != expected)
+				elog(ERROR, "failed (%u, %u) : adaptive rtbm %d, expected %d",
+					 blk, off, !expected, expected);
 		}
 	}
 
-	elog(WARNING, "attached dead tuples to %s", mode);
+	rtbm_free(rtbm);
 
-	PG_RETURN_VOID();
+	/* a compact rtbm converts back if a block is added out of order */
+	rtbm = rtbm_create_adaptive();
+	for (BlockNumber blk = 1; blk <= nblocks; blk++)
+	{
+		offsets[0] = 1;
+		rtbm_add_tuples(rtbm, blk, offsets, 1);
+	}
+	offsets[0] = 2;
+	rtbm_add_tuples(rtbm, 0, offsets, 1);
+
+	if (rtbm_is_compact(rtbm))
+		elog(ERROR, "rtbm is still compact after adding a block out of order");
+
+	{
+		RTbmIter *iter = rtbm_begin_iterate(rtbm);
+		BlockNumber blkno;
+		BlockNumber expected = 0;
+
+		while (rtbm_iterate_next(iter, &blkno, offsets, &noffsets))
+		{
+			if (blkno != expected || noffsets != 1 ||
+				offsets[0] != (blkno == 0 ? 2 : 1))
+				elog(ERROR, "failed (%u) : adaptive rtbm iteration returned unexpected block",
+					 blkno);
+			expected++;
+		}
+		rtbm_end_iterate(iter);
+
+		if (expected != nblocks + 1)
+			elog(ERROR, "adaptive rtbm iteration returned %u blocks, expected %u",
+				 expected, nblocks + 1);
+	}
+
+	rtbm_free(rtbm);
 }
 
-Datum
-bench(PG_FUNCTION_ARGS)
+/*
+ * The dead tuples of block blkno for rtbm_test_intersect_forms(), returning
+ * how many there are. The pages cycle through the forms of svtm pages: a
+ * single dead tuple, a raw bitmap, a sparse bitmap and an inverted one.
+ */
+static int
+intersect_forms_page(BlockNumber blkno, OffsetNumber *offsets)
 {
-	char *mode = text_to_cstring(PG_GETARG_TEXT_P(0));
+	int n = 0;
 
-	if (!IndexTids_cache || !IndexTids_cache->itemptrs)
-		elog(ERROR, "index tuples are not preapred");
-
-	for (int i = 0; i < TEST_SUBJECT_TYPES; i++)
+	switch (blkno % 4)
 	{
-		LVTestType *lvtt = &(LVTestSubjects[i]);
-		if (strcmp(mode, lvtt->name) == 0)
-		{
-			_bench(lvtt);
+		case 0:
+			offsets[n++] = blkno % MaxHeapTuplesPerPage + 1;
+			break;
+		case 1:
+			for (OffsetNumber off = 1; off < 100; off += 2)
+				offsets[n++] = off;
+			break;
+		case 2:
+			offsets[n++] = 1;
+			offsets[n++] = MaxHeapTuplesPerPage / 2;
+			offsets[n++] = MaxHeapTuplesPerPage - 1;
+			break;
+		default:
+			for (OffsetNumber off = 1; off <= MaxHeapTuplesPerPage; off++)
+				if (off != blkno % 64 + 2 && off != MaxHeapTuplesPerPage / 2)
+					offsets[n++] = off;
 			break;
-		}
 	}
 
-	PG_RETURN_NULL();
+	return n;
 }
 
-Datum
-test_generate_tid(PG_FUNCTION_ARGS)
+/* Whether block blkno has dead tuples in rtbm_test_intersect_forms() */
+static bool
+intersect_forms_dirty(BlockNumber blkno)
 {
-	uint64 nitems = PG_GETARG_INT32(0);
-	BlockNumber minblk = PG_GETARG_INT32(1);
-	BlockNumber maxblk = PG_GETARG_INT32(2);
-	OffsetNumber maxoff = PG_GETARG_INT32(3);
-	ItemPointer itemptrs = palloc(sizeof(ItemPointer) * nitems);
-	StringInfoData buf;
+	/* a run of chunks, then chunks further and further apart */
+	return blkno < 128 ||
+		(blkno >= 320 && blkno < 384 && blkno % 3 == 0) ||
+		(blkno >= 3200 && blkno < 3232 && blkno % 7 == 0) ||
+		blkno == 32031;
+}
 
-	generate_random_itemptrs(nitems, minblk, maxblk, maxoff, itemptrs);
+/*
+ * Check the intersection of svtm and vtbm against their scalar lookup, and
+ * the scalar lookup against the dead tuples. The dead tuples start with a
+ * run of chunks, followed by chunks with gaps between them, so that
+ * svtm_chunk_rank() both finds the chunk of the TID and skips to a later
+ * one. The dirty pages cycle through all page forms, and are probed at
+ * every offset, but every third one at two offsets only, to take both the
+ * per-TID and the decoding paths of svtm_intersect_sorted().
+ */
+static void
+rtbm_test_intersect_forms(void)
+{
+	const BlockNumber nblocks = 32032;
+	SVTm *svtm = svtm_create();
+	VTbm *vtbm = vtbm_create();
+	ItemPointer dead_tuples;
+	ItemPointer index_tuples;
+	bool *expected;
+	int nitems_dead = 0;
+	int nitems_index = 0;
+	int maxitems = 0;
+
+	for (BlockNumber blk = 0; blk < nblocks; blk++)
+	{
+		if (intersect_forms_dirty(blk) || blk % 64 == 0 ||
+			(blk > 0 && intersect_forms_dirty(blk - 1)))
+			maxitems += MaxHeapTuplesPerPage;
+	}
 
-	initStringInfo(&buf);
-	for (int i = 0; i < nitems; i++)
+	dead_tuples = palloc(sizeof(ItemPointerData) * maxitems);
+	index_tuples = palloc(sizeof(ItemPointerData) * maxitems);
+	expected = palloc(sizeof(bool) * maxitems);
+
+	for (BlockNumber blk = 0; blk < nblocks; blk++)
 	{
-		appendStringInfo(&buf, "(%u %u) ",
-						 ItemPointerGetBlockNumber(&itemptrs[i]),
-						 ItemPointerGetOffsetNumber(&itemptrs[i]));
+		OffsetNumber offsets[MaxHeapTuplesPerPage];
+		bool dead[MaxHeapTuplesPerPage + 1] = {0};
+		int noffsets = 0;
+
+		if (intersect_forms_dirty(blk))
+		{
+			noffsets = intersect_forms_page(blk, offsets);
+			for (int i = 0; i < noffsets; i++)
+			{
+				ItemPointerSet(&(dead_tuples[nitems_dead++]), blk, offsets[i]);
+				dead[offsets[i]] = true;
+			}
+		}
+
+		if (noffsets > 0 && blk % 3 == 0)
+		{
+			ItemPointerSet(&(index_tuples[nitems_index]), blk, offsets[0]);
+			expected[nitems_index++] = true;
+			ItemPointerSet(&(index_tuples[nitems_index]), blk,
+						   MaxHeapTuplesPerPage);
+			expected[nitems_index++] = dead[MaxHeapTuplesPerPage];
+		}
+		else if (noffsets > 0 || blk % 64 == 0 ||
+				 (blk > 0 && intersect_forms_dirty(blk - 1)))
+		{
+			for (OffsetNumber off = 1; off <= MaxHeapTuplesPerPage; off++)
+			{
+				ItemPointerSet(&(index_tuples[nitems_index]), blk, off);
+				expected[nitems_index++] = dead[off];
+			}
+		}
 	}
-	elog(NOTICE, "%s", buf.data);
+	Assert(nitems_index <= maxitems);
 
-	PG_RETURN_NULL();
+	svtm_load(svtm, dead_tuples, nitems_dead, NULL);
+	load_vtbm(vtbm, dead_tuples, nitems_dead);
+
+	for (int i = 0; i < nitems_index; i += BENCH_BATCH_SIZE)
+	{
+		uint64 result_svtm[(BENCH_BATCH_SIZE + 63) / 64];
+		uint64 result_vtbm[(BENCH_BATCH_SIZE + 63) / 64];
+		int n = Min(nitems_index - i, BENCH_BATCH_SIZE);
+		int nmatched_svtm = 0;
+		int nmatched_vtbm = 0;
+		int nintersected_svtm;
+		int nintersected_vtbm;
+
+		CHECK_FOR_INTERRUPTS();
+
+		nintersected_svtm = svtm_intersect_sorted(svtm, &(index_tuples[i]), n,
+												  result_svtm);
+		nintersected_vtbm = vtbm_intersect_sorted(vtbm, &(index_tuples[i]), n,
+												  result_vtbm);
+
+		for (int j = 0; j < n; j++)
+		{
+			ItemPointer tid = &(index_tuples[i + j]);
+			bool ret1 = svtm_lookup(svtm, tid);
+			bool ret2 = (result_svtm[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+			bool ret3 = vtbm_lookup(vtbm, tid);
+			bool ret4 = (result_vtbm[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+
+			if (ret1 != expected[i + j] || ret3 != expected[i + j])
+				elog(ERROR, "failed (%u, %u) : expected %d svtm %d vtbm %d",
+					 ItemPointerGetBlockNumber(tid),
+					 ItemPointerGetOffsetNumber(tid),
+					 expected[i + j], ret1, ret3);
+
+			if (ret1 != ret2 || ret3 != ret4)
+				elog(ERROR, "failed (%u, %u) : svtm %d intersected svtm %d vtbm %d intersected vtbm %d",
+					 ItemPointerGetBlockNumber(tid),
+					 ItemPointerGetOffsetNumber(tid),
+					 ret1, ret2, ret3, ret4);
+
+			nmatched_svtm += ret1;
+			nmatched_vtbm += ret3;
+		}
+
+		if (nintersected_svtm != nmatched_svtm ||
+			nintersected_vtbm != nmatched_vtbm)
+			elog(ERROR, "svtm or vtbm intersection of %d index tuples at %d returned a wrong count",
+				 n, i);
+	}
+
+	svtm_free(svtm);
+	vtbm_free(vtbm);
+	pfree(dead_tuples);
+	pfree(index_tuples);
+	pfree(expected);
 }
 
 Datum
 rtbm_test(PG_FUNCTION_ARGS)
 {
 	RTbm *rtbm = rtbm_create();
+	RTbm *rtbm_copy;
+	char *serialized;
 	IntegerSet *intset = intset_create();
 	int matched_intset = 0, matched_rtbm = 0;
 	const int nitems_dead = 1000;
@@ -1538,16 +5451,22 @@ rtbm_test(PG_FUNCTION_ARGS)
 
 	for (int i = 0; i < nitems_dead; i++)
 		intset_add_member(intset, itemptr_encode(&dead_tuples[i]));
-	load_rtbm(rtbm, dead_tuples, nitems_dead);
+	load_rtbm(rtbm, dead_tuples, nitems_dead, NULL);
+
+	/* the serialized copy must give the same answers */
+	serialized = palloc(rtbm_serialized_size(rtbm));
+	rtbm_serialize(rtbm, serialized);
+	rtbm_copy = rtbm_deserialize(serialized);
 
 	for (int i = 0; i < nitems_index; i++)
 	{
-		bool ret1, ret2;
+		bool ret1, ret2, ret3;
 
 		CHECK_FOR_INTERRUPTS();
 
 		ret1 = intset_is_member(intset, itemptr_encode(&(index_tuples[i])));
 		ret2 = rtbm_lookup(rtbm, &(index_tuples[i]));
+		ret3 = rtbm_lookup(rtbm_copy, &(index_tuples[i]));
 
 		if (i % 10000000 == 0)
 			elog(NOTICE, "%d done", i);
@@ -1561,13 +5480,101 @@ rtbm_test(PG_FUNCTION_ARGS)
 				 ret1, ret2);
 		}
 
+		if (ret2 != ret3)
+			elog(ERROR, "failed (%d, %d) : rtbm %d serialized rtbm %d",
+				 ItemPointerGetBlockNumber(&(index_tuples[i])),
+				 ItemPointerGetOffsetNumber(&(index_tuples[i])),
+				 ret2, ret3);
+
 		if (ret1)
 			matched_intset++;
 		if (ret2)
 			matched_rtbm++;
 	}
 
+	/*
+	 * The pipelined lookup must give the same answers as well, and so must
+	 * the intersection of both, the index tuples being sorted.
+	 */
+	for (int i = 0; i < nitems_index; i += BENCH_BATCH_SIZE)
+	{
+		uint64 result[(BENCH_BATCH_SIZE + 63) / 64];
+		uint64 result_is[(BENCH_BATCH_SIZE + 63) / 64];
+		uint64 result_copy[(BENCH_BATCH_SIZE + 63) / 64];
+		int n = Min(nitems_index - i, BENCH_BATCH_SIZE);
+		int nmatched = 0;
+		int nintersected;
+
+		rtbm_lookup_batch_pipelined(rtbm, &(index_tuples[i]), n, result);
+		nintersected = rtbm_intersect_sorted(rtbm, &(index_tuples[i]), n,
+											 result_is);
+		rtbm_intersect_sorted(rtbm_copy, &(index_tuples[i]), n, result_copy);
+
+		for (int j = 0; j < n; j++)
+		{
+			bool ret1 = rtbm_lookup(rtbm, &(index_tuples[i + j]));
+			bool ret2 = (result[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+			bool ret3 = (result_is[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+			bool ret4 = (result_copy[j / 64] & (UINT64CONST(1) << (j % 64))) != 0;
+
+			if (ret1 != ret2)
+				elog(ERROR, "failed (%d, %d) : rtbm %d pipelined rtbm %d",
+					 ItemPointerGetBlockNumber(&(index_tuples[i + j])),
+					 ItemPointerGetOffsetNumber(&(index_tuples[i + j])),
+					 ret1, ret2);
+
+			if (ret1 != ret3 || ret1 != ret4)
+				elog(ERROR, "failed (%d, %d) : rtbm %d intersected rtbm %d serialized rtbm %d",
+					 ItemPointerGetBlockNumber(&(index_tuples[i + j])),
+					 ItemPointerGetOffsetNumber(&(index_tuples[i + j])),
+					 ret1, ret3, ret4);
+
+			nmatched += ret1;
+		}
+
+		if (nintersected != nmatched)
+			elog(ERROR, "rtbm intersection of %d index tuples at %d returned a wrong count",
+				 n, i);
+	}
+
+	/* and both must return the dead tuples in order when iterated over */
+	for (int i = 0; i < 2; i++)
+	{
+		RTbmIter *iter = rtbm_begin_iterate(i == 0 ? rtbm : rtbm_copy);
+		OffsetNumber offsets[MaxHeapTuplesPerPage];
+		BlockNumber blkno;
+		int noffsets;
+		int pos = 0;
+
+		while (rtbm_iterate_next(iter, &blkno, offsets, &noffsets))
+		{
+			for (int j = 0; j < noffsets; j++, pos++)
+			{
+				if (pos >= nitems_dead ||
+					ItemPointerGetBlockNumber(&(dead_tuples[pos])) != blkno ||
+					ItemPointerGetOffsetNumber(&(dead_tuples[pos])) != offsets[j])
+					elog(ERROR, "failed (%u, %u) : %s rtbm iteration returned unexpected TID",
+						 blkno, offsets[j], i == 0 ? "original" : "serialized");
+			}
+		}
+		rtbm_end_iterate(iter);
+
+		if (pos != nitems_dead)
+			elog(ERROR, "%s rtbm iteration returned %d TIDs, expected %d",
+				 i == 0 ? "original" : "serialized", pos, nitems_dead);
+	}
+
+	rtbm_test_merge(rtbm, dead_tuples, nitems_dead, index_tuples, nitems_index, 2);
+	rtbm_test_merge(rtbm, dead_tuples, nitems_dead, index_tuples, nitems_index, 5);
+	rtbm_test_merge_compact();
+
 	rtbm_dump(rtbm);
+	rtbm_free(rtbm_copy);
+	pfree(serialized);
+
+	rtbm_test_adaptive();
+	rtbm_test_intersect_forms();
+
 	elog(NOTICE, "matched intset %d rtbm %d",
 		 matched_intset,
 		 matched_rtbm);
@@ -1580,7 +5587,8 @@ radix_run_tests(PG_FUNCTION_ARGS)
 {
 	LVTestType *tree1;
 	LVTestType *tree2;
-	uint64 nmatched1 = 0, nmatched2 = 0;
+	LVTestType *tree3;
+	uint64 nmatched1 = 0, nmatched2 = 0, nmatched3 = 0;
 
 	DirectFunctionCall6(prepare,
 						Int64GetDatum(1000000),
@@ -1594,26 +5602,39 @@ radix_run_tests(PG_FUNCTION_ARGS)
 						CStringGetDatum(cstring_to_text("intset")));
 	DirectFunctionCall1(attach_dead_tuples,
 						CStringGetDatum(cstring_to_text("radix_tree")));
+	DirectFunctionCall1(attach_dead_tuples,
+						CStringGetDatum(cstring_to_text("radix_tree_block")));
 
-	tree1 = &(LVTestSubjects[2]);
-	tree2 = &(LVTestSubjects[7]);
+	tree1 = find_subject("intset");
+	tree2 = find_subject("radix_tree");
+	tree3 = find_subject("radix_tree_block");
 
 	elog(NOTICE, "tree1 name %s", tree1->name);
 	elog(NOTICE, "tree2 name %s", tree2->name);
 
 	for (int i = 0; i < IndexTids_cache->dtinfo.nitems; i++)
 	{
-		bool match1, match2;
+		bool match1, match2, match3;
 
 		CHECK_FOR_INTERRUPTS();
 
 		match1 = tree1->reaped_fn(tree1, &(IndexTids_cache->itemptrs[i]));
 		match2 = tree2->reaped_fn(tree2, &(IndexTids_cache->itemptrs[i]));
+		match3 = tree3->reaped_fn(tree3, &(IndexTids_cache->itemptrs[i]));
 
 		if (match1)
 			nmatched1++;
 		if (match2)
 			nmatched2++;
+		if (match3)
+			nmatched3++;
+
+		if (match1 != match3)
+			elog(NOTICE, "ERR: tid = (%u,%u) %s = %s %s = %s",
+				 ItemPointerGetBlockNumber(&(IndexTids_cache->itemptrs[i])),
+				 ItemPointerGetOffsetNumber(&(IndexTids_cache->itemptrs[i])),
+				 tree1->name, match1 ? "OK" : "NG",
+				 tree3->name, match3 ? "OK" : "NG");
 
 		if (match1 != match2)
 		{
@@ -1622,17 +5643,18 @@ radix_run_tests(PG_FUNCTION_ARGS)
 
 			key = radix_to_key_off(&(IndexTids_cache->itemptrs[i]), &dummy);
 
-			elog(NOTICE, "ERR: tid = (%u,%u) key = %lX intset = %s radix = %s",
+			elog(NOTICE, "ERR: tid = (%u,%u) key = %lX %s = %s %s = %s",
 				 ItemPointerGetBlockNumber(&(IndexTids_cache->itemptrs[i])),
 				 ItemPointerGetOffsetNumber(&(IndexTids_cache->itemptrs[i])),
 				 key,
-				 match1 ? "OK" : "NG",
-				 match2 ? "OK" : "NG");
+				 tree1->name, match1 ? "OK" : "NG",
+				 tree2->name, match2 ? "OK" : "NG");
 		}
 	}
 
-	elog(NOTICE, "RES: bfm matched = %lu radix matched = %lu",
-		 nmatched1, nmatched2);
+	elog(NOTICE, "RES: %s matched = %lu %s matched = %lu %s matched = %lu",
+		 tree1->name, nmatched1, tree2->name, nmatched2,
+		 tree3->name, nmatched3);
 
 	ItemPointerData item;
 	uint64 ikey;
@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------
+ *
+ * bdbench_stats.h
+ *	  counters of the branches the lookups of the TID stores take
+ *
+ * The counters are incremented only while bdbench.stats is on, and are
+ * shown by bdbench_stats(). Building with BDBENCH_NO_STATS compiles them
+ * out of the lookup paths altogether.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef BDBENCH_STATS_H
+#define BDBENCH_STATS_H
+
+/*
+ * The counters of a structure. The per-level counters, if any, are for the
+ * trees and are counted for each level from the root separately.
+ */
+typedef struct BdbenchStatsSet
+{
+	const char *structure;
+
+	const char *const *names;
+	int			ncounters;
+	uint64	   *counters;
+
+	const char *const *level_names;
+	int			nlevel_counters;
+	int			nlevels;
+	uint64	   *level_counters;	/* [level * nlevel_counters + id] */
+} BdbenchStatsSet;
+
+extern bool bdbench_stats_enabled;
+
+extern BdbenchStatsSet rtbm_lookup_stats;
+extern BdbenchStatsSet svtm_lookup_stats;
+extern BdbenchStatsSet bfm_lookup_stats;
+
+#ifndef BDBENCH_NO_STATS
+#define BDBENCH_STATS_ADD(counters, id, n) \
+	do { \
+		if (unlikely(bdbench_stats_enabled)) \
+			(counters)[(id)] += (n); \
+	} while (0)
+#else
+#define BDBENCH_STATS_ADD(counters, id, n) ((void) 0)
+#endif
+
+#define BDBENCH_STATS_INC(counters, id) BDBENCH_STATS_ADD(counters, id, 1)
+
+#endif
@@ -38,13 +38,13 @@ select 'radix_tree', attach_dead_tuples('radix_tree');
 
 -- Do benchmark of lazy_tid_reaped.
 --select 'array bench', bench('array');
-select 'intset bench', bench('intset');
-select 'rtbm bench', bench('rtbm');
-select 'tbm bench', bench('tbm');
+select * from bench('intset');
+select * from bench('rtbm');
+select * from bench('tbm');
 --select 'vtbm bench', bench('vtbm');
-select 'radix', bench('radix');
+select * from bench('radix');
 --select 'svtm', bench('svtm');
-select 'radix_tree', bench('radix_tree');
+select * from bench('radix_tree');
 
 
 -- Check the memory usage.
@@ -10,6 +10,8 @@
 #include "port/pg_bitutils.h"
 #include "utils/memutils.h"
 
+#include "bdbench_stats.h"
+
 
 /*
  * How many bits are encoded in one tree level.
@@ -26,6 +28,74 @@
 
 #define BFM_MASK			((1 << BFM_FANOUT) - 1)
 
+/* The number of levels of a tree of 64-bit keys */
+#define BFM_STATS_LEVELS		(64 / BFM_FANOUT)
+
+/* The branches of the lookups counted for bdbench_stats() */
+typedef enum bfm_lookup_stat
+{
+	BFM_STAT_WALKS,
+	BFM_STAT_OUT_OF_RANGE,		/* empty tree or key above maxval */
+	BFM_STAT_NO_SLOT,			/* no child for the chunk in an inner node */
+	BFM_STAT_LEAF_MISS,			/* no value for the chunk in the leaf */
+	BFM_STAT_BATCH_LEAF_REUSE,	/* bfm_lookup_batch() searched the last leaf */
+	BFM_STAT_BATCH_ABSENT_REUSE,	/* bfm_lookup_batch() knew it's absent */
+	BFM_STAT_FOUND,
+	BFM_STAT_BYTES,				/* chunk and slot bytes read */
+	BFM_NUM_STATS
+} bfm_lookup_stat;
+
+/* Per level, the kinds of the nodes visited and the walks stopped there */
+#define BFM_LEVEL_STAT_STOPPED	BFM_KIND_COUNT
+#define BFM_NUM_LEVEL_STATS		(BFM_KIND_COUNT + 1)
+
+static const char *const bfm_stat_names[BFM_NUM_STATS] = {
+	"walks",
+	"out_of_range",
+	"no_slot",
+	"leaf_miss",
+	"batch_leaf_reuse",
+	"batch_absent_reuse",
+	"found",
+	"bytes"
+};
+
+static const char *const bfm_level_stat_names[BFM_NUM_LEVEL_STATS] = {
+	"node_1",
+	"node_4",
+	"node_16",
+	"node_32",
+	"node_128",
+	"node_max",
+	"stopped"
+};
+
+static uint64 bfm_stat_counters[BFM_NUM_STATS];
+static uint64 bfm_level_stat_counters[BFM_STATS_LEVELS * BFM_NUM_LEVEL_STATS];
+
+BdbenchStatsSet bfm_lookup_stats = {
+	"radix",
+	bfm_stat_names, BFM_NUM_STATS, bfm_stat_counters,
+	bfm_level_stat_names, BFM_NUM_LEVEL_STATS, BFM_STATS_LEVELS,
+	bfm_level_stat_counters
+};
+
+/* the chunk bytes searching a node of each kind reads */
+static const uint8 bfm_search_bytes[BFM_KIND_COUNT] = {1, 4, 16, 32, 1, 0};
+
+#define BFM_LOOKUP_STATS_INC(id) BDBENCH_STATS_INC(bfm_stat_counters, id)
+#define BFM_LOOKUP_STATS_ADD(id, n) BDBENCH_STATS_ADD(bfm_stat_counters, id, n)
+#define BFM_LEVEL_STATS_INC(level, id) \
+	BDBENCH_STATS_INC(bfm_level_stat_counters, (level) * BFM_NUM_LEVEL_STATS + (id))
+
+/* Count the visit of node at the given level */
+#define BFM_LOOKUP_STATS_VISIT(level, node) \
+	do { \
+		BFM_LEVEL_STATS_INC(level, (node)->kind); \
+		BFM_LOOKUP_STATS_ADD(BFM_STAT_BYTES, \
+							 bfm_search_bytes[(node)->kind] + sizeof(void *)); \
+	} while (0)
+
 
 /*
  * Base type for all node types.
@@ -263,12 +333,40 @@ const bfm_tree_size_class_info leaf_class_info[] =
 	[BFM_KIND_MAX] = {"max", BFM_MAX_CLASS, sizeof(bfm_tree_node_leaf_max)},
 };
 
+/*
+ * With BFM_USE_ARENA, nodes are carved one after another from blocks of this
+ * size, without the chunk header of a slab. Freed nodes, which are the ones
+ * replaced by a larger size class, are kept in a free list per size class for
+ * reuse, and the blocks are only released along with root->context.
+ */
+#define BFM_ARENA_BLOCK_SIZE (1024 * 1024)
+
 static void *
 bfm_alloc_node(bfm_tree *root, bool inner, bfm_tree_node_kind kind, size_t size)
 {
 	bfm_tree_node *node;
 
-#ifdef BFM_USE_SLAB
+#ifdef BFM_USE_ARENA
+	void	  **freelist = inner ? &root->inner_free[kind] : &root->leaf_free[kind];
+
+	size = MAXALIGN(size);
+	if (*freelist != NULL)
+	{
+		node = (bfm_tree_node *) *freelist;
+		*freelist = *((void **) node);
+	}
+	else
+	{
+		if (root->arena_end - root->arena_ptr < size)
+		{
+			root->arena_ptr = MemoryContextAlloc(root->context, BFM_ARENA_BLOCK_SIZE);
+			root->arena_end = root->arena_ptr + BFM_ARENA_BLOCK_SIZE;
+		}
+
+		node = (bfm_tree_node *) root->arena_ptr;
+		root->arena_ptr += size;
+	}
+#elif defined(BFM_USE_SLAB)
 	if (inner)
 		node = (bfm_tree_node *) MemoryContextAlloc(root->inner_slabs[kind], size);
 	else
@@ -439,9 +537,14 @@ bfm_alloc_leaf_max(bfm_tree *root)
 }
 
 static void
-bfm_free_internal(bfm_tree *root, void *p)
+bfm_free_internal(bfm_tree *root, bool inner, bfm_tree_node_kind kind, void *p)
 {
-#if defined(BFM_USE_OS)
+#if defined(BFM_USE_ARENA)
+	void	  **freelist = inner ? &root->inner_free[kind] : &root->leaf_free[kind];
+
+	*((void **) p) = *freelist;
+	*freelist = p;
+#elif defined(BFM_USE_OS)
 	free(p);
 #else
 	pfree(p);
@@ -457,7 +560,7 @@ bfm_free_inner(bfm_tree *root, bfm_tree_node_inner *node)
 	root->inner_nodes[node->b.kind]--;
 #endif
 
-	bfm_free_internal(root, node);
+	bfm_free_internal(root, true, node->b.kind, node);
 }
 
 static void
@@ -469,7 +572,7 @@ bfm_free_leaf(bfm_tree *root, bfm_tree_node_leaf *node)
 	root->leaf_nodes[node->b.kind]--;
 #endif
 
-	bfm_free_internal(root, node);
+	bfm_free_internal(root, false, node->b.kind, node);
 }
 
 #define BFM_LEAF_MAX_SET_OFFSET(i) (i / (sizeof(uint8) * BITS_PER_BYTE))
@@ -974,12 +1077,17 @@ bfm_walk(bfm_tree *root, bfm_tree_node **nodep, bfm_value_type *valp, uint64_t k
 	bfm_tree_node *cur;
 	uint8 chunk;
 	uint32 shift;
+	int level pg_attribute_unused() = 0;
+	bool found;
 
 	rnode = root->rnode;
 
+	BFM_LOOKUP_STATS_INC(BFM_STAT_WALKS);
+
 	/* can't be contained in the tree */
 	if (!rnode || key > root->maxval)
 	{
+		BFM_LOOKUP_STATS_INC(BFM_STAT_OUT_OF_RANGE);
 		*nodep = NULL;
 		return false;
 	}
@@ -998,10 +1106,13 @@ bfm_walk(bfm_tree *root, bfm_tree_node **nodep, bfm_value_type *valp, uint64_t k
 
 		cur_inner = (bfm_tree_node_inner *) cur;
 
+		BFM_LOOKUP_STATS_VISIT(level, cur);
 		slot = bfm_find_one_level_inner(cur_inner, chunk);
 
 		if (slot == NULL)
 		{
+			BFM_LOOKUP_STATS_INC(BFM_STAT_NO_SLOT);
+			BFM_LEVEL_STATS_INC(level, BFM_LEVEL_STAT_STOPPED);
 			*nodep = cur;
 			return false;
 		}
@@ -1012,13 +1123,19 @@ bfm_walk(bfm_tree *root, bfm_tree_node **nodep, bfm_value_type *valp, uint64_t k
 		cur = slot;
 		shift -= BFM_FANOUT;
 		chunk = (key >> shift) & BFM_MASK;
+		level++;
 	}
 
 	Assert(cur->node_shift == shift && shift == 0);
 
 	*nodep = cur;
 
-	return bfm_find_one_level_leaf((bfm_tree_node_leaf*) cur, chunk, valp);
+	BFM_LOOKUP_STATS_VISIT(level, cur);
+	BFM_LEVEL_STATS_INC(level, BFM_LEVEL_STAT_STOPPED);
+	found = bfm_find_one_level_leaf((bfm_tree_node_leaf*) cur, chunk, valp);
+	BFM_LOOKUP_STATS_INC(found ? BFM_STAT_FOUND : BFM_STAT_LEAF_MISS);
+
+	return found;
 }
 
 /*
@@ -2258,6 +2375,64 @@ bfm_lookup(bfm_tree *root, uint64_t key, bfm_value_type *val)
 	return bfm_walk(root, &node, val, key);
 }
 
+/*
+ * Look up nkeys keys at once, storing the value of keys[i] into vals[i] and
+ * whether it was found into found[i].
+ *
+ * The node at which the previous walk ended is remembered. If the next key
+ * falls into the same leaf, only that leaf is searched, and if the previous
+ * walk stopped at an inner node lacking the key's chunk, keys sharing that
+ * chunk are known to be absent without walking the tree again. Keys built
+ * from TIDs of the same heap page typically share their leaf.
+ */
+void
+bfm_lookup_batch(bfm_tree *root, const bfm_key_type *keys, int nkeys,
+				 bfm_value_type *vals, bool *found)
+{
+	bfm_tree_node *last = NULL;
+	uint32 last_shift = 0;
+	bfm_key_type last_prefix = 0;
+
+	for (int i = 0; i < nkeys; i++)
+	{
+		bfm_key_type key = keys[i];
+		bfm_tree_node *node;
+
+		if (last != NULL && (key >> last_shift) == last_prefix)
+		{
+			if (last->node_shift == 0)
+			{
+				BFM_LOOKUP_STATS_INC(BFM_STAT_BATCH_LEAF_REUSE);
+				BFM_LOOKUP_STATS_ADD(BFM_STAT_BYTES,
+									 bfm_search_bytes[last->kind] + sizeof(void *));
+				found[i] = bfm_find_one_level_leaf((bfm_tree_node_leaf *) last,
+												   key & BFM_MASK, &vals[i]);
+				BFM_LOOKUP_STATS_INC(found[i] ? BFM_STAT_FOUND : BFM_STAT_LEAF_MISS);
+			}
+			else
+			{
+				BFM_LOOKUP_STATS_INC(BFM_STAT_BATCH_ABSENT_REUSE);
+				found[i] = false;
+			}
+			continue;
+		}
+
+		found[i] = bfm_walk(root, &node, &vals[i], key);
+
+		last = node;
+		if (node != NULL)
+		{
+			/*
+			 * A leaf covers all keys sharing the bits above its chunk, while
+			 * a missing slot in an inner node covers all keys sharing the
+			 * bits down to the node's chunk.
+			 */
+			last_shift = node->node_shift == 0 ? BFM_FANOUT : node->node_shift;
+			last_prefix = key >> last_shift;
+		}
+	}
+}
+
 /*
  * Set key to val. Returns false if entry doesn't yet exist, true if it did.
  */
@@ -2312,6 +2487,256 @@ bfm_set(bfm_tree *root, bfm_key_type key, bfm_value_type val)
 	return bfm_set_leaf(root, key, val, target, chunk);
 }
 
+/*
+ * Return the smallest size class that fits count entries.
+ */
+static bfm_tree_node_kind
+bfm_kind_for_count(int count)
+{
+	for (int kind = BFM_KIND_1; kind < BFM_KIND_MAX; kind++)
+	{
+		if (count <= inner_class_info[kind].elements)
+			return kind;
+	}
+
+	return BFM_KIND_MAX;
+}
+
+/*
+ * Build the node at shift for the sorted keys, which all have the same key
+ * bits above shift, after building its children. The node is allocated in its
+ * final size class, whereas bfm_set() starts every node in the smallest class
+ * and grows it, one class at a time, as entries are added.
+ */
+static bfm_tree_node *
+bfm_build_node(bfm_tree *root, const bfm_key_type *keys,
+			   const bfm_value_type *vals, int nkeys, uint32 shift)
+{
+	bfm_tree_node *node;
+	bfm_tree_node_kind kind;
+	uint8 chunks[BFM_MAX_CLASS];
+	bfm_tree_node *slots[BFM_MAX_CLASS];
+	bfm_value_type values[BFM_MAX_CLASS];
+	int count = 0;
+
+	for (int start = 0, end; start < nkeys; start = end)
+	{
+		uint8 chunk = (keys[start] >> shift) & BFM_MASK;
+
+		for (end = start + 1; end < nkeys; end++)
+		{
+			if (((keys[end] >> shift) & BFM_MASK) != chunk)
+				break;
+		}
+
+		chunks[count] = chunk;
+		if (shift == 0)
+		{
+			Assert(end - start == 1);
+			values[count] = vals[start];
+		}
+		else
+			slots[count] = bfm_build_node(root, &keys[start], &vals[start],
+										  end - start, shift - BFM_FANOUT);
+		count++;
+	}
+
+	kind = bfm_kind_for_count(count);
+
+	if (shift > 0)
+	{
+		bfm_tree_node_inner *inner;
+
+		switch (kind)
+		{
+			case BFM_KIND_1:
+				{
+					bfm_tree_node_inner_1 *node_1 = bfm_alloc_inner_1(root);
+
+					node_1->chunk = chunks[0];
+					node_1->slot = slots[0];
+					inner = &node_1->b;
+					break;
+				}
+			case BFM_KIND_4:
+				{
+					bfm_tree_node_inner_4 *node_4 = bfm_alloc_inner_4(root);
+
+					memcpy(node_4->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_4->slots, slots, sizeof(slots[0]) * count);
+					inner = &node_4->b;
+					break;
+				}
+			case BFM_KIND_16:
+				{
+					bfm_tree_node_inner_16 *node_16 = bfm_alloc_inner_16(root);
+
+					memcpy(node_16->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_16->slots, slots, sizeof(slots[0]) * count);
+					inner = &node_16->b;
+					break;
+				}
+			case BFM_KIND_32:
+				{
+					bfm_tree_node_inner_32 *node_32 = bfm_alloc_inner_32(root);
+
+					memcpy(node_32->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_32->slots, slots, sizeof(slots[0]) * count);
+					inner = &node_32->b;
+					break;
+				}
+			case BFM_KIND_128:
+				{
+					bfm_tree_node_inner_128 *node_128 = bfm_alloc_inner_128(root);
+
+					for (int i = 0; i < count; i++)
+						node_128->offsets[chunks[i]] = i;
+					memcpy(node_128->slots, slots, sizeof(slots[0]) * count);
+					inner = &node_128->b;
+					break;
+				}
+			case BFM_KIND_MAX:
+			default:
+				{
+					bfm_tree_node_inner_max *node_max = bfm_alloc_inner_max(root);
+
+					for (int i = 0; i < count; i++)
+						node_max->slots[chunks[i]] = slots[i];
+					inner = &node_max->b;
+					break;
+				}
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			slots[i]->parent = inner;
+			slots[i]->node_chunk = chunks[i];
+		}
+
+		node = &inner->b;
+	}
+	else
+	{
+		switch (kind)
+		{
+			case BFM_KIND_1:
+				{
+					bfm_tree_node_leaf_1 *node_1 = bfm_alloc_leaf_1(root);
+
+					node_1->chunk = chunks[0];
+					node_1->value = values[0];
+					node = &node_1->b.b;
+					break;
+				}
+			case BFM_KIND_4:
+				{
+					bfm_tree_node_leaf_4 *node_4 = bfm_alloc_leaf_4(root);
+
+					memcpy(node_4->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_4->values, values, sizeof(values[0]) * count);
+					node = &node_4->b.b;
+					break;
+				}
+			case BFM_KIND_16:
+				{
+					bfm_tree_node_leaf_16 *node_16 = bfm_alloc_leaf_16(root);
+
+					memcpy(node_16->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_16->values, values, sizeof(values[0]) * count);
+					node = &node_16->b.b;
+					break;
+				}
+			case BFM_KIND_32:
+				{
+					bfm_tree_node_leaf_32 *node_32 = bfm_alloc_leaf_32(root);
+
+					memcpy(node_32->chunks, chunks, sizeof(chunks[0]) * count);
+					memcpy(node_32->values, values, sizeof(values[0]) * count);
+					node = &node_32->b.b;
+					break;
+				}
+			case BFM_KIND_128:
+				{
+					bfm_tree_node_leaf_128 *node_128 = bfm_alloc_leaf_128(root);
+
+					for (int i = 0; i < count; i++)
+						node_128->offsets[chunks[i]] = i;
+					memcpy(node_128->values, values, sizeof(values[0]) * count);
+					node = &node_128->b.b;
+					break;
+				}
+			case BFM_KIND_MAX:
+			default:
+				{
+					bfm_tree_node_leaf_max *node_max = bfm_alloc_leaf_max(root);
+
+					for (int i = 0; i < count; i++)
+					{
+						bfm_leaf_max_set(node_max, chunks[i]);
+						node_max->values[chunks[i]] = values[i];
+					}
+					node = &node_max->b.b;
+					break;
+				}
+		}
+	}
+
+	node->node_shift = shift;
+	node->count = count;
+
+#ifdef BFM_STATS
+	/* bfm_set() would have allocated and freed every smaller class */
+	for (int k = BFM_KIND_1; k < kind; k++)
+	{
+		root->build_skipped_nodes++;
+		root->build_skipped_bytes += (shift > 0) ?
+			inner_class_info[k].size : leaf_class_info[k].size;
+	}
+#endif
+
+	return node;
+}
+
+/*
+ * Load the keys, which must be in strictly ascending order, with their values
+ * to the empty tree. The tree is built bottom-up with each node in its final
+ * size class, so unlike calling bfm_set() for each key, no node is grown and
+ * copied and the tree isn't descended from the root for every key.
+ */
+void
+bfm_build_sorted(bfm_tree *root, const bfm_key_type *keys,
+				 const bfm_value_type *vals, int nkeys)
+{
+	uint32 shift;
+
+	if (root->rnode != NULL)
+		elog(ERROR, "radix tree must be empty to be built from sorted keys");
+
+	for (int i = 1; i < nkeys; i++)
+	{
+		if (keys[i] <= keys[i - 1])
+			elog(ERROR, "keys are not in strictly ascending order at %d", i);
+	}
+
+	if (nkeys == 0)
+		return;
+
+	/* the largest key determines the height, as in bfm_set_empty() */
+	if (keys[nkeys - 1] == 0)
+		shift = 0;
+	else
+		shift = (pg_leftmost_one_pos64(keys[nkeys - 1]) / BFM_FANOUT) * BFM_FANOUT;
+
+	root->rnode = bfm_build_node(root, keys, vals, nkeys, shift);
+	root->rnode->node_chunk = 0;
+	root->rnode->parent = NULL;
+	root->maxval = bfm_maxval_shift(shift);
+
+#ifdef BFM_STATS
+	root->entries += nkeys;
+#endif
+}
+
 bool
 bfm_delete(bfm_tree *root, uint64 key)
 {
@@ -2329,6 +2754,301 @@ bfm_delete(bfm_tree *root, uint64 key)
 	return true;
 }
 
+/*
+ * Iteration over all keys in ascending order.
+ *
+ * We walk the tree depth-first with an explicit stack, remembering for each
+ * node on the stack the position of the next child or value to visit and the
+ * key bits the node represents. Chunk arrays are kept sorted, and the 128 and
+ * max classes are visited in chunk order, so the keys come out sorted.
+ *
+ * The tree must not be modified during iteration.
+ */
+#define BFM_MAX_LEVELS	((sizeof(bfm_key_type) * BITS_PER_BYTE) / BFM_FANOUT + 1)
+
+typedef struct bfm_iter_level
+{
+	bfm_tree_node *node;
+	int pos;			/* index into the chunk array, or chunk */
+	bfm_key_type key;	/* key bits above the node's chunk */
+} bfm_iter_level;
+
+struct bfm_iter
+{
+	int depth;
+	bfm_iter_level stack[BFM_MAX_LEVELS];
+};
+
+bfm_iter *
+bfm_begin_iterate(bfm_tree *root)
+{
+	bfm_iter *iter = palloc0(sizeof(bfm_iter));
+
+	if (root->rnode)
+	{
+		iter->stack[0].node = root->rnode;
+		iter->depth = 1;
+	}
+
+	return iter;
+}
+
+/*
+ * Return the child of the inner node at or after *pos, advancing *pos past
+ * it, or NULL if there are no more children.
+ */
+static bfm_tree_node *
+bfm_iter_next_child(bfm_tree_node_inner *node, int *pos, uint8 *chunk)
+{
+	switch((bfm_tree_node_kind) node->b.kind)
+	{
+		case BFM_KIND_1:
+			{
+				bfm_tree_node_inner_1 *node_1 =
+					(bfm_tree_node_inner_1 *) node;
+
+				if (*pos >= node_1->b.b.count)
+					return NULL;
+
+				(*pos)++;
+				*chunk = node_1->chunk;
+				return node_1->slot;
+			}
+
+		case BFM_KIND_4:
+			{
+				bfm_tree_node_inner_4 *node_4 =
+					(bfm_tree_node_inner_4 *) node;
+
+				if (*pos >= node_4->b.b.count)
+					return NULL;
+
+				*chunk = node_4->chunks[*pos];
+				return node_4->slots[(*pos)++];
+			}
+
+		case BFM_KIND_16:
+			{
+				bfm_tree_node_inner_16 *node_16 =
+					(bfm_tree_node_inner_16 *) node;
+
+				if (*pos >= node_16->b.b.count)
+					return NULL;
+
+				*chunk = node_16->chunks[*pos];
+				return node_16->slots[(*pos)++];
+			}
+
+		case BFM_KIND_32:
+			{
+				bfm_tree_node_inner_32 *node_32 =
+					(bfm_tree_node_inner_32 *) node;
+
+				if (*pos >= node_32->b.b.count)
+					return NULL;
+
+				*chunk = node_32->chunks[*pos];
+				return node_32->slots[(*pos)++];
+			}
+
+		case BFM_KIND_128:
+			{
+				bfm_tree_node_inner_128 *node_128 =
+					(bfm_tree_node_inner_128 *) node;
+
+				for (; *pos < BFM_MAX_CLASS; (*pos)++)
+				{
+					uint8 offset = node_128->offsets[*pos];
+
+					if (offset == BFM_TREE_NODE_128_INVALID)
+						continue;
+
+					*chunk = (*pos)++;
+					return node_128->slots[offset];
+				}
+
+				return NULL;
+			}
+
+		case BFM_KIND_MAX:
+			{
+				bfm_tree_node_inner_max *node_max =
+					(bfm_tree_node_inner_max *) node;
+
+				for (; *pos < BFM_MAX_CLASS; (*pos)++)
+				{
+					if (node_max->slots[*pos] == NULL)
+						continue;
+
+					*chunk = *pos;
+					return node_max->slots[(*pos)++];
+				}
+
+				return NULL;
+			}
+	}
+
+	pg_unreachable();
+}
+
+/*
+ * Like bfm_iter_next_child(), for the values of a leaf node. Returns false if
+ * there are no more values.
+ */
+static bool
+bfm_iter_next_value(bfm_tree_node_leaf *node, int *pos, uint8 *chunk,
+					bfm_value_type *val)
+{
+	switch((bfm_tree_node_kind) node->b.kind)
+	{
+		case BFM_KIND_1:
+			{
+				bfm_tree_node_leaf_1 *node_1 =
+					(bfm_tree_node_leaf_1 *) node;
+
+				if (*pos >= node_1->b.b.count)
+					return false;
+
+				(*pos)++;
+				*chunk = node_1->chunk;
+				*val = node_1->value;
+				return true;
+			}
+
+		case BFM_KIND_4:
+			{
+				bfm_tree_node_leaf_4 *node_4 =
+					(bfm_tree_node_leaf_4 *) node;
+
+				if (*pos >= node_4->b.b.count)
+					return false;
+
+				*chunk = node_4->chunks[*pos];
+				*val = node_4->values[(*pos)++];
+				return true;
+			}
+
+		case BFM_KIND_16:
+			{
+				bfm_tree_node_leaf_16 *node_16 =
+					(bfm_tree_node_leaf_16 *) node;
+
+				if (*pos >= node_16->b.b.count)
+					return false;
+
+				*chunk = node_16->chunks[*pos];
+				*val = node_16->values[(*pos)++];
+				return true;
+			}
+
+		case BFM_KIND_32:
+			{
+				bfm_tree_node_leaf_32 *node_32 =
+					(bfm_tree_node_leaf_32 *) node;
+
+				if (*pos >= node_32->b.b.count)
+					return false;
+
+				*chunk = node_32->chunks[*pos];
+				*val = node_32->values[(*pos)++];
+				return true;
+			}
+
+		case BFM_KIND_128:
+			{
+				bfm_tree_node_leaf_128 *node_128 =
+					(bfm_tree_node_leaf_128 *) node;
+
+				for (; *pos < BFM_MAX_CLASS; (*pos)++)
+				{
+					uint8 offset = node_128->offsets[*pos];
+
+					if (offset == BFM_TREE_NODE_128_INVALID)
+						continue;
+
+					*chunk = (*pos)++;
+					*val = node_128->values[offset];
+					return true;
+				}
+
+				return false;
+			}
+
+		case BFM_KIND_MAX:
+			{
+				bfm_tree_node_leaf_max *node_max =
+					(bfm_tree_node_leaf_max *) node;
+
+				for (; *pos < BFM_MAX_CLASS; (*pos)++)
+				{
+					if (!bfm_leaf_max_isset(node_max, *pos))
+						continue;
+
+					*chunk = *pos;
+					*val = node_max->values[(*pos)++];
+					return true;
+				}
+
+				return false;
+			}
+	}
+
+	pg_unreachable();
+}
+
+/*
+ * Return the next key and its value. Returns false if there are no more
+ * keys.
+ */
+bool
+bfm_iterate_next(bfm_iter *iter, bfm_key_type *key, bfm_value_type *val)
+{
+	while (iter->depth > 0)
+	{
+		bfm_iter_level *level = &iter->stack[iter->depth - 1];
+		bfm_tree_node *node = level->node;
+		uint8 chunk;
+
+		if (node->node_shift == 0)
+		{
+			if (bfm_iter_next_value((bfm_tree_node_leaf *) node, &level->pos,
+									&chunk, val))
+			{
+				*key = level->key | chunk;
+				return true;
+			}
+		}
+		else
+		{
+			bfm_tree_node *child;
+
+			child = bfm_iter_next_child((bfm_tree_node_inner *) node,
+										&level->pos, &chunk);
+			if (child != NULL)
+			{
+				bfm_iter_level *next = &iter->stack[iter->depth++];
+
+				Assert(iter->depth <= BFM_MAX_LEVELS);
+				next->node = child;
+				next->pos = 0;
+				next->key = level->key | ((bfm_key_type) chunk << node->node_shift);
+				continue;
+			}
+		}
+
+		/* no more children or values in this node */
+		iter->depth--;
+	}
+
+	return false;
+}
+
+void
+bfm_end_iterate(bfm_iter *iter)
+{
+	pfree(iter);
+}
+
 
 StringInfo
 bfm_stats(bfm_tree *root)
@@ -2392,6 +3112,10 @@ bfm_stats(bfm_tree *root)
 	appendStringInfo(s, "\t%.2f bytes/entry including allocator overhead\n",
 					 root->entries > 0 ?
 					 allocator_bytes/(double)root->entries : 0);
+	if (root->build_skipped_nodes > 0)
+		appendStringInfo(s, "\tbulk build skipped %zu smaller nodes, %.2f MB\n",
+						 root->build_skipped_nodes,
+						 root->build_skipped_bytes / (double) (1024 * 1024));
 #endif
 
 	if (0)
@@ -2850,6 +3574,130 @@ bfm_test_delete_lots(void)
 	EXPECT_TRUE(root.rnode == NULL);
 }
 
+/*
+ * Check that a tree built from sorted keys has the same shape as the one
+ * built by inserting the keys one by one, and the same contents.
+ */
+static void
+bfm_test_build_sorted(void)
+{
+	bfm_tree root;
+	bfm_tree inserted;
+	bfm_value_type val;
+	bfm_key_type *keys;
+	bfm_value_type *vals;
+	bfm_key_type key = 0;
+	int nkeys = 100000;
+
+	keys = palloc(sizeof(bfm_key_type) * nkeys);
+	vals = palloc(sizeof(bfm_value_type) * nkeys);
+
+	/* node sizes of all classes, from dense and sparse stretches */
+	for (int i = 0; i < nkeys; i++)
+	{
+		keys[i] = key;
+		vals[i] = -key;
+
+		key += 1 + (i % 7919) % 300;
+		if (i % 10000 == 9999)
+			key += UINT64CONST(1) << 40;
+	}
+
+	bfm_init(&root);
+	bfm_init(&inserted);
+
+	bfm_build_sorted(&root, keys, vals, nkeys);
+	for (int i = 0; i < nkeys; i++)
+		EXPECT_FALSE(bfm_set(&inserted, keys[i], vals[i]));
+
+#ifdef BFM_STATS
+	EXPECT_EQ_U32(root.entries, inserted.entries);
+	for (int i = 0; i < BFM_KIND_COUNT; i++)
+	{
+		EXPECT_EQ_U32(root.inner_nodes[i], inserted.inner_nodes[i]);
+		EXPECT_EQ_U32(root.leaf_nodes[i], inserted.leaf_nodes[i]);
+	}
+#endif
+	EXPECT_EQ_U32(root.rnode->node_shift, inserted.rnode->node_shift);
+
+	for (int i = 0; i < nkeys; i++)
+	{
+		EXPECT_TRUE(bfm_lookup(&root, keys[i], &val));
+		EXPECT_EQ_U32(val, vals[i]);
+
+		if (i + 1 < nkeys && keys[i] + 1 < keys[i + 1])
+			EXPECT_FALSE(bfm_lookup(&root, keys[i] + 1, &val));
+	}
+
+	/* the built tree can be modified as usual */
+	EXPECT_TRUE(bfm_delete(&root, keys[0]));
+	EXPECT_FALSE(bfm_lookup(&root, keys[0], &val));
+	EXPECT_FALSE(bfm_set(&root, keys[0], 1));
+	EXPECT_TRUE(bfm_lookup(&root, keys[0], &val));
+	EXPECT_EQ_U32(val, 1);
+
+	pfree(keys);
+	pfree(vals);
+}
+
+/*
+ * Check that iteration returns all keys in ascending order with their
+ * values, after inserting them out of order and deleting some.
+ */
+static void
+bfm_test_iterate(void)
+{
+	bfm_tree root;
+	bfm_iter *iter;
+	bfm_key_type *keys;
+	bfm_key_type key = 0;
+	bfm_value_type val;
+	int nkeys = 100000;
+	int nfound = 0;
+
+	keys = palloc(sizeof(bfm_key_type) * nkeys);
+
+	for (int i = 0; i < nkeys; i++)
+	{
+		keys[i] = key;
+
+		key += 1 + (i % 7919) % 300;
+		if (i % 10000 == 9999)
+			key += UINT64CONST(1) << 40;
+	}
+
+	bfm_init(&root);
+
+	/* an empty tree has no keys */
+	iter = bfm_begin_iterate(&root);
+	EXPECT_FALSE(bfm_iterate_next(iter, &key, &val));
+	bfm_end_iterate(iter);
+
+	for (int i = nkeys - 1; i >= 0; i--)
+		EXPECT_FALSE(bfm_set(&root, keys[i], -keys[i]));
+	for (int i = 0; i < nkeys; i += 3)
+		EXPECT_TRUE(bfm_delete(&root, keys[i]));
+
+	iter = bfm_begin_iterate(&root);
+	for (int i = 0; i < nkeys; i++)
+	{
+		if (i % 3 == 0)
+			continue;
+
+		EXPECT_TRUE(bfm_iterate_next(iter, &key, &val));
+		if (key != keys[i] || val != -keys[i])
+			elog(ERROR, "iteration returned key " UINT64_FORMAT " value " UINT64_FORMAT ", expected " UINT64_FORMAT,
+				 key, val, keys[i]);
+		nfound++;
+	}
+	EXPECT_FALSE(bfm_iterate_next(iter, &key, &val));
+	bfm_end_iterate(iter);
+
+	EXPECT_EQ_U32(nfound, nkeys - (nkeys + 2) / 3);
+
+	pfree(keys);
+}
+
 #include "portability/instr_time.h"
 
 static void
@@ -3056,6 +3904,10 @@ bfm_tests(void)
 
 	bfm_test_delete_lots();
 
+	bfm_test_build_sorted();
+
+	bfm_test_iterate();
+
 	if (0)
 	{
 		int cnt = 300;
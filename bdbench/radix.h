@@ -35,11 +35,19 @@ typedef enum bfm_tree_node_kind
 struct MemoryContextData;
 struct bfm_tree_node;
 
+typedef struct bfm_iter bfm_iter;
+
 /* NB: makes things a bit slower */
 #define BFM_STATS
 
 #define BFM_USE_SLAB
 //#define BFM_USE_OS
+//#define BFM_USE_ARENA
+
+/* the arena takes the place of the slabs */
+#if defined(BFM_USE_ARENA) && defined(BFM_USE_SLAB)
+#undef BFM_USE_SLAB
+#endif
 
 /*
  * A radix tree with nodes that are sized based on occupancy.
@@ -54,21 +62,41 @@ typedef struct bfm_tree
 	struct MemoryContextData *inner_slabs[BFM_KIND_COUNT];
 	struct MemoryContextData *leaf_slabs[BFM_KIND_COUNT];
 #endif
+#ifdef BFM_USE_ARENA
+	/* nodes are carved from large blocks, see bfm_alloc_node() */
+	char *arena_ptr;
+	char *arena_end;
+	void *inner_free[BFM_KIND_COUNT];
+	void *leaf_free[BFM_KIND_COUNT];
+#endif
 
 #ifdef BFM_STATS
 	/* stats */
 	size_t entries;
 	size_t inner_nodes[BFM_KIND_COUNT];
 	size_t leaf_nodes[BFM_KIND_COUNT];
+
+	/* nodes of smaller size classes that bfm_build_sorted() didn't need */
+	size_t build_skipped_nodes;
+	size_t build_skipped_bytes;
 #endif
 } bfm_tree;
 
 extern void bfm_init(bfm_tree *root);
 //extern bool bfm_lookup(bfm_tree *root, bfm_key_type key, bfm_value_type *val);
 extern bool bfm_lookup(bfm_tree *root, uint64_t key, bfm_value_type *val);
+extern void bfm_lookup_batch(bfm_tree *root, const bfm_key_type *keys, int nkeys,
+							 bfm_value_type *vals, bool *found);
 extern bool bfm_set(bfm_tree *root, bfm_key_type key, bfm_value_type val);
+extern void bfm_build_sorted(bfm_tree *root, const bfm_key_type *keys,
+							 const bfm_value_type *vals, int nkeys);
 extern bool bfm_delete(bfm_tree *root, bfm_key_type key);
 
+extern bfm_iter *bfm_begin_iterate(bfm_tree *root);
+extern bool bfm_iterate_next(bfm_iter *iter, bfm_key_type *key,
+							 bfm_value_type *val);
+extern void bfm_end_iterate(bfm_iter *iter);
+
 extern struct StringInfoData* bfm_stats(bfm_tree *root);
 extern void bfm_print(bfm_tree *root);
 
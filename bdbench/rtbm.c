@@ -40,19 +40,44 @@
  * The smallest container type varies depending on the cardinarity of the offset
  * numbers in the block.
  *
+ * Adaptive mode
+ * -------------
+ * Every block costs a hash table entry, 16 bytes plus the free space of the
+ * hash table, even if it has a single dead tuple. When most blocks have only
+ * one or two dead tuples, a flat sorted array of the TIDs, 6 bytes each, is
+ * much smaller. An RTbm created by rtbm_create_adaptive() tracks the bytes
+ * used per TID while tuples are added, and converts itself in place to such
+ * a compact form, a sorted array of block numbers and a parallel array of
+ * offset numbers, if it takes less than half the space of the hash table and
+ * the containers. It converts back if the compact form grows larger than the
+ * hash table would be, or if a block is added out of order. Lookups in the
+ * compact form are binary searches, which is why we want it to be
+ * substantially smaller before switching to it.
+ *
+ * Memory limit
+ * ------------
+ * rtbm_set_memory_limit() sets a limit on the bytes allocated for the hash
+ * table and the container space (or the compact form), as reported by
+ * rtbm_memory_usage(). The callback is called once, right after adding the
+ * block that leaves less room than the next block could allocate, which is
+ * the growth of the container space for the largest container plus the hash
+ * table growth if the next insertion grows it, so that the caller can stop
+ * adding before the limit is crossed. The container space, and the compact
+ * form, grow up to the limit rather than doubling past it, leaving room for
+ * the hash table to double, as long as the caller stops.
+ *
  * Limitations
  * -----------
  * - No support for removing and updating block and offset values.
  *
  * - Offset numbers must be added in order.
  *
- * - No computation of the intersection, the union, and the difference of
- *   between sets.
+ * - No computation of the union and the difference of between sets. Only
+ *   the intersection with a sorted array of TIDs is supported, see
+ *   rtbm_intersect_sorted().
  *
  * TODO
  * ----
- * - Support iteration.
- *
  * - Support DSM and DSA.
  *
  * Portions Copyright (c) 1996-2021, PostgreSQL Global Development Group
@@ -70,7 +95,9 @@
 #include "utils/builtins.h"
 #include "utils/memutils.h"
 #include "lib/stringinfo.h"
+#include "port/pg_bitutils.h"
 
+#include "bdbench_stats.h"
 #include "rtbm.h"
 
 /*
@@ -103,6 +130,21 @@ typedef struct DtEntry
 #define DTENTRY_IS_RUN(entry) \
 	((((DtEntry *) (entry))->flags & DTENTRY_FLAG_TYPE_RUN) != 0)
 
+#define RTBM_ADAPT_INTERVAL	1024	/* check the form every this many blocks */
+#define RTBM_COMPACT_FACTOR	2		/* the compact form must be this much smaller */
+#define RTBM_HASH_FILLFACTOR	0.9	/* as simplehash */
+#define RTBM_COMPACT_TID_SIZE	(sizeof(BlockNumber) + sizeof(OffsetNumber))
+#define RTBM_COMPACT_INITIAL_SIZE	1024
+
+/* the number of TIDs rtbm_lookup_batch_pipelined() looks up together */
+#define RTBM_PIPELINE_GROUP	16
+
+#ifdef __GNUC__
+#define rtbm_prefetch(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define rtbm_prefetch(addr) ((void) (addr))
+#endif
+
 #define BITMAP_CONTAINER_SIZE(maxoff) (((maxoff) - 1) / BITBYTE + 1)
 #define MAX_BITMAP_CONTAINER_SIZE BITMAP_CONTAINER_SIZE(MaxHeapTuplesPerPage)
 
@@ -128,6 +170,25 @@ typedef struct RTbm
 	char	*containerdata;	/* the space for containers */
 	uint64	containerdata_size;
 	uint32	offset;	/* current offset within the containerdata */
+
+	bool	readonly;	/* working on a serialized copy? */
+
+	/* adaptive mode, see above */
+	bool	adaptive;
+	bool	compact;		/* in the compact form? */
+	uint64	ntids;
+	uint64	container_bytes;	/* size of the containers of all blocks */
+
+	/* the compact form, ntids entries sorted by block and offset number */
+	BlockNumber *cblocks;
+	OffsetNumber *coffsets;
+	uint64	compact_size;	/* allocated entries */
+
+	/* memory limit, see above */
+	Size	mem_limit;		/* 0 if unlimited */
+	rtbm_limit_callback limit_callback;
+	void	*limit_arg;
+	bool	limit_reached;	/* callback called? */
 } RTbm;
 #define RTBM_CONTAINERDATA_INITIAL_SIZE	(64 * 1024) /* 64kB */
 
@@ -135,9 +196,66 @@ typedef struct RTbm
 #define BYTENUM(x) ((x) / BITBYTE)
 #define BITNUM(x) ((x) % BITBYTE)
 
-static void enlarge_container_space(RTbm *rtbm)
+/* The branches of the lookups counted for bdbench_stats() */
+typedef enum RTbmStat
+{
+	RTBM_STAT_NO_BLOCK,			/* no entry of the block in the hash table */
+	RTBM_STAT_ARRAY,
+	RTBM_STAT_BITMAP,
+	RTBM_STAT_BITMAP_PAST_END,	/* offset past the end of the bitmap */
+	RTBM_STAT_RUN,
+	RTBM_STAT_RUN_BEFORE_START,	/* offset before the run it stopped at */
+	RTBM_STAT_COMPACT_SEARCH,	/* binary search for the block */
+	RTBM_STAT_COMPACT,
+	RTBM_STAT_FOUND,
+	RTBM_STAT_BYTES,			/* container bytes read */
+	RTBM_NUM_STATS
+} RTbmStat;
+
+static const char *const rtbm_stat_names[RTBM_NUM_STATS] = {
+	"no_block",
+	"array",
+	"bitmap",
+	"bitmap_past_end",
+	"run",
+	"run_before_start",
+	"compact_search",
+	"compact",
+	"found",
+	"bytes"
+};
+
+static uint64 rtbm_stat_counters[RTBM_NUM_STATS];
+
+BdbenchStatsSet rtbm_lookup_stats = {
+	"rtbm",
+	rtbm_stat_names, RTBM_NUM_STATS, rtbm_stat_counters,
+	NULL, 0, 0, NULL
+};
+
+#define RTBM_STATS_INC(id) BDBENCH_STATS_INC(rtbm_stat_counters, id)
+#define RTBM_STATS_ADD(id, n) BDBENCH_STATS_ADD(rtbm_stat_counters, id, n)
+
+/*
+ * Enlarge the container space to have room for needed more bytes. It doubles,
+ * but not beyond the memory limit if the room left is enough. The room leaves
+ * out the next growth of the hash table, which doubles it.
+ */
+static void
+enlarge_container_space(RTbm *rtbm, int needed)
 {
-	int newsize = rtbm->containerdata_size * 2;
+	uint64 newsize = rtbm->containerdata_size * 2;
+
+	if (rtbm->mem_limit > 0)
+	{
+		uint64 room = rtbm->mem_limit -
+			Min(rtbm->mem_limit,
+				sizeof(RTbm) + sizeof(dttable_hash) + rtbm->dttable_size * 2);
+
+		if (room >= rtbm->offset + needed)
+			newsize = Min(newsize, room);
+	}
+	newsize = Max(newsize, rtbm->offset + needed);
 
 	rtbm->containerdata = repalloc_huge(rtbm->containerdata, newsize);
 	rtbm->containerdata_size = newsize;
@@ -156,10 +274,42 @@ rtbm_create(void)
 	return rtbm;
 }
 
+/*
+ * Like rtbm_create(), but the returned RTbm switches to the compact form when
+ * it's substantially smaller.
+ */
+RTbm *
+rtbm_create_adaptive(void)
+{
+	RTbm *rtbm = rtbm_create();
+
+	rtbm->adaptive = true;
+
+	return rtbm;
+}
+
 void
 rtbm_free(RTbm *rtbm)
 {
-	pfree(rtbm->containerdata);
+	/* the hash table entries and containers belong to the serialized copy */
+	if (rtbm->readonly)
+	{
+		if (rtbm->dttable)
+			pfree(rtbm->dttable);
+		pfree(rtbm);
+		return;
+	}
+
+	if (rtbm->compact)
+	{
+		pfree(rtbm->cblocks);
+		pfree(rtbm->coffsets);
+	}
+	else
+	{
+		dttable_destroy(rtbm->dttable);
+		pfree(rtbm->containerdata);
+	}
 	pfree(rtbm);
 }
 
@@ -179,7 +329,7 @@ create_run_container(const OffsetNumber *offnums, int noffs, uint16 *container)
 		length = 1;
 		startoff = offnums[i - 1];
 
-		while (i <= noffs && offnums[i - 1] + 1 == offnums[i])
+		while (i < noffs && offnums[i - 1] + 1 == offnums[i])
 		{
 			length++;
 			i++;
@@ -227,16 +377,20 @@ choose_container_type(const OffsetNumber *offnums, int noffs, int *size_p,
 	}
 }
 
-void
-rtbm_add_tuples(RTbm *rtbm, const BlockNumber blkno,
-				   const OffsetNumber *offnums, int nitems)
+/*
+ * Add the container of a block to the hash table. The container type and
+ * size, and the run container if that's the type, are chosen by
+ * choose_container_type().
+ */
+static void
+rtbm_hash_add_tuples(RTbm *rtbm, const BlockNumber blkno,
+					 const OffsetNumber *offnums, int nitems,
+					 int container_type, int container_size,
+					 uint16 *runcontainer)
 {
 	DtEntry *entry;
 	bool	found;
 	char	oldstatus;
-	OffsetNumber runcontainer[MaxHeapTuplesPerPage];
-	int container_type;
-	int container_size;
 
 	entry = dttable_insert(rtbm->dttable, blkno, &found);
 	Assert(!found);
@@ -248,18 +402,18 @@ rtbm_add_tuples(RTbm *rtbm, const BlockNumber blkno,
 	entry->blkno = blkno;
 	entry->offset = rtbm->offset;
 
-	/* Choose smallest container type */
-	container_type = choose_container_type(offnums, nitems, &container_size,
-										   runcontainer);
 	/* Make sure we have enough container data space */
 	if ((rtbm->offset + container_size) > rtbm->containerdata_size)
 	{
-		enlarge_container_space(rtbm);
-		Assert((rtbm->offset + container_size) < rtbm->containerdata_size);
+		enlarge_container_space(rtbm, container_size);
+		Assert((rtbm->offset + container_size) <= rtbm->containerdata_size);
 	}
 
 	if (container_type == DTENTRY_FLAG_TYPE_BITMAP)
 	{
+		/* the enlarged part of the space is not zeroed */
+		memset(&(rtbm->containerdata[entry->offset]), 0, container_size);
+
 		for (int i = 0; i < nitems; i++)
 		{
 			OffsetNumber off = offnums[i];
@@ -303,32 +457,372 @@ rtbm_add_tuples(RTbm *rtbm, const BlockNumber blkno,
 	}
 
 	rtbm->offset += container_size;
+}
+
+/*
+ * Append the offsets of a block to the compact form. The block must be after
+ * all blocks in it.
+ */
+static void
+rtbm_compact_add_tuples(RTbm *rtbm, const BlockNumber blkno,
+						const OffsetNumber *offnums, int nitems)
+{
+	if (rtbm->ntids + nitems > rtbm->compact_size)
+	{
+		uint64 newsize = rtbm->compact_size * 2;
+
+		/* don't grow beyond the memory limit if the room left is enough */
+		if (rtbm->mem_limit > 0)
+		{
+			uint64 room = (rtbm->mem_limit - Min(rtbm->mem_limit, sizeof(RTbm))) /
+				RTBM_COMPACT_TID_SIZE;
+
+			if (room >= rtbm->ntids + nitems)
+				newsize = Min(newsize, room);
+		}
+		newsize = Max(newsize, rtbm->ntids + nitems);
+
+		rtbm->cblocks = repalloc_huge(rtbm->cblocks,
+									  sizeof(BlockNumber) * newsize);
+		rtbm->coffsets = repalloc_huge(rtbm->coffsets,
+									   sizeof(OffsetNumber) * newsize);
+		rtbm->compact_size = newsize;
+	}
+
+	for (int i = 0; i < nitems; i++)
+	{
+		rtbm->cblocks[rtbm->ntids + i] = blkno;
+		rtbm->coffsets[rtbm->ntids + i] = offnums[i];
+	}
+}
+
+static int rtbm_container_decode(RTbm *rtbm, DtEntry *entry,
+								 OffsetNumber *offsets);
+static int rtbm_comparator(const void *left, const void *right);
+
+/*
+ * Convert the hash table to the compact form in place.
+ */
+static void
+rtbm_convert_to_compact(RTbm *rtbm)
+{
+	MemoryContext ctx = GetMemoryChunkContext(rtbm);
+	dttable_iterator iter;
+	DtEntry *entry;
+	DtEntry **entries;
+	uint64	pos = 0;
+	int		num = 0;
+
+	Assert(!rtbm->compact);
+
+	rtbm->compact_size = Max(rtbm->ntids, RTBM_COMPACT_INITIAL_SIZE);
+	rtbm->cblocks = MemoryContextAllocHuge(ctx, sizeof(BlockNumber) * rtbm->compact_size);
+	rtbm->coffsets = MemoryContextAllocHuge(ctx, sizeof(OffsetNumber) * rtbm->compact_size);
+
+	entries = (DtEntry **) MemoryContextAllocHuge(ctx, sizeof(DtEntry *) * rtbm->nblocks);
+	dttable_start_iterate(rtbm->dttable, &iter);
+	while ((entry = dttable_iterate(rtbm->dttable, &iter)) != NULL)
+		entries[num++] = entry;
+	qsort(entries, num, sizeof(DtEntry *), rtbm_comparator);
+
+	for (int i = 0; i < num; i++)
+	{
+		int n = rtbm_container_decode(rtbm, entries[i], &(rtbm->coffsets[pos]));
+
+		for (int j = 0; j < n; j++)
+			rtbm->cblocks[pos + j] = entries[i]->blkno;
+		pos += n;
+	}
+	Assert(pos == rtbm->ntids);
+
+	pfree(entries);
+	dttable_destroy(rtbm->dttable);
+	pfree(rtbm->containerdata);
+	rtbm->dttable = NULL;
+	rtbm->dttable_size = 0;
+	rtbm->containerdata = NULL;
+	rtbm->containerdata_size = 0;
+	rtbm->offset = 0;
+	rtbm->compact = true;
+}
+
+/*
+ * Convert the compact form back to the hash table in place.
+ */
+static void
+rtbm_convert_to_hash(RTbm *rtbm)
+{
+	MemoryContext ctx = GetMemoryChunkContext(rtbm);
+	uint16	runcontainer[MaxHeapTuplesPerPage];
+	uint64	pos = 0;
+
+	Assert(rtbm->compact);
+
+	rtbm->dttable = dttable_create(ctx, rtbm->nblocks, (void *) rtbm);
+	rtbm->containerdata_size = Max(RTBM_CONTAINERDATA_INITIAL_SIZE,
+								   pg_nextpower2_64(rtbm->container_bytes + 1));
+	rtbm->containerdata = MemoryContextAllocExtended(ctx, rtbm->containerdata_size,
+													 MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	rtbm->offset = 0;
+
+	while (pos < rtbm->ntids)
+	{
+		BlockNumber blkno = rtbm->cblocks[pos];
+		uint64	end = pos;
+		int		container_type;
+		int		container_size;
+
+		while (end < rtbm->ntids && rtbm->cblocks[end] == blkno)
+			end++;
+
+		container_type = choose_container_type(&(rtbm->coffsets[pos]), end - pos,
+											   &container_size, runcontainer);
+		rtbm_hash_add_tuples(rtbm, blkno, &(rtbm->coffsets[pos]), end - pos,
+							 container_type, container_size, runcontainer);
+		pos = end;
+	}
+
+	pfree(rtbm->cblocks);
+	pfree(rtbm->coffsets);
+	rtbm->cblocks = NULL;
+	rtbm->coffsets = NULL;
+	rtbm->compact_size = 0;
+	rtbm->compact = false;
+}
+
+/*
+ * Switch to the smaller form, if it's small enough to be worth it.
+ */
+static void
+rtbm_adapt(RTbm *rtbm)
+{
+	uint64	compact_bytes = rtbm->ntids * RTBM_COMPACT_TID_SIZE;
+	uint64	hash_bytes;
+
+	if (rtbm->compact)
+	{
+		/* estimate the hash table sized for the blocks, as simplehash does */
+		hash_bytes = pg_nextpower2_64((uint64) (rtbm->nblocks / RTBM_HASH_FILLFACTOR) + 1) *
+			sizeof(DtEntry) + rtbm->container_bytes;
+
+		if (compact_bytes > hash_bytes)
+			rtbm_convert_to_hash(rtbm);
+	}
+	else
+	{
+		hash_bytes = rtbm->dttable_size + rtbm->offset;
+
+		if (hash_bytes > compact_bytes * RTBM_COMPACT_FACTOR)
+			rtbm_convert_to_compact(rtbm);
+	}
+}
+
+/*
+ * Return the most bytes adding a block could allocate: the growth of the
+ * compact form or of the container space needed for a full block or the
+ * largest container, plus the hash table growth if the next insertion grows
+ * it.
+ */
+static Size
+rtbm_next_add_bytes(RTbm *rtbm)
+{
+	Size	bytes = 0;
+
+	if (rtbm->compact)
+	{
+		if (rtbm->ntids + MaxHeapTuplesPerPage > rtbm->compact_size)
+			bytes = (rtbm->ntids + MaxHeapTuplesPerPage - rtbm->compact_size) *
+				RTBM_COMPACT_TID_SIZE;
+		return bytes;
+	}
+
+	if (rtbm->offset + BITMAP_CONTAINER_SIZE(MaxHeapTuplesPerPage) > rtbm->containerdata_size)
+		bytes = rtbm->offset + BITMAP_CONTAINER_SIZE(MaxHeapTuplesPerPage) -
+			rtbm->containerdata_size;
+	if (rtbm->dttable->members >= rtbm->dttable->grow_threshold)
+		bytes += rtbm->dttable_size;
+
+	return bytes;
+}
+
+void
+rtbm_add_tuples(RTbm *rtbm, const BlockNumber blkno,
+				   const OffsetNumber *offnums, int nitems)
+{
+	OffsetNumber runcontainer[MaxHeapTuplesPerPage];
+	int container_type;
+	int container_size;
+
+	Assert(!rtbm->readonly);
+
+	/* The compact form can only be appended to */
+	if (rtbm->compact && blkno <= rtbm->cblocks[rtbm->ntids - 1])
+		rtbm_convert_to_hash(rtbm);
+
+	/*
+	 * Choose smallest container type. We need its size even in the compact
+	 * form, to know how large the hash table would be.
+	 */
+	container_type = choose_container_type(offnums, nitems, &container_size,
+										   runcontainer);
+
+	if (rtbm->compact)
+		rtbm_compact_add_tuples(rtbm, blkno, offnums, nitems);
+	else
+		rtbm_hash_add_tuples(rtbm, blkno, offnums, nitems, container_type,
+							 container_size, runcontainer);
+
 	rtbm->nblocks++;
+	rtbm->ntids += nitems;
+	rtbm->container_bytes += container_size;
+
+	if (rtbm->adaptive && rtbm->nblocks % RTBM_ADAPT_INTERVAL == 0)
+		rtbm_adapt(rtbm);
+
+	if (rtbm->mem_limit > 0 && !rtbm->limit_reached &&
+		rtbm_memory_usage(rtbm) + rtbm_next_add_bytes(rtbm) > rtbm->mem_limit)
+	{
+		rtbm->limit_reached = true;
+		rtbm->limit_callback(rtbm->limit_arg);
+	}
+}
+
+/*
+ * Move the dead tuples of src to rtbm, and free src. The blocks of src must
+ * not be in rtbm, as with RTbms built for disjoint block ranges. The
+ * containers of src are copied at once and its hash table entries are added
+ * pointing to the copies, so it takes O(blocks) rather than adding every dead
+ * tuple again. The compact form is appended to if src is compact too and its
+ * blocks are all after the ones of rtbm; otherwise both are converted to the
+ * hash table first.
+ */
+void
+rtbm_merge(RTbm *rtbm, RTbm *src)
+{
+	Assert(!rtbm->readonly && !src->readonly);
+
+	if (src->nblocks == 0)
+	{
+		rtbm_free(src);
+		return;
+	}
+
+	if (rtbm->compact && src->compact &&
+		src->cblocks[0] > rtbm->cblocks[rtbm->ntids - 1])
+	{
+		uint64	ntids = rtbm->ntids + src->ntids;
+
+		if (ntids > rtbm->compact_size)
+		{
+			rtbm->cblocks = repalloc_huge(rtbm->cblocks,
+										  sizeof(BlockNumber) * ntids);
+			rtbm->coffsets = repalloc_huge(rtbm->coffsets,
+										   sizeof(OffsetNumber) * ntids);
+			rtbm->compact_size = ntids;
+		}
+
+		memcpy(&(rtbm->cblocks[rtbm->ntids]), src->cblocks,
+			   sizeof(BlockNumber) * src->ntids);
+		memcpy(&(rtbm->coffsets[rtbm->ntids]), src->coffsets,
+			   sizeof(OffsetNumber) * src->ntids);
+	}
+	else
+	{
+		dttable_iterator iter;
+		DtEntry *entry;
+
+		if (rtbm->compact)
+			rtbm_convert_to_hash(rtbm);
+		if (src->compact)
+			rtbm_convert_to_hash(src);
+
+		/* the containers of src go after the ones of rtbm */
+		if ((rtbm->offset + src->offset) > rtbm->containerdata_size)
+			enlarge_container_space(rtbm, src->offset);
+		memcpy(&(rtbm->containerdata[rtbm->offset]), src->containerdata,
+			   src->offset);
+
+		dttable_start_iterate(src->dttable, &iter);
+		while ((entry = dttable_iterate(src->dttable, &iter)) != NULL)
+		{
+			DtEntry *newentry;
+			bool	found;
+
+			newentry = dttable_insert(rtbm->dttable, entry->blkno, &found);
+			Assert(!found);
+
+			newentry->flags = entry->flags;
+			newentry->offset = rtbm->offset + entry->offset;
+		}
+
+		rtbm->offset += src->offset;
+	}
+
+	rtbm->nblocks += src->nblocks;
+	rtbm->ntids += src->ntids;
+	rtbm->container_bytes += src->container_bytes;
+
+	if (rtbm->adaptive)
+		rtbm_adapt(rtbm);
+
+	rtbm_free(src);
+}
+
+/*
+ * Set the memory limit in bytes, and the callback to be called once adding
+ * the next block could cross it. 0 means no limit.
+ */
+void
+rtbm_set_memory_limit(RTbm *rtbm, Size limit, rtbm_limit_callback callback,
+					  void *arg)
+{
+	Assert(limit == 0 || callback != NULL);
+
+	rtbm->mem_limit = limit;
+	rtbm->limit_callback = callback;
+	rtbm->limit_arg = arg;
+	rtbm->limit_reached = false;
+}
+
+/*
+ * Return the bytes allocated for the dead tuples, including the unused part
+ * of the container space and of the compact form.
+ */
+Size
+rtbm_memory_usage(RTbm *rtbm)
+{
+	if (rtbm->compact)
+		return sizeof(RTbm) + rtbm->compact_size * RTBM_COMPACT_TID_SIZE;
+
+	return sizeof(RTbm) + sizeof(dttable_hash) + rtbm->dttable_size +
+		rtbm->containerdata_size;
 }
 
 bool
-rtbm_lookup(RTbm *rtbm, ItemPointer tid)
+rtbm_is_compact(RTbm *rtbm)
+{
+	return rtbm->compact;
+}
+
+/*
+ * Check if the container of the given entry has the offset number.
+ */
+static inline bool
+rtbm_container_contains(RTbm *rtbm, DtEntry *entry, OffsetNumber off)
 {
-	BlockNumber blk = ItemPointerGetBlockNumber(tid);
-	OffsetNumber off = ItemPointerGetOffsetNumber(tid);
-	DtEntry *entry;
 	int bytenum, bitnum;
 	bool ret = false;
 	uint16 len;
 
-	entry = dttable_lookup(rtbm->dttable, blk);
-
-	if (!entry)
-		return false;
-
 	len = (uint16) (entry->flags & DTENTRY_FLAG_NUM_MASK);
 
 	if (DTENTRY_IS_ARRAY(entry))
 	{
 		OffsetNumber *off_p = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+		int i;
 		ret = false;
 
-		for (int i = 0; i < len; i++)
+		for (i = 0; i < len; i++)
 		{
 			if (*(off_p + i) == off)
 			{
@@ -336,30 +830,41 @@ rtbm_lookup(RTbm *rtbm, ItemPointer tid)
 				break;
 			}
 		}
+
+		RTBM_STATS_INC(RTBM_STAT_ARRAY);
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, sizeof(OffsetNumber) * Min(i + 1, len));
 	}
 	else if (DTENTRY_IS_BITMAP(entry))
 	{
+		RTBM_STATS_INC(RTBM_STAT_BITMAP);
+
 		if (len <= off - 1)
+		{
+			RTBM_STATS_INC(RTBM_STAT_BITMAP_PAST_END);
 			ret = false;
+		}
 		else
 		{
 			bytenum = BYTENUM(off - 1);
 			bitnum = BITNUM(off - 1);
 
 			ret = ((rtbm->containerdata[entry->offset + bytenum] & (1 << bitnum)) != 0);
+			RTBM_STATS_ADD(RTBM_STAT_BYTES, 1);
 		}
 	}
 	else
 	{
 		OffsetNumber *runs = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+		int i;
 
-		for (int i = 0; i < len; i += 2)
+		for (i = 0; i < len; i += 2)
 		{
 			OffsetNumber start = runs[i];
 			uint16 end = start + runs[i + 1] - 1;
 
 			if (off < start)
 			{
+				RTBM_STATS_INC(RTBM_STAT_RUN_BEFORE_START);
 				ret = false;
 				break;
 			}
@@ -370,57 +875,596 @@ rtbm_lookup(RTbm *rtbm, ItemPointer tid)
 			ret = true;
 			break;
 		}
+
+		RTBM_STATS_INC(RTBM_STAT_RUN);
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, sizeof(OffsetNumber) * Min(i + 2, len));
 	}
 
+	if (ret)
+		RTBM_STATS_INC(RTBM_STAT_FOUND);
+
 	return ret;
 }
 
-static inline void *
-dttable_allocate(dttable_hash *dttable, Size size)
+/*
+ * Return the position of the first TID of the given block in the compact
+ * form, or of the first TID of the following blocks if it has none.
+ */
+static inline uint64
+rtbm_compact_search(RTbm *rtbm, BlockNumber blk)
 {
-	RTbm *rtbm = (RTbm *) dttable->private_data;
+	uint64	lo = 0;
+	uint64	hi = rtbm->ntids;
 
-	rtbm->dttable_size = size;
-	return MemoryContextAllocExtended(dttable->ctx, size,
-									  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
-}
+	RTBM_STATS_INC(RTBM_STAT_COMPACT_SEARCH);
 
-static inline void
-dttable_free(dttable_hash *dttable, void *pointer)
-{
-	pfree(pointer);
-}
+	while (lo < hi)
+	{
+		uint64 mid = lo + (hi - lo) / 2;
 
-void
-rtbm_stats(RTbm *rtbm)
-{
-	elog(NOTICE, "dtatble_size %d containerdata_size %lu nblocks %d, offset %d",
-		 rtbm->dttable_size,
-		 rtbm->containerdata_size,
-		 rtbm->nblocks,
-		 rtbm->offset);
+		if (rtbm->cblocks[mid] < blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, sizeof(BlockNumber));
+	}
+
+	return lo;
 }
 
-static void
-dump_entry(RTbm *rtbm, DtEntry *entry)
+/*
+ * Check if the compact form has the offset number of the block whose TIDs
+ * begin at pos.
+ */
+static inline bool
+rtbm_compact_contains(RTbm *rtbm, uint64 pos, BlockNumber blk, OffsetNumber off)
 {
-	StringInfoData str;
-	uint16 len;
+	RTBM_STATS_INC(RTBM_STAT_COMPACT);
 
-	initStringInfo(&str);
+	for (; pos < rtbm->ntids && rtbm->cblocks[pos] == blk; pos++)
+	{
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, RTBM_COMPACT_TID_SIZE);
 
-	appendStringInfo(&str, "[%5d] (%-6s): ", entry->blkno,
-					 DTENTRY_IS_ARRAY(entry) ? "ARRAY" :
-					 DTENTRY_IS_BITMAP(entry) ? "BITMAP" :
-					 DTENTRY_IS_RUN(entry) ? "RUN" : "UNKNOWN");
+		if (rtbm->coffsets[pos] >= off)
+		{
+			if (rtbm->coffsets[pos] != off)
+				return false;
 
-	len = (uint16) (entry->flags & DTENTRY_FLAG_NUM_MASK);
+			RTBM_STATS_INC(RTBM_STAT_FOUND);
+			return true;
+		}
+	}
 
-	if (DTENTRY_IS_ARRAY(entry))
-	{
-		OffsetNumber *off_p = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+	return false;
+}
 
-		for (int i = 0; i < len; i++)
+bool
+rtbm_lookup(RTbm *rtbm, ItemPointer tid)
+{
+	BlockNumber blk = ItemPointerGetBlockNumber(tid);
+	OffsetNumber off = ItemPointerGetOffsetNumber(tid);
+	DtEntry *entry;
+
+	if (rtbm->compact)
+		return rtbm_compact_contains(rtbm, rtbm_compact_search(rtbm, blk),
+									 blk, off);
+
+	entry = dttable_lookup(rtbm->dttable, blk);
+
+	if (!entry)
+	{
+		RTBM_STATS_INC(RTBM_STAT_NO_BLOCK);
+		return false;
+	}
+
+	return rtbm_container_contains(rtbm, entry, off);
+}
+
+/*
+ * Look up ntids TIDs at once. The i'th bit of result is set if tids[i] is
+ * in the store, and the number of TIDs found is returned.
+ *
+ * The block entry found for a TID is reused for the following TIDs on the
+ * same block, so a run of TIDs pointing to the same heap page costs a single
+ * hash table probe. Likewise in the compact form, the position of the block
+ * is reused.
+ */
+int
+rtbm_lookup_batch(RTbm *rtbm, ItemPointer tids, int ntids, uint64 *result)
+{
+	BlockNumber curblk = InvalidBlockNumber;
+	DtEntry *entry = NULL;
+	int nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	if (rtbm->compact)
+	{
+		uint64	pos = 0;
+
+		for (int i = 0; i < ntids; i++)
+		{
+			BlockNumber blk = ItemPointerGetBlockNumber(&(tids[i]));
+
+			if (blk != curblk)
+			{
+				pos = rtbm_compact_search(rtbm, blk);
+				curblk = blk;
+			}
+
+			if (rtbm_compact_contains(rtbm, pos, blk,
+									  ItemPointerGetOffsetNumber(&(tids[i]))))
+			{
+				result[i / 64] |= UINT64CONST(1) << (i % 64);
+				nmatched++;
+			}
+		}
+
+		return nmatched;
+	}
+
+	for (int i = 0; i < ntids; i++)
+	{
+		BlockNumber blk = ItemPointerGetBlockNumber(&(tids[i]));
+
+		if (blk != curblk)
+		{
+			entry = dttable_lookup(rtbm->dttable, blk);
+			curblk = blk;
+		}
+
+		if (entry == NULL)
+			RTBM_STATS_INC(RTBM_STAT_NO_BLOCK);
+		else if (rtbm_container_contains(rtbm, entry,
+										 ItemPointerGetOffsetNumber(&(tids[i]))))
+		{
+			result[i / 64] |= UINT64CONST(1) << (i % 64);
+			nmatched++;
+		}
+	}
+
+	return nmatched;
+}
+
+/*
+ * Look up ntids TIDs like rtbm_lookup_batch(), but RTBM_PIPELINE_GROUP TIDs at
+ * a time in stages: hash all block numbers of the group prefetching their
+ * buckets, then probe the hash table prefetching the containers, and then
+ * check the containers. The cache misses of the TIDs of a group overlap
+ * rather than following each other, which is what matters when the TIDs come
+ * in random order, as from a non-clustered index. The compact form is left
+ * to rtbm_lookup_batch(), its binary searches being dependent loads anyway.
+ */
+int
+rtbm_lookup_batch_pipelined(RTbm *rtbm, ItemPointer tids, int ntids,
+							uint64 *result)
+{
+	dttable_hash *dttable = rtbm->dttable;
+	int nmatched = 0;
+
+	if (rtbm->compact)
+		return rtbm_lookup_batch(rtbm, tids, ntids, result);
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	for (int base = 0; base < ntids; base += RTBM_PIPELINE_GROUP)
+	{
+		int n = Min(ntids - base, RTBM_PIPELINE_GROUP);
+		ItemPointer group = &(tids[base]);
+		uint32 hashes[RTBM_PIPELINE_GROUP];
+		DtEntry *entries[RTBM_PIPELINE_GROUP];
+
+		/* stage 1: hash the block numbers, prefetching the buckets */
+		for (int i = 0; i < n; i++)
+		{
+			hashes[i] = murmurhash32(ItemPointerGetBlockNumber(&(group[i])));
+			rtbm_prefetch(&(dttable->data[hashes[i] & dttable->sizemask]));
+		}
+
+		/* stage 2: probe the hash table, prefetching the containers */
+		for (int i = 0; i < n; i++)
+		{
+			entries[i] = dttable_lookup_hash(dttable,
+											 ItemPointerGetBlockNumber(&(group[i])),
+											 hashes[i]);
+			if (entries[i] != NULL)
+				rtbm_prefetch(&(rtbm->containerdata[entries[i]->offset]));
+		}
+
+		/* stage 3: check the containers */
+		for (int i = 0; i < n; i++)
+		{
+			int pos = base + i;
+
+			if (entries[i] == NULL)
+				RTBM_STATS_INC(RTBM_STAT_NO_BLOCK);
+			else if (rtbm_container_contains(rtbm, entries[i],
+											 ItemPointerGetOffsetNumber(&(group[i]))))
+			{
+				result[pos / 64] |= UINT64CONST(1) << (pos % 64);
+				nmatched++;
+			}
+		}
+	}
+
+	return nmatched;
+}
+
+/*
+ * Return the position of the first TID of the given block or of the following
+ * blocks in the compact form, searching forward from pos, which must not be
+ * past it. We gallop, doubling the step until we overshoot, and then binary
+ * search the last step, so that a block close to pos is found quickly.
+ */
+static inline uint64
+rtbm_compact_gallop(RTbm *rtbm, uint64 pos, BlockNumber blk)
+{
+	uint64	lo = pos;
+	uint64	hi;
+	uint64	step = 1;
+
+	if (lo >= rtbm->ntids || rtbm->cblocks[lo] >= blk)
+		return lo;
+
+	/* cblocks[lo] < blk holds in the loop */
+	for (;;)
+	{
+		hi = lo + step;
+		if (hi >= rtbm->ntids)
+		{
+			hi = rtbm->ntids;
+			break;
+		}
+		if (rtbm->cblocks[hi] >= blk)
+			break;
+		lo = hi;
+		step *= 2;
+	}
+
+	lo++;
+	while (lo < hi)
+	{
+		uint64 mid = lo + (hi - lo) / 2;
+
+		if (rtbm->cblocks[mid] < blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Check which of the ntids offset numbers of tids, all on the block of entry
+ * and in ascending order, the container has, setting the bits of result from
+ * the base'th one. The container offsets being sorted as well, array and run
+ * containers are merged with the TIDs in a single pass.
+ */
+static int
+rtbm_container_intersect(RTbm *rtbm, DtEntry *entry, ItemPointer tids,
+						 int ntids, int base, uint64 *result)
+{
+	uint16	len = (uint16) (entry->flags & DTENTRY_FLAG_NUM_MASK);
+	int		nmatched = 0;
+
+	if (DTENTRY_IS_ARRAY(entry))
+	{
+		OffsetNumber *offs = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+		int		j = 0;
+
+		for (int i = 0; i < ntids && j < len; i++)
+		{
+			OffsetNumber off = ItemPointerGetOffsetNumber(&(tids[i]));
+
+			while (j < len && offs[j] < off)
+				j++;
+
+			if (j < len && offs[j] == off)
+			{
+				result[(base + i) / 64] |= UINT64CONST(1) << ((base + i) % 64);
+				nmatched++;
+			}
+		}
+
+		RTBM_STATS_INC(RTBM_STAT_ARRAY);
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, sizeof(OffsetNumber) * Min(j + 1, len));
+	}
+	else if (DTENTRY_IS_BITMAP(entry))
+	{
+		unsigned char *bitmap = (unsigned char *) &(rtbm->containerdata[entry->offset]);
+
+		RTBM_STATS_INC(RTBM_STAT_BITMAP);
+
+		for (int i = 0; i < ntids; i++)
+		{
+			OffsetNumber off = ItemPointerGetOffsetNumber(&(tids[i]));
+
+			if (off - 1 >= len)
+			{
+				RTBM_STATS_INC(RTBM_STAT_BITMAP_PAST_END);
+				break;
+			}
+
+			RTBM_STATS_ADD(RTBM_STAT_BYTES, 1);
+			if ((bitmap[BYTENUM(off - 1)] & (1 << BITNUM(off - 1))) != 0)
+			{
+				result[(base + i) / 64] |= UINT64CONST(1) << ((base + i) % 64);
+				nmatched++;
+			}
+		}
+	}
+	else
+	{
+		OffsetNumber *runs = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+		int		j = 0;
+
+		for (int i = 0; i < ntids && j < len; i++)
+		{
+			OffsetNumber off = ItemPointerGetOffsetNumber(&(tids[i]));
+
+			/* skip the runs ending before off */
+			while (j < len && runs[j] + runs[j + 1] - 1 < off)
+				j += 2;
+
+			if (j < len && runs[j] <= off)
+			{
+				result[(base + i) / 64] |= UINT64CONST(1) << ((base + i) % 64);
+				nmatched++;
+			}
+		}
+
+		RTBM_STATS_INC(RTBM_STAT_RUN);
+		RTBM_STATS_ADD(RTBM_STAT_BYTES, sizeof(OffsetNumber) * Min(j + 2, len));
+	}
+
+	RTBM_STATS_ADD(RTBM_STAT_FOUND, nmatched);
+
+	return nmatched;
+}
+
+/*
+ * Look up ntids TIDs like rtbm_lookup_batch(), but the TIDs must be sorted in
+ * TID order, as they come from a btree index. Each block of the TIDs is
+ * looked up once and its offset numbers are merged with the container. In
+ * the compact form, whose TIDs are sorted as well, we merge the whole input
+ * with it, galloping forward over the blocks not in the input rather than
+ * binary searching the whole array for each block.
+ */
+int
+rtbm_intersect_sorted(RTbm *rtbm, ItemPointer tids, int ntids, uint64 *result)
+{
+	uint64	pos = 0;
+	int		nmatched = 0;
+	int		i = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	while (i < ntids)
+	{
+		BlockNumber blk = ItemPointerGetBlockNumber(&(tids[i]));
+		int		start = i;
+
+		/* the TIDs on this block */
+		while (i < ntids && ItemPointerGetBlockNumber(&(tids[i])) == blk)
+		{
+			Assert(i == start ||
+				   ItemPointerGetOffsetNumber(&(tids[i - 1])) <
+				   ItemPointerGetOffsetNumber(&(tids[i])));
+			i++;
+		}
+		Assert(i == ntids || ItemPointerGetBlockNumber(&(tids[i])) > blk);
+
+		if (rtbm->compact)
+		{
+			pos = rtbm_compact_gallop(rtbm, pos, blk);
+
+			if (pos >= rtbm->ntids)
+				break;
+
+			for (int j = start; j < i; j++)
+			{
+				OffsetNumber off = ItemPointerGetOffsetNumber(&(tids[j]));
+
+				while (pos < rtbm->ntids && rtbm->cblocks[pos] == blk &&
+					   rtbm->coffsets[pos] < off)
+					pos++;
+
+				if (pos >= rtbm->ntids || rtbm->cblocks[pos] != blk)
+					break;
+
+				if (rtbm->coffsets[pos] == off)
+				{
+					result[j / 64] |= UINT64CONST(1) << (j % 64);
+					nmatched++;
+				}
+			}
+		}
+		else
+		{
+			DtEntry *entry = dttable_lookup(rtbm->dttable, blk);
+
+			if (entry != NULL)
+				nmatched += rtbm_container_intersect(rtbm, entry, &(tids[start]),
+													 i - start, start, result);
+			else
+				RTBM_STATS_INC(RTBM_STAT_NO_BLOCK);
+		}
+	}
+
+	return nmatched;
+}
+
+static inline void *
+dttable_allocate(dttable_hash *dttable, Size size)
+{
+	RTbm *rtbm = (RTbm *) dttable->private_data;
+
+	rtbm->dttable_size = size;
+	return MemoryContextAllocExtended(dttable->ctx, size,
+									  MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+}
+
+static inline void
+dttable_free(dttable_hash *dttable, void *pointer)
+{
+	pfree(pointer);
+}
+
+/*
+ * The serialized form of RTbm. The header is followed by the hash table
+ * entries and the used part of the container data, both as they are in
+ * memory. Neither has pointers, so a read-only RTbm can work directly on a
+ * serialized copy, for instance in a shared memory segment. In the compact
+ * form, the header is followed by the block numbers and the offset numbers
+ * instead.
+ */
+typedef struct RTbmSerialized
+{
+	uint64	dttable_size;	/* the number of hash table buckets */
+	uint32	dttable_members;
+	uint32	dttable_sizemask;
+	int		nblocks;
+	uint32	offset;	/* used bytes of the container data */
+	bool	compact;
+	uint64	ntids;
+} RTbmSerialized;
+
+Size
+rtbm_serialized_size(RTbm *rtbm)
+{
+	if (rtbm->compact)
+		return MAXALIGN(sizeof(RTbmSerialized)) +
+			MAXALIGN(sizeof(BlockNumber) * rtbm->ntids) +
+			sizeof(OffsetNumber) * rtbm->ntids;
+
+	return MAXALIGN(sizeof(RTbmSerialized)) +
+		MAXALIGN(sizeof(DtEntry) * rtbm->dttable->size) +
+		rtbm->offset;
+}
+
+/*
+ * Write the serialized form of rtbm into dest, which must have at least
+ * rtbm_serialized_size() bytes.
+ */
+void
+rtbm_serialize(RTbm *rtbm, char *dest)
+{
+	RTbmSerialized *hdr = (RTbmSerialized *) dest;
+	char *p = dest + MAXALIGN(sizeof(RTbmSerialized));
+
+	MemSet(hdr, 0, sizeof(RTbmSerialized));
+	hdr->nblocks = rtbm->nblocks;
+	hdr->compact = rtbm->compact;
+	hdr->ntids = rtbm->ntids;
+
+	if (rtbm->compact)
+	{
+		memcpy(p, rtbm->cblocks, sizeof(BlockNumber) * rtbm->ntids);
+		p += MAXALIGN(sizeof(BlockNumber) * rtbm->ntids);
+		memcpy(p, rtbm->coffsets, sizeof(OffsetNumber) * rtbm->ntids);
+		return;
+	}
+
+	hdr->dttable_size = rtbm->dttable->size;
+	hdr->dttable_members = rtbm->dttable->members;
+	hdr->dttable_sizemask = rtbm->dttable->sizemask;
+	hdr->offset = rtbm->offset;
+
+	memcpy(p, rtbm->dttable->data, sizeof(DtEntry) * rtbm->dttable->size);
+	p += MAXALIGN(sizeof(DtEntry) * rtbm->dttable->size);
+
+	memcpy(p, rtbm->containerdata, rtbm->offset);
+}
+
+/*
+ * Return a read-only RTbm working on the serialized form at src, without
+ * copying it. src must be MAXALIGN'ed and outlive the returned RTbm.
+ */
+RTbm *
+rtbm_deserialize(char *src)
+{
+	RTbmSerialized *hdr = (RTbmSerialized *) src;
+	char *p = src + MAXALIGN(sizeof(RTbmSerialized));
+	RTbm *rtbm = palloc0(sizeof(RTbm));
+	dttable_hash *dttable;
+
+	rtbm->nblocks = hdr->nblocks;
+	rtbm->ntids = hdr->ntids;
+	rtbm->readonly = true;
+
+	if (hdr->compact)
+	{
+		rtbm->compact = true;
+		rtbm->cblocks = (BlockNumber *) p;
+		rtbm->coffsets = (OffsetNumber *) (p + MAXALIGN(sizeof(BlockNumber) * hdr->ntids));
+		rtbm->compact_size = hdr->ntids;
+		return rtbm;
+	}
+
+	dttable = palloc0(sizeof(dttable_hash));
+
+	/*
+	 * Set up a hash table header pointing to the serialized entries. Lookups
+	 * only need the size, the mask and the entries.
+	 */
+	dttable->size = hdr->dttable_size;
+	dttable->members = hdr->dttable_members;
+	dttable->sizemask = hdr->dttable_sizemask;
+	dttable->grow_threshold = hdr->dttable_members;
+	dttable->data = (DtEntry *) p;
+	dttable->ctx = CurrentMemoryContext;
+	dttable->private_data = rtbm;
+	p += MAXALIGN(sizeof(DtEntry) * hdr->dttable_size);
+
+	rtbm->dttable = dttable;
+	rtbm->dttable_size = sizeof(DtEntry) * hdr->dttable_size;
+	rtbm->containerdata = p;
+	rtbm->containerdata_size = hdr->offset;
+	rtbm->offset = hdr->offset;
+
+	return rtbm;
+}
+
+void
+rtbm_stats(RTbm *rtbm)
+{
+	if (rtbm->compact)
+	{
+		elog(NOTICE, "compact nblocks %d ntids " UINT64_FORMAT ", %lu bytes",
+			 rtbm->nblocks, rtbm->ntids,
+			 rtbm->compact_size * RTBM_COMPACT_TID_SIZE);
+		return;
+	}
+
+	elog(NOTICE, "dtatble_size %d containerdata_size %lu nblocks %d, offset %d",
+		 rtbm->dttable_size,
+		 rtbm->containerdata_size,
+		 rtbm->nblocks,
+		 rtbm->offset);
+}
+
+static void
+dump_entry(RTbm *rtbm, DtEntry *entry)
+{
+	StringInfoData str;
+	uint16 len;
+
+	initStringInfo(&str);
+
+	appendStringInfo(&str, "[%5d] (%-6s): ", entry->blkno,
+					 DTENTRY_IS_ARRAY(entry) ? "ARRAY" :
+					 DTENTRY_IS_BITMAP(entry) ? "BITMAP" :
+					 DTENTRY_IS_RUN(entry) ? "RUN" : "UNKNOWN");
+
+	len = (uint16) (entry->flags & DTENTRY_FLAG_NUM_MASK);
+
+	if (DTENTRY_IS_ARRAY(entry))
+	{
+		OffsetNumber *off_p = (OffsetNumber *) &(rtbm->containerdata[entry->offset]);
+
+		for (int i = 0; i < len; i++)
 			appendStringInfo(&str, "%d ", *(off_p + i));
 	}
 	else if (DTENTRY_IS_BITMAP(entry))
@@ -454,6 +1498,27 @@ dump_entry(RTbm *rtbm, DtEntry *entry)
 		 (long long unsigned) entry->offset, len);
 }
 
+/*
+ * Dump the TIDs of the block whose TIDs begin at pos in the compact form.
+ * Returns the position of the next block.
+ */
+static uint64
+dump_compact_block(RTbm *rtbm, uint64 pos)
+{
+	StringInfoData str;
+	BlockNumber blkno = rtbm->cblocks[pos];
+
+	initStringInfo(&str);
+
+	appendStringInfo(&str, "[%5d] (%-6s): ", blkno, "COMPACT");
+	for (; pos < rtbm->ntids && rtbm->cblocks[pos] == blkno; pos++)
+		appendStringInfo(&str, "%d ", rtbm->coffsets[pos]);
+
+	elog(NOTICE, "%s", str.data);
+
+	return pos;
+}
+
 static int
 rtbm_comparator(const void *left, const void *right)
 {
@@ -475,6 +1540,17 @@ rtbm_dump(RTbm *rtbm)
 	DtEntry **entries;
 	int num = 0;
 
+	if (rtbm->compact)
+	{
+		uint64 pos = 0;
+
+		elog(NOTICE, "DEADTUPLESTORE (compact, ntids " UINT64_FORMAT ", nblocks %d) ----------------------------",
+			 rtbm->ntids, rtbm->nblocks);
+		while (pos < rtbm->ntids)
+			pos = dump_compact_block(rtbm, pos);
+		return;
+	}
+
 	entries = (DtEntry **) palloc(rtbm->nblocks * sizeof(DtEntry *));
 
 	dttable_start_iterate(rtbm->dttable, &iter);
@@ -501,6 +1577,17 @@ rtbm_dump_blk(RTbm *rtbm, BlockNumber blkno)
 
 	initStringInfo(&str);
 
+	if (rtbm->compact)
+	{
+		uint64 pos = rtbm_compact_search(rtbm, blkno);
+
+		if (pos >= rtbm->ntids || rtbm->cblocks[pos] != blkno)
+			elog(NOTICE, "NOT FOUND blkno %u", blkno);
+		else
+			dump_compact_block(rtbm, pos);
+		return;
+	}
+
 	elog(NOTICE, "DEADTUPLESTORE (containerdata size %lu, nblocks %d) ----------------------------",
 		 rtbm->containerdata_size, rtbm->nblocks);
 	entry = dttable_lookup(rtbm->dttable, blkno);
@@ -513,3 +1600,147 @@ rtbm_dump_blk(RTbm *rtbm, BlockNumber blkno)
 
 	dump_entry(rtbm, entry);
 }
+
+/*
+ * Iteration over the block entries in block number order.
+ *
+ * The hash table has no order, so we collect the entries and sort them at
+ * the beginning. The containers are decoded straight into the caller's
+ * buffer, so no memory is allocated per block or per TID. The compact form is
+ * already in order.
+ */
+struct RTbmIter
+{
+	RTbm	*rtbm;
+	DtEntry	**entries;
+	int		nentries;
+	int		next;
+	uint64	pos;		/* position in the compact form */
+};
+
+RTbmIter *
+rtbm_begin_iterate(RTbm *rtbm)
+{
+	RTbmIter *iter = palloc(sizeof(RTbmIter));
+	dttable_iterator hiter;
+	DtEntry *entry;
+
+	iter->rtbm = rtbm;
+	iter->pos = 0;
+
+	if (rtbm->compact)
+	{
+		iter->entries = NULL;
+		iter->nentries = 0;
+		iter->next = 0;
+		return iter;
+	}
+
+	iter->entries = (DtEntry **)
+		MemoryContextAllocHuge(CurrentMemoryContext,
+							   sizeof(DtEntry *) * Max(rtbm->nblocks, 1));
+	iter->nentries = 0;
+	iter->next = 0;
+
+	dttable_start_iterate(rtbm->dttable, &hiter);
+	while ((entry = dttable_iterate(rtbm->dttable, &hiter)) != NULL)
+		iter->entries[iter->nentries++] = entry;
+
+	Assert(iter->nentries == rtbm->nblocks);
+	qsort(iter->entries, iter->nentries, sizeof(DtEntry *), rtbm_comparator);
+
+	return iter;
+}
+
+/*
+ * Decode the container of the entry into offsets in ascending order, and
+ * return the number of offset numbers.
+ */
+static int
+rtbm_container_decode(RTbm *rtbm, DtEntry *entry, OffsetNumber *offsets)
+{
+	char *container;
+	uint16 len;
+	int n = 0;
+
+	container = &(rtbm->containerdata[entry->offset]);
+	len = (uint16) (entry->flags & DTENTRY_FLAG_NUM_MASK);
+
+	if (DTENTRY_IS_ARRAY(entry))
+	{
+		memcpy(offsets, container, sizeof(OffsetNumber) * len);
+		n = len;
+	}
+	else if (DTENTRY_IS_BITMAP(entry))
+	{
+		for (int i = 0; i < BYTENUM(len); i++)
+		{
+			uint8 byte = (uint8) container[i];
+
+			while (byte != 0)
+			{
+				int bitnum = pg_rightmost_one_pos32(byte);
+
+				offsets[n++] = i * BITBYTE + bitnum + 1;
+				byte &= byte - 1;
+			}
+		}
+	}
+	else
+	{
+		OffsetNumber *runs = (OffsetNumber *) container;
+
+		for (int i = 0; i < len; i += 2)
+		{
+			for (int j = 0; j < runs[i + 1]; j++)
+				offsets[n++] = runs[i] + j;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Return the next block and its offset numbers in ascending order. offsets
+ * must have room for MaxHeapTuplesPerPage offset numbers. Returns false if
+ * there are no more blocks.
+ */
+bool
+rtbm_iterate_next(RTbmIter *iter, BlockNumber *blkno, OffsetNumber *offsets,
+				  int *noffsets)
+{
+	RTbm *rtbm = iter->rtbm;
+	DtEntry *entry;
+
+	if (rtbm->compact)
+	{
+		int n = 0;
+
+		if (iter->pos >= rtbm->ntids)
+			return false;
+
+		*blkno = rtbm->cblocks[iter->pos];
+		while (iter->pos < rtbm->ntids && rtbm->cblocks[iter->pos] == *blkno)
+			offsets[n++] = rtbm->coffsets[iter->pos++];
+		*noffsets = n;
+
+		return true;
+	}
+
+	if (iter->next >= iter->nentries)
+		return false;
+
+	entry = iter->entries[iter->next++];
+	*blkno = entry->blkno;
+	*noffsets = rtbm_container_decode(rtbm, entry, offsets);
+
+	return true;
+}
+
+void
+rtbm_end_iterate(RTbmIter *iter)
+{
+	if (iter->entries)
+		pfree(iter->entries);
+	pfree(iter);
+}
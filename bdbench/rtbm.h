@@ -2,12 +2,33 @@
 #define _RTBM_H
 
 typedef struct RTbm RTbm;
+typedef struct RTbmIter RTbmIter;
+typedef void (*rtbm_limit_callback) (void *arg);
 
 RTbm *rtbm_create(void);
+RTbm *rtbm_create_adaptive(void);
 void rtbm_free(RTbm *dtstore);
 void rtbm_add_tuples(RTbm *dtstore, const BlockNumber blkno,
 						const OffsetNumber *offnums, int nitems);
+bool rtbm_is_compact(RTbm *dtstore);
+void rtbm_merge(RTbm *dtstore, RTbm *src);
+void rtbm_set_memory_limit(RTbm *dtstore, Size limit,
+						   rtbm_limit_callback callback, void *arg);
+Size rtbm_memory_usage(RTbm *dtstore);
 bool rtbm_lookup(RTbm *dtstore, ItemPointer tid);
+int rtbm_lookup_batch(RTbm *dtstore, ItemPointer tids, int ntids,
+					  uint64 *result);
+int rtbm_lookup_batch_pipelined(RTbm *dtstore, ItemPointer tids, int ntids,
+								uint64 *result);
+int rtbm_intersect_sorted(RTbm *dtstore, ItemPointer tids, int ntids,
+						  uint64 *result);
+Size rtbm_serialized_size(RTbm *dtstore);
+void rtbm_serialize(RTbm *dtstore, char *dest);
+RTbm *rtbm_deserialize(char *src);
+RTbmIter *rtbm_begin_iterate(RTbm *dtstore);
+bool rtbm_iterate_next(RTbmIter *iter, BlockNumber *blkno,
+					   OffsetNumber *offsets, int *noffsets);
+void rtbm_end_iterate(RTbmIter *iter);
 void rtbm_stats(RTbm *dtstore);
 void rtbm_dump(RTbm *dtstore);
 void rtbm_dump_blk(RTbm *dtstore, BlockNumber blkno);
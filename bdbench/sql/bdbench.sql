@@ -0,0 +1,22 @@
+CREATE EXTENSION bdbench;
+SET client_min_messages = error;
+
+-- bench_fuzz() must leave the memory limit of the subjects in effect
+SELECT prepare(1000, 10, 1, 1, 1);
+SELECT attach_dead_tuples('svtm', mem_limit => 8);
+SELECT count(*) AS failed
+FROM bench_fuzz(seed => 1, rounds => 1, ndead => 200000, modes => '{svtm}')
+WHERE mismatches > 0 OR error IS NOT NULL;
+SELECT attach_dead_tuples('svtm', mem_limit => 8);
+SELECT DISTINCT ndeadtuples < 100000 AS capped
+FROM bench('svtm', warmup => 0, iterations => 1);
+
+-- every subject answers like the binary search on every shape, and only
+-- radix_tree_tid rejects the dead tuples up to MaxBlockNumber
+CREATE TEMP TABLE fuzz AS
+SELECT * FROM bench_fuzz(seed => 1, rounds => 4, ndead => 20000, modes => NULL);
+SELECT count(DISTINCT (round, structure)) AS subjects FROM fuzz;
+SELECT count(*) AS mismatched FROM fuzz WHERE mismatches > 0;
+SELECT round, structure, workload, error
+FROM fuzz WHERE error IS NOT NULL
+ORDER BY round, structure;
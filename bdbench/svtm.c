@@ -87,6 +87,16 @@
  * Number of first non-empty chunk and first empty chunk after it are
  * remembered to reduce size of bitmap and speedup access to first run
  * of non-empty chunks.
+ *
+ * # Memory limit.
+ *
+ * mem_used counts the bytes taken by the store, the chunks, the chunk
+ * pointers and the ixmap, but not the free space in the allocator blocks.
+ * With a limit set by svtm_set_memory_limit(), the callback is called once,
+ * right after adding the page that leaves less room than the next page could
+ * need, which is the chunk being built plus the largest page plus the growth
+ * of the chunk pointers and the ixmap. Allocator blocks are made smaller near the limit so
+ * that they don't overshoot it.
  */
 
 #include "postgres.h"
@@ -97,6 +107,7 @@
 #include "lib/stringinfo.h"
 #include "port/pg_bitutils.h"
 
+#include "bdbench_stats.h"
 #include "svtm.h"
 
 #define PAGES_PER_CHUNK (1<<5)
@@ -106,6 +117,15 @@
 
 #define SVTAllocChunk ((1<<19)-128)
 
+/* the number of TIDs svtm_lookup_batch_pipelined() looks up together */
+#define SVTM_PIPELINE_GROUP 16
+
+#ifdef __GNUC__
+#define svtm_prefetch(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define svtm_prefetch(addr) ((void) (addr))
+#endif
+
 typedef struct SVTPagesChunk SVTPagesChunk;
 typedef struct SVTChunkBuilder SVTChunkBuilder;
 typedef struct SVTAlloc		 SVTAlloc;
@@ -145,8 +165,17 @@ struct SVTm
 	uint32		nchunks;
 	SVTPagesChunk **chunks; /* chunks pointers */
 	IxMap	   *ixmap;   	/* compression map for chunks */
+	uint32		nmaps;		/* number of ixmap entries */
 	Size		total_size;
 	SVTAlloc	*alloc;
+	bool		readonly;	/* working on a serialized copy? */
+
+	/* memory limit, see above */
+	Size		mem_used;
+	Size		mem_limit;	/* 0 if unlimited */
+	svtm_limit_callback limit_callback;
+	void	   *limit_arg;
+	bool		limit_reached;	/* callback called? */
 
 	uint32  npages;
 	uint32  hcnt[4];
@@ -191,6 +220,54 @@ const uint8 four_bit_cnt[32] = {
 	2, 3, 3, 4, 3, 4, 4, 5,
 };
 
+/* The branches of the lookups counted for bdbench_stats() */
+typedef enum SVTmStat
+{
+	SVTM_STAT_PAST_LAST_BLOCK,	/* block after store->lastblock */
+	SVTM_STAT_BEFORE_FIRST_RUN,	/* chunk before the first run */
+	SVTM_STAT_NO_CHUNK,			/* no bit of the chunk in ixmap */
+	SVTM_STAT_NO_PAGE,			/* no bit of the page in the chunk */
+	SVTM_STAT_SINGLE,
+	SVTM_STAT_RAW,
+	SVTM_STAT_SPARSE,
+	SVTM_STAT_INVERSE,
+	SVTM_STAT_DECODED,			/* bitmap decoded by svtm_intersect_sorted() */
+	SVTM_STAT_PAST_BITMAP_END,	/* offset past the end of the bitmap */
+	SVTM_STAT_INDEX2_MISS,		/* zero bit in the second level index */
+	SVTM_STAT_INDEX1_MISS,		/* zero bit in the first level index */
+	SVTM_STAT_FOUND,
+	SVTM_STAT_BYTES,			/* ixmap, chunk and bitmap bytes read */
+	SVTM_NUM_STATS
+} SVTmStat;
+
+static const char *const svtm_stat_names[SVTM_NUM_STATS] = {
+	"past_last_block",
+	"before_first_run",
+	"no_chunk",
+	"no_page",
+	"single",
+	"raw",
+	"sparse",
+	"inverse",
+	"decoded",
+	"past_bitmap_end",
+	"index2_miss",
+	"index1_miss",
+	"found",
+	"bytes"
+};
+
+static uint64 svtm_stat_counters[SVTM_NUM_STATS];
+
+BdbenchStatsSet svtm_lookup_stats = {
+	"svtm",
+	svtm_stat_names, SVTM_NUM_STATS, svtm_stat_counters,
+	NULL, 0, 0, NULL
+};
+
+#define SVTM_STATS_INC(id) BDBENCH_STATS_INC(svtm_stat_counters, id)
+#define SVTM_STATS_ADD(id, n) BDBENCH_STATS_ADD(svtm_stat_counters, id, n)
+
 #define makeoff(v, bits) ((v)/bits)
 #define makebit(v, bits) (1<<((v)&((bits)-1)))
 #define maskbits(v, vits) ((v) & ((1<<(bits))-1))
@@ -198,6 +275,10 @@ const uint8 four_bit_cnt[32] = {
 
 static inline uint32 svt_popcnt32(uint32 val);
 static void svtm_build_chunk(SVTm *store);
+static Size svtm_next_add_bytes(SVTm *store);
+static uint8 *svtm_page_raw_bitmap(SVTPagesChunk *chunk, SVTHeader header,
+								   uint8 *raw, uint32 *bmlen);
+static Size svtm_chunk_size(SVTPagesChunk *chunk);
 
 static inline uint32
 svt_popcnt8(uint8 val)
@@ -211,11 +292,27 @@ svt_popcnt32(uint32 val)
 	return pg_popcount32(val);
 }
 
+/*
+ * Allocate a block having room for at least size bytes. It's smaller than
+ * SVTAllocChunk if the room left below the memory limit is enough.
+ */
 static SVTAlloc*
-svtm_alloc_alloc(void)
+svtm_alloc_alloc(SVTm *store, Size size)
 {
-	SVTAlloc *alloc = palloc0(SVTAllocChunk);
-	alloc->limit = SVTAllocChunk - offsetof(SVTAlloc, bytes);
+	Size	blksize = SVTAllocChunk;
+	SVTAlloc *alloc;
+
+	if (store->mem_limit > 0 && store->mem_limit > store->mem_used)
+	{
+		Size	room = store->mem_limit - store->mem_used;
+
+		if (room >= offsetof(SVTAlloc, bytes) + size)
+			blksize = Min(blksize, room);
+	}
+	blksize = Max(blksize, offsetof(SVTAlloc, bytes) + size);
+
+	alloc = palloc0(blksize);
+	alloc->limit = blksize - offsetof(SVTAlloc, bytes);
 	return alloc;
 }
 
@@ -225,7 +322,9 @@ svtm_create(void)
 	SVTm* store = palloc0(sizeof(SVTm));
 	/* preallocate chunks just to pass it to repalloc later */
 	store->chunks = palloc(sizeof(SVTPagesChunk*)*2);
-	store->alloc = svtm_alloc_alloc();
+	/* the first allocator block is allocated with the first chunk */
+	store->alloc = NULL;
+	store->mem_used = sizeof(SVTm) + sizeof(SVTPagesChunk*)*2;
 	return store;
 }
 
@@ -237,15 +336,16 @@ svtm_alloc(SVTm *store, Size size)
 
 	size = INTALIGN(size);
 
-	if (alloc->limit - alloc->pos < size)
+	if (alloc == NULL || alloc->limit - alloc->pos < size)
 	{
-		alloc = svtm_alloc_alloc();
+		alloc = svtm_alloc_alloc(store, size);
 		alloc->next = store->alloc;
 		store->alloc = alloc;
 	}
 
 	res = alloc->bytes + alloc->pos;
 	alloc->pos += size;
+	store->mem_used += size;
 
 	return res;
 }
@@ -257,6 +357,13 @@ svtm_free(SVTm *store)
 
 	if (store == NULL)
 		return;
+	/* ixmap and chunks belong to the serialized copy */
+	if (store->readonly)
+	{
+		pfree(store->chunks);
+		pfree(store);
+		return;
+	}
 	if (store->ixmap != NULL)
 		pfree(store->ixmap);
 	if (store->chunks != NULL)
@@ -321,7 +428,7 @@ svtm_add_page(SVTm *store, const BlockNumber blkno,
 		/* calculate bitmap */
 		for (i = 0; i < nitems; i++)
 		{
-			Assert(i == 0 || off(i) < off(i-1));
+			Assert(i == 0 || off(i) > off(i-1));
 			bitmap[makeoff(off(i),8)] |= makebit(off(i), 8);
 		}
 
@@ -404,9 +511,71 @@ svtm_add_page(SVTm *store, const BlockNumber blkno,
 	bld->headers[bld->npages] = header;
 	bld->npages++;
 	bld->hcnt[HeaderType(header)]++;
+
+	if (store->mem_limit > 0 && !store->limit_reached &&
+		store->mem_used + svtm_next_add_bytes(store) > store->mem_limit)
+	{
+		store->limit_reached = true;
+		store->limit_callback(store->limit_arg);
+	}
 }
 #undef off
 
+/*
+ * Set the memory limit in bytes, and the callback to be called once adding
+ * the next page could cross it. 0 means no limit.
+ */
+void
+svtm_set_memory_limit(SVTm *store, Size limit, svtm_limit_callback callback,
+					  void *arg)
+{
+	Assert(limit == 0 || callback != NULL);
+
+	store->mem_limit = limit;
+	store->limit_callback = callback;
+	store->limit_arg = arg;
+	store->limit_reached = false;
+}
+
+/*
+ * Return the bytes used by the dead tuples, not counting the free space in
+ * the allocator blocks. The chunk being built is counted once it's added.
+ */
+Size
+svtm_memory_usage(SVTm *store)
+{
+	return store->mem_used;
+}
+
+/* The number of chunk pointers allocated for nchunks chunks */
+static inline Size
+svtm_chunks_capacity(uint32 nchunks)
+{
+	return nchunks == 0 ? 2 : pg_nextpower2_32(nchunks);
+}
+
+/*
+ * Return the most bytes adding a page could need: flushing the chunk being
+ * built with the largest page in it, growing the chunk pointers, and the
+ * ixmap svtm_finalize_addition() builds, assuming the page is in the next
+ * chunk.
+ */
+static Size
+svtm_next_add_bytes(SVTm *store)
+{
+	SVTChunkBuilder *bld = &store->builder;
+	Size	bytes;
+
+	bytes = INTALIGN(offsetof(SVTPagesChunk, headers) +
+					 sizeof(SVTHeader) * (bld->npages + 1) +
+					 bld->bitmaps_pos + BITMAP_PER_PAGE + 2);
+	if ((store->nchunks & (store->nchunks-1)) == 0)
+		bytes += svtm_chunks_capacity(store->nchunks) * sizeof(SVTPagesChunk*);
+	bytes += (makeoff(bld->chunk_number + 1, 32) + 1) * sizeof(IxMap);
+
+	return bytes;
+}
+
 static void
 svtm_build_chunk(SVTm *store)
 {
@@ -451,6 +620,8 @@ svtm_build_chunk(SVTm *store)
 		Size new_nchunks = store->nchunks ? (store->nchunks<<1) : 1;
 		store->chunks = (SVTPagesChunk**) repalloc(store->chunks,
 				new_nchunks * sizeof(SVTPagesChunk*));
+		store->mem_used -= svtm_chunks_capacity(store->nchunks) * sizeof(SVTPagesChunk*);
+		store->mem_used += new_nchunks * sizeof(SVTPagesChunk*);
 	}
 	store->chunks[store->nchunks] = chunk;
 	store->nchunks++;
@@ -464,8 +635,11 @@ svtm_build_chunk(SVTm *store)
 	memset(bld, 0, sizeof(SVTChunkBuilder));
 }
 
-void
-svtm_finalize_addition(SVTm *store)
+/*
+ * Build the ixmap of the chunks, replacing the old one if any.
+ */
+static void
+svtm_build_ixmap(SVTm *store)
 {
 	SVTPagesChunk **chunks = store->chunks;
 	IxMap  *ixmap;
@@ -474,27 +648,21 @@ svtm_finalize_addition(SVTm *store)
 	uint32	nmaps;
 	uint32	i;
 
-	if (store->nchunks == 0)
+	Assert(store->nchunks > 0);
+
+	if (store->ixmap != NULL)
 	{
-		/*
-		 * block number will be rejected with:
-		 * block <= lastblock, lastblock == 0
-		 * chunk >= firstrun.start, firstrun.start = 1
-		 */
-		store->firstrun.start = 1;
-		return;
+		pfree(store->ixmap);
+		store->mem_used -= store->nmaps * sizeof(IxMap);
 	}
 
 	firstrun = chunks[0]->chunk_number;
 	firstrunend = firstrun+1;
 
-	/* adsorb last chunk */
-	svtm_build_chunk(store);
-
-	/* Now we need to build ixmap */
 	last_chunk = PAGE_TO_CHUNK(store->lastblock);
 	nmaps = makeoff(last_chunk, 32) + 1;
 	ixmap = palloc0(nmaps * sizeof(IxMap));
+	store->mem_used += nmaps * sizeof(IxMap);
 
 	for (i = 0; i < store->nchunks; i++)
 	{
@@ -514,61 +682,257 @@ svtm_finalize_addition(SVTm *store)
 	store->firstrun.start = firstrun;
 	store->firstrun.end = firstrunend;
 	store->ixmap = ixmap;
+	store->nmaps = nmaps;
 }
 
-bool
-svtm_lookup(SVTm *store, ItemPointer tid)
+void
+svtm_finalize_addition(SVTm *store)
+{
+	/* adsorb last chunk */
+	svtm_build_chunk(store);
+
+	if (store->nchunks == 0)
+	{
+		/*
+		 * block number will be rejected with:
+		 * block <= lastblock, lastblock == 0
+		 * chunk >= firstrun.start, firstrun.start = 1
+		 */
+		store->firstrun.start = 1;
+		return;
+	}
+
+	/* Now we need to build ixmap */
+	svtm_build_ixmap(store);
+}
+
+/*
+ * Merge the chunk of src into the chunk of dst for the same chunk number,
+ * where the pages of src are all after the pages of dst. Returns the merged
+ * chunk, allocated in store.
+ */
+static SVTPagesChunk *
+svtm_merge_chunks(SVTm *store, SVTPagesChunk *dst, SVTPagesChunk *src)
+{
+	SVTPagesChunk *chunk;
+	uint32	ndst = svt_popcnt32(dst->bitmap);
+	uint32	nsrc = svt_popcnt32(src->bitmap);
+	uint32	dstlen = svtm_chunk_size(dst) - offsetof(SVTPagesChunk, headers) -
+		sizeof(SVTHeader) * ndst;
+	uint32	srclen = svtm_chunk_size(src) - offsetof(SVTPagesChunk, headers) -
+		sizeof(SVTHeader) * nsrc;
+	uint8  *bitmaps;
+	uint32	i;
+
+	Assert(dst->chunk_number == src->chunk_number);
+	Assert(pg_leftmost_one_pos32(dst->bitmap) < pg_rightmost_one_pos32(src->bitmap));
+	Assert(dstlen + srclen <= MaxBitmapPosition);
+
+	chunk = svtm_alloc(store, offsetof(SVTPagesChunk, headers) +
+					   sizeof(SVTHeader) * (ndst + nsrc) + dstlen + srclen);
+	chunk->chunk_number = dst->chunk_number;
+	chunk->bitmap = dst->bitmap | src->bitmap;
+
+	memcpy(chunk->headers, dst->headers, sizeof(SVTHeader) * ndst);
+	for (i = 0; i < nsrc; i++)
+	{
+		SVTHeader	header = src->headers[i];
+
+		/* the bitmaps of src come after the ones of dst */
+		if (HeaderType(header) != SVTH_single)
+			header = MakeHeaderType(HeaderType(header)) |
+				MakeBitmapPosition(BitmapPosition(header) + dstlen);
+		chunk->headers[ndst + i] = header;
+	}
+
+	bitmaps = (uint8 *) (chunk->headers + ndst + nsrc);
+	memcpy(bitmaps, dst->headers + ndst, dstlen);
+	memcpy(bitmaps + dstlen, src->headers + nsrc, srclen);
+
+	return chunk;
+}
+
+/*
+ * Move the dead tuples of src to store, and free src. Both must be
+ * finalized, and the pages of src must all be after the pages of store, as
+ * with stores built for consecutive block ranges. The chunks are moved along
+ * with the allocator blocks of src rather than copied, except that the chunk
+ * both have pages in is merged, and the ixmap is rebuilt, so it takes
+ * O(chunks) regardless of the number of dead tuples.
+ */
+void
+svtm_merge(SVTm *store, SVTm *src)
+{
+	Size	oldcap = svtm_chunks_capacity(store->nchunks);
+	Size	newcap;
+	uint32	first = 0;
+	uint32	i;
+
+	Assert(!store->readonly && !src->readonly);
+	Assert(store->builder.npages == 0 && src->builder.npages == 0);
+
+	if (src->nchunks == 0)
+	{
+		/* see svtm_finalize_addition() */
+		if (store->nchunks == 0)
+			store->firstrun.start = 1;
+		svtm_free(src);
+		return;
+	}
+
+	Assert(store->nchunks == 0 ||
+		   src->chunks[0]->chunk_number >=
+		   store->chunks[store->nchunks - 1]->chunk_number);
+
+	/* hand the allocator blocks, and so the chunks, of src over to store */
+	if (src->alloc != NULL)
+	{
+		SVTAlloc   *alloc = src->alloc;
+
+		while (alloc->next != NULL)
+			alloc = alloc->next;
+		alloc->next = store->alloc;
+		store->alloc = src->alloc;
+		src->alloc = NULL;
+	}
+	store->mem_used += src->mem_used - sizeof(SVTm) -
+		svtm_chunks_capacity(src->nchunks) * sizeof(SVTPagesChunk*) -
+		src->nmaps * sizeof(IxMap);
+
+	/* a block range boundary in the middle of a chunk splits it in two */
+	if (store->nchunks > 0 &&
+		src->chunks[0]->chunk_number ==
+		store->chunks[store->nchunks - 1]->chunk_number)
+	{
+		store->chunks[store->nchunks - 1] =
+			svtm_merge_chunks(store, store->chunks[store->nchunks - 1],
+							  src->chunks[0]);
+		store->total_size -= offsetof(SVTPagesChunk, headers);
+		first = 1;
+	}
+
+	newcap = svtm_chunks_capacity(store->nchunks + src->nchunks - first);
+	if (newcap > oldcap)
+	{
+		store->chunks = (SVTPagesChunk**) repalloc(store->chunks,
+				newcap * sizeof(SVTPagesChunk*));
+		store->mem_used += (newcap - oldcap) * sizeof(SVTPagesChunk*);
+	}
+	for (i = first; i < src->nchunks; i++)
+		store->chunks[store->nchunks++] = src->chunks[i];
+
+	store->lastblock = src->lastblock;
+	store->total_size += src->total_size;
+	store->npages += src->npages;
+	for (i = 0; i < 4; i++)
+		store->hcnt[i] += src->hcnt[i];
+
+	svtm_build_ixmap(store);
+
+	svtm_free(src);
+}
+
+/*
+ * Return the index in store->chunks of the given chunk number, which must be
+ * after the first run, or INVALID_INDEX if there is no dead tuple in the
+ * chunk.
+ */
+static inline uint32
+svtm_ixmap_index(SVTm *store, uint32 chunkno)
 {
-	BlockNumber		blkno = ItemPointerGetBlockNumber(tid);
-	OffsetNumber	offset = ItemPointerGetOffsetNumber(tid) - 1;
-	SVTPagesChunk  *chunk;
 	IxMap          *ixmap = store->ixmap;
 	uint32			off, bit;
 
-	SVTHeader		header;
-	uint8		   *bitmaps;
-	uint8		   *bitmap;
-	uint32	index;
-	uint32	chunkno, blk_in_chunk;
-	uint8	type;
-	uint8	bmoff, bmbit, bmlen, bmbyte;
-	uint8	bmstart, bbmoff, bbmbit, bbmbyte;
-	uint8	bbbmlen, bbbmoff, bbbmbit;
-	uint8	six1off, sbmoff;
-	bool	inverse, bitset;
+	off = makeoff(chunkno - store->firstrun.start, 32);
+	bit = makebit(chunkno - store->firstrun.start, 32);
+	SVTM_STATS_ADD(SVTM_STAT_BYTES, sizeof(IxMap));
+	if ((ixmap[off].bitmap & bit) == 0)
+	{
+		SVTM_STATS_INC(SVTM_STAT_NO_CHUNK);
+		return INVALID_INDEX;
+	}
 
-	if (blkno > store->lastblock)
-		return false;
+	return ixmap[off].offset + svt_popcnt32(ixmap[off].bitmap & (bit-1));
+}
+
+/*
+ * Find the chunk for the given chunk number. Returns NULL if there is no
+ * dead tuple in the chunk. The chunk number must not be after the chunk of
+ * store->lastblock.
+ */
+static inline SVTPagesChunk *
+svtm_find_chunk(SVTm *store, uint32 chunkno)
+{
+	uint32			index;
 
-	chunkno = PAGE_TO_CHUNK(blkno);
 	if (chunkno < store->firstrun.start)
-		return false;
+	{
+		SVTM_STATS_INC(SVTM_STAT_BEFORE_FIRST_RUN);
+		return NULL;
+	}
 
 	if (chunkno < store->firstrun.end)
 		index = chunkno - store->firstrun.start;
 	else
 	{
-		off = makeoff(chunkno - store->firstrun.start, 32);
-		bit = makebit(chunkno - store->firstrun.start, 32);
-		if ((ixmap[off].bitmap & bit) == 0)
-			return false;
-
-		index = ixmap[off].offset + svt_popcnt32(ixmap[off].bitmap & (bit-1));
+		index = svtm_ixmap_index(store, chunkno);
+		if (index == INVALID_INDEX)
+			return NULL;
 	}
-	chunk = store->chunks[index];
-	Assert(chunkno == chunk->chunk_number);
+	Assert(chunkno == store->chunks[index]->chunk_number);
+
+	return store->chunks[index];
+}
 
-	blk_in_chunk = blkno - CHUNK_TO_PAGE(chunkno);
+/*
+ * Find the page header of blkno in the chunk. Returns false if the page has
+ * no dead tuple.
+ */
+static inline bool
+svtm_chunk_find_page(SVTPagesChunk *chunk, BlockNumber blkno,
+					 SVTHeader *header_p)
+{
+	uint32	blk_in_chunk, bit;
+
+	blk_in_chunk = blkno - CHUNK_TO_PAGE(chunk->chunk_number);
 	bit = makebit(blk_in_chunk, 32);
 
+	SVTM_STATS_ADD(SVTM_STAT_BYTES, sizeof(chunk->bitmap));
 	if ((chunk->bitmap & bit) == 0)
+	{
+		SVTM_STATS_INC(SVTM_STAT_NO_PAGE);
 		return false;
-	index = svt_popcnt32(chunk->bitmap & (bit - 1));
-	header = chunk->headers[index];
+	}
+
+	*header_p = chunk->headers[svt_popcnt32(chunk->bitmap & (bit - 1))];
+	SVTM_STATS_ADD(SVTM_STAT_BYTES, sizeof(SVTHeader));
+	return true;
+}
+
+/*
+ * Check if the page described by header has the (zero-based) offset.
+ */
+static inline bool
+svtm_page_contains(SVTPagesChunk *chunk, SVTHeader header, OffsetNumber offset)
+{
+	uint8		   *bitmaps;
+	uint8		   *bitmap;
+	uint8	type;
+	uint8	bmoff, bmbit, bmlen, bmbyte;
+	uint8	bmstart, bbmoff, bbmbit, bbmbyte;
+	uint8	bbbmlen, bbbmoff, bbbmbit;
+	uint8	six1off, sbmoff;
+	bool	inverse, bitset;
 
 	type = HeaderType(header);
 	if (type == SVTH_single)
-		return offset == SingleItem(header);
+	{
+		SVTM_STATS_INC(SVTM_STAT_SINGLE);
+		bitset = (offset == SingleItem(header));
+		if (bitset)
+			SVTM_STATS_INC(SVTM_STAT_FOUND);
+		return bitset;
+	}
 
 	bitmaps = (uint8*)(chunk->headers + svt_popcnt32(chunk->bitmap));
 	bmoff = makeoff(offset, 8);
@@ -577,18 +941,31 @@ svtm_lookup(SVTm *store, ItemPointer tid)
 
 	bitmap = bitmaps + BitmapPosition(header);
 	bmlen = bitmap[0];
+	SVTM_STATS_ADD(SVTM_STAT_BYTES, 1);
 	if (bmoff >= bmlen)
+	{
+		SVTM_STATS_INC(type == SVTH_rawBitmap ? SVTM_STAT_RAW :
+					   type == SVTH_sparseBitmap ? SVTM_STAT_SPARSE :
+					   SVTM_STAT_INVERSE);
+		SVTM_STATS_INC(SVTM_STAT_PAST_BITMAP_END);
 		return false;
+	}
 
 	switch (type)
 	{
 		case SVTH_rawBitmap:
-			return (bitmap[bmoff+1] & bmbit) != 0;
+			SVTM_STATS_INC(SVTM_STAT_RAW);
+			SVTM_STATS_ADD(SVTM_STAT_BYTES, 1);
+			bitset = (bitmap[bmoff+1] & bmbit) != 0;
+			if (bitset)
+				SVTM_STATS_INC(SVTM_STAT_FOUND);
+			return bitset;
 
 		case SVTH_inverseBitmap:
 			inverse = true;
 			/* fallthrough */
 		case SVTH_sparseBitmap:
+			SVTM_STATS_INC(inverse ? SVTM_STAT_INVERSE : SVTM_STAT_SPARSE);
 			bmstart = bitmap[1] & 0x1f;
 			bbbmlen = bitmap[1] >> 5;
 			bitmap += 2;
@@ -597,27 +974,678 @@ svtm_lookup(SVTm *store, ItemPointer tid)
 			bbbmoff = makeoff(bbmoff, 8);
 			bbbmbit = makebit(bbmoff, 8);
 			/* check bit in second level index */
+			SVTM_STATS_ADD(SVTM_STAT_BYTES, 2 + bbbmoff);
 			if ((bitmap[bbbmoff] & bbbmbit) == 0)
+			{
+				SVTM_STATS_INC(SVTM_STAT_INDEX2_MISS);
+				if (inverse)
+					SVTM_STATS_INC(SVTM_STAT_FOUND);
 				return inverse;
+			}
 			/* calculate sparse offset into compressed first level index */
 			six1off = pg_popcount((char*)bitmap, bbbmoff) +
 						svt_popcnt8(bitmap[bbbmoff] & (bbbmbit-1));
 			/* check bit in first level index */
 			bbmbyte = bitmap[bbbmlen+six1off];
+			SVTM_STATS_ADD(SVTM_STAT_BYTES, six1off + 1);
 			if ((bbmbyte & bbmbit) == 0)
+			{
+				SVTM_STATS_INC(SVTM_STAT_INDEX1_MISS);
+				if (inverse)
+					SVTM_STATS_INC(SVTM_STAT_FOUND);
 				return inverse;
+			}
 			/* and sparse offset into compressed bitmap itself */
 			sbmoff = pg_popcount((char*)bitmap+bbbmlen, six1off) +
 						svt_popcnt8(bbmbyte & (bbmbit-1));
 			bmbyte = bitmap[bmstart + sbmoff];
+			SVTM_STATS_ADD(SVTM_STAT_BYTES, 1);
 			/* finally check bit in bitmap */
 			bitset = (bmbyte & bmbit) != 0;
+			if (bitset != inverse)
+				SVTM_STATS_INC(SVTM_STAT_FOUND);
 			return bitset != inverse;
 	}
 	Assert(false);
 	return false;
 }
 
+bool
+svtm_lookup(SVTm *store, ItemPointer tid)
+{
+	BlockNumber		blkno = ItemPointerGetBlockNumber(tid);
+	OffsetNumber	offset = ItemPointerGetOffsetNumber(tid) - 1;
+	SVTPagesChunk  *chunk;
+	SVTHeader		header;
+
+	if (blkno > store->lastblock)
+	{
+		SVTM_STATS_INC(SVTM_STAT_PAST_LAST_BLOCK);
+		return false;
+	}
+
+	chunk = svtm_find_chunk(store, PAGE_TO_CHUNK(blkno));
+	if (chunk == NULL)
+		return false;
+
+	if (!svtm_chunk_find_page(chunk, blkno, &header))
+		return false;
+
+	return svtm_page_contains(chunk, header, offset);
+}
+
+/*
+ * Look up ntids TIDs at once. The i'th bit of result is set if tids[i] is
+ * in the store, and the number of TIDs found is returned.
+ *
+ * The chunk and the page header resolved for a TID are reused for the
+ * following TIDs on the same chunk or page, so that a run of TIDs of the same
+ * heap page walks ixmap and the chunk only once.
+ */
+int
+svtm_lookup_batch(SVTm *store, ItemPointer tids, int ntids, uint64 *result)
+{
+	BlockNumber		curblk = InvalidBlockNumber;
+	uint32			curchunkno = INVALID_INDEX;
+	SVTPagesChunk  *chunk = NULL;
+	SVTHeader		header = 0;
+	bool			page_found = false;
+	int				nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	for (int i = 0; i < ntids; i++)
+	{
+		BlockNumber		blkno = ItemPointerGetBlockNumber(&tids[i]);
+		OffsetNumber	offset = ItemPointerGetOffsetNumber(&tids[i]) - 1;
+
+		if (blkno != curblk)
+		{
+			uint32	chunkno = PAGE_TO_CHUNK(blkno);
+
+			curblk = blkno;
+			page_found = false;
+
+			if (blkno > store->lastblock)
+			{
+				SVTM_STATS_INC(SVTM_STAT_PAST_LAST_BLOCK);
+				continue;
+			}
+
+			if (chunkno != curchunkno)
+			{
+				chunk = svtm_find_chunk(store, chunkno);
+				curchunkno = chunkno;
+			}
+
+			if (chunk != NULL)
+				page_found = svtm_chunk_find_page(chunk, blkno, &header);
+		}
+
+		if (page_found && svtm_page_contains(chunk, header, offset))
+		{
+			result[i / 64] |= UINT64CONST(1) << (i % 64);
+			nmatched++;
+		}
+	}
+
+	return nmatched;
+}
+
+/*
+ * Look up ntids TIDs like svtm_lookup_batch(), but SVTM_PIPELINE_GROUP TIDs
+ * at a time in stages, each stage prefetching for all TIDs of the group what
+ * the next stage is going to load: the ixmap word, the chunk pointer, the
+ * chunk header and the page bitmap. The cache misses of the TIDs of a group
+ * then overlap rather than following each other, which is what matters when
+ * the TIDs come in random order, as from a non-clustered index.
+ */
+int
+svtm_lookup_batch_pipelined(SVTm *store, ItemPointer tids, int ntids,
+							uint64 *result)
+{
+	int				nmatched = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	for (int base = 0; base < ntids; base += SVTM_PIPELINE_GROUP)
+	{
+		int				n = Min(ntids - base, SVTM_PIPELINE_GROUP);
+		ItemPointer		group = &tids[base];
+		uint32			indexes[SVTM_PIPELINE_GROUP];
+		SVTPagesChunk  *chunks[SVTM_PIPELINE_GROUP];
+		SVTHeader		headers[SVTM_PIPELINE_GROUP];
+		bool			found[SVTM_PIPELINE_GROUP];
+
+		/* stage 1: the chunk numbers, prefetching the ixmap words */
+		for (int i = 0; i < n; i++)
+		{
+			BlockNumber	blkno = ItemPointerGetBlockNumber(&group[i]);
+			uint32		chunkno = PAGE_TO_CHUNK(blkno);
+
+			if (blkno > store->lastblock)
+			{
+				SVTM_STATS_INC(SVTM_STAT_PAST_LAST_BLOCK);
+				indexes[i] = INVALID_INDEX;
+			}
+			else if (chunkno < store->firstrun.start)
+			{
+				SVTM_STATS_INC(SVTM_STAT_BEFORE_FIRST_RUN);
+				indexes[i] = INVALID_INDEX;
+			}
+			else if (chunkno < store->firstrun.end)
+			{
+				indexes[i] = chunkno - store->firstrun.start;
+				svtm_prefetch(&store->chunks[indexes[i]]);
+			}
+			else
+			{
+				/* resolved in the next stage */
+				indexes[i] = chunkno;
+				svtm_prefetch(&store->ixmap[makeoff(chunkno - store->firstrun.start, 32)]);
+			}
+		}
+
+		/* stage 2: the chunk indexes, prefetching the chunk pointers */
+		for (int i = 0; i < n; i++)
+		{
+			BlockNumber	blkno = ItemPointerGetBlockNumber(&group[i]);
+
+			if (indexes[i] == INVALID_INDEX ||
+				PAGE_TO_CHUNK(blkno) < store->firstrun.end)
+				continue;
+
+			indexes[i] = svtm_ixmap_index(store, indexes[i]);
+			if (indexes[i] != INVALID_INDEX)
+				svtm_prefetch(&store->chunks[indexes[i]]);
+		}
+
+		/* stage 3: the chunks, prefetching their headers */
+		for (int i = 0; i < n; i++)
+		{
+			chunks[i] = NULL;
+			if (indexes[i] == INVALID_INDEX)
+				continue;
+
+			chunks[i] = store->chunks[indexes[i]];
+			svtm_prefetch(chunks[i]);
+		}
+
+		/* stage 4: the page headers, prefetching the page bitmaps */
+		for (int i = 0; i < n; i++)
+		{
+			found[i] = false;
+			if (chunks[i] == NULL)
+				continue;
+
+			found[i] = svtm_chunk_find_page(chunks[i],
+											ItemPointerGetBlockNumber(&group[i]),
+											&headers[i]);
+			if (found[i] && HeaderType(headers[i]) != SVTH_single)
+				svtm_prefetch((uint8 *) (chunks[i]->headers +
+										 svt_popcnt32(chunks[i]->bitmap)) +
+							  BitmapPosition(headers[i]));
+		}
+
+		/* stage 5: the offsets */
+		for (int i = 0; i < n; i++)
+		{
+			int			pos = base + i;
+
+			if (found[i] &&
+				svtm_page_contains(chunks[i], headers[i],
+								   ItemPointerGetOffsetNumber(&group[i]) - 1))
+			{
+				result[pos / 64] |= UINT64CONST(1) << (pos % 64);
+				nmatched++;
+			}
+		}
+	}
+
+	return nmatched;
+}
+
+/*
+ * Return the index in store->chunks of the first chunk whose number is not
+ * less than chunkno, or store->nchunks if there is none. ixmap has a bit for
+ * every chunk, so this is the number of chunks before chunkno.
+ */
+static inline uint32
+svtm_chunk_rank(SVTm *store, uint32 chunkno)
+{
+	uint32	off, bit;
+
+	if (chunkno < store->firstrun.start)
+		return 0;
+
+	off = makeoff(chunkno - store->firstrun.start, 32);
+	if (off >= store->nmaps)
+		return store->nchunks;
+
+	bit = makebit(chunkno - store->firstrun.start, 32);
+
+	return store->ixmap[off].offset +
+		svt_popcnt32(store->ixmap[off].bitmap & (bit - 1));
+}
+
+/*
+ * Look up ntids TIDs like svtm_lookup_batch(), but the TIDs must be sorted in
+ * TID order, as they come from a btree index. The chunks are in chunk number
+ * order too, so we walk them alongside the TIDs: ixmap gives the next chunk
+ * having dead tuples at or after the chunk of the current TID, and the TIDs
+ * before it are skipped without looking at any chunk. Within a chunk, its
+ * page bitmap tells which pages of the TIDs have dead tuples. The bitmap of
+ * a page having more than a couple of TIDs is decoded once rather than
+ * walking the sparse index for each of them.
+ */
+int
+svtm_intersect_sorted(SVTm *store, ItemPointer tids, int ntids, uint64 *result)
+{
+	int				nmatched = 0;
+	int				i = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	while (i < ntids)
+	{
+		uint32			chunkno = PAGE_TO_CHUNK(ItemPointerGetBlockNumber(&tids[i]));
+		uint32			index;
+		SVTPagesChunk  *chunk;
+		BlockNumber		chunkend;
+
+		index = svtm_chunk_rank(store, chunkno);
+		if (index >= store->nchunks)
+			break;
+
+		chunk = store->chunks[index];
+		if (chunk->chunk_number != chunkno)
+		{
+			BlockNumber	next = CHUNK_TO_PAGE(chunk->chunk_number);
+
+			/* skip the TIDs of the chunks without dead tuples */
+			while (i < ntids && ItemPointerGetBlockNumber(&tids[i]) < next)
+				i++;
+			continue;
+		}
+
+		/* the pages of the chunk, walking the TIDs on them */
+		chunkend = CHUNK_TO_PAGE(chunkno) + PAGES_PER_CHUNK;
+		while (i < ntids && ItemPointerGetBlockNumber(&tids[i]) < chunkend)
+		{
+			BlockNumber		blkno = ItemPointerGetBlockNumber(&tids[i]);
+			int				start = i;
+			SVTHeader		header;
+
+			while (i < ntids && ItemPointerGetBlockNumber(&tids[i]) == blkno)
+			{
+				Assert(i == start ||
+					   ItemPointerGetOffsetNumber(&tids[i - 1]) <
+					   ItemPointerGetOffsetNumber(&tids[i]));
+				i++;
+			}
+			Assert(i == ntids || ItemPointerGetBlockNumber(&tids[i]) > blkno);
+
+			if (!svtm_chunk_find_page(chunk, blkno, &header))
+				continue;
+
+			if (i - start <= 2 || HeaderType(header) == SVTH_single)
+			{
+				for (int j = start; j < i; j++)
+				{
+					if (svtm_page_contains(chunk, header,
+										   ItemPointerGetOffsetNumber(&tids[j]) - 1))
+					{
+						result[j / 64] |= UINT64CONST(1) << (j % 64);
+						nmatched++;
+					}
+				}
+			}
+			else
+			{
+				uint8		rawbuf[BITMAP_PER_PAGE];
+				uint8	   *raw;
+				uint32		bmlen;
+
+				raw = svtm_page_raw_bitmap(chunk, header, rawbuf, &bmlen);
+				SVTM_STATS_INC(SVTM_STAT_DECODED);
+
+				for (int j = start; j < i; j++)
+				{
+					OffsetNumber	offset = ItemPointerGetOffsetNumber(&tids[j]) - 1;
+
+					if (makeoff(offset, 8) >= bmlen)
+						break;
+
+					if ((raw[makeoff(offset, 8)] & makebit(offset, 8)) != 0)
+					{
+						result[j / 64] |= UINT64CONST(1) << (j % 64);
+						nmatched++;
+						SVTM_STATS_INC(SVTM_STAT_FOUND);
+					}
+				}
+			}
+		}
+	}
+
+	return nmatched;
+}
+
+/*
+ * Iteration over the pages in block number order.
+ *
+ * Chunks are stored in chunk number order, and pages within a chunk in
+ * block number order, so we just walk them. The page bitmaps are decoded
+ * straight into the caller's buffer. The store must be finalized.
+ */
+struct SVTmIter
+{
+	SVTm	   *store;
+	uint32		chunkidx;	/* index of the next chunk in store->chunks */
+	SVTPagesChunk *chunk;	/* current chunk */
+	uint32		pagebits;	/* pages of the current chunk not returned yet */
+	uint32		pageidx;	/* index of the next page header in the chunk */
+};
+
+SVTmIter *
+svtm_begin_iterate(SVTm *store)
+{
+	SVTmIter   *iter = palloc0(sizeof(SVTmIter));
+
+	iter->store = store;
+
+	return iter;
+}
+
+/*
+ * Return the raw bitmap of the page described by header, which must not be a
+ * single item, setting *bmlen to its length in bytes. A raw bitmap page is
+ * returned in place, the others are decoded into raw, which must have room
+ * for BITMAP_PER_PAGE bytes.
+ */
+static uint8 *
+svtm_page_raw_bitmap(SVTPagesChunk *chunk, SVTHeader header, uint8 *raw,
+					 uint32 *bmlen)
+{
+	uint8	   *bitmap;
+	uint8		type;
+	uint32		i;
+
+	type = HeaderType(header);
+	Assert(type != SVTH_single);
+
+	bitmap = (uint8*)(chunk->headers + svt_popcnt32(chunk->bitmap)) +
+		BitmapPosition(header);
+	*bmlen = bitmap[0];
+	Assert(*bmlen <= BITMAP_PER_PAGE);
+
+	if (type == SVTH_rawBitmap)
+		return bitmap + 1;
+	else
+	{
+		uint8	bmstart = bitmap[1] & 0x1f;
+		uint8	bbbmlen = bitmap[1] >> 5;
+		uint8  *spix2, *spix1, *bytes;
+
+		bitmap += 2;
+		spix2 = bitmap;
+		spix1 = bitmap + bbbmlen;
+		bytes = bitmap + bmstart;
+
+		/*
+		 * Both indexes and the non-zero bytes are in the order of the raw
+		 * bitmap, so consume them sequentially.
+		 */
+		memset(raw, 0, *bmlen);
+		for (i = 0; i < bbbmlen * 8; i++)
+		{
+			uint8	six1;
+
+			if ((spix2[makeoff(i, 8)] & makebit(i, 8)) == 0)
+				continue;
+
+			six1 = *spix1++;
+			while (six1 != 0)
+			{
+				uint32	bmoff = i * 8 + pg_rightmost_one_pos32(six1);
+
+				Assert(bmoff < *bmlen);
+				raw[bmoff] = *bytes++;
+				six1 &= six1 - 1;
+			}
+		}
+
+		if (type == SVTH_inverseBitmap)
+		{
+			for (i = 0; i < *bmlen; i++)
+				raw[i] ^= 0xff;
+		}
+	}
+
+	return raw;
+}
+
+/*
+ * Decode the page described by header into one-based offset numbers, and
+ * return the number of them.
+ */
+static int
+svtm_page_decode(SVTPagesChunk *chunk, SVTHeader header, OffsetNumber *offsets)
+{
+	uint8		rawbuf[BITMAP_PER_PAGE];
+	uint8	   *raw;
+	uint32		bmlen;
+	uint32		i;
+	int			n = 0;
+
+	if (HeaderType(header) == SVTH_single)
+	{
+		offsets[0] = SingleItem(header) + 1;
+		return 1;
+	}
+
+	raw = svtm_page_raw_bitmap(chunk, header, rawbuf, &bmlen);
+
+	for (i = 0; i < bmlen; i++)
+	{
+		uint8	bmbyte = raw[i];
+
+		while (bmbyte != 0)
+		{
+			offsets[n++] = i * 8 + pg_rightmost_one_pos32(bmbyte) + 1;
+			bmbyte &= bmbyte - 1;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Return the next page and its offset numbers in ascending order. offsets
+ * must have room for MaxHeapTuplesPerPage offset numbers. Returns false if
+ * there are no more pages.
+ */
+bool
+svtm_iterate_next(SVTmIter *iter, BlockNumber *blkno, OffsetNumber *offsets,
+				  int *noffsets)
+{
+	SVTHeader	header;
+
+	while (iter->pagebits == 0)
+	{
+		if (iter->chunkidx >= iter->store->nchunks)
+			return false;
+
+		iter->chunk = iter->store->chunks[iter->chunkidx++];
+		iter->pagebits = iter->chunk->bitmap;
+		iter->pageidx = 0;
+	}
+
+	*blkno = CHUNK_TO_PAGE(iter->chunk->chunk_number) +
+		pg_rightmost_one_pos32(iter->pagebits);
+	header = iter->chunk->headers[iter->pageidx++];
+	iter->pagebits &= iter->pagebits - 1;
+
+	*noffsets = svtm_page_decode(iter->chunk, header, offsets);
+
+	return true;
+}
+
+void
+svtm_end_iterate(SVTmIter *iter)
+{
+	pfree(iter);
+}
+
+/*
+ * The serialized form of SVTm. The header is followed by the ixmap, the
+ * offsets of chunks from the beginning of the serialized form and the chunks
+ * themselves. A read-only SVTm can work directly on a serialized copy and
+ * only needs its own chunk pointers array.
+ */
+typedef struct SVTmSerialized
+{
+	BlockNumber	lastblock;
+	uint32		firstrun_start;
+	uint32		firstrun_end;
+	uint32		nchunks;
+	uint32		nmaps;
+	uint32		npages;
+	uint32		hcnt[4];
+	Size		total_size;
+} SVTmSerialized;
+
+/*
+ * Return the size of the chunk. Chunks don't remember their size, so we
+ * find the end of the last bitmap.
+ */
+static Size
+svtm_chunk_size(SVTPagesChunk *chunk)
+{
+	uint32	npages = svt_popcnt32(chunk->bitmap);
+	uint8  *bitmaps = (uint8*)(chunk->headers + npages);
+	uint32	end = 0;
+	uint32	i;
+
+	for (i = 0; i < npages; i++)
+	{
+		SVTHeader	header = chunk->headers[i];
+		uint8	   *bitmap;
+		uint32		len;
+		uint8		bbbmlen, sbmlen;
+
+		if (HeaderType(header) == SVTH_single)
+			continue;
+
+		bitmap = bitmaps + BitmapPosition(header);
+		if (HeaderType(header) == SVTH_rawBitmap)
+			len = bitmap[0] + 1;
+		else
+		{
+			/* non-zero bytes are indexed by bits in the first level index */
+			bbbmlen = bitmap[1] >> 5;
+			sbmlen = (bitmap[1] & 0x1f) - bbbmlen;
+			len = 2 + bbbmlen + sbmlen +
+				pg_popcount((char*)bitmap + 2 + bbbmlen, sbmlen);
+		}
+		end = Max(end, BitmapPosition(header) + len);
+	}
+
+	return offsetof(SVTPagesChunk, headers) + sizeof(SVTHeader)*npages + end;
+}
+
+#define SVTM_SERIALIZED_CHUNKS_START(nmaps, nchunks) \
+	(MAXALIGN(sizeof(SVTmSerialized)) + MAXALIGN(sizeof(IxMap) * (nmaps)) + \
+	 MAXALIGN(sizeof(uint64) * (nchunks)))
+
+/* The store must be finalized */
+Size
+svtm_serialized_size(SVTm *store)
+{
+	Size	size = SVTM_SERIALIZED_CHUNKS_START(store->nmaps, store->nchunks);
+	uint32	i;
+
+	for (i = 0; i < store->nchunks; i++)
+		size += INTALIGN(svtm_chunk_size(store->chunks[i]));
+
+	return size;
+}
+
+/*
+ * Write the serialized form of the finalized store into dest, which must have
+ * at least svtm_serialized_size() bytes.
+ */
+void
+svtm_serialize(SVTm *store, char *dest)
+{
+	SVTmSerialized *hdr = (SVTmSerialized *) dest;
+	IxMap  *ixmap;
+	uint64 *offsets;
+	Size	pos;
+	uint32	i;
+
+	hdr->lastblock = store->lastblock;
+	hdr->firstrun_start = store->firstrun.start;
+	hdr->firstrun_end = store->firstrun.end;
+	hdr->nchunks = store->nchunks;
+	hdr->nmaps = store->nmaps;
+	hdr->npages = store->npages;
+	memcpy(hdr->hcnt, store->hcnt, sizeof(hdr->hcnt));
+	hdr->total_size = store->total_size;
+
+	ixmap = (IxMap *) (dest + MAXALIGN(sizeof(SVTmSerialized)));
+	if (store->nmaps > 0)
+		memcpy(ixmap, store->ixmap, sizeof(IxMap) * store->nmaps);
+
+	offsets = (uint64 *) ((char *) ixmap +
+						  MAXALIGN(sizeof(IxMap) * store->nmaps));
+	pos = SVTM_SERIALIZED_CHUNKS_START(store->nmaps, store->nchunks);
+	for (i = 0; i < store->nchunks; i++)
+	{
+		Size	size = svtm_chunk_size(store->chunks[i]);
+
+		offsets[i] = pos;
+		memcpy(dest + pos, store->chunks[i], size);
+		pos += INTALIGN(size);
+	}
+}
+
+/*
+ * Return a read-only SVTm working on the serialized form at src. Only the
+ * chunk pointers array is allocated. src must be MAXALIGN'ed and outlive the
+ * returned store.
+ */
+SVTm *
+svtm_deserialize(char *src)
+{
+	SVTmSerialized *hdr = (SVTmSerialized *) src;
+	SVTm   *store = palloc0(sizeof(SVTm));
+	uint64 *offsets;
+	uint32	i;
+
+	store->lastblock = hdr->lastblock;
+	store->firstrun.start = hdr->firstrun_start;
+	store->firstrun.end = hdr->firstrun_end;
+	store->nchunks = hdr->nchunks;
+	store->nmaps = hdr->nmaps;
+	store->npages = hdr->npages;
+	memcpy(store->hcnt, hdr->hcnt, sizeof(store->hcnt));
+	store->total_size = hdr->total_size;
+	store->readonly = true;
+
+	store->ixmap = (IxMap *) (src + MAXALIGN(sizeof(SVTmSerialized)));
+	offsets = (uint64 *) ((char *) store->ixmap +
+						  MAXALIGN(sizeof(IxMap) * hdr->nmaps));
+
+	store->chunks = palloc(sizeof(SVTPagesChunk*) * Max(hdr->nchunks, 1));
+	for (i = 0; i < hdr->nchunks; i++)
+		store->chunks[i] = (SVTPagesChunk *) (src + offsets[i]);
+
+	/* the serialized form is not ours */
+	store->mem_used = sizeof(SVTm) + sizeof(SVTPagesChunk*) * Max(hdr->nchunks, 1);
+
+	return store;
+}
+
 void svtm_stats(SVTm *store)
 {
 	StringInfo s;
@@ -3,6 +3,8 @@
 
 /* Specialized Vacuum TID Map */
 typedef struct SVTm SVTm;
+typedef struct SVTmIter SVTmIter;
+typedef void (*svtm_limit_callback) (void *arg);
 
 SVTm *svtm_create(void);
 void svtm_free(SVTm *store);
@@ -13,7 +15,28 @@ void svtm_free(SVTm *store);
 void svtm_add_page(SVTm *store, const BlockNumber blkno,
 		const OffsetNumber *offnums, uint32 nitems);
 void svtm_finalize_addition(SVTm *store);
+/*
+ * Move the dead tuples of src, whose pages are all after the ones of store,
+ * to store and free src. Both must be finalized.
+ */
+void svtm_merge(SVTm *store, SVTm *src);
+void svtm_set_memory_limit(SVTm *store, Size limit,
+						   svtm_limit_callback callback, void *arg);
+Size svtm_memory_usage(SVTm *store);
 bool svtm_lookup(SVTm *store, ItemPointer tid);
+int svtm_lookup_batch(SVTm *store, ItemPointer tids, int ntids,
+					  uint64 *result);
+int svtm_lookup_batch_pipelined(SVTm *store, ItemPointer tids, int ntids,
+								uint64 *result);
+int svtm_intersect_sorted(SVTm *store, ItemPointer tids, int ntids,
+						  uint64 *result);
+Size svtm_serialized_size(SVTm *store);
+void svtm_serialize(SVTm *store, char *dest);
+SVTm *svtm_deserialize(char *src);
+SVTmIter *svtm_begin_iterate(SVTm *store);
+bool svtm_iterate_next(SVTmIter *iter, BlockNumber *blkno,
+					   OffsetNumber *offsets, int *noffsets);
+void svtm_end_iterate(SVTmIter *iter);
 void svtm_stats(SVTm *store);
 
 #endif
@@ -154,6 +154,43 @@ vtbm_lookup(VTbm *vtbm, ItemPointer tid)
 	return ((vtbm->bitmap[entry->offset + wordnum] & (1 << bitnum)) != 0);
 }
 
+/*
+ * Look up ntids TIDs sorted in TID order at once. The i'th bit of result is
+ * set if tids[i] is in the store, and the number of TIDs found is returned.
+ * Each block of the TIDs is looked up once, the bitmap of its entry serving
+ * all of its TIDs.
+ */
+int
+vtbm_intersect_sorted(VTbm *vtbm, ItemPointer tids, int ntids, uint64 *result)
+{
+	int nmatched = 0;
+	int i = 0;
+
+	memset(result, 0, sizeof(uint64) * ((ntids + 63) / 64));
+
+	while (i < ntids)
+	{
+		BlockNumber blk = ItemPointerGetBlockNumber(&(tids[i]));
+		DtEntry *entry = dttable_lookup(vtbm->dttable, blk);
+
+		for (; i < ntids && ItemPointerGetBlockNumber(&(tids[i])) == blk; i++)
+		{
+			OffsetNumber off = ItemPointerGetOffsetNumber(&(tids[i]));
+
+			if (!entry || entry->len <= off - 1)
+				continue;
+
+			if ((vtbm->bitmap[entry->offset + WORDNUM(off - 1)] & (1 << BITNUM(off - 1))) != 0)
+			{
+				result[i / 64] |= UINT64CONST(1) << (i % 64);
+				nmatched++;
+			}
+		}
+	}
+
+	return nmatched;
+}
+
 static inline void *
 dttable_allocate(dttable_hash *dttable, Size size)
 {
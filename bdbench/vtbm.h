@@ -8,6 +8,8 @@ void vtbm_free(VTbm *vtbm);
 void vtbm_add_tuples(VTbm *vtbm, const BlockNumber blkno,
 						const OffsetNumber *offnums, int nitems);
 bool vtbm_lookup(VTbm *vtbm, ItemPointer tid);
+int vtbm_intersect_sorted(VTbm *vtbm, ItemPointer tids, int ntids,
+						  uint64 *result);
 void vtbm_stats(VTbm *vtbm);
 void vtbm_dump(VTbm *vtbm);
 void vtbm_dump_blk(VTbm *vtbm, BlockNumber blkno);
@@ -10,3 +10,16 @@ OUT min_order regtype[])
 RETURNS SETOF record
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION suggest_col_order(
+IN schema name,
+OUT relid regclass,
+OUT natts int,
+OUT current_size bigint,
+OUT reltuples float4,
+OUT optimal_size bigint,
+OUT saved_bytes bigint,
+OUT optimal_order name[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
@@ -9,33 +9,74 @@
 
 #include "postgres.h"
 
+#include "access/genam.h"
 #include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "access/table.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_statistic.h"
 #include "catalog/pg_type.h"
 #include "fmgr.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "tcop/utility.h"
+#include "utils/acl.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
+#include "utils/tuplestore.h"
 #include "utils/snapmgr.h"
 #include "utils/ps_status.h"
 #include "utils/memutils.h"
 
 PG_MODULE_MAGIC;
 
-Size minSize = INT_MAX;
-List *minOrder = NIL;
-
 bool col_order_debug_enabled = false;
 
+/*
+ * Every alignment divides this, so the padding before a column only depends
+ * on the offset modulo OFFSET_MOD.
+ */
+#define OFFSET_MOD	8
+
+/* The maximum number of states compute_col_order_dp() solves */
+#define MAX_DP_STATES	(32 * 1024 * 1024)
+
+/*
+ * Columns with the same alignment and the same length modulo OFFSET_MOD are
+ * interchangeable as far as padding is concerned.
+ */
+typedef struct ColumnClass
+{
+	char	typalign;
+	int		lenmod;			/* length modulo OFFSET_MOD */
+	int		count;			/* number of columns */
+	int		nahead;			/* of them put first, see compute_col_order_dp() */
+	int		dimsize;		/* number of distinct counts in the DP table */
+	Size	stride;			/* of the count in the DP state index */
+} ColumnClass;
+
+/* What compute_col_order_dp() needs to know about a column */
+typedef struct ColumnSpec
+{
+	Oid		typid;
+	char	typalign;
+	Size	length;
+} ColumnSpec;
+
 PG_FUNCTION_INFO_V1(compute_col_order);
+PG_FUNCTION_INFO_V1(suggest_col_order);
 
 void _PG_init(void);
-static void compute_col_order_recurse(List *target, List *remain);
+static bool compute_col_order_dp(ColumnSpec *cols, int ncols, bool merge_char,
+								 int *order);
+static void compute_col_order_greedy(ColumnSpec *cols, int ncols, int *order);
 static Oid *get_type_oid_contents(ArrayType *array, int *numitems);
-static Size compute_data_size(List *types);
+static Size compute_data_size(ColumnSpec *cols, int *order, int ncols);
 
 void
 _PG_init(void)
@@ -51,22 +92,17 @@ _PG_init(void)
 }
 
 static void
-dump_order(List *l, Size size, char *msg)
+dump_order(ColumnSpec *cols, int *order, int ncols, Size size, char *msg)
 {
-	ListCell *cell;
 	StringInfoData buf;
 
 	initStringInfo(&buf);
-	foreach(cell, l)
-	{
-		Form_pg_type type = (Form_pg_type) lfirst(cell);
-		appendStringInfo(&buf, "%u ", type->oid);
-	}
+	for (int i = 0; i < ncols; i++)
+		appendStringInfo(&buf, "%u ", cols[order[i]].typid);
 
-	elog(NOTICE, "%s: %lu %s (minSize %lu)",
+	elog(NOTICE, "%s: %lu %s",
 		 buf.data, size,
-		 msg == NULL ? "" : msg,
-		 minSize);
+		 msg == NULL ? "" : msg);
 	pfree(buf.data);
 }
 
@@ -122,94 +158,315 @@ get_type_oid_contents(ArrayType *array, int *numitems)
 	return values;
 }
 
+static int
+column_padding(int offset, char typalign)
+{
+	return att_align_nominal(offset, typalign) - offset;
+}
+
 /*
- * Compute column definition order with minimum length.
+ * Compute column definition order with minimum length, which is the first
+ * order with the minimum length in the lexicographic order of the positions
+ * in cols, and set the positions in that order to order.  Return false if
+ * there are too many states to compute.
+ *
+ * Since the length is the sum of the column lengths plus the padding, we
+ * minimize the padding.  The padding needed for the remaining columns only
+ * depends on how many of them are left in each ColumnClass and the current
+ * offset modulo OFFSET_MOD, so we compute the minimum padding of every such
+ * state from the one with no columns left, and then build the order by
+ * picking the first remaining column that leads to a state achieving it.
+ *
+ * A class whose length is a multiple of OFFSET_MOD costs the same with one
+ * column or more left, since the others can follow the first one without
+ * padding, so we only distinguish whether such a class is empty.
+ *
+ * If merge_char is true, the columns with 'c' alignment, which never need
+ * padding, of each class are put first in groups whose lengths add up to a
+ * multiple of OFFSET_MOD, so that the offset after them is still 0, and only
+ * the rest of them, fewer than OFFSET_MOD, are left to order.  This takes at
+ * most OFFSET_MOD counts per class, e.g. for the short varlenas, but the
+ * order is not always the minimum since the grouped columns can't fill the
+ * padding of the others.
  */
-static void
-compute_col_order_recurse(List *target, List *remain)
+static bool
+compute_col_order_dp(ColumnSpec *cols, int ncols, bool merge_char, int *order)
 {
-	ListCell *lc;
-	Size size;
-	int n = 0;
+	int		   *col_class;
+	bool	   *used;
+	ColumnClass *classes;
+	int			nclasses = 0;
+	int		   *counts;
+	uint16	   *padding;
+	Size		nvectors = 1;
+	Size		idx;
+	int			offset;
+	int			nahead = 0;
+	int			i;
+	int			k;
+
+	col_class = (int *) palloc(sizeof(int) * Max(ncols, 1));
+	used = (bool *) palloc0(sizeof(bool) * Max(ncols, 1));
+	classes = (ColumnClass *) palloc(sizeof(ColumnClass) * Max(ncols, 1));
+
+	/* Classify the columns */
+	for (i = 0; i < ncols; i++)
+	{
+		int		lenmod = cols[i].length % OFFSET_MOD;
 
-	/* compute col size so far */
-	size = compute_data_size(target);
+		for (k = 0; k < nclasses; k++)
+		{
+			if (classes[k].typalign == cols[i].typalign &&
+				classes[k].lenmod == lenmod)
+				break;
+		}
 
-	/* computed size of all columns */
-	if (remain == NIL)
+		if (k == nclasses)
+		{
+			classes[k].typalign = cols[i].typalign;
+			classes[k].lenmod = lenmod;
+			classes[k].count = 0;
+			classes[k].nahead = 0;
+			nclasses++;
+		}
+
+		classes[k].count++;
+		col_class[i] = k;
+	}
+
+	/*
+	 * Take out the groups of 'c' columns.  The lengths of OFFSET_MOD / gcd
+	 * of them add up to a multiple of OFFSET_MOD.
+	 */
+	if (merge_char)
 	{
-		if (col_order_debug_enabled)
+		for (k = 0; k < nclasses; k++)
 		{
-			if (size < minSize)
-				dump_order(target, size, "(selected)");
-			else
-				dump_order(target, size, "(not selected)");
+			int		group;
+
+			if (classes[k].typalign != 'c' || classes[k].lenmod == 0)
+				continue;
+
+			group = OFFSET_MOD;
+			while ((classes[k].lenmod * group / 2) % OFFSET_MOD == 0)
+				group /= 2;
+
+			classes[k].nahead = classes[k].count - classes[k].count % group;
+			classes[k].count -= classes[k].nahead;
 		}
+	}
+
+	/* Compute the strides of the state index */
+	for (k = 0; k < nclasses; k++)
+	{
+		classes[k].dimsize = (classes[k].lenmod == 0) ? 2 : classes[k].count + 1;
+		classes[k].stride = nvectors;
 
-		/* update minimun size and order */
-		if (size < minSize)
+		if (nvectors > MAX_DP_STATES / OFFSET_MOD / classes[k].dimsize)
 		{
-			minSize = size;
-			minOrder = list_copy(target);
+			pfree(col_class);
+			pfree(used);
+			pfree(classes);
+			return false;
 		}
-		return;
+
+		nvectors *= classes[k].dimsize;
 	}
 
-	/* quick exit, if the size so far is greater than minimun size */
-	if (minSize < size)
+	/*
+	 * padding[idx * OFFSET_MOD + offset] is the minimum padding needed for the
+	 * remaining columns of the state idx, starting at offset modulo
+	 * OFFSET_MOD, including the padding at the end for MAXALIGN.  Removing a
+	 * column from a state makes the index smaller, so we can fill them in the
+	 * index order.
+	 */
+	padding = (uint16 *) palloc(sizeof(uint16) * nvectors * OFFSET_MOD);
+	for (offset = 0; offset < OFFSET_MOD; offset++)
+		padding[offset] = MAXALIGN(offset) - offset;
+
+	for (idx = 1; idx < nvectors; idx++)
 	{
-		if (col_order_debug_enabled)
-			dump_order(target, size, "(skipped)");
+		CHECK_FOR_INTERRUPTS();
+
+		for (offset = 0; offset < OFFSET_MOD; offset++)
+		{
+			int		min = PG_INT32_MAX;
 
-		return;
+			for (k = 0; k < nclasses; k++)
+			{
+				int		pad;
+				int		next;
+
+				if ((idx / classes[k].stride) % classes[k].dimsize == 0)
+					continue;
+
+				pad = column_padding(offset, classes[k].typalign);
+				next = (offset + pad + classes[k].lenmod) % OFFSET_MOD;
+				pad += padding[(idx - classes[k].stride) * OFFSET_MOD + next];
+
+				if (pad < min)
+					min = pad;
+			}
+
+			padding[idx * OFFSET_MOD + offset] = (uint16) min;
+		}
+	}
+
+	/* Build the order, starting with the groups of 'c' columns */
+	counts = (int *) palloc(sizeof(int) * Max(nclasses, 1));
+	for (k = 0; k < nclasses; k++)
+		counts[k] = classes[k].nahead;
+
+	for (i = 0; i < ncols; i++)
+	{
+		if (counts[col_class[i]] > 0)
+		{
+			order[nahead++] = i;
+			used[i] = true;
+			counts[col_class[i]]--;
+		}
+	}
+
+	for (k = 0; k < nclasses; k++)
+		counts[k] = classes[k].count;
+
+	idx = nvectors - 1;
+	offset = 0;
+	for (int n = nahead; n < ncols; n++)
+	{
+		for (i = 0; i < ncols; i++)
+		{
+			ColumnClass *class = &(classes[col_class[i]]);
+			Size	next_idx;
+			int		pad;
+			int		next;
+
+			if (used[i])
+				continue;
+
+			pad = column_padding(offset, class->typalign);
+			next = (offset + pad + class->lenmod) % OFFSET_MOD;
+
+			/* The index doesn't change until the last column of the class */
+			next_idx = idx;
+			if (class->lenmod != 0 || counts[col_class[i]] == 1)
+				next_idx -= class->stride;
+
+			if (pad + padding[next_idx * OFFSET_MOD + next] ==
+				padding[idx * OFFSET_MOD + offset])
+			{
+				order[n] = i;
+				used[i] = true;
+				counts[col_class[i]]--;
+				idx = next_idx;
+				offset = next;
+				break;
+			}
+		}
 	}
 
 	if (col_order_debug_enabled)
-		dump_order(target, size, NULL);
+		elog(NOTICE, "%d columns in %d classes, %lu states",
+			 ncols, nclasses, nvectors * OFFSET_MOD);
+
+	pfree(col_class);
+	pfree(used);
+	pfree(classes);
+	pfree(counts);
+	pfree(padding);
+
+	return true;
+}
+
+/*
+ * Compute a column definition order without looking for the minimum, for
+ * when compute_col_order_dp() can't: the columns in the descending order of
+ * alignment, each preceded by the longest 'c' columns fitting in the padding
+ * before it, and then the rest of the 'c' columns.
+ */
+static void
+compute_col_order_greedy(ColumnSpec *cols, int ncols, int *order)
+{
+	static const char aligns[] = {'d', 'i', 's'};
+	int		   *chars;
+	bool	   *used;
+	int			nchars = 0;
+	int			n = 0;
+	Size		offset = 0;
+
+	chars = (int *) palloc(sizeof(int) * Max(ncols, 1));
+	used = (bool *) palloc0(sizeof(bool) * Max(ncols, 1));
+
+	/* The 'c' columns in the descending order of length, by insertion */
+	for (int i = 0; i < ncols; i++)
+	{
+		int		j;
+
+		if (cols[i].typalign != 'c')
+			continue;
+
+		for (j = nchars; j > 0 && cols[chars[j - 1]].length < cols[i].length; j--)
+			chars[j] = chars[j - 1];
+		chars[j] = i;
+		nchars++;
+	}
 
-	foreach(lc, remain)
+	for (int a = 0; a < lengthof(aligns); a++)
 	{
-		List *t = NIL, *r = NIL;
-		Form_pg_type type = (Form_pg_type) lfirst(lc);
-		Form_pg_type del;
+		for (int i = 0; i < ncols; i++)
+		{
+			if (cols[i].typalign != aligns[a])
+				continue;
+
+			/* Fill the padding with the longest 'c' columns that fit */
+			for (int j = 0; j < nchars; j++)
+			{
+				Size	pad = att_align_nominal(offset, aligns[a]) - offset;
 
-		t = list_copy(target);
-		r = list_copy(remain);
+				if (pad == 0)
+					break;
 
-		/* copy a type from remain... */
-		t = lappend(t, type);
+				if (used[chars[j]] || cols[chars[j]].length > pad)
+					continue;
 
-		/* and then delete it from remain */
-		del = (Form_pg_type) list_nth(r, n);
-		r = list_delete_ptr(r, (void *) del);
+				order[n++] = chars[j];
+				used[chars[j]] = true;
+				offset += cols[chars[j]].length;
+			}
 
-		compute_col_order_recurse(t, r);
-		list_free(t);
-		list_free(r);
-		n++;
+			order[n++] = i;
+			offset = att_align_nominal(offset, aligns[a]) + cols[i].length;
+		}
 	}
+
+	for (int j = 0; j < nchars; j++)
+	{
+		if (!used[chars[j]])
+			order[n++] = chars[j];
+	}
+	Assert(n == ncols);
+
+	pfree(chars);
+	pfree(used);
 }
 
 /*
  * Brrowed heap_compute_data_size() in heaptuple.c
+ *
+ * Compute the length of the columns in the given order, in cols' order if
+ * order is NULL.
  */
 static Size
-compute_data_size(List *types)
+compute_data_size(ColumnSpec *cols, int *order, int ncols)
 {
 	Size data_length = 0;
-	ListCell *lc;
 
-	foreach (lc, types)
+	for (int i = 0; i < ncols; i++)
 	{
-		Form_pg_type type = (Form_pg_type) lfirst(lc);
-		data_length = att_align_nominal(data_length, type->typalign);
-		if (type->typlen == -1)
-		{
-			/* Assume varlena size is fixed size, 100 */
-			data_length += 100;
-		}
-		else
-			data_length += type->typlen;
+		ColumnSpec *col = &(cols[order ? order[i] : i]);
+
+		data_length = att_align_nominal(data_length, col->typalign);
+		data_length += col->length;
 	}
 	return MAXALIGN(data_length);
 }
@@ -223,25 +480,22 @@ compute_col_order(PG_FUNCTION_ARGS)
 	int		ntypes;
 	Oid		*oids;
 	Datum	*res_oids;
-	List	*types = NIL;	/* list of Form_pg_attribute */
-	ListCell *lc;
+	ColumnSpec *cols;
+	int		*order;
+	Size	minSize;
 	int		i;
 	Datum	values[2];
 	bool	nulls[2];
 
-	/* Initialize */
-	minSize = INT_MAX;
-	minOrder = NIL;
-
 	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 		elog(ERROR, "return type must be a rowtype");
 
 	oids = get_type_oid_contents(type_array, &ntypes);
 
-	/* get list of Form_pg_type */
-	for (int i = 0; i < ntypes; i++)
+	/* get the alignment and the length of the types */
+	cols = (ColumnSpec *) palloc(sizeof(ColumnSpec) * Max(ntypes, 1));
+	for (i = 0; i < ntypes; i++)
 	{
-		Form_pg_type	type = (Form_pg_type) palloc(sizeof(FormData_pg_type));
 		Form_pg_type	t;
 		HeapTuple		htup;
 
@@ -252,33 +506,395 @@ compute_col_order(PG_FUNCTION_ARGS)
 		/* Get pg_type tuple */
 		t = (Form_pg_type) GETSTRUCT(htup);
 
-		/* Copy */
-		memcpy(type, t, sizeof(FormData_pg_type));
+		cols[i].typid = t->oid;
+		cols[i].typalign = t->typalign;
 
-		/* Append it to the list */
-		types = lappend(types, type);
+		/* Assume varlena size is fixed size, 100 */
+		if (t->typlen == -1)
+			cols[i].length = 100;
+		else
+			cols[i].length = t->typlen;
 
 		ReleaseSysCache(htup);
 	}
 
 	/* compute the smallest column definition order */
-	compute_col_order_recurse(NIL, types);
+	order = (int *) palloc(sizeof(int) * Max(ntypes, 1));
+	if (!compute_col_order_dp(cols, ntypes, false, order))
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many combinations of column alignments and lengths to compute"),
+				 errdetail("The number of states exceeds the limit of %d.",
+						   MAX_DP_STATES)));
+
+	minSize = compute_data_size(cols, order, ntypes);
+
+	if (col_order_debug_enabled)
+		dump_order(cols, order, ntypes, minSize, "(selected)");
 
 	/* make oid list in form of Datum for arrray construction */
-	i = 0;
-	res_oids = palloc(sizeof(Datum) * ntypes);
-	foreach(lc, minOrder)
-	{
-		Form_pg_type t = (Form_pg_type) lfirst(lc);
-		res_oids[i++] = UInt32GetDatum(t->oid);
-	}
+	res_oids = palloc(sizeof(Datum) * Max(ntypes, 1));
+	for (i = 0; i < ntypes; i++)
+		res_oids[i] = ObjectIdGetDatum(cols[order[i]].typid);
 
 	memset(nulls, 0, sizeof(nulls));
 	values[0] = Int64GetDatum(minSize);
-	values[1] = PointerGetDatum(construct_array(res_oids, i,
+	values[1] = PointerGetDatum(construct_array(res_oids, ntypes,
 												REGTYPEOID, sizeof(Oid), true, 'i'));
 
 	/* built result heap tuple and return */
 	resultTuple = heap_form_tuple(tupdesc, values, nulls);
 	return HeapTupleGetDatum(resultTuple);
 }
+
+/*
+ * Columns whose values are NULL at least this often are assumed to be NULL
+ * by suggest_col_order().
+ */
+#define NULL_FRAC_THRESHOLD		0.5
+
+/*
+ * Fallback width of a varlena column without statistics, the same as
+ * get_typavgwidth() but without looking up the type again since pg_attribute
+ * has what we need.
+ */
+static int32
+varlena_width_estimate(Form_pg_attribute att)
+{
+	int32		maxwidth = type_maximum_size(att->atttypid, att->atttypmod);
+
+	if (maxwidth > 0)
+	{
+		if (att->atttypid == BPCHAROID || maxwidth <= 32)
+			return maxwidth;
+		if (maxwidth < 1000)
+			return 32 + (maxwidth - 32) / 2;
+		return 32 + (1000 - 32) / 2;
+	}
+
+	return 32;
+}
+
+/*
+ * Fill col with the alignment and the length of the values of att, using
+ * the statistics of the column if we may read them.  Return the fraction of
+ * NULLs.
+ */
+static float4
+get_column_spec(Form_pg_attribute att, bool use_stats, ColumnSpec *col)
+{
+	HeapTuple	htup = NULL;
+	float4		null_frac = 0;
+	int32		width = -1;
+
+	if (use_stats)
+		htup = SearchSysCache3(STATRELATTINH,
+							   ObjectIdGetDatum(att->attrelid),
+							   Int16GetDatum(att->attnum),
+							   BoolGetDatum(false));
+	if (HeapTupleIsValid(htup))
+	{
+		Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(htup);
+
+		null_frac = stats->stanullfrac;
+		width = stats->stawidth;
+		ReleaseSysCache(htup);
+	}
+
+	col->typid = att->atttypid;
+	col->typalign = att->attalign;
+
+	if (att->attlen > 0)
+		col->length = att->attlen;
+	else if (att->attlen == -1)
+	{
+		/*
+		 * The average width in the statistics is of the values as stored, so
+		 * it includes the varlena header.  Short values, up to
+		 * VARATT_SHORT_MAX bytes with the header, are stored with a 1-byte
+		 * header and without alignment unless the storage is plain.
+		 */
+		if (width < 0)
+		{
+			width = varlena_width_estimate(att);
+			if (att->attstorage != 'p' &&
+				width - VARHDRSZ + VARHDRSZ_SHORT <= VARATT_SHORT_MAX)
+				width = width - VARHDRSZ + VARHDRSZ_SHORT;
+		}
+
+		if (att->attstorage != 'p' && width <= VARATT_SHORT_MAX)
+			col->typalign = 'c';
+
+		col->length = width;
+	}
+	else
+	{
+		/* cstring */
+		col->length = (width < 0) ? 32 : width;
+	}
+
+	return null_frac;
+}
+
+/* Tuple length with a header for natts columns and the data of data_len */
+static Size
+tuple_size(int natts, bool hasnulls, Size data_len)
+{
+	Size		hoff = SizeofHeapTupleHeader;
+
+	if (hasnulls)
+		hoff += BITMAPLEN(natts);
+
+	return MAXALIGN(hoff) + data_len;
+}
+
+/*
+ * Compare the current and the minimum tuple length of every table and
+ * materialized view in the given schema, estimated from the statistics of
+ * their columns.
+ */
+Datum
+suggest_col_order(PG_FUNCTION_ARGS)
+{
+	Name		schema = PG_GETARG_NAME(0);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Oid			nspid = get_namespace_oid(NameStr(*schema), false);
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext rel_ctx;
+	MemoryContext old_ctx;
+	Relation	pg_class;
+	SysScanDesc scan;
+	ScanKeyData key;
+	HeapTuple	classtup;
+	Oid		   *relids;
+	float4	   *reltuples;
+	int			nrels = 0;
+	int			maxrels = 64;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a rowtype");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	old_ctx = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(old_ctx);
+
+	/* Collect the tables in the schema */
+	ScanKeyInit(&key,
+				Anum_pg_class_relnamespace,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(nspid));
+
+	relids = (Oid *) palloc(sizeof(Oid) * maxrels);
+	reltuples = (float4 *) palloc(sizeof(float4) * maxrels);
+
+	pg_class = table_open(RelationRelationId, AccessShareLock);
+	scan = systable_beginscan(pg_class, InvalidOid, false, NULL, 1, &key);
+	while (HeapTupleIsValid(classtup = systable_getnext(scan)))
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(classtup);
+
+		if (classForm->relkind != RELKIND_RELATION &&
+			classForm->relkind != RELKIND_MATVIEW)
+			continue;
+
+		if (nrels >= maxrels)
+		{
+			maxrels *= 2;
+			relids = (Oid *) repalloc(relids, sizeof(Oid) * maxrels);
+			reltuples = (float4 *) repalloc(reltuples, sizeof(float4) * maxrels);
+		}
+
+		/* reltuples is -1 if the table has never been vacuumed or analyzed */
+		relids[nrels] = classForm->oid;
+		reltuples[nrels] = Max(classForm->reltuples, 0);
+		nrels++;
+	}
+	systable_endscan(scan);
+	table_close(pg_class, AccessShareLock);
+
+	/* All the memory for a table is freed before the next one */
+	rel_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									"suggest_col_order",
+									ALLOCSET_DEFAULT_SIZES);
+
+	for (int r = 0; r < nrels; r++)
+	{
+		Oid			relid = relids[r];
+		float4		ntuples = reltuples[r];
+		CatCList   *attlist;
+		int			nmembers;
+		ColumnSpec *cols;
+		NameData   *names;
+		int		   *order;
+		int			ncols = 0;
+		int			nnulls = 0;
+		int			nattrs = 0;
+		bool		hasnulls = false;
+		bool		hasdropped = false;
+		bool		use_stats;
+		Size		cur_size;
+		Size		min_size;
+		Form_pg_attribute *atts;
+		Datum	   *res_names;
+		int			n;
+		Datum		values[7];
+		bool		nulls[7];
+
+		CHECK_FOR_INTERRUPTS();
+
+		MemoryContextReset(rel_ctx);
+		old_ctx = MemoryContextSwitchTo(rel_ctx);
+
+		/* Same as pg_stats, don't show the statistics of what we can't read */
+		use_stats = (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) == ACLCHECK_OK);
+
+		attlist = SearchSysCacheList1(ATTNUM, ObjectIdGetDatum(relid));
+		nmembers = attlist->n_members;
+
+		/*
+		 * The columns assumed to be NULL go after the others so that we can
+		 * compute the length of both orders from the same array.
+		 */
+		cols = (ColumnSpec *) palloc(sizeof(ColumnSpec) * Max(nmembers, 1));
+		names = (NameData *) palloc(sizeof(NameData) * Max(nmembers, 1));
+		order = (int *) palloc(sizeof(int) * Max(nmembers, 1));
+
+		for (int i = 0; i < nmembers; i++)
+		{
+			Form_pg_attribute att =
+				(Form_pg_attribute) GETSTRUCT(&attlist->members[i]->tuple);
+
+			if (att->attnum > 0)
+				nattrs = Max(nattrs, att->attnum);
+		}
+
+		/* Index the list by attnum, which the list may not be in order of */
+		atts = (Form_pg_attribute *) palloc0(sizeof(Form_pg_attribute) * (nattrs + 1));
+		for (int i = 0; i < nmembers; i++)
+		{
+			Form_pg_attribute att =
+				(Form_pg_attribute) GETSTRUCT(&attlist->members[i]->tuple);
+
+			if (att->attnum > 0)
+				atts[att->attnum] = att;
+		}
+
+		for (int attnum = 1; attnum <= nattrs; attnum++)
+		{
+			Form_pg_attribute att = atts[attnum];
+			ColumnSpec	col;
+			float4		null_frac;
+
+			/* New tuples have NULL for dropped columns */
+			if (att == NULL || att->attisdropped)
+			{
+				hasdropped = true;
+				continue;
+			}
+
+			null_frac = get_column_spec(att,
+										use_stats ||
+										pg_attribute_aclcheck(relid, attnum, GetUserId(),
+															  ACL_SELECT) == ACLCHECK_OK,
+										&col);
+			if (null_frac > 0)
+				hasnulls = true;
+
+			if (null_frac >= NULL_FRAC_THRESHOLD)
+			{
+				/* fill from the end */
+				nnulls++;
+				cols[nmembers - nnulls] = col;
+				names[nmembers - nnulls] = att->attname;
+			}
+			else
+			{
+				cols[ncols] = col;
+				names[ncols] = att->attname;
+				ncols++;
+			}
+		}
+
+		ReleaseSysCacheList(attlist);
+
+		if (ncols + nnulls == 0)
+		{
+			MemoryContextSwitchTo(old_ctx);
+			continue;
+		}
+
+		/* Current length, with the bitmap covering the dropped columns too */
+		cur_size = tuple_size(nattrs, hasnulls || hasdropped,
+							  compute_data_size(cols, NULL, ncols));
+
+		/*
+		 * Too many classes for the exact order, as with many varlenas of
+		 * various widths.  Group the 'c' columns, and failing that, take the
+		 * greedy order.  Either may be longer than the current order, which
+		 * we keep then.
+		 */
+		if (!compute_col_order_dp(cols, ncols, false, order))
+		{
+			if (!compute_col_order_dp(cols, ncols, true, order))
+				compute_col_order_greedy(cols, ncols, order);
+
+			if (compute_data_size(cols, order, ncols) >
+				compute_data_size(cols, NULL, ncols))
+			{
+				for (int i = 0; i < ncols; i++)
+					order[i] = i;
+			}
+		}
+
+		min_size = tuple_size(ncols + nnulls, hasnulls,
+							  compute_data_size(cols, order, ncols));
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(relid);
+		values[1] = Int32GetDatum(ncols + nnulls);
+		values[2] = Int64GetDatum(cur_size);
+		values[3] = Float4GetDatum(ntuples);
+
+		res_names = (Datum *) palloc(sizeof(Datum) * (ncols + nnulls));
+		for (n = 0; n < ncols; n++)
+			res_names[n] = NameGetDatum(&names[order[n]]);
+
+		/* The columns assumed to be NULL, in attnum order */
+		for (int j = 0; j < nnulls; j++)
+			res_names[n++] = NameGetDatum(&names[nmembers - 1 - j]);
+
+		values[4] = Int64GetDatum(min_size);
+		values[5] = Int64GetDatum((int64) (((double) cur_size - (double) min_size) *
+										   ntuples));
+		values[6] = PointerGetDatum(construct_array(res_names, ncols + nnulls,
+													NAMEOID, NAMEDATALEN,
+													false, 'c'));
+
+		MemoryContextSwitchTo(old_ctx);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	MemoryContextDelete(rel_ctx);
+
+	return (Datum) 0;
+}
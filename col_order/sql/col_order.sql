@@ -2,3 +2,37 @@ CREATE EXTENSION col_order;
 
 SELECT * FROM compute_col_order(ARRAY['bigint'::regtype, 'bigint', 'bigint', 'bigint', 'bigint', 'bigint', 'bigint', 'bigint']);
 SELECT * FROM compute_col_order(ARRAY['bigint'::regtype, 'text', 'timestamptz', 'jsonb', 'timestamp', 'date']);
+SELECT * FROM compute_col_order(ARRAY['boolean'::regtype, 'bigint', 'smallint', 'integer', 'boolean', 'time with time zone', 'smallint', 'uuid', 'date', 'text']);
+-- wide table, which the exhaustive search could never finish
+SELECT min_size, array_length(min_order, 1)
+FROM compute_col_order((SELECT array_agg((ARRAY['boolean', 'bigint', 'smallint', 'integer', 'text', 'time with time zone'])[i % 6 + 1]::regtype ORDER BY i)
+                        FROM generate_series(1, 60) i));
+-- suggest column orders of the tables in a schema from their statistics
+CREATE SCHEMA col_order_test;
+CREATE TABLE col_order_test.t1 (a boolean, b bigint, c smallint, d integer, e text);
+INSERT INTO col_order_test.t1 SELECT true, i, 1, i, 'abcdefghij' FROM generate_series(1, 100) i;
+CREATE TABLE col_order_test.t2 (id integer, dropme bigint, note text, flag boolean, ts bigint, n smallint);
+ALTER TABLE col_order_test.t2 DROP COLUMN dropme;
+INSERT INTO col_order_test.t2 SELECT i, NULL, true, i, 1 FROM generate_series(1, 100) i;
+ANALYZE col_order_test.t1, col_order_test.t2;
+SELECT * FROM suggest_col_order('col_order_test') ORDER BY relid::text;
+DROP SCHEMA col_order_test CASCADE;
+-- a wide table with short texts of every width, too many for the exact order
+CREATE SCHEMA col_order_wide;
+DO $$
+BEGIN
+  EXECUTE 'CREATE TABLE col_order_wide.wide (' ||
+    (SELECT string_agg(format('t%s text, ', i), '') FROM generate_series(1, 48) i) ||
+    (SELECT string_agg(format('i%s integer, b%s bigint, s%s smallint', i, i, i), ', ')
+     FROM generate_series(1, 4) i) || ')';
+  EXECUTE 'INSERT INTO col_order_wide.wide SELECT ' ||
+    (SELECT string_agg(format('repeat(''x'', %s), ', i % 8 + 1), '') FROM generate_series(1, 48) i) ||
+    (SELECT string_agg('g, g, 1', ', ') FROM generate_series(1, 4)) ||
+    ' FROM generate_series(1, 100) g';
+END
+$$;
+ANALYZE col_order_wide.wide;
+SELECT natts, optimal_size IS NOT NULL AS solved, optimal_size <= current_size AS not_longer,
+       array_length(optimal_order, 1) AS ncols
+FROM suggest_col_order('col_order_wide');
+DROP SCHEMA col_order_wide CASCADE;
@@ -86,6 +86,53 @@ $$
 LANGUAGE plpgsql;
 
 
+-- Line pointers and MVCC fields of the tuples in the blocks from start_blkno
+-- to end_blkno, or to the end of the relation if end_blkno is NULL, read
+-- through a ring buffer.  A start_blkno past the end of the relation raises
+-- an error, as get_raw_page() does, so mvcc() keeps doing so.  The rows are
+-- returned while reading the blocks only when called in the target list; in
+-- FROM, they are all collected first, so use mvcc_summary() on large tables.
+CREATE OR REPLACE FUNCTION mvcc_range(
+    rel regclass,
+    start_blkno int8 DEFAULT 0,
+    end_blkno int8 DEFAULT NULL,
+    blkno OUT int8,
+    ctid OUT tid,
+    lp_off OUT smallint,
+    lp_flag OUT text,
+    t_xmin OUT int8,
+    t_xmax OUT int8,
+    t_infomask OUT text[],
+    t_infomask2 OUT text[],
+    t_ctid OUT tid
+)
+RETURNS SETOF RECORD
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- Per-block numbers of the line pointers of each kind and of the tuples with
+-- each hint bit of xmin and xmax set, over the same blocks as mvcc_range().
+CREATE OR REPLACE FUNCTION mvcc_summary(
+    rel regclass,
+    start_blkno int8 DEFAULT 0,
+    end_blkno int8 DEFAULT NULL,
+    blkno OUT int8,
+    lp_normal OUT int4,
+    lp_redirect OUT int4,
+    lp_dead OUT int4,
+    lp_unused OUT int4,
+    xmin_frozen OUT int4,
+    xmin_committed OUT int4,
+    xmin_invalid OUT int4,
+    xmax_committed OUT int4,
+    xmax_invalid OUT int4,
+    xmax_multi OUT int4,
+    xmax_lock_only OUT int4
+)
+RETURNS SETOF RECORD
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
 CREATE OR REPLACE FUNCTION mvcc(
     rel text,
     blkno int,
@@ -100,21 +147,15 @@ CREATE OR REPLACE FUNCTION mvcc(
 )
 RETURNS SETOF RECORD
 AS $$
-SELECT  '(0,' || lp || ')' AS ctid,
-lp_off,
-CASE lp_flags
-WHEN 0 THEN 'Unused'
-WHEN 1 THEN 'Normal'
-WHEN 2 THEN 'Redirect to ' || lp_off
-WHEN 3 THEN 'Dead'
-END,
-t_xmin::text::int8 AS xmin,
-t_xmax::text::int8 AS xmax,
-get_infomask(t_infomask) AS t_infomask,
-get_infomask2(t_infomask2) AS t_infomask,
-t_ctid
-FROM heap_page_items(get_raw_page($1, $2))
-order by lp;
+SELECT ctid::text, lp_off, lp_flag, t_xmin, t_xmax, t_infomask, t_infomask2, t_ctid
+FROM mvcc_range($1::regclass, $2, $2);
 $$ LANGUAGE SQL;
 
 CREATE PROCEDURE waste_xid(cnt int) AS $$ DECLARE i int; BEGIN FOR i in 1..cnt LOOP EXECUTE 'SELECT txid_current()'; COMMIT; END LOOP; END; $$ LANGUAGE plpgsql;
+
+-- Consume cnt XIDs in batches without running a transaction per XID, in
+-- nworkers background workers if nworkers > 0.  Returns the next full XID.
+CREATE FUNCTION consume_xids(cnt int8, nworkers int DEFAULT 0)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
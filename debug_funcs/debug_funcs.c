@@ -0,0 +1,837 @@
+/* -------------------------------------------------------------------------
+ *
+ * debug_funcs.c
+ *
+ * Functions for debugging PostgreSQL.
+ *
+ * -------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/relation.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
+#include "storage/bufmgr.h"
+#include "storage/bufpage.h"
+#include "storage/dsm.h"
+#include "storage/lwlock.h"
+#include "storage/shm_toc.h"
+#include "tcop/tcopprot.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/rel.h"
+
+PG_MODULE_MAGIC;
+
+/* The number of blocks mvcc_range() prefetches ahead of the one it reads */
+#define MVCC_PREFETCH_DISTANCE	32
+
+#define MVCC_RANGE_COLS	9
+#define MVCC_SUMMARY_COLS	12
+
+/* State of mvcc_range() kept across calls */
+typedef struct MvccRangeState
+{
+	Oid			relid;
+	BlockNumber	blkno;			/* the block copied to page */
+	BlockNumber	end_blkno;		/* the last block to read */
+	BlockNumber	prefetch_blkno;	/* the next block to prefetch */
+	OffsetNumber offnum;		/* the next line pointer in page */
+	OffsetNumber maxoff;		/* the last line pointer in page */
+	bool		page_valid;		/* page has a copy of blkno */
+	BufferAccessStrategy strategy;
+	PGAlignedBlock page;
+} MvccRangeState;
+
+/*
+ * These are private to clog.c, subtrans.c and commit_ts.c, and must be kept
+ * in sync with them.  COMMIT_TS_XACTS_PER_PAGE matches commit_ts.c's
+ * BLCKSZ / SizeOfCommitTimestampEntry, the entry being a TimestampTz and a
+ * RepOriginId, 10 bytes.
+ */
+#define CLOG_XACTS_PER_PAGE			(BLCKSZ * 4)
+#define SUBTRANS_XACTS_PER_PAGE		(BLCKSZ / sizeof(TransactionId))
+#define COMMIT_TS_XACTS_PER_PAGE	(BLCKSZ / (sizeof(TimestampTz) + sizeof(RepOriginId)))
+
+/* Take the slow path for the XIDs this close to the special ones */
+#define XID_SKIP_MARGIN		5
+
+#if PG_VERSION_NUM >= 170000
+#define NEXT_FULL_XID	(TransamVariables->nextXid)
+#elif PG_VERSION_NUM >= 140000
+#define NEXT_FULL_XID	(ShmemVariableCache->nextXid)
+#else
+#define NEXT_FULL_XID	(ShmemVariableCache->nextFullXid)
+#endif
+
+#define DEBUG_FUNCS_XIDS_MAGIC		0x64667869
+#define DEBUG_FUNCS_KEY_SHARED		1
+
+typedef struct ConsumeXidsWorkerResult
+{
+	bool		done;
+	uint64		consumed;
+	double		elapsed_ms;
+} ConsumeXidsWorkerResult;
+
+typedef struct ConsumeXidsShared
+{
+	Oid			dboid;
+	Oid			useroid;
+	uint64		nxids;			/* in total */
+	int			nworkers;
+
+	ConsumeXidsWorkerResult results[FLEXIBLE_ARRAY_MEMBER];
+} ConsumeXidsShared;
+
+PG_FUNCTION_INFO_V1(mvcc_range);
+PG_FUNCTION_INFO_V1(mvcc_summary);
+PG_FUNCTION_INFO_V1(consume_xids);
+
+PGDLLEXPORT void debug_funcs_consume_xids_main(Datum main_arg);
+
+static void check_relation(Relation rel);
+static bool read_next_page(MvccRangeState *state);
+static void mvcc_range_begin(FunctionCallInfo fcinfo);
+static Datum infomask_flags(uint16 infomask);
+static Datum infomask2_flags(uint16 infomask2);
+static uint32 xid_skip_distance(FullTransactionId next_xid);
+static void consume_xids_internal(uint64 nxids);
+static void consume_xids_parallel(uint64 nxids, int nworkers);
+
+static void
+check_relation(Relation rel)
+{
+	if (rel->rd_rel->relkind != RELKIND_RELATION &&
+		rel->rd_rel->relkind != RELKIND_MATVIEW &&
+		rel->rd_rel->relkind != RELKIND_TOASTVALUE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a table, materialized view, or TOAST table",
+						RelationGetRelationName(rel))));
+
+	if (rel->rd_rel->relam != HEAP_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("only heap AM is supported")));
+
+	/*
+	 * Reject attempts to read non-local temporary relations; we would be
+	 * likely to get wrong data since we have no visibility into the owning
+	 * session's local buffers.
+	 */
+	if (RELATION_IS_OTHER_TEMP(rel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot access temporary tables of other sessions")));
+}
+
+/*
+ * Copy the next block, skipping new pages, into state->page.  Return false
+ * if there is no more block to read.
+ *
+ * We don't keep the relation open across calls, so that a query that stops
+ * fetching rows early doesn't leak it.  The relation is closed without
+ * releasing the lock, so that the lock taken at the first call is held until
+ * the end of the transaction and the relation can't be truncated or dropped
+ * between the calls.
+ */
+static bool
+read_next_page(MvccRangeState *state)
+{
+	Relation	rel;
+
+	if (state->page_valid)
+	{
+		state->page_valid = false;
+		if (state->blkno == state->end_blkno)
+			return false;
+		state->blkno++;
+	}
+
+	if (state->blkno > state->end_blkno)
+		return false;
+
+	rel = relation_open(state->relid, AccessShareLock);
+
+	while (!state->page_valid)
+	{
+		Buffer		buf;
+
+		CHECK_FOR_INTERRUPTS();
+
+#ifdef USE_PREFETCH
+		/* Keep the prefetch MVCC_PREFETCH_DISTANCE blocks ahead */
+		if (state->prefetch_blkno < state->blkno)
+			state->prefetch_blkno = state->blkno;
+		while (state->prefetch_blkno <= state->end_blkno &&
+			   state->prefetch_blkno - state->blkno < MVCC_PREFETCH_DISTANCE)
+			PrefetchBuffer(rel, MAIN_FORKNUM, state->prefetch_blkno++);
+#endif
+
+		/* Read the page through the ring buffer not to evict other pages */
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, state->blkno, RBM_NORMAL,
+								 state->strategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(state->page.data, BufferGetPage(buf), BLCKSZ);
+		UnlockReleaseBuffer(buf);
+
+		if (!PageIsNew((Page) state->page.data))
+		{
+			state->page_valid = true;
+			state->offnum = FirstOffsetNumber;
+			state->maxoff = PageGetMaxOffsetNumber((Page) state->page.data);
+		}
+		else if (state->blkno == state->end_blkno)
+			break;
+		else
+			state->blkno++;
+	}
+
+	relation_close(rel, NoLock);
+
+	return state->page_valid;
+}
+
+/* Same as get_infomask() but XMIN_FROZEN hides XMIN_COMMITTED and XMIN_INVALID */
+static Datum
+infomask_flags(uint16 infomask)
+{
+	Datum		flags[16];
+	int			n = 0;
+
+	if ((infomask & HEAP_HASNULL) != 0)
+		flags[n++] = CStringGetTextDatum("HASNULL");
+	if ((infomask & HEAP_HASVARWIDTH) != 0)
+		flags[n++] = CStringGetTextDatum("HASVARWIDTH");
+	if ((infomask & HEAP_HASEXTERNAL) != 0)
+		flags[n++] = CStringGetTextDatum("HASEXTERNAL");
+	if ((infomask & HEAP_HASOID_OLD) != 0)
+		flags[n++] = CStringGetTextDatum("HASOID");
+	if ((infomask & HEAP_XMAX_KEYSHR_LOCK) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_KEYSHR_LOCK");
+	if ((infomask & HEAP_COMBOCID) != 0)
+		flags[n++] = CStringGetTextDatum("COMBOCID");
+	if ((infomask & HEAP_XMAX_EXCL_LOCK) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_EXCL_LOCK");
+	if ((infomask & HEAP_XMAX_LOCK_ONLY) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_LOCK_ONLY");
+	if ((infomask & HEAP_XMIN_FROZEN) == HEAP_XMIN_FROZEN)
+		flags[n++] = CStringGetTextDatum("XMIN_FROZEN");
+	else
+	{
+		if ((infomask & HEAP_XMIN_COMMITTED) != 0)
+			flags[n++] = CStringGetTextDatum("XMIN_COMMITTED");
+		if ((infomask & HEAP_XMIN_INVALID) != 0)
+			flags[n++] = CStringGetTextDatum("XMIN_INVALID");
+	}
+	if ((infomask & HEAP_XMAX_COMMITTED) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_COMMITTED");
+	if ((infomask & HEAP_XMAX_INVALID) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_INVALID");
+	if ((infomask & HEAP_XMAX_IS_MULTI) != 0)
+		flags[n++] = CStringGetTextDatum("XMAX_IS_MULTI");
+	if ((infomask & HEAP_UPDATED) != 0)
+		flags[n++] = CStringGetTextDatum("UPDATED");
+	if ((infomask & HEAP_MOVED_OFF) != 0)
+		flags[n++] = CStringGetTextDatum("MOVED_OFF");
+	if ((infomask & HEAP_MOVED_IN) != 0)
+		flags[n++] = CStringGetTextDatum("MOVED_IN");
+
+	return PointerGetDatum(construct_array(flags, n, TEXTOID, -1, false, 'i'));
+}
+
+static Datum
+infomask2_flags(uint16 infomask2)
+{
+	Datum		flags[3];
+	int			n = 0;
+
+	if ((infomask2 & HEAP_KEYS_UPDATED) != 0)
+		flags[n++] = CStringGetTextDatum("KEYS_UPDATED");
+	if ((infomask2 & HEAP_HOT_UPDATED) != 0)
+		flags[n++] = CStringGetTextDatum("HOT_UPDATED");
+	if ((infomask2 & HEAP_ONLY_TUPLE) != 0)
+		flags[n++] = CStringGetTextDatum("ONLY_TUPLE");
+
+	return PointerGetDatum(construct_array(flags, n, TEXTOID, -1, false, 'i'));
+}
+
+/*
+ * Set up the state of mvcc_range() and mvcc_summary() at the first call,
+ * checking the arguments.
+ */
+static void
+mvcc_range_begin(FunctionCallInfo fcinfo)
+{
+	FuncCallContext *funcctx;
+	MvccRangeState *state;
+	Oid			relid;
+	int64		start_blkno = PG_ARGISNULL(1) ? 0 : PG_GETARG_INT64(1);
+	int64		end_blkno;
+	BlockNumber	nblocks;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	MemoryContext oldcontext;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to use raw page functions")));
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("relation must not be null")));
+	relid = PG_GETARG_OID(0);
+
+	funcctx = SRF_FIRSTCALL_INIT();
+	oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+	if (start_blkno < 0 || start_blkno > MaxBlockNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid start block number " INT64_FORMAT,
+						start_blkno)));
+
+	rel = relation_open(relid, AccessShareLock);
+	check_relation(rel);
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	/*
+	 * As get_raw_page() does, a block past the end is an error, except
+	 * for the whole relation, which may be empty.
+	 */
+	if (start_blkno >= (int64) nblocks &&
+		!(start_blkno == 0 && PG_ARGISNULL(2)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("block number " INT64_FORMAT " is out of range for relation \"%s\"",
+						start_blkno, RelationGetRelationName(rel))));
+	relation_close(rel, NoLock);
+
+	end_blkno = PG_ARGISNULL(2) ? (int64) nblocks - 1 : PG_GETARG_INT64(2);
+	if (!PG_ARGISNULL(2) && (end_blkno < start_blkno || end_blkno > MaxBlockNumber))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid end block number " INT64_FORMAT,
+						end_blkno)));
+
+	state = (MvccRangeState *) palloc0(sizeof(MvccRangeState));
+	state->relid = relid;
+	state->blkno = (BlockNumber) start_blkno;
+	state->prefetch_blkno = (BlockNumber) start_blkno;
+	state->page_valid = false;
+	state->strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	/* Blocks past the end of the relation have nothing to return */
+	if (end_blkno >= (int64) nblocks)
+		end_blkno = (int64) nblocks - 1;
+
+	if (end_blkno < start_blkno)
+	{
+		/* Nothing to read, make read_next_page() return false */
+		state->end_blkno = 0;
+		state->blkno = 1;
+	}
+	else
+		state->end_blkno = (BlockNumber) end_blkno;
+
+	funcctx->user_fctx = state;
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Return the line pointers and the MVCC fields of the tuples in the blocks
+ * from start_blkno to end_blkno.  end_blkno is the last block of the relation
+ * if NULL.
+ *
+ * Unlike heap_page_items(get_raw_page(...)) the blocks are read one at a
+ * time, and the rows are returned while reading them when called in the
+ * target list.  Called in FROM, the executor collects all the rows in a
+ * tuplestore before returning the first one, which spills to temporary files
+ * on a large table; mvcc_summary() returns a row per block instead.
+ */
+Datum
+mvcc_range(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	MvccRangeState *state;
+
+	if (SRF_IS_FIRSTCALL())
+		mvcc_range_begin(fcinfo);
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (MvccRangeState *) funcctx->user_fctx;
+
+	while (state->page_valid || read_next_page(state))
+	{
+		Page		page = (Page) state->page.data;
+		ItemId		id;
+		OffsetNumber offnum;
+		uint16		lp_off;
+		uint16		lp_len;
+		Datum		values[MVCC_RANGE_COLS];
+		bool		nulls[MVCC_RANGE_COLS];
+		ItemPointer	ctid;
+		HeapTuple	tuple;
+
+		if (state->offnum > state->maxoff)
+		{
+			if (!read_next_page(state))
+				break;
+			continue;
+		}
+
+		offnum = state->offnum++;
+		id = PageGetItemId(page, offnum);
+		lp_off = ItemIdGetOffset(id);
+		lp_len = ItemIdGetLength(id);
+
+		memset(nulls, 0, sizeof(nulls));
+
+		ctid = (ItemPointer) palloc(sizeof(ItemPointerData));
+		ItemPointerSet(ctid, state->blkno, offnum);
+		values[0] = Int64GetDatum((int64) state->blkno);
+		values[1] = ItemPointerGetDatum(ctid);
+		values[2] = Int16GetDatum(lp_off);
+
+		switch (ItemIdGetFlags(id))
+		{
+			case LP_UNUSED:
+				values[3] = CStringGetTextDatum("Unused");
+				break;
+			case LP_NORMAL:
+				values[3] = CStringGetTextDatum("Normal");
+				break;
+			case LP_REDIRECT:
+				values[3] = CStringGetTextDatum(psprintf("Redirect to %u", lp_off));
+				break;
+			case LP_DEAD:
+				values[3] = CStringGetTextDatum("Dead");
+				break;
+		}
+
+		/*
+		 * Decode the tuple header only if it's a normal line pointer that
+		 * points to a whole header in the page, as with heap_page_items().
+		 */
+		if (ItemIdIsNormal(id) &&
+			lp_off >= MAXALIGN(SizeOfPageHeaderData) &&
+			lp_off == MAXALIGN(lp_off) &&
+			lp_len >= MAXALIGN(SizeofHeapTupleHeader) &&
+			lp_off + lp_len <= BLCKSZ)
+		{
+			HeapTupleHeader tuphdr = (HeapTupleHeader) PageGetItem(page, id);
+			ItemPointer	t_ctid = (ItemPointer) palloc(sizeof(ItemPointerData));
+
+			*t_ctid = tuphdr->t_ctid;
+			values[4] = Int64GetDatum((int64) HeapTupleHeaderGetRawXmin(tuphdr));
+			values[5] = Int64GetDatum((int64) HeapTupleHeaderGetRawXmax(tuphdr));
+			values[6] = infomask_flags(tuphdr->t_infomask);
+			values[7] = infomask2_flags(tuphdr->t_infomask2);
+			values[8] = ItemPointerGetDatum(t_ctid);
+		}
+		else
+			nulls[4] = nulls[5] = nulls[6] = nulls[7] = nulls[8] = true;
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return a row per block from start_blkno to end_blkno, skipping new pages as
+ * mvcc_range() does, with the numbers of
+ * line pointers of each kind, and of the tuples with each hint bit of xmin
+ * and xmax set.  Unlike mvcc_range(), the rows don't grow with the tuples, so
+ * it can be used in FROM to look for the blocks left to freeze in a large
+ * table.
+ */
+Datum
+mvcc_summary(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	MvccRangeState *state;
+	Page		page;
+	int32		counts[MVCC_SUMMARY_COLS - 1];
+	Datum		values[MVCC_SUMMARY_COLS];
+	bool		nulls[MVCC_SUMMARY_COLS];
+	HeapTuple	tuple;
+
+	if (SRF_IS_FIRSTCALL())
+		mvcc_range_begin(fcinfo);
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (MvccRangeState *) funcctx->user_fctx;
+
+	if (!read_next_page(state))
+		SRF_RETURN_DONE(funcctx);
+
+	page = (Page) state->page.data;
+	memset(counts, 0, sizeof(counts));
+
+	for (OffsetNumber offnum = FirstOffsetNumber; offnum <= state->maxoff; offnum++)
+	{
+		ItemId		id = PageGetItemId(page, offnum);
+		uint16		lp_off = ItemIdGetOffset(id);
+		uint16		lp_len = ItemIdGetLength(id);
+		HeapTupleHeader tuphdr;
+		uint16		infomask;
+
+		switch (ItemIdGetFlags(id))
+		{
+			case LP_UNUSED:
+				counts[3]++;
+				continue;
+			case LP_NORMAL:
+				counts[0]++;
+				break;
+			case LP_REDIRECT:
+				counts[1]++;
+				continue;
+			case LP_DEAD:
+				counts[2]++;
+				continue;
+		}
+
+		/* Check the tuple header as mvcc_range() does */
+		if (lp_off < MAXALIGN(SizeOfPageHeaderData) ||
+			lp_off != MAXALIGN(lp_off) ||
+			lp_len < MAXALIGN(SizeofHeapTupleHeader) ||
+			lp_off + lp_len > BLCKSZ)
+			continue;
+
+		tuphdr = (HeapTupleHeader) PageGetItem(page, id);
+		infomask = tuphdr->t_infomask;
+
+		if ((infomask & HEAP_XMIN_FROZEN) == HEAP_XMIN_FROZEN)
+			counts[4]++;
+		else if ((infomask & HEAP_XMIN_COMMITTED) != 0)
+			counts[5]++;
+		else if ((infomask & HEAP_XMIN_INVALID) != 0)
+			counts[6]++;
+
+		if ((infomask & HEAP_XMAX_COMMITTED) != 0)
+			counts[7]++;
+		if ((infomask & HEAP_XMAX_INVALID) != 0)
+			counts[8]++;
+		if ((infomask & HEAP_XMAX_IS_MULTI) != 0)
+			counts[9]++;
+		if ((infomask & HEAP_XMAX_LOCK_ONLY) != 0)
+			counts[10]++;
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum((int64) state->blkno);
+	for (int i = 0; i < MVCC_SUMMARY_COLS - 1; i++)
+		values[i + 1] = Int32GetDatum(counts[i]);
+
+	tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/*
+ * Return how many XIDs from next_xid we can consume by just advancing the
+ * counter, without reaching the first XID of a clog, subtrans or commit_ts
+ * page, which GetNewTransactionId() needs to extend, or the XIDs around the
+ * wraparound of the 32-bit XID.
+ *
+ * Since the clog pages are on 65536-XID boundaries too, GetNewTransactionId()
+ * still sees every XID at which it signals the autovacuum launcher, and it
+ * checks the wraparound limits at least once every COMMIT_TS_XACTS_PER_PAGE
+ * XIDs.
+ */
+static uint32
+xid_skip_distance(FullTransactionId next_xid)
+{
+	uint32		xid = XidFromFullTransactionId(next_xid);
+	uint32		distance;
+	uint32		rem;
+
+	/* SizeOfCommitTimestampEntry of commit_ts.c */
+	StaticAssertStmt(sizeof(TimestampTz) + sizeof(RepOriginId) == 10,
+					 "commit_ts entry size changed");
+
+	if (xid < XID_SKIP_MARGIN || xid >= PG_UINT32_MAX - XID_SKIP_MARGIN)
+		return 0;
+	distance = PG_UINT32_MAX - XID_SKIP_MARGIN - xid;
+
+	rem = xid % COMMIT_TS_XACTS_PER_PAGE;
+	if (rem == 0)
+		return 0;
+	distance = Min(distance, COMMIT_TS_XACTS_PER_PAGE - rem);
+
+	rem = xid % SUBTRANS_XACTS_PER_PAGE;
+	if (rem == 0)
+		return 0;
+	distance = Min(distance, SUBTRANS_XACTS_PER_PAGE - rem);
+
+	rem = xid % CLOG_XACTS_PER_PAGE;
+	if (rem == 0)
+		return 0;
+	distance = Min(distance, CLOG_XACTS_PER_PAGE - rem);
+
+	return distance;
+}
+
+/*
+ * Consume nxids XIDs in the current transaction, counting its own XID if it
+ * has to be assigned.
+ *
+ * The XIDs between the SLRU page boundaries are allocated in a batch by
+ * advancing nextXid under one XidGenLock acquisition, and the others by
+ * GetNewTransactionId() as subtransactions of the current transaction, which
+ * extends the SLRUs.  Neither is recorded as committed, so all of the
+ * consumed XIDs appear aborted once the transaction ends.
+ */
+static void
+consume_xids_internal(uint64 nxids)
+{
+	uint64		consumed = 0;
+
+	/* Make the slow path XIDs subtransactions of ours */
+	if (!TransactionIdIsValid(GetTopTransactionIdIfAny()))
+	{
+		(void) GetTopTransactionId();
+		consumed++;
+	}
+
+	while (consumed < nxids)
+	{
+		uint32		distance;
+
+		CHECK_FOR_INTERRUPTS();
+
+		LWLockAcquire(XidGenLock, LW_EXCLUSIVE);
+		distance = xid_skip_distance(NEXT_FULL_XID);
+		if ((uint64) distance > nxids - consumed)
+			distance = (uint32) (nxids - consumed);
+		NEXT_FULL_XID.value += distance;
+		LWLockRelease(XidGenLock);
+
+		consumed += distance;
+
+		if (distance == 0)
+		{
+			(void) GetNewTransactionId(true);
+			consumed++;
+		}
+	}
+}
+
+/*
+ * Consume nxids XIDs with nworkers background workers, splitting them
+ * evenly.  The batches are serialized by XidGenLock, so the workers mostly
+ * overlap the slow path and the transaction overhead.
+ */
+static void
+consume_xids_parallel(uint64 nxids, int nworkers)
+{
+	BackgroundWorkerHandle **handles;
+	ConsumeXidsShared *shared;
+	dsm_segment *seg;
+	shm_toc_estimator e;
+	shm_toc	   *toc;
+	Size		shared_size;
+	Size		segsize;
+	int			i;
+
+	shared_size = add_size(offsetof(ConsumeXidsShared, results),
+						   mul_size(sizeof(ConsumeXidsWorkerResult), nworkers));
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, shared_size);
+	shm_toc_estimate_keys(&e, 1);
+	segsize = shm_toc_estimate(&e);
+
+	seg = dsm_create(segsize, 0);
+	toc = shm_toc_create(DEBUG_FUNCS_XIDS_MAGIC, dsm_segment_address(seg),
+						 segsize);
+
+	shared = shm_toc_allocate(toc, shared_size);
+	memset(shared, 0, shared_size);
+	shared->dboid = MyDatabaseId;
+	shared->useroid = GetUserId();
+	shared->nxids = nxids;
+	shared->nworkers = nworkers;
+	shm_toc_insert(toc, DEBUG_FUNCS_KEY_SHARED, shared);
+
+	/* Launch workers */
+	handles = palloc0(sizeof(BackgroundWorkerHandle *) * nworkers);
+	PG_TRY();
+	{
+		for (i = 0; i < nworkers; i++)
+		{
+			BackgroundWorker worker;
+
+			memset(&worker, 0, sizeof(worker));
+			worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+				BGWORKER_BACKEND_DATABASE_CONNECTION;
+			worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+			worker.bgw_restart_time = BGW_NEVER_RESTART;
+			sprintf(worker.bgw_library_name, "debug_funcs");
+			sprintf(worker.bgw_function_name, "debug_funcs_consume_xids_main");
+			snprintf(worker.bgw_name, BGW_MAXLEN,
+					 "debug_funcs consume_xids worker %d", i);
+			snprintf(worker.bgw_type, BGW_MAXLEN, "debug_funcs consume_xids worker");
+			worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+			memcpy(worker.bgw_extra, &i, sizeof(int));
+			worker.bgw_notify_pid = MyProcPid;
+
+			if (!RegisterDynamicBackgroundWorker(&worker, &handles[i]))
+				ereport(ERROR,
+						(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+						 errmsg("could not register background process"),
+						 errhint("You may need to increase max_worker_processes.")));
+		}
+
+		for (i = 0; i < nworkers; i++)
+			WaitForBackgroundWorkerShutdown(handles[i]);
+	}
+	PG_CATCH();
+	{
+		for (i = 0; i < nworkers; i++)
+		{
+			if (handles[i])
+				TerminateBackgroundWorker(handles[i]);
+		}
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	for (i = 0; i < nworkers; i++)
+	{
+		ConsumeXidsWorkerResult *res = &(shared->results[i]);
+
+		if (!res->done)
+			elog(ERROR, "debug_funcs consume_xids worker %d did not finish", i);
+
+		elog(DEBUG1, "consume_xids worker %d: consumed " UINT64_FORMAT " XIDs, %.3f ms",
+			 i, res->consumed, res->elapsed_ms);
+	}
+
+	dsm_detach(seg);
+	pfree(handles);
+}
+
+/*
+ * Entry point of the workers launched by consume_xids_parallel().  main_arg
+ * is the segment set up by consume_xids_parallel() and bgw_extra has the
+ * worker number.
+ */
+void
+debug_funcs_consume_xids_main(Datum main_arg)
+{
+	ConsumeXidsShared *shared;
+	ConsumeXidsWorkerResult *res;
+	dsm_segment *seg;
+	shm_toc	   *toc;
+	instr_time	start_time,
+				elapsed;
+	uint64		nxids;
+	int			worker_id;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	memcpy(&worker_id, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "debug_funcs consume_xids worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	toc = shm_toc_attach(DEBUG_FUNCS_XIDS_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("bad magic number in dynamic shared memory segment")));
+	shared = shm_toc_lookup(toc, DEBUG_FUNCS_KEY_SHARED, false);
+	res = &(shared->results[worker_id]);
+
+	BackgroundWorkerInitializeConnectionByOid(shared->dboid, shared->useroid, 0);
+
+	nxids = shared->nxids / shared->nworkers;
+	if ((uint64) worker_id < shared->nxids % shared->nworkers)
+		nxids++;
+
+	StartTransactionCommand();
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	consume_xids_internal(nxids);
+	res->consumed = nxids;
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+	CommitTransactionCommand();
+
+	res->elapsed_ms = INSTR_TIME_GET_MILLISEC(elapsed);
+	res->done = true;
+
+	dsm_detach(seg);
+}
+
+/*
+ * Consume the given number of XIDs, using nworkers background workers if
+ * nworkers > 0, and return the next XID after that.  Much faster than
+ * waste_xid() since it doesn't run a transaction per XID.
+ */
+Datum
+consume_xids(PG_FUNCTION_ARGS)
+{
+	int64		nxids = PG_GETARG_INT64(0);
+	int			nworkers = PG_GETARG_INT32(1);
+	FullTransactionId next_xid;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to consume XIDs")));
+
+	if (nxids < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of XIDs must not be negative")));
+	if (nworkers < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers must not be negative")));
+
+	if (RecoveryInProgress())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("recovery is in progress"),
+				 errhint("XIDs cannot be consumed during recovery.")));
+
+	/* Don't bother launching workers with nothing to do */
+	if ((int64) nworkers > nxids)
+		nworkers = (int) nxids;
+
+	if (nworkers > 0)
+		consume_xids_parallel((uint64) nxids, nworkers);
+	else if (nxids > 0)
+		consume_xids_internal((uint64) nxids);
+
+	next_xid = ReadNextFullTransactionId();
+
+	PG_RETURN_INT64((int64) U64FromFullTransactionId(next_xid));
+}
@@ -0,0 +1,26 @@
+CREATE EXTENSION debug_funcs;
+CREATE TABLE mvcc_test (a int) WITH (autovacuum_enabled = off);
+INSERT INTO mvcc_test SELECT generate_series(1, 1000);
+
+-- the whole relation
+SELECT count(*) FROM mvcc_range('mvcc_test');
+
+-- a single block, whose ctids have its block number
+SELECT count(*) = (SELECT count(*) FROM mvcc_test
+                   WHERE ctid >= '(1,0)' AND ctid < '(2,0)') AS all_rows,
+       bool_and(blkno = 1) AS blkno,
+       bool_and((ctid::text::point)[0] = 1) AS ctid_blkno
+FROM mvcc_range('mvcc_test', 1, 1);
+
+SELECT ctid, lp_flag, t_infomask2, t_ctid FROM mvcc('mvcc_test', 0) LIMIT 2;
+
+-- a start block past the end of the relation
+SELECT * FROM mvcc_range('mvcc_test', 100);
+
+-- all tuples are frozen in every block
+VACUUM (FREEZE) mvcc_test;
+SELECT sum(lp_normal) AS lp_normal, sum(xmin_frozen) AS xmin_frozen,
+       count(*) = pg_relation_size('mvcc_test') / current_setting('block_size')::int AS all_blocks
+FROM mvcc_summary('mvcc_test');
+
+DROP TABLE mvcc_test;
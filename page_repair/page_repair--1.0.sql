@@ -13,7 +13,28 @@ RETURNS bool
 AS 'MODULE_PATHNAME', 'pg_repair_page_fork'
 LANGUAGE C STRICT PARALLEL UNSAFE;
 
+CREATE FUNCTION pg_repair_pages(regclass, bigint[], text, text default 'main')
+RETURNS int
+AS 'MODULE_PATHNAME', 'pg_repair_pages'
+LANGUAGE C STRICT PARALLEL UNSAFE;
+
+CREATE FUNCTION pg_scan_and_repair(regclass, text, int default 0,
+                                   text default 'main')
+RETURNS int
+AS 'MODULE_PATHNAME', 'pg_scan_and_repair'
+LANGUAGE C STRICT PARALLEL UNSAFE;
+
 CREATE FUNCTION get_page(text, text, int4)
 RETURNS bytea
 AS 'MODULE_PATHNAME', 'get_page'
 LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION get_page_packed(text, text, int4, text)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'get_page_packed'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION wait_for_replay(pg_lsn, int)
+RETURNS bool
+AS 'MODULE_PATHNAME', 'wait_for_replay'
+LANGUAGE C STRICT PARALLEL SAFE;
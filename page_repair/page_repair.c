@@ -14,40 +14,218 @@
 #include <unistd.h>
 
 #include "access/relation.h"
+#include "access/xact.h"
 #include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xloginsert.h"
+#if PG_VERSION_NUM >= 150000
+#include "access/xlogrecovery.h"
+#endif
 #include "catalog/namespace.h"
 #include "catalog/pg_control.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "common/pg_lzcompress.h"
 #include "fe_utils/connect.h"
 #include "fmgr.h"
 #include "funcapi.h"
 #include "lib/stringinfo.h"
 #include "miscadmin.h"
 #include "pgstat.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
 #include "storage/buf_internals.h"
 #include "storage/checksum.h"
+#include "storage/dsm.h"
 #include "storage/lockdefs.h"
 #include "storage/proc.h"
+#include "storage/shm_toc.h"
+#include "tcop/tcopprot.h"
 #include "tcop/utility.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
 #include "utils/pg_lsn.h"
 #include "utils/rel.h"
+#include "utils/timestamp.h"
 #include "utils/varlena.h"
 
 #include "libpq-int.h"
 
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
 PG_MODULE_MAGIC;
 
-#define STANDBY_LSN_CHECK_INTERVAL (5 * 1000L) /* 5 sec */
+/*
+ * wait_for_replay() on the standby checks the replay LSN every
+ * REPLAY_CHECK_INTERVAL, and returns after STANDBY_WAIT_TIMEOUT at the latest
+ * so that it doesn't keep waiting long after we went away.
+ */
+#define REPLAY_CHECK_INTERVAL	10L			/* 10 ms */
+#define STANDBY_WAIT_TIMEOUT	(5 * 1000)	/* 5 sec */
+
+/*
+ * The maximum number of get_page() queries we have in flight on the standby
+ * connection at once.  Each result is a whole page, so we must not let the
+ * standby's output fill up the socket while we are still sending queries,
+ * see "Interleaving Result Processing and Query Dispatch" in the libpq docs.
+ */
+#define FETCH_PIPELINE_DEPTH 64
+
+/*
+ * pg_scan_and_repair() reads the relation in chunks of SCAN_CHUNK_BLOCKS
+ * blocks, prefetching the next chunk while verifying the current one.
+ */
+#define SCAN_CHUNK_BLOCKS 128
+
+/*
+ * The maximum number of corrupted blocks a scan worker reports.  A worker
+ * finding more stops scanning, the leader repairs what was found and asks
+ * to run the scan again.
+ */
+#define SCAN_MAX_CORRUPTED 65536
+
+#define PAGE_REPAIR_SCAN_MAGIC		0x70727363
+#define PAGE_REPAIR_KEY_SHARED		1
+#define PAGE_REPAIR_KEY_CORRUPTED	2
+
+typedef struct ScanWorkerResult
+{
+	bool		done;
+	bool		overflowed;		/* found more than SCAN_MAX_CORRUPTED */
+	BlockNumber	nscanned;
+	int			ncorrupted;
+	double		elapsed_ms;
+} ScanWorkerResult;
+
+typedef struct ScanShared
+{
+	Oid			dboid;
+	Oid			useroid;
+	Oid			relid;
+	ForkNumber	forknum;
+	BlockNumber	nblocks;
+	int			nworkers;
+
+	ScanWorkerResult results[FLEXIBLE_ARRAY_MEMBER];
+} ScanShared;
+
+/*
+ * The pages are fetched from the standby server by get_page_packed(), which
+ * returns a PackedPageHeader followed by the page with its hole, from
+ * hole_offset to hole_offset + hole_length, removed and then compressed by
+ * the given method.  The hole is removed only if it's all zeros so that the
+ * restored page has the same checksum.  The standby server has the same
+ * system identifier, so we don't care about the byte order.
+ */
+typedef struct PackedPageHeader
+{
+	uint16		hole_offset;
+	uint16		hole_length;
+	uint8		method;			/* FetchCompression */
+} PackedPageHeader;
+
+#define SizeOfPackedPageHeader	(offsetof(PackedPageHeader, method) + sizeof(uint8))
+
+typedef enum FetchCompression
+{
+	FETCH_COMPRESSION_NONE,
+	FETCH_COMPRESSION_PGLZ,
+	FETCH_COMPRESSION_LZ4
+} FetchCompression;
+
+/* Indexed by FetchCompression */
+static const char *const fetch_compression_names[] = {
+	"none",
+	"pglz",
+	"lz4"
+};
+
+static const struct config_enum_entry fetch_compression_options[] = {
+	{"none", FETCH_COMPRESSION_NONE, false},
+	{"pglz", FETCH_COMPRESSION_PGLZ, false},
+#ifdef USE_LZ4
+	{"lz4", FETCH_COMPRESSION_LZ4, false},
+#endif
+	{NULL, 0, false}
+};
+
+static int fetch_compression = FETCH_COMPRESSION_NONE;
+
+/* How the repaired pages are written */
+typedef enum WriteMode
+{
+	WRITE_MODE_SMGR,			/* overwrite on the disk and sync the fork */
+	WRITE_MODE_BUFFER			/* install in shared buffers and WAL-log */
+} WriteMode;
+
+static const struct config_enum_entry write_mode_options[] = {
+	{"smgr", WRITE_MODE_SMGR, false},
+	{"buffer", WRITE_MODE_BUFFER, false},
+	{NULL, 0, false}
+};
+
+static int write_mode = WRITE_MODE_SMGR;
+
+/* Time spent in each phase of a repair */
+typedef struct RepairTimings
+{
+	instr_time	catchup;		/* waiting for the standby, with or without the lock */
+	instr_time	lock_wait;		/* acquiring AccessExclusiveLock */
+	instr_time	read;			/* reading and verifying the local pages */
+	instr_time	fetch;			/* fetching and verifying the standby's pages */
+	instr_time	write;			/* writing the pages, including the sync */
+} RepairTimings;
 
 PGconn *conn = NULL;
 
 PG_FUNCTION_INFO_V1(pg_repair_page);
 PG_FUNCTION_INFO_V1(pg_repair_page_fork);
+PG_FUNCTION_INFO_V1(pg_repair_pages);
+PG_FUNCTION_INFO_V1(pg_scan_and_repair);
 PG_FUNCTION_INFO_V1(get_page);
+PG_FUNCTION_INFO_V1(get_page_packed);
+PG_FUNCTION_INFO_V1(wait_for_replay);
+
+void _PG_init(void);
 
 static void repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
 								 const char *conninfo);
+static int repair_pages_internal(Oid oid, BlockNumber *blknos, int nblocks,
+								 const char *forkname, const char *conninfo);
+static int repair_pages_from_standby(Oid oid, BlockNumber *blknos, int nblocks,
+									 const char *forkname);
+static void check_repair_prerequisites(void);
+
+PGDLLEXPORT void page_repair_scan_main(Datum main_arg);
+
+void
+_PG_init(void)
+{
+	DefineCustomEnumVariable("page_repair.fetch_compression",
+							 "Compression method of the pages fetched from the standby server.",
+							 NULL,
+							 &fetch_compression,
+							 FETCH_COMPRESSION_NONE,
+							 fetch_compression_options,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("page_repair.write_mode",
+							 "How the repaired pages are written.",
+							 "\"smgr\" overwrites the pages on the disk and syncs the fork, "
+							 "\"buffer\" installs them in shared buffers as WAL-logged full page images.",
+							 &write_mode,
+							 WRITE_MODE_SMGR,
+							 write_mode_options,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+}
 
 static void
 exec_command(const char *sql)
@@ -133,7 +311,7 @@ connect_standby(const char *conninfo)
 }
 
 static void
-check_relation(Relation rel, ForkNumber forknum, BlockNumber blkno)
+check_relation_kind(Relation rel)
 {
 	/* Check that this relation has storage */
 	if (rel->rd_rel->relkind == RELKIND_VIEW)
@@ -171,13 +349,18 @@ check_relation(Relation rel, ForkNumber forknum, BlockNumber blkno)
 		ereport(ERROR,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				 errmsg("cannot access temporary tables of other sessions")));
+}
+
+static void
+check_relation(Relation rel, ForkNumber forknum, BlockNumber blkno)
+{
+	check_relation_kind(rel);
 
 	if (blkno >= RelationGetNumberOfBlocksInFork(rel, forknum))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("block number %u is out of range for relation \"%s\"",
 						blkno, RelationGetRelationName(rel))));
-
 }
 
 static bool
@@ -193,68 +376,466 @@ verify_page(BlockNumber blkno, char *page)
 	return chk_expected == chk_found;
 }
 
+/*
+ * Verify the checksums of the blocks from start to end - 1 reading them from
+ * the disk, and store the corrupted ones in corrupted.  The scan doesn't go
+ * through shared buffers and doesn't lock out the concurrent writers, so a
+ * page written while we read it may be reported too.  The repair rechecks
+ * the reported pages under AccessExclusiveLock.  Return false if we stopped
+ * because we found more than SCAN_MAX_CORRUPTED corrupted blocks.
+ */
+static bool
+scan_blocks(Relation relation, ForkNumber forknum, BlockNumber start,
+			BlockNumber end, BlockNumber *corrupted, int *ncorrupted,
+			BlockNumber *nscanned)
+{
+	PGAlignedBlock buf;
+	BlockNumber blkno;
+	BlockNumber prefetched = start;
+
+	*ncorrupted = 0;
+	*nscanned = 0;
+
+	for (blkno = start; blkno < end; blkno++)
+	{
+		/* Read ahead the next chunk when entering a chunk */
+		if ((blkno - start) % SCAN_CHUNK_BLOCKS == 0)
+		{
+			BlockNumber	target = Min(blkno + 2 * SCAN_CHUNK_BLOCKS, end);
+
+			for (prefetched = Max(prefetched, blkno); prefetched < target; prefetched++)
+				(void) smgrprefetch(RelationGetSmgr(relation), forknum, prefetched);
+
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		smgrread(RelationGetSmgr(relation), forknum, blkno, buf.data);
+		(*nscanned)++;
+
+		/* New pages have no checksum */
+		if (PageIsNew((Page) buf.data))
+			continue;
+
+		if (verify_page(blkno, buf.data))
+			continue;
+
+		if (*ncorrupted >= SCAN_MAX_CORRUPTED)
+			return false;
+
+		corrupted[(*ncorrupted)++] = blkno;
+	}
+
+	return true;
+}
+
+static bool
+is_all_zeros(const char *p, Size len)
+{
+	Size		i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (p[i] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Restore the page packed by get_page_packed() from data of len bytes
+ * directly into page.
+ */
+static void
+unpack_page(const char *data, int len, BlockNumber blkno, char *page)
+{
+	PackedPageHeader hdr;
+	int			rawlen;
+	int			decompressed = -1;
+
+	if (len < SizeOfPackedPageHeader)
+		ereport(ERROR,
+				(errmsg("fetched page of block %u is too short: %d bytes",
+						blkno, len)));
+
+	memcpy(&hdr, data, SizeOfPackedPageHeader);
+	data += SizeOfPackedPageHeader;
+	len -= SizeOfPackedPageHeader;
+
+	if (hdr.hole_offset + hdr.hole_length > BLCKSZ)
+		ereport(ERROR,
+				(errmsg("fetched page of block %u has invalid hole: offset %u length %u",
+						blkno, hdr.hole_offset, hdr.hole_length)));
+
+	rawlen = BLCKSZ - hdr.hole_length;
+
+	switch (hdr.method)
+	{
+		case FETCH_COMPRESSION_NONE:
+			if (len != rawlen)
+				ereport(ERROR,
+						(errmsg("fetched page length is invalid: expected %d but got %d",
+								rawlen, len)));
+
+			/* Put both sides of the hole in place */
+			memcpy(page, data, hdr.hole_offset);
+			memcpy(page + hdr.hole_offset + hdr.hole_length,
+				   data + hdr.hole_offset, rawlen - hdr.hole_offset);
+			memset(page + hdr.hole_offset, 0, hdr.hole_length);
+			return;
+
+		case FETCH_COMPRESSION_PGLZ:
+#if PG_VERSION_NUM >= 120000
+			decompressed = pglz_decompress(data, len, page, rawlen, true);
+#else
+			decompressed = pglz_decompress(data, len, page, rawlen);
+#endif
+			break;
+
+		case FETCH_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			decompressed = LZ4_decompress_safe(data, page, len, rawlen);
+			break;
+#else
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("fetched page of block %u is compressed by lz4 which is not supported by this build",
+							blkno)));
+#endif
+
+		default:
+			ereport(ERROR,
+					(errmsg("fetched page of block %u has unknown compression method %u",
+							blkno, hdr.method)));
+	}
+
+	if (decompressed != rawlen)
+		ereport(ERROR,
+				(errmsg("could not decompress fetched page of block %u",
+						blkno)));
+
+	/* Move the part after the hole to its place, and clear the hole */
+	memmove(page + hdr.hole_offset + hdr.hole_length, page + hdr.hole_offset,
+			rawlen - hdr.hole_offset);
+	memset(page + hdr.hole_offset, 0, hdr.hole_length);
+}
+
+/*
+ * Pack the page for transfer, see PackedPageHeader.  If the compression
+ * doesn't make the page smaller, it's sent uncompressed.
+ */
+static bytea *
+pack_page(const char *page, FetchCompression method)
+{
+	PageHeader	phdr = (PageHeader) page;
+	PackedPageHeader hdr;
+	PGAlignedBlock raw;
+	int			rawlen;
+	int			len = -1;
+	Size		bound = PGLZ_MAX_OUTPUT(BLCKSZ);
+	bytea	   *result;
+	char	   *dest;
+
+	hdr.hole_offset = 0;
+	hdr.hole_length = 0;
+
+	if (PageIsNew(page))
+	{
+		if (is_all_zeros(page, BLCKSZ))
+			hdr.hole_length = BLCKSZ;
+	}
+	else if (phdr->pd_lower >= SizeOfPageHeaderData &&
+			 phdr->pd_lower < phdr->pd_upper &&
+			 phdr->pd_upper <= BLCKSZ &&
+			 is_all_zeros(page + phdr->pd_lower, phdr->pd_upper - phdr->pd_lower))
+	{
+		hdr.hole_offset = phdr->pd_lower;
+		hdr.hole_length = phdr->pd_upper - phdr->pd_lower;
+	}
+
+	rawlen = BLCKSZ - hdr.hole_length;
+	memcpy(raw.data, page, hdr.hole_offset);
+	memcpy(raw.data + hdr.hole_offset, page + hdr.hole_offset + hdr.hole_length,
+		   rawlen - hdr.hole_offset);
+
+#ifdef USE_LZ4
+	bound = Max(bound, LZ4_COMPRESSBOUND(BLCKSZ));
+#endif
+
+	result = (bytea *) palloc(VARHDRSZ + SizeOfPackedPageHeader + bound);
+	dest = VARDATA(result) + SizeOfPackedPageHeader;
+
+	switch (method)
+	{
+		case FETCH_COMPRESSION_NONE:
+			break;
+		case FETCH_COMPRESSION_PGLZ:
+			len = pglz_compress(raw.data, rawlen, dest, PGLZ_strategy_always);
+			break;
+		case FETCH_COMPRESSION_LZ4:
+#ifdef USE_LZ4
+			len = LZ4_compress_default(raw.data, dest, rawlen, (int) bound);
+			if (len <= 0)
+				len = -1;
+#endif
+			break;
+	}
+
+	if (len < 0 || len >= rawlen)
+	{
+		method = FETCH_COMPRESSION_NONE;
+		len = rawlen;
+		memcpy(dest, raw.data, rawlen);
+	}
+
+	hdr.method = (uint8) method;
+	memcpy(VARDATA(result), &hdr, SizeOfPackedPageHeader);
+	SET_VARSIZE(result, VARHDRSZ + SizeOfPackedPageHeader + len);
+
+	return result;
+}
+
+static void
+check_fetch_result(PGresult *res, BlockNumber blkno)
+{
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		ereport(ERROR,
+				(errmsg("error fetching block %u from source server: %s",
+						blkno, PQresultErrorMessage(res))));
+
+	if (PQnfields(res) != 1 || PQntuples(res) != 1 || PQgetisnull(res, 0, 0))
+		ereport(ERROR,
+				(errmsg("unexpected result set from query")));
+}
+
 static void
 fetch_page_from_standby(Relation relation, const char *forkname, BlockNumber blkno,
 						char *page)
 {
-	StringInfoData	sql;
+	const char *sql = "SELECT get_page_packed($1, $2, $3, $4)";
+	const char *params[4];
+	char		blkno_str[12];
 	PGresult *res;
 
-	initStringInfo(&sql);
-	appendStringInfo(&sql, "SELECT get_page('%s', '%s', %u)",
-					 RelationGetRelationName(relation), forkname, blkno);
-
-	res = PQexecParams(conn, sql.data,
-					   0, NULL, NULL, NULL, NULL,
-					   1);
-
-    if (PQresultStatus(res) != PGRES_TUPLES_OK)
-        ereport(ERROR,
-				(errmsg("error running query (%s) in source server: %s",
-						sql.data, PQresultErrorMessage(res))));
+	snprintf(blkno_str, sizeof(blkno_str), "%u", blkno);
+	params[0] = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+										   RelationGetRelationName(relation));
+	params[1] = forkname;
+	params[2] = blkno_str;
+	params[3] = fetch_compression_names[fetch_compression];
 
-	if (PQgetlength(res, 0, 0) != BLCKSZ)
-        ereport(ERROR,
-				(errmsg("fetched page length is invalid: expected %d but got %d",
-						BLCKSZ, PQgetlength(res, 0, 0))));
+	res = PQexecParams(conn, sql, 4, NULL, params, NULL, NULL, 1);
+	check_fetch_result(res, blkno);
 
-	memcpy(page, PQgetvalue(res, 0, 0), BLCKSZ);
+	unpack_page(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0), blkno, page);
 	PQclear(res);
 }
 
+/*
+ * Fetch the given pages from the standby server into pages, BLCKSZ bytes
+ * each.  If libpq supports pipeline mode, we send the queries for all pages
+ * before reading any result so that we pay the round trip to the standby
+ * only once per FETCH_PIPELINE_DEPTH pages.
+ */
 static void
-wait_until_catchup(XLogRecPtr lsn)
+fetch_pages_from_standby(Relation relation, const char *forkname,
+						 BlockNumber *blknos, int nblocks, char *pages)
 {
-	int rc;
+#ifdef LIBPQ_HAS_PIPELINING
+	const char *sql = "SELECT get_page_packed($1, $2, $3, $4)";
+	const char *params[4];
+	char		blkno_str[12];
+	char	   *relname;
+	PGresult   *res;
+	int			i;
+
+	relname = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+										 RelationGetRelationName(relation));
+	params[0] = relname;
+	params[1] = forkname;
+	params[2] = blkno_str;
+	params[3] = fetch_compression_names[fetch_compression];
+
+	if (PQenterPipelineMode(conn) != 1)
+		ereport(ERROR,
+				(errmsg("could not enter pipeline mode: %s",
+						PQerrorMessage(conn))));
 
-	for (;;)
+	for (i = 0; i < nblocks; i++)
 	{
-		XLogRecPtr standby_lsn;
-		char *lsn_str;
+		snprintf(blkno_str, sizeof(blkno_str), "%u", blknos[i]);
 
+		/* libpq copies the parameters, so we can reuse blkno_str */
+		if (PQsendQueryParams(conn, sql, 4, NULL, params, NULL, NULL, 1) != 1)
+			ereport(ERROR,
+					(errmsg("could not send query (%s) to source server: %s",
+							sql, PQerrorMessage(conn))));
+	}
+
+	if (PQpipelineSync(conn) != 1)
+		ereport(ERROR,
+				(errmsg("could not send pipeline sync to source server: %s",
+						PQerrorMessage(conn))));
+
+	for (i = 0; i < nblocks; i++)
+	{
 		CHECK_FOR_INTERRUPTS();
 
-		lsn_str = exec_query("SELECT pg_last_wal_replay_lsn()");
+		res = PQgetResult(conn);
+		check_fetch_result(res, blknos[i]);
 
-		standby_lsn =
-			DatumGetLSN(DirectFunctionCall1(pg_lsn_in, CStringGetDatum(lsn_str)));
+		unpack_page(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0), blknos[i],
+					pages + (Size) i * BLCKSZ);
+		PQclear(res);
 
-		/* Standby caught up the master */
-		if (lsn <= standby_lsn)
-			break;
+		/* Each query's results are terminated by a NULL */
+		if ((res = PQgetResult(conn)) != NULL)
+			ereport(ERROR,
+					(errmsg("unexpected result set from query")));
+	}
+
+	res = PQgetResult(conn);
+	if (PQresultStatus(res) != PGRES_PIPELINE_SYNC)
+		ereport(ERROR,
+				(errmsg("unexpected result from source server: %s",
+						PQresultErrorMessage(res))));
+	PQclear(res);
+
+	if (PQexitPipelineMode(conn) != 1)
+		ereport(ERROR,
+				(errmsg("could not exit pipeline mode: %s",
+						PQerrorMessage(conn))));
+
+	pfree(relname);
+#else
+	int			i;
+
+	/* No pipeline mode before PostgreSQL 14, fetch the pages one by one */
+	for (i = 0; i < nblocks; i++)
+		fetch_page_from_standby(relation, forkname, blknos[i],
+								pages + (Size) i * BLCKSZ);
+#endif
+}
+
+/*
+ * Get the result of the query sent to the standby server, waiting for it
+ * while processing interrupts.  Only one result is expected.
+ */
+static PGresult *
+get_result_interruptible(void)
+{
+	PGresult   *res;
+	PGresult   *next;
+
+	while (PQisBusy(conn))
+	{
+		int		rc;
 
 #if PG_VERSION_NUM >= 100000
-		rc = WaitLatch(&MyProc->procLatch,
-					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   STANDBY_LSN_CHECK_INTERVAL,
-					   PG_WAIT_EXTENSION);
+		rc = WaitLatchOrSocket(MyLatch,
+							   WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+							   PQsocket(conn), -1L, PG_WAIT_EXTENSION);
+#else
+		rc = WaitLatchOrSocket(MyLatch,
+							   WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+							   PQsocket(conn), -1L);
+#endif
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		if ((rc & WL_SOCKET_READABLE) && PQconsumeInput(conn) == 0)
+			ereport(ERROR,
+					(errmsg("could not receive data from source server: %s",
+							PQerrorMessage(conn))));
+	}
+
+	res = PQgetResult(conn);
+	while ((next = PQgetResult(conn)) != NULL)
+		PQclear(next);
+
+	return res;
+}
+
+/*
+ * Get the LSN that the standby must have replayed to have the latest version
+ * of the pages we can see, and flush the WAL up to it so that the walsender
+ * can send it right away rather than after the WAL writer does.
+ *
+ * That is the end of the last record inserted.  The insert position can't be
+ * used as is: at the start of a WAL page it points past the page header,
+ * which neither XLogFlush() nor the standby's replay position ever reach.
+ */
+static XLogRecPtr
+get_target_lsn(void)
+{
+	XLogRecPtr	lsn;
+
+#if PG_VERSION_NUM >= 160000
+	lsn = GetXLogInsertEndRecPtr();
 #else
-		rc = WaitLatch(&MyProc->procLatch,
-					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   STANDBY_LSN_CHECK_INTERVAL);
+	lsn = GetXLogInsertRecPtr();
+	if (XLogSegmentOffset(lsn, wal_segment_size) == SizeOfXLogLongPHD)
+		lsn -= SizeOfXLogLongPHD;
+	else if (lsn % XLOG_BLCKSZ == SizeOfXLogShortPHD)
+		lsn -= SizeOfXLogShortPHD;
 #endif
 
-		ResetLatch(&MyProc->procLatch);
+	XLogFlush(lsn);
+
+	return lsn;
+}
+
+/*
+ * Wait for the standby server to replay the WAL up to lsn.  Rather than
+ * polling the replay LSN over the connection, we ask the standby to check it
+ * locally and return once it has replayed it, so we notice it without a
+ * round trip per check.
+ */
+static void
+wait_until_catchup(XLogRecPtr lsn)
+{
+	const char *sql = "SELECT wait_for_replay($1, $2)";
+	const char *params[2];
+	char		lsn_str[32];
+	char		timeout_str[12];
+
+	snprintf(lsn_str, sizeof(lsn_str), "%X/%X",
+			 (uint32) (lsn >> 32), (uint32) lsn);
+	snprintf(timeout_str, sizeof(timeout_str), "%d", STANDBY_WAIT_TIMEOUT);
+	params[0] = lsn_str;
+	params[1] = timeout_str;
+
+	for (;;)
+	{
+		PGresult   *res;
+		bool		caught_up;
+
+		if (PQsendQueryParams(conn, sql, 2, NULL, params, NULL, NULL, 0) != 1)
+			ereport(ERROR,
+					(errmsg("could not send query (%s) to source server: %s",
+							sql, PQerrorMessage(conn))));
+
+		res = get_result_interruptible();
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			ereport(ERROR,
+					(errmsg("error running query (%s) in source server: %s",
+							sql, PQresultErrorMessage(res))));
+
+		if (PQnfields(res) != 1 || PQntuples(res) != 1 || PQgetisnull(res, 0, 0))
+			ereport(ERROR,
+					(errmsg("unexpected result set from query")));
+
+		caught_up = (strcmp(PQgetvalue(res, 0, 0), "t") == 0);
+		PQclear(res);
+
+		/* Standby caught up the master */
+		if (caught_up)
+			break;
 	}
 }
 
@@ -283,18 +864,343 @@ pg_repair_page(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(true);
 }
 
-/* Copied from pageinspect.get_raw_page */
+static int
+blkno_cmp(const void *a, const void *b)
+{
+	BlockNumber	blk_a = *(const BlockNumber *) a;
+	BlockNumber	blk_b = *(const BlockNumber *) b;
+
+	if (blk_a < blk_b)
+		return -1;
+	if (blk_a > blk_b)
+		return 1;
+	return 0;
+}
+
 Datum
-get_page(PG_FUNCTION_ARGS)
+pg_repair_pages(PG_FUNCTION_ARGS)
+{
+	Oid oid = PG_GETARG_OID(0);
+	ArrayType *blknos_array = PG_GETARG_ARRAYTYPE_P(1);
+	char *conninfo = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	char *forkname = text_to_cstring(PG_GETARG_TEXT_PP(3));
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	BlockNumber *blknos;
+	int nblocks = 0;
+	int nrepaired;
+	int i;
+
+	deconstruct_array(blknos_array, INT8OID, sizeof(int64), FLOAT8PASSBYVAL,
+					  'd', &elems, &nulls, &nelems);
+
+	if (nelems == 0)
+		PG_RETURN_INT32(0);
+
+	blknos = (BlockNumber *) palloc(sizeof(BlockNumber) * nelems);
+	for (i = 0; i < nelems; i++)
+	{
+		int64 blkno;
+
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("block number must not be null")));
+
+		blkno = DatumGetInt64(elems[i]);
+		if (blkno < 0 || blkno > MaxBlockNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid block number " INT64_FORMAT, blkno)));
+
+		blknos[i] = (BlockNumber) blkno;
+	}
+
+	/* Sort and remove duplicates so we fetch and write blocks only once */
+	qsort(blknos, nelems, sizeof(BlockNumber), blkno_cmp);
+	for (i = 0; i < nelems; i++)
+	{
+		if (nblocks == 0 || blknos[nblocks - 1] != blknos[i])
+			blknos[nblocks++] = blknos[i];
+	}
+
+	nrepaired = repair_pages_internal(oid, blknos, nblocks, forkname, conninfo);
+
+	pfree(blknos);
+
+	PG_RETURN_INT32(nrepaired);
+}
+
+/*
+ * Scan the blocks from 0 to shared->nblocks with nworkers background workers,
+ * each of them scanning a contiguous range, and store the corrupted blocks
+ * found in corrupted in block order.  Return false if any worker overflowed.
+ */
+static bool
+scan_blocks_parallel(Relation relation, ForkNumber forknum, BlockNumber nblocks,
+					 int nworkers, BlockNumber *corrupted, int *ncorrupted)
+{
+	BackgroundWorkerHandle **handles;
+	ScanShared *shared;
+	BlockNumber *worker_corrupted;
+	dsm_segment *seg;
+	shm_toc_estimator e;
+	shm_toc	   *toc;
+	Size		shared_size;
+	Size		segsize;
+	bool		complete = true;
+	int			i;
+
+	/* Set up the segment for the shared state and the corrupted blocks */
+	shared_size = add_size(offsetof(ScanShared, results),
+						   mul_size(sizeof(ScanWorkerResult), nworkers));
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, shared_size);
+	shm_toc_estimate_chunk(&e, mul_size(sizeof(BlockNumber) * SCAN_MAX_CORRUPTED,
+										nworkers));
+	shm_toc_estimate_keys(&e, 2);
+	segsize = shm_toc_estimate(&e);
+
+	seg = dsm_create(segsize, 0);
+	toc = shm_toc_create(PAGE_REPAIR_SCAN_MAGIC, dsm_segment_address(seg),
+						 segsize);
+
+	shared = shm_toc_allocate(toc, shared_size);
+	memset(shared, 0, shared_size);
+	shared->dboid = MyDatabaseId;
+	shared->useroid = GetUserId();
+	shared->relid = RelationGetRelid(relation);
+	shared->forknum = forknum;
+	shared->nblocks = nblocks;
+	shared->nworkers = nworkers;
+	shm_toc_insert(toc, PAGE_REPAIR_KEY_SHARED, shared);
+
+	worker_corrupted = shm_toc_allocate(toc, sizeof(BlockNumber) *
+										SCAN_MAX_CORRUPTED * nworkers);
+	shm_toc_insert(toc, PAGE_REPAIR_KEY_CORRUPTED, worker_corrupted);
+
+	/* Launch workers */
+	handles = palloc0(sizeof(BackgroundWorkerHandle *) * nworkers);
+	PG_TRY();
+	{
+		for (i = 0; i < nworkers; i++)
+		{
+			BackgroundWorker worker;
+
+			memset(&worker, 0, sizeof(worker));
+			worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+				BGWORKER_BACKEND_DATABASE_CONNECTION;
+			worker.bgw_start_time = BgWorkerStart_ConsistentState;
+			worker.bgw_restart_time = BGW_NEVER_RESTART;
+			sprintf(worker.bgw_library_name, "page_repair");
+			sprintf(worker.bgw_function_name, "page_repair_scan_main");
+			snprintf(worker.bgw_name, BGW_MAXLEN,
+					 "page_repair scan worker %d", i);
+			snprintf(worker.bgw_type, BGW_MAXLEN, "page_repair scan worker");
+			worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+			memcpy(worker.bgw_extra, &i, sizeof(int));
+			worker.bgw_notify_pid = MyProcPid;
+
+			if (!RegisterDynamicBackgroundWorker(&worker, &handles[i]))
+				ereport(ERROR,
+						(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+						 errmsg("could not register background process"),
+						 errhint("You may need to increase max_worker_processes.")));
+		}
+
+		for (i = 0; i < nworkers; i++)
+			WaitForBackgroundWorkerShutdown(handles[i]);
+	}
+	PG_CATCH();
+	{
+		for (i = 0; i < nworkers; i++)
+		{
+			if (handles[i])
+				TerminateBackgroundWorker(handles[i]);
+		}
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/* The workers scanned contiguous ranges in order, so just concatenate */
+	*ncorrupted = 0;
+	for (i = 0; i < nworkers; i++)
+	{
+		ScanWorkerResult *res = &(shared->results[i]);
+
+		if (!res->done)
+			elog(ERROR, "page_repair scan worker %d did not finish", i);
+
+		elog(DEBUG1, "scan worker %d: scanned %u blocks, %d corrupted, %.3f ms",
+			 i, res->nscanned, res->ncorrupted, res->elapsed_ms);
+
+		memcpy(&(corrupted[*ncorrupted]),
+			   &(worker_corrupted[(Size) SCAN_MAX_CORRUPTED * i]),
+			   sizeof(BlockNumber) * res->ncorrupted);
+		*ncorrupted += res->ncorrupted;
+
+		if (res->overflowed)
+			complete = false;
+	}
+
+	dsm_detach(seg);
+	pfree(handles);
+
+	return complete;
+}
+
+/*
+ * Verify the checksums of all blocks of the given fork, using nworkers
+ * background workers if nworkers > 0, and repair the corrupted ones with the
+ * pages of the standby server.  Return the number of repaired pages.
+ */
+Datum
+pg_scan_and_repair(PG_FUNCTION_ARGS)
+{
+	Oid oid = PG_GETARG_OID(0);
+	char *conninfo = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	int nworkers = PG_GETARG_INT32(2);
+	char *forkname = text_to_cstring(PG_GETARG_TEXT_PP(3));
+	ForkNumber forknum = forkname_to_number(forkname);
+	Relation relation;
+	BlockNumber nblocks;
+	BlockNumber *corrupted;
+	int ncorrupted;
+	int nrepaired = 0;
+	bool complete;
+	instr_time start_time,
+		elapsed;
+
+	check_repair_prerequisites();
+
+	if (nworkers < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers must not be negative")));
+
+	/* Don't block the concurrent readers and writers while scanning */
+	relation = relation_open(oid, AccessShareLock);
+	check_relation_kind(relation);
+	nblocks = RelationGetNumberOfBlocksInFork(relation, forknum);
+
+	/* Don't bother launching more workers than chunks */
+	if ((BlockNumber) nworkers > nblocks / SCAN_CHUNK_BLOCKS)
+		nworkers = nblocks / SCAN_CHUNK_BLOCKS + (nblocks % SCAN_CHUNK_BLOCKS != 0);
+
+	corrupted = (BlockNumber *) palloc(sizeof(BlockNumber) * SCAN_MAX_CORRUPTED *
+									   Max(nworkers, 1));
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	if (nworkers > 0)
+		complete = scan_blocks_parallel(relation, forknum, nblocks, nworkers,
+										corrupted, &ncorrupted);
+	else
+	{
+		BlockNumber nscanned;
+
+		complete = scan_blocks(relation, forknum, 0, nblocks, corrupted,
+							   &ncorrupted, &nscanned);
+	}
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+	elog(NOTICE, "scanned %u blocks in %.3f ms (%.1f MB/s) with %d workers, found %d corrupted pages",
+		 nblocks, INSTR_TIME_GET_MILLISEC(elapsed),
+		 (double) nblocks * BLCKSZ / (1024 * 1024) /
+		 Max(INSTR_TIME_GET_DOUBLE(elapsed), 0.001),
+		 nworkers, ncorrupted);
+
+	/* repair_pages_internal() takes AccessExclusiveLock, release ours first */
+	relation_close(relation, AccessShareLock);
+
+	if (ncorrupted > 0)
+		nrepaired = repair_pages_internal(oid, corrupted, ncorrupted, forkname,
+										  conninfo);
+
+	if (!complete)
+		ereport(WARNING,
+				(errmsg("stopped scanning after finding %d corrupted pages",
+						ncorrupted),
+				 errhint("Run pg_scan_and_repair() again to repair the rest.")));
+
+	pfree(corrupted);
+
+	PG_RETURN_INT32(nrepaired);
+}
+
+/*
+ * Entry point of the pg_scan_and_repair() workers. main_arg is the handle of
+ * the segment set up by scan_blocks_parallel() and bgw_extra has the worker
+ * number.
+ */
+void
+page_repair_scan_main(Datum main_arg)
+{
+	ScanShared *shared;
+	ScanWorkerResult *res;
+	BlockNumber *corrupted;
+	dsm_segment *seg;
+	shm_toc	   *toc;
+	Relation	relation;
+	instr_time	start_time,
+				elapsed;
+	BlockNumber	start,
+				end;
+	int			worker_id;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	memcpy(&worker_id, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "page_repair scan worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	toc = shm_toc_attach(PAGE_REPAIR_SCAN_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("bad magic number in dynamic shared memory segment")));
+	shared = shm_toc_lookup(toc, PAGE_REPAIR_KEY_SHARED, false);
+	corrupted = shm_toc_lookup(toc, PAGE_REPAIR_KEY_CORRUPTED, false);
+	res = &(shared->results[worker_id]);
+
+	BackgroundWorkerInitializeConnectionByOid(shared->dboid, shared->useroid, 0);
+
+	StartTransactionCommand();
+	relation = relation_open(shared->relid, AccessShareLock);
+
+	start = (uint64) shared->nblocks * worker_id / shared->nworkers;
+	end = (uint64) shared->nblocks * (worker_id + 1) / shared->nworkers;
+
+	INSTR_TIME_SET_CURRENT(start_time);
+	res->overflowed = !scan_blocks(relation, shared->forknum, start, end,
+								   &(corrupted[(Size) SCAN_MAX_CORRUPTED * worker_id]),
+								   &(res->ncorrupted), &(res->nscanned));
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start_time);
+
+	relation_close(relation, AccessShareLock);
+	CommitTransactionCommand();
+
+	res->elapsed_ms = INSTR_TIME_GET_MILLISEC(elapsed);
+	res->done = true;
+
+	dsm_detach(seg);
+}
+
+/* Copied from pageinspect.get_raw_page */
+static void
+read_raw_page(text *relname, text *forkname, uint32 blkno, char *raw_page_data)
 {
-	text *relname = PG_GETARG_TEXT_PP(0);
-	text *forkname = PG_GETARG_TEXT_PP(1);
-	uint32 blkno = PG_GETARG_UINT32(2);
 	ForkNumber forknum = forkname_to_number(text_to_cstring(forkname));
-	bytea	   *raw_page;
 	RangeVar   *relrv;
 	Relation	rel;
-	char	   *raw_page_data;
 	Buffer		buf;
 
 	if (!superuser())
@@ -305,11 +1211,6 @@ get_page(PG_FUNCTION_ARGS)
 	relrv = makeRangeVarFromNameList(textToQualifiedNameList(relname));
 	rel = relation_openrv(relrv, AccessShareLock);
 
-	/* Initialize buffer to copy to */
-	raw_page = (bytea *) palloc(BLCKSZ + VARHDRSZ);
-	SET_VARSIZE(raw_page, BLCKSZ + VARHDRSZ);
-	raw_page_data = VARDATA(raw_page);
-
 	/* Take a verbatim copy of the page */
 
 	buf = ReadBufferExtended(rel, forknum, blkno, RBM_NORMAL, NULL);
@@ -321,24 +1222,95 @@ get_page(PG_FUNCTION_ARGS)
 	ReleaseBuffer(buf);
 
 	relation_close(rel, AccessShareLock);
+}
+
+Datum
+get_page(PG_FUNCTION_ARGS)
+{
+	text *relname = PG_GETARG_TEXT_PP(0);
+	text *forkname = PG_GETARG_TEXT_PP(1);
+	uint32 blkno = PG_GETARG_UINT32(2);
+	bytea	   *raw_page;
+
+	/* Initialize buffer to copy to */
+	raw_page = (bytea *) palloc(BLCKSZ + VARHDRSZ);
+	SET_VARSIZE(raw_page, BLCKSZ + VARHDRSZ);
+
+	read_raw_page(relname, forkname, blkno, VARDATA(raw_page));
 
 	PG_RETURN_BYTEA_P(raw_page);
 }
 
-static void
-repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
-					 const char *conninfo)
+/*
+ * Same as get_page() but returns the page packed by pack_page(), compressed
+ * by the given method.
+ */
+Datum
+get_page_packed(PG_FUNCTION_ARGS)
 {
-	Relation	relation;
-	ForkNumber	forknum = forkname_to_number(forkname);
-	BufferTag	tag;
-	uint32		taghash;
-	LWLock		*partlock;
-	int			buf_id;
-	char		page[BLCKSZ];
-	char		standby_page[BLCKSZ];
-	XLogRecPtr	target_lsn;
+	text *relname = PG_GETARG_TEXT_PP(0);
+	text *forkname = PG_GETARG_TEXT_PP(1);
+	uint32 blkno = PG_GETARG_UINT32(2);
+	char *method_name = text_to_cstring(PG_GETARG_TEXT_PP(3));
+	const struct config_enum_entry *entry;
+	PGAlignedBlock page;
 
+	for (entry = fetch_compression_options; entry->name; entry++)
+	{
+		if (strcmp(entry->name, method_name) == 0)
+			break;
+	}
+
+	if (entry->name == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unsupported compression method \"%s\"", method_name)));
+
+	read_raw_page(relname, forkname, blkno, page.data);
+
+	PG_RETURN_BYTEA_P(pack_page(page.data, (FetchCompression) entry->val));
+}
+
+/*
+ * Wait for the recovery to replay the WAL up to the given LSN, for timeout
+ * milliseconds at most.  Return true if it was replayed.
+ */
+Datum
+wait_for_replay(PG_FUNCTION_ARGS)
+{
+	XLogRecPtr	lsn = PG_GETARG_LSN(0);
+	int			timeout = PG_GETARG_INT32(1);
+	TimestampTz	end;
+
+	if (!RecoveryInProgress())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("recovery is not in progress")));
+
+	end = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout);
+
+	for (;;)
+	{
+		long		remaining;
+
+		if (GetXLogReplayRecPtr(NULL) >= lsn)
+			PG_RETURN_BOOL(true);
+
+		remaining = (long) ((end - GetCurrentTimestamp()) / 1000);
+		if (remaining <= 0)
+			PG_RETURN_BOOL(false);
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 Min(remaining, REPLAY_CHECK_INTERVAL),
+						 PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+static void
+check_repair_prerequisites(void)
+{
 	if (RecoveryInProgress())
 		ereport(ERROR,
 				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
@@ -352,17 +1324,22 @@ repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
 	if (!DataChecksumsEnabled())
 		ereport(ERROR,
 				(errmsg("data checksums are not enabled")));
+}
 
-	/* Connect to the standby server and do sanity checks */
-	connect_standby(conninfo);
-	check_standby();
-
-	/* Open relation and do sanity checks */
-	relation = relation_open(oid, AccessExclusiveLock);
-	check_relation(relation, forknum, blkno);
-
-	/* Get the current lsn */
-	target_lsn = GetXLogWriteRecPtr();
+/*
+ * Read the given block from the disk into page, bypassing shared buffers.
+ * If the page is loaded in shared buffers, we invalidate it so that the
+ * repaired page is read from the disk afterwards.  Return false without
+ * reading if the buffer is dirty.
+ */
+static bool
+read_local_page(Relation relation, ForkNumber forknum, BlockNumber blkno,
+				char *page)
+{
+	BufferTag	tag;
+	uint32		taghash;
+	LWLock		*partlock;
+	int			buf_id;
 
 	/* Create buffer tag and compute partition lock ID */
 	INIT_BUFFERTAG(tag, relation->rd_smgr->smgr_rnode.node, forknum, blkno);
@@ -385,9 +1362,8 @@ repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
 		 */
 		if ((buf_state & (BM_DIRTY | BM_JUST_DIRTIED)) != 0)
 		{
-			elog(NOTICE,"skipping page repair of the given page --- page is marked as dirty");
 			LWLockRelease(partlock);
-			goto cleanup;
+			return false;
 		}
 
 		if ((buf_state & BM_VALID) != 0)
@@ -403,31 +1379,224 @@ repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
 	smgrread(relation->rd_smgr, forknum, blkno, page);
 	LWLockRelease(partlock);
 
-	if (verify_page(blkno, page))
+	return true;
+}
+
+/*
+ * Add the time since *start to *phase, and start the next phase.
+ */
+static void
+end_phase(instr_time *phase, instr_time *start)
+{
+	instr_time	now;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_ACCUM_DIFF(*phase, now, *start);
+	*start = now;
+}
+
+/*
+ * Install the page fetched from the standby in shared buffers, replacing the
+ * corrupted one without reading it, and WAL-log it as a full page image.  The
+ * page becomes durable by the next checkpoint like any other change.
+ */
+static void
+install_page(Relation relation, ForkNumber forknum, BlockNumber blkno,
+			 const char *page)
+{
+	Buffer		buf;
+
+	buf = ReadBufferExtended(relation, forknum, blkno, RBM_ZERO_AND_LOCK, NULL);
+
+	START_CRIT_SECTION();
+
+	memcpy(BufferGetPage(buf), page, BLCKSZ);
+	MarkBufferDirty(buf);
+
+	/*
+	 * Not all forks have the standard page layout, so log the whole page
+	 * rather than letting the hole go.
+	 */
+	if (RelationNeedsWAL(relation))
+		log_newpage_buffer(buf, false);
+
+	END_CRIT_SECTION();
+
+	UnlockReleaseBuffer(buf);
+}
+
+static void
+repair_page_internal(Oid oid, BlockNumber blkno, const char *forkname,
+					 const char *conninfo)
+{
+	(void) repair_pages_internal(oid, &blkno, 1, forkname, conninfo);
+}
+
+/*
+ * Repair the given blocks, which must be sorted and unique, in one go.  We
+ * connect to the standby once, find the corrupted pages, wait for the standby
+ * to catch up once and fetch them using pipelined queries.  Depending on
+ * page_repair.write_mode, the pages are overwritten on the disk and the
+ * relation is synced only once at the end, or installed in shared buffers.
+ * Return the number of repaired pages.
+ */
+static int
+repair_pages_internal(Oid oid, BlockNumber *blknos, int nblocks,
+					  const char *forkname, const char *conninfo)
+{
+	int			nrepaired;
+
+	check_repair_prerequisites();
+
+	/*
+	 * Connect to the standby server and do sanity checks.  Close the
+	 * connection on error too, as waiting for the standby can be cancelled or
+	 * time out.
+	 */
+	PG_TRY();
 	{
-		elog(NOTICE, "skipping page repair of the given page --- page is not corrupted");
-		goto cleanup;
+		connect_standby(conninfo);
+		check_standby();
+
+		nrepaired = repair_pages_from_standby(oid, blknos, nblocks, forkname);
 	}
+	PG_CATCH();
+	{
+		PQfinish(conn);
+		conn = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	PQfinish(conn);
+	conn = NULL;
+
+	return nrepaired;
+}
+
+/*
+ * Workhorse of repair_pages_internal(), once connected to the standby.
+ */
+static int
+repair_pages_from_standby(Oid oid, BlockNumber *blknos, int nblocks,
+						  const char *forkname)
+{
+	Relation	relation;
+	ForkNumber	forknum = forkname_to_number(forkname);
+	char		page[BLCKSZ];
+	char	   *standby_pages;
+	BlockNumber *corrupted;
+	int			ncorrupted = 0;
+	XLogRecPtr	target_lsn;
+	RepairTimings timings;
+	instr_time	start;
+	int			i;
+
+	memset(&timings, 0, sizeof(timings));
+	INSTR_TIME_SET_CURRENT(start);
 
 	/*
-	 * The page is corrupted. We wait for the standby's applay LSN  to reach the
-	 * current local LSN .
+	 * Let the standby catch up before taking the lock, so that we have little
+	 * to wait for while holding it.
+	 */
+	wait_until_catchup(get_target_lsn());
+	end_phase(&timings.catchup, &start);
+
+	/* Open relation and do sanity checks */
+	relation = relation_open(oid, AccessExclusiveLock);
+	end_phase(&timings.lock_wait, &start);
+	for (i = 0; i < nblocks; i++)
+		check_relation(relation, forknum, blknos[i]);
+
+	/*
+	 * Get the current lsn. Since we're holding AccessExclusiveLock, this
+	 * covers the latest changes of all the given pages.
+	 */
+	target_lsn = get_target_lsn();
+
+	/* Collect the corrupted pages */
+	corrupted = (BlockNumber *) palloc(sizeof(BlockNumber) * nblocks);
+	for (i = 0; i < nblocks; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		if (!read_local_page(relation, forknum, blknos[i], page))
+		{
+			elog(NOTICE, "skipping page repair of block %u --- page is marked as dirty",
+				 blknos[i]);
+			continue;
+		}
+
+		if (verify_page(blknos[i], page))
+		{
+			elog(NOTICE, "skipping page repair of block %u --- page is not corrupted",
+				 blknos[i]);
+			continue;
+		}
+
+		corrupted[ncorrupted++] = blknos[i];
+	}
+	end_phase(&timings.read, &start);
+
+	if (ncorrupted == 0)
+		goto cleanup;
+
+	/*
+	 * Recheck that the standby caught up, once for all pages.  This returns
+	 * immediately unless the pages have been modified since we waited before
+	 * taking the lock.
 	 */
 	wait_until_catchup(target_lsn);
+	end_phase(&timings.catchup, &start);
 
-	/* Get the target page from the standby server */
-	fetch_page_from_standby(relation, forkname, blkno, standby_page);
+	standby_pages = (char *) palloc(BLCKSZ * FETCH_PIPELINE_DEPTH);
+	for (i = 0; i < ncorrupted; i += FETCH_PIPELINE_DEPTH)
+	{
+		int		n = Min(ncorrupted - i, FETCH_PIPELINE_DEPTH);
+		int		j;
 
-	/* Verify the page got from the standby server */
-	if (!verify_page(blkno, standby_page))
-		ereport(ERROR,
-				(errmsg("page on standby is also corrupted")));
+		fetch_pages_from_standby(relation, forkname, &(corrupted[i]), n,
+								 standby_pages);
 
-	/* Overwrite the corrupted page */
-	smgrwrite(relation->rd_smgr, forknum, blkno, standby_page, 1);
-	smgrimmedsync(relation->rd_smgr, forknum);
+		/* Verify all pages of this batch before overwriting any of them */
+		for (j = 0; j < n; j++)
+		{
+			if (!verify_page(corrupted[i + j], standby_pages + (Size) j * BLCKSZ))
+				ereport(ERROR,
+						(errmsg("page of block %u on standby is also corrupted",
+								corrupted[i + j])));
+		}
+		end_phase(&timings.fetch, &start);
+
+		/* Overwrite the corrupted pages */
+		for (j = 0; j < n; j++)
+		{
+			if (write_mode == WRITE_MODE_BUFFER)
+				install_page(relation, forknum, corrupted[i + j],
+							 standby_pages + (Size) j * BLCKSZ);
+			else
+				smgrwrite(RelationGetSmgr(relation), forknum, corrupted[i + j],
+						  standby_pages + (Size) j * BLCKSZ, 1);
+		}
+		end_phase(&timings.write, &start);
+	}
+	pfree(standby_pages);
+
+	if (write_mode == WRITE_MODE_SMGR)
+		smgrimmedsync(RelationGetSmgr(relation), forknum);
+	end_phase(&timings.write, &start);
 
 cleanup:
 	relation_close(relation, NoLock);
-	PQfinish(conn);
+	pfree(corrupted);
+
+	elog(NOTICE, "repaired %d of %d pages: catch-up %.3f ms, lock wait %.3f ms, read %.3f ms, fetch %.3f ms, write %.3f ms",
+		 ncorrupted, nblocks,
+		 INSTR_TIME_GET_MILLISEC(timings.catchup),
+		 INSTR_TIME_GET_MILLISEC(timings.lock_wait),
+		 INSTR_TIME_GET_MILLISEC(timings.read),
+		 INSTR_TIME_GET_MILLISEC(timings.fetch),
+		 INSTR_TIME_GET_MILLISEC(timings.write));
+
+	return ncorrupted;
 }
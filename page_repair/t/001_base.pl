@@ -2,7 +2,7 @@ use strict;
 use warnings;
 use PostgresNode;
 use TestLib;
-use Test::More tests => 9;
+use Test::More tests => 13;
 
 my $master = get_new_node('master');
 $master->init(
@@ -24,12 +24,16 @@ command_fails([ 'pg_checksums', '--enable', '--no-sync', '-D', $pgdata ],
 	      "enabling checksums fails if already enabled");
 
 
-# Populate table
+# Populate table, big enough for pg_scan_and_repair() to split it into more
+# chunks (of SCAN_CHUNK_BLOCKS, 128 blocks) than it has workers
 $master->start;
 $master->safe_psql(
     'postgres',
     'CREATE EXTENSION page_repair;
-    CREATE TABLE test WITH (autovacuum_enabled = off) AS SELECT generate_series(1,1000) as i;');
+    CREATE TABLE test WITH (autovacuum_enabled = off) AS SELECT generate_series(1,150000) as i;');
+my $nblocks = $master->safe_psql('postgres',
+    "SELECT pg_relation_size('test') / current_setting('block_size')::int;");
+ok($nblocks > 2 * 128, 'table spans more than 2 * SCAN_CHUNK_BLOCKS blocks');
 
 $master->backup('backup');
 
@@ -51,10 +55,13 @@ my $block_size = $master->safe_psql('postgres', 'SHOW block_size;');
 $master->stop;
 $standby->stop;
 
-# Time to create some corruption
+# Time to create some corruption, on the first three blocks
 open my $file, '+<', "$pgdata/$file_corrupted";
-seek($file, $pageheader_size, 0);
-syswrite($file, "\0\0\0\0\0\0\0\0\0");
+foreach my $blkno (0 .. 2)
+{
+    seek($file, $blkno * $block_size + $pageheader_size, 0);
+    syswrite($file, "\0\0\0\0\0\0\0\0\0");
+}
 close $file;
 
 # Check checksum verification fails due to corrupted relation
@@ -65,7 +72,7 @@ $master->command_checks_all(
      '--filenode',   $relfilenode_corrupted
     ],
     1,
-    [qr/Bad checksums:.*1/],
+    [qr/Bad checksums:.*3/],
     [qr/checksum verification failed/],
     "fails with corrupted data for single relfilenode"
     );
@@ -79,6 +86,13 @@ $master->safe_psql(
 	'postgres',
 	"SELECT pg_repair_page('test', 0, '$standby_connstr')");
 
+# Repair the rest at once through shared buffers, block 3 is not corrupted
+my $nrepaired = $master->safe_psql(
+	'postgres',
+	"SET page_repair.write_mode = 'buffer';
+	 SELECT pg_repair_pages('test', '{2, 1, 3, 2}', '$standby_connstr')");
+is($nrepaired, '2', 'pg_repair_pages repairs only corrupted pages');
+
 $master->stop;
 $standby->stop;
 
@@ -89,3 +103,32 @@ command_ok([
 	'--filenode', $relfilenode_corrupted
 		   ],
 		   "succeeds with offline cluster");
+
+# Corrupt blocks of different chunks again, and let a scan with two workers
+# find and repair them
+open $file, '+<', "$pgdata/$file_corrupted";
+foreach my $blkno (1, 4, 200, $nblocks - 1)
+{
+    seek($file, $blkno * $block_size + $pageheader_size, 0);
+    syswrite($file, "\0\0\0\0\0\0\0\0\0");
+}
+close $file;
+
+$master->start;
+$standby->start;
+
+$nrepaired = $master->safe_psql(
+	'postgres',
+	"SET page_repair.fetch_compression = 'pglz';
+	 SELECT pg_scan_and_repair('test', '$standby_connstr', 2)");
+is($nrepaired, '4', 'pg_scan_and_repair finds and repairs corrupted pages');
+
+$master->stop;
+$standby->stop;
+
+command_ok([
+	'pg_checksums', '--check',
+	'-D', $pgdata,
+	'--filenode', $relfilenode_corrupted
+		   ],
+		   "succeeds with offline cluster after scan");
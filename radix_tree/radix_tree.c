@@ -1,12 +1,25 @@
 #include "postgres.h"
 
 #include "miscadmin.h"
+#include "port/atomics.h"
 #include "port/pg_bitutils.h"
 #include "utils/memutils.h"
 #include "lib/stringinfo.h"
 
 #include "radix_tree.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>			/* x86 SSE2 intrinsics */
+#define RT_USE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RT_USE_NEON
+#endif
+
+#if defined(RT_USE_SSE2) || defined(RT_USE_NEON)
+#define RT_USE_SIMD
+#endif
+
 #define RADIX_TREE_NODE_FANOUT	8
 #define RADIX_TREE_CHUNK_MASK ((1 << RADIX_TREE_NODE_FANOUT) - 1)
 #define RADIX_TREE_MAX_SHIFT key_get_shift(UINT64_MAX)
@@ -28,12 +41,30 @@ typedef enum radix_tree_node_kind
 } radix_tree_node_kind;
 #define RADIX_TREE_NODE_KIND_COUNT 4
 
+/*
+ * Path compression and lazy expansion.
+ *
+ * A node doesn't need to be at the level right below its parent. Every node
+ * stores the key bits above its own chunk as prefix (lower bits are zero),
+ * and the levels between the parent and the node, which would have a single
+ * child, are skipped. A key is only present below the node if its upper bits
+ * match the prefix, so the number of skipped levels is implied by the shifts
+ * of the parent and the node and doesn't need to be stored separately.
+ *
+ * A new key is inserted as a leaf that is linked directly to the deepest node
+ * sharing its prefix, rather than as a chain of node-4 with one child each.
+ * If the key doesn't match the prefix of a node on the way, a node-4 is put
+ * above the node at the highest differing chunk, having the node and the new
+ * leaf as children. The root is handled the same way, so the tree never
+ * needs to be extended for larger keys.
+ */
 typedef struct radix_tree_node
 {
-	uint8	count;
+	uint64	prefix;
+	uint16	count;			/* up to 256 */
 	uint8	shift;
-	uint8	chunk;
-	radix_tree_node_kind	kind;
+	uint8	kind;			/* radix_tree_node_kind */
+	uint32	handle;			/* arena mode only, see below */
 } radix_tree_node;
 
 typedef struct radix_tree_node_4
@@ -52,11 +83,21 @@ typedef struct radix_tree_node_16
 	Datum slots[16];
 } radix_tree_node_16;
 
+/*
+ * node-48 keeps its slots in chunk order. The slot of a chunk is found by
+ * counting the chunks present before it, using the bitmap of present chunks
+ * and the number of chunks present before each bitmap word. Together with
+ * the node header they take 52 bytes, so resolving the slot index touches
+ * only the cache line(s) that we read for the header anyway.
+ */
+#define RADIX_TREE_ISSET_WORDS	(256 / 64)
+
 typedef struct radix_tree_node_48
 {
 	radix_tree_node n;
 
-	uint8	slot_idxs[255];
+	uint64	isset[RADIX_TREE_ISSET_WORDS];
+	uint8	base[RADIX_TREE_ISSET_WORDS];
 	Datum slots[48];
 } radix_tree_node_48;
 
@@ -64,49 +105,177 @@ typedef struct radix_tree_node_256
 {
 	radix_tree_node n;
 
+	/* a slot can be used even for (Datum) 0 as value */
+	uint64	isset[RADIX_TREE_ISSET_WORDS];
 	Datum	slots[256];
 } radix_tree_node_256;
 
+#define ISSET_WORD(chunk)	((chunk) / 64)
+#define ISSET_BIT(chunk)	(UINT64CONST(1) << ((chunk) % 64))
+
+/*
+ * Arena mode.
+ *
+ * A tree created by radix_tree_create_arena() carves its nodes one after
+ * another from large blocks rather than taking them from a slab per node
+ * kind, so the nodes have no chunk headers. A node replaced by a larger kind
+ * is put on a free list to be reused for a node of the same kind, and the
+ * blocks are released all at once by radix_tree_destroy(). This suits a tree
+ * that is built and then searched, like the dead tuples of a vacuum.
+ *
+ * A node in the arena is identified by a 32-bit handle, made of the block
+ * number and the offset in the block in 8-byte units. The slots of the inner
+ * nodes hold the handles of the children instead of pointers, and are half
+ * the size, e.g. an inner node-256 takes 1072 bytes instead of 2096. Leaves
+ * have the same slots as in the normal mode, since they hold the values.
+ */
+#define RADIX_TREE_ARENA_BLOCK_SIZE		(1024 * 1024)
+#define RADIX_TREE_ARENA_OFFSET_BITS	17	/* log2(block size / 8) */
+#define RADIX_TREE_ARENA_OFFSET_MASK	((1 << RADIX_TREE_ARENA_OFFSET_BITS) - 1)
+#define RADIX_TREE_ARENA_MAX_BLOCKS		(1 << (32 - RADIX_TREE_ARENA_OFFSET_BITS))
+
+/* Do the slots of the node hold handles? */
+#define NodeHasHandles(tree, n) ((tree)->arena && !NodeIsLeaf(n))
+
+#define RADIX_TREE_INNER_ARENA_SIZE(type, nslots) \
+	MAXALIGN(offsetof(type, slots) + sizeof(uint32) * (nslots))
+
 typedef struct radix_tree_node_info_elem
 {
 	const char *name;
 	int		max_slots;
 	Size	size;
+	Size	slots_offset;
+	Size	inner_arena_size;	/* size of an inner node in arena mode */
 } radix_tree_node_info_elem;
 
 static radix_tree_node_info_elem radix_tree_node_info[] =
 {
-	{"radix tree node 4", 4, sizeof(radix_tree_node_4)},
-	{"radix tree node 16", 16, sizeof(radix_tree_node_16)},
-	{"radix tree node 48", 48, sizeof(radix_tree_node_48)},
-	{"radix tree node 256", 256, sizeof(radix_tree_node_256)},
+	{"radix tree node 4", 4, sizeof(radix_tree_node_4),
+	 offsetof(radix_tree_node_4, slots),
+	 RADIX_TREE_INNER_ARENA_SIZE(radix_tree_node_4, 4)},
+	{"radix tree node 16", 16, sizeof(radix_tree_node_16),
+	 offsetof(radix_tree_node_16, slots),
+	 RADIX_TREE_INNER_ARENA_SIZE(radix_tree_node_16, 16)},
+	{"radix tree node 48", 48, sizeof(radix_tree_node_48),
+	 offsetof(radix_tree_node_48, slots),
+	 RADIX_TREE_INNER_ARENA_SIZE(radix_tree_node_48, 48)},
+	{"radix tree node 256", 256, sizeof(radix_tree_node_256),
+	 offsetof(radix_tree_node_256, slots),
+	 RADIX_TREE_INNER_ARENA_SIZE(radix_tree_node_256, 256)},
 };
 
+/*
+ * Concurrency mode.
+ *
+ * A tree created by radix_tree_create_concurrent() allows one writer and any
+ * number of readers at the same time, without readers taking a lock. The
+ * writer never changes anything a reader can see except by a single aligned
+ * pointer (or slot) store issued after a write barrier:
+ *
+ * - A new leaf, or a new node-4 put above a node whose prefix doesn't match
+ *   the key, is built completely before being linked to the tree.
+ * - Inserting into node-4, node-16 and node-48, whose arrays are shifted in
+ *   place, or growing a node, is done on a copy of the node, which then
+ *   replaces the old node in its parent (or the root).
+ * - Inserting into node-256 fills the slot before setting its bit.
+ * - Deleting from node-4, node-16 and node-48, or shrinking a node, is done
+ *   on a copy like inserting. Deleting from node-256 just clears the bit.
+ * - A removed node, or an inner node left with one child that takes its
+ *   place in the parent, is unlinked by a single store as well.
+ * - The prefix and shift of a node never change once it's linked.
+ *
+ * Replaced nodes might still be visited by readers, so they are retired
+ * rather than freed. Readers announce the epoch they started in with
+ * radix_tree_read_begin() and clear it with radix_tree_read_end(). Retiring a
+ * node advances the global epoch, and the node is freed once no reader
+ * started in an epoch up to the one it was retired in.
+ */
+typedef union radix_tree_reader
+{
+	pg_atomic_uint64 epoch;		/* 0 when not reading */
+	char		pad[PG_CACHE_LINE_SIZE];
+} radix_tree_reader;
+
+typedef struct radix_tree_retired
+{
+	radix_tree_node *node;
+	uint64		epoch;			/* the epoch when the node was unlinked */
+} radix_tree_retired;
+
+/* Try to reclaim retired nodes when we have this many */
+#define RADIX_TREE_RECLAIM_THRESHOLD 64
+
+/*
+ * Memory limit.
+ *
+ * mem_used counts the bytes of the nodes, including the retired ones not
+ * freed yet. With a limit set by radix_tree_set_memory_limit(), the callback
+ * is called once, right after the insertion that leaves less room than the
+ * next insertion could need. That's a new leaf and a node-256 grown from a
+ * node-48, while the node-48 is still there.
+ */
+#define RADIX_TREE_MAX_INSERT_BYTES \
+	(sizeof(radix_tree_node_4) + sizeof(radix_tree_node_256))
+
 struct radix_tree
 {
-	uint64	max_val;
 	MemoryContext context;
 	radix_tree_node	*root;
 	MemoryContextData *slabs[RADIX_TREE_NODE_KIND_COUNT];
 
 	uint64	num_entries;
 
+	/* arena mode, see above */
+	bool	arena;
+	MemoryContext arena_context;
+	char  **arena_blocks;
+	int		arena_nblocks;
+	int		arena_maxblocks;
+	Size	arena_freeoff;		/* offset of the free space in the last block */
+	Size	arena_carved;		/* bytes carved from the blocks */
+	radix_tree_node *arena_free[2][RADIX_TREE_NODE_KIND_COUNT]; /* [leaf][kind] */
+
+	/* concurrency mode, see above */
+	bool	concurrent;
+	pg_atomic_uint64 epoch;
+	radix_tree_reader *readers;
+	int		max_readers;
+	radix_tree_retired *retired;
+	int		nretired;
+	int		max_retired;
+
+	/* memory limit, see above */
+	uint64	mem_used;
+	Size	mem_limit;		/* 0 if unlimited */
+	radix_tree_limit_callback limit_callback;
+	void	*limit_arg;
+	bool	limit_reached;	/* callback called? */
+
 	/* stats */
 	int32	cnt[RADIX_TREE_NODE_KIND_COUNT];
 	uint64 nkeys;
 };
 
-static radix_tree_node *radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node);
-static radix_tree_node *radix_tree_find_child(radix_tree_node *node, uint64 key);
-static Datum *radix_tree_find_slot_ptr(radix_tree_node *node, uint8 chunk);
-static void radix_tree_replace_slot(radix_tree_node *parent, radix_tree_node *node,
-									uint8 chunk);
-static void radix_tree_extend(radix_tree *tree, uint64 key);
-static void radix_tree_new_root(radix_tree *tree, uint64 key, Datum val);
-static radix_tree_node *radix_tree_insert_child(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node,
-												uint64 key);
+static radix_tree_node *radix_tree_node_grow(radix_tree *tree, radix_tree_node *node);
+static radix_tree_node *radix_tree_node_copy(radix_tree *tree, radix_tree_node *node);
+static void radix_tree_replace_node(radix_tree *tree, radix_tree_node *parent,
+									radix_tree_node *oldnode, radix_tree_node *newnode);
+static void radix_tree_retire_node(radix_tree *tree, radix_tree_node *node);
+static radix_tree_node *radix_tree_find_child(radix_tree *tree, radix_tree_node *node,
+											  uint64 key);
+static int radix_tree_find_slot_index(radix_tree_node *node, uint8 chunk);
+static void radix_tree_replace_slot(radix_tree *tree, radix_tree_node *parent,
+									radix_tree_node *node);
+static void radix_tree_link_node(radix_tree *tree, radix_tree_node *parent,
+								 radix_tree_node *node);
+static radix_tree_node *radix_tree_new_leaf(radix_tree *tree, uint64 key, Datum val);
+static radix_tree_node *radix_tree_split(radix_tree *tree, radix_tree_node *node,
+										 uint64 key, Datum val);
 static void radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node,
 								  uint64 key, Datum val);
+static void radix_tree_discard_node(radix_tree *tree, radix_tree_node *node);
+static int radix_tree_iter_next_slot(radix_tree_node *node, int *pos, uint8 *chunk);
 /*
  * Return the shift that is satisfied to store the given key.
  */
@@ -130,14 +299,361 @@ shift_get_max_val(int shift)
 	return (UINT64_C(1) << (shift + RADIX_TREE_NODE_FANOUT)) - 1;
 }
 
+static inline int
+rt_popcount64(uint64 word)
+{
+#ifdef HAVE__BUILTIN_POPCOUNT
+	return __builtin_popcountll(word);
+#else
+	return pg_popcount64(word);
+#endif
+}
+
+/*
+ * Vector helpers for searching the chunk arrays of node-4 and node-16. The
+ * masks have bit i set for the i'th chunk.
+ */
+#if defined(RT_USE_SSE2)
+typedef __m128i rt_vector8;
+
+static inline rt_vector8
+rt_vector8_load4(const uint8 *chunks)
+{
+	uint32 v;
+
+	memcpy(&v, chunks, sizeof(uint32));
+	return _mm_cvtsi32_si128((int) v);
+}
+
+static inline rt_vector8
+rt_vector8_load16(const uint8 *chunks)
+{
+	return _mm_loadu_si128((const __m128i *) chunks);
+}
+
+static inline uint32
+rt_vector8_eq_mask(rt_vector8 v, uint8 match)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(match)));
+}
+
+/*
+ * There is no unsigned byte comparison in SSE2, but min(v, match) == match
+ * iff v >= match.
+ */
+static inline uint32
+rt_vector8_ge_mask(rt_vector8 v, uint8 match)
+{
+	__m128i spread_chunk = _mm_set1_epi8(match);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, spread_chunk),
+											spread_chunk));
+}
+#elif defined(RT_USE_NEON)
+typedef uint8x16_t rt_vector8;
+
+static inline rt_vector8
+rt_vector8_load4(const uint8 *chunks)
+{
+	uint32 v;
+
+	memcpy(&v, chunks, sizeof(uint32));
+	return vreinterpretq_u8_u32(vsetq_lane_u32(v, vdupq_n_u32(0), 0));
+}
+
+static inline rt_vector8
+rt_vector8_load16(const uint8 *chunks)
+{
+	return vld1q_u8(chunks);
+}
+
+/* NEON has no movemask, so weight each lane by its bit and add them up */
+static inline uint32
+rt_vector8_movemask(uint8x16_t cmp)
+{
+	static const uint8 weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+	};
+	uint8x16_t	masked = vandq_u8(cmp, vld1q_u8(weights));
+
+	return vaddv_u8(vget_low_u8(masked)) |
+		((uint32) vaddv_u8(vget_high_u8(masked)) << 8);
+}
+
+static inline uint32
+rt_vector8_eq_mask(rt_vector8 v, uint8 match)
+{
+	return rt_vector8_movemask(vceqq_u8(v, vdupq_n_u8(match)));
+}
+
+static inline uint32
+rt_vector8_ge_mask(rt_vector8 v, uint8 match)
+{
+	return rt_vector8_movemask(vcgeq_u8(v, vdupq_n_u8(match)));
+}
+#endif
+
+/*
+ * Return the index of the chunk equal to match in the sorted chunk array of
+ * count elements, or -1 if not found.
+ */
+static inline int
+search_chunk_array_eq(const uint8 *chunks, uint8 match, uint8 count,
+					  int nchunks)
+{
+#if !defined(RT_USE_SIMD) || defined(USE_ASSERT_CHECKING)
+	int index = -1;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (chunks[i] > match)
+			break;
+
+		if (chunks[i] == match)
+		{
+			index = i;
+			break;
+		}
+	}
+#endif
+
+#ifdef RT_USE_SIMD
+	{
+		rt_vector8	haystack;
+		uint32		bitfield;
+		int			index_simd;
+
+		haystack = (nchunks == 4) ? rt_vector8_load4(chunks) :
+			rt_vector8_load16(chunks);
+		bitfield = rt_vector8_eq_mask(haystack, match) & ((1 << count) - 1);
+		index_simd = bitfield ? pg_rightmost_one_pos32(bitfield) : -1;
+
+		Assert(index_simd == index);
+
+		return index_simd;
+	}
+#else
+	return index;
+#endif
+}
+
+/*
+ * Return the index of the first chunk greater than or equal to match in the
+ * sorted chunk array of count elements, or count if there is none. This is
+ * where a new chunk is inserted.
+ */
+static inline int
+search_chunk_array_le(const uint8 *chunks, uint8 match, uint8 count,
+					  int nchunks)
+{
+#if !defined(RT_USE_SIMD) || defined(USE_ASSERT_CHECKING)
+	int index;
+
+	for (index = 0; index < count; index++)
+	{
+		if (chunks[index] >= match)
+			break;
+	}
+#endif
+
+#ifdef RT_USE_SIMD
+	{
+		rt_vector8	haystack;
+		uint32		bitfield;
+		int			index_simd;
+
+		haystack = (nchunks == 4) ? rt_vector8_load4(chunks) :
+			rt_vector8_load16(chunks);
+		bitfield = rt_vector8_ge_mask(haystack, match) & ((1 << count) - 1);
+		index_simd = bitfield ? pg_rightmost_one_pos32(bitfield) : count;
+
+		Assert(index_simd == index);
+
+		return index_simd;
+	}
+#else
+	return index;
+#endif
+}
+
+#define search_chunk_array_4_eq(c, m, n)	search_chunk_array_eq((c), (m), (n), 4)
+#define search_chunk_array_16_eq(c, m, n)	search_chunk_array_eq((c), (m), (n), 16)
+#define search_chunk_array_4_le(c, m, n)	search_chunk_array_le((c), (m), (n), 4)
+#define search_chunk_array_16_le(c, m, n)	search_chunk_array_le((c), (m), (n), 16)
+
+static inline bool
+radix_tree_node_48_isset(radix_tree_node_48 *n48, uint8 chunk)
+{
+	return (n48->isset[ISSET_WORD(chunk)] & ISSET_BIT(chunk)) != 0;
+}
+
+/* Return the slot index for the chunk, whether or not it's present */
+static inline int
+radix_tree_node_48_slot_index(radix_tree_node_48 *n48, uint8 chunk)
+{
+	int w = ISSET_WORD(chunk);
+
+	return n48->base[w] + rt_popcount64(n48->isset[w] & (ISSET_BIT(chunk) - 1));
+}
+
+static inline bool
+radix_tree_node_256_isset(radix_tree_node_256 *n256, uint8 chunk)
+{
+	return (n256->isset[ISSET_WORD(chunk)] & ISSET_BIT(chunk)) != 0;
+}
+
+/*
+ * Slot access. The slots of a leaf hold the values, and the slots of an inner
+ * node hold the children, either as pointers or, in arena mode, as handles.
+ * A slot is referred to by its index in the slots array.
+ */
+static inline Size
+radix_tree_slot_size(radix_tree *tree, radix_tree_node *node)
+{
+	return NodeHasHandles(tree, node) ? sizeof(uint32) : sizeof(Datum);
+}
+
+static inline char *
+radix_tree_slot_addr(radix_tree *tree, radix_tree_node *node, int idx)
+{
+	return (char *) node + radix_tree_node_info[node->kind].slots_offset +
+		idx * radix_tree_slot_size(tree, node);
+}
+
+static inline radix_tree_node *
+radix_tree_handle_get_node(radix_tree *tree, uint32 handle)
+{
+	return (radix_tree_node *)
+		(tree->arena_blocks[handle >> RADIX_TREE_ARENA_OFFSET_BITS] +
+		 ((Size) (handle & RADIX_TREE_ARENA_OFFSET_MASK) << 3));
+}
+
+static inline Datum
+radix_tree_get_value(radix_tree_node *node, int idx)
+{
+	Assert(NodeIsLeaf(node));
+
+	return ((Datum *) ((char *) node +
+					   radix_tree_node_info[node->kind].slots_offset))[idx];
+}
+
+static inline radix_tree_node *
+radix_tree_get_child(radix_tree *tree, radix_tree_node *node, int idx)
+{
+	char   *slots = (char *) node + radix_tree_node_info[node->kind].slots_offset;
+
+	Assert(!NodeIsLeaf(node));
+
+	if (tree->arena)
+		return radix_tree_handle_get_node(tree, ((uint32 *) slots)[idx]);
+
+	return (radix_tree_node *) DatumGetPointer(((Datum *) slots)[idx]);
+}
+
+/*
+ * Set the slot to the value for a leaf, or to the child given by
+ * PointerGetDatum() for an inner node.
+ */
+static inline void
+radix_tree_set_slot(radix_tree *tree, radix_tree_node *node, int idx, Datum val)
+{
+	char   *slots = (char *) node + radix_tree_node_info[node->kind].slots_offset;
+
+	if (NodeHasHandles(tree, node))
+		((uint32 *) slots)[idx] = ((radix_tree_node *) DatumGetPointer(val))->handle;
+	else
+		((Datum *) slots)[idx] = val;
+}
+
+/* Copy nslots slots from src to dst, which must be both leaves or inner nodes */
+static inline void
+radix_tree_copy_slots(radix_tree *tree, radix_tree_node *dst, int dst_idx,
+					  radix_tree_node *src, int src_idx, int nslots)
+{
+	Assert(NodeIsLeaf(dst) == NodeIsLeaf(src));
+
+	memmove(radix_tree_slot_addr(tree, dst, dst_idx),
+			radix_tree_slot_addr(tree, src, src_idx),
+			radix_tree_slot_size(tree, src) * nslots);
+}
+
+static inline Size
+radix_tree_node_size(radix_tree *tree, radix_tree_node_kind kind, bool leaf)
+{
+	if (tree->arena && !leaf)
+		return radix_tree_node_info[kind].inner_arena_size;
+
+	return radix_tree_node_info[kind].size;
+}
+
+/*
+ * Carve a zeroed node from the arena, or reuse a freed one. The handle of the
+ * node is set.
+ */
+static radix_tree_node *
+radix_tree_arena_alloc(radix_tree *tree, radix_tree_node_kind kind, bool leaf,
+					   Size size)
+{
+	radix_tree_node *node = tree->arena_free[leaf][kind];
+	uint32	handle;
+
+	if (node != NULL)
+	{
+		tree->arena_free[leaf][kind] = *((radix_tree_node **) node);
+		handle = node->handle;
+	}
+	else
+	{
+		if (tree->arena_freeoff + size > RADIX_TREE_ARENA_BLOCK_SIZE)
+		{
+			if (tree->arena_nblocks >= RADIX_TREE_ARENA_MAX_BLOCKS)
+				elog(ERROR, "radix tree arena cannot have more than %d blocks",
+					 RADIX_TREE_ARENA_MAX_BLOCKS);
+
+			if (tree->arena_nblocks >= tree->arena_maxblocks)
+			{
+				tree->arena_maxblocks *= 2;
+				tree->arena_blocks = repalloc(tree->arena_blocks,
+											  sizeof(char *) * tree->arena_maxblocks);
+			}
+
+			tree->arena_blocks[tree->arena_nblocks++] =
+				MemoryContextAlloc(tree->arena_context, RADIX_TREE_ARENA_BLOCK_SIZE);
+			tree->arena_freeoff = 0;
+		}
+
+		node = (radix_tree_node *)
+			(tree->arena_blocks[tree->arena_nblocks - 1] + tree->arena_freeoff);
+		handle = ((uint32) (tree->arena_nblocks - 1) << RADIX_TREE_ARENA_OFFSET_BITS) |
+			(uint32) (tree->arena_freeoff >> 3);
+
+		tree->arena_freeoff += size;
+		tree->arena_carved += size;
+	}
+
+	memset(node, 0, size);
+	node->handle = handle;
+
+	return node;
+}
+
+/*
+ * Allocate a zeroed node of the kind. Whether it's a leaf decides the size in
+ * arena mode, so the caller must set the shift accordingly.
+ */
 static radix_tree_node *
-radix_tree_alloc_node(radix_tree *tree, radix_tree_node_kind kind)
+radix_tree_alloc_node(radix_tree *tree, radix_tree_node_kind kind, bool leaf)
 {
 	radix_tree_node *newnode;
+	Size	size = radix_tree_node_size(tree, kind, leaf);
 
-	newnode = (radix_tree_node *) MemoryContextAllocZero(tree->slabs[kind],
-														 radix_tree_node_info[kind].size);
+	if (tree->arena)
+		newnode = radix_tree_arena_alloc(tree, kind, leaf, size);
+	else
+		newnode = (radix_tree_node *) MemoryContextAllocZero(tree->slabs[kind],
+															 size);
 	newnode->kind = kind;
+	tree->mem_used += size;
 
 	/* stats */
 	tree->cnt[kind]++;
@@ -148,178 +664,268 @@ radix_tree_alloc_node(radix_tree *tree, radix_tree_node_kind kind)
 static void
 radix_tree_copy_node_common(radix_tree_node *src, radix_tree_node *dst)
 {
+	dst->prefix = src->prefix;
 	dst->shift = src->shift;
-	dst->chunk = src->chunk;
 	dst->count = src->count;
 }
 
 static void
-radix_tree_free_node(radix_tree_node *node)
-{
-	pfree(node);
-}
-
-/*
- * The tree doesn't have not sufficient height, so grow it */
-static void
-radix_tree_extend(radix_tree *tree, uint64 key)
+radix_tree_free_node(radix_tree *tree, radix_tree_node *node)
 {
-	int max_shift;
-	int shift = tree->root->shift + RADIX_TREE_NODE_FANOUT;
+	bool	leaf = NodeIsLeaf(node);
 
-	max_shift = key_get_shift(key);
+	tree->mem_used -= radix_tree_node_size(tree, node->kind, leaf);
 
-	/* Grow tree from 'shift' to 'max_shift' */
-	while (shift <= max_shift)
+	if (tree->arena)
 	{
-		radix_tree_node_4 *node =
-			(radix_tree_node_4 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_4);
-
-		node->n.count = 1;
-		node->n.shift = shift;
-		node->chunks[0] = 0;
-		node->slots[0] = PointerGetDatum(tree->root);
-
-		tree->root->chunk = 0;
-		tree->root = (radix_tree_node *) node;
-
-		shift += RADIX_TREE_NODE_FANOUT;
+		/* the link overwrites the prefix, but not the handle */
+		*((radix_tree_node **) node) = tree->arena_free[leaf][node->kind];
+		tree->arena_free[leaf][node->kind] = node;
 	}
-
-	tree->max_val = shift_get_max_val(max_shift);
+	else
+		pfree(node);
 }
 
+/*
+ * Return true if the key can be found below the node, i.e. the key bits above
+ * the chunk of the node match its prefix.
+ */
+static inline bool
+radix_tree_node_match_prefix(radix_tree_node *node, uint64 key)
+{
+	return (key & ~shift_get_max_val(node->shift)) == node->prefix;
+}
 
 /*
  * Return the pointer to the child node corresponding with the key. Otherwise (if
  * not found) return NULL.
  */
 static radix_tree_node *
-radix_tree_find_child(radix_tree_node *node, uint64 key)
+radix_tree_find_child(radix_tree *tree, radix_tree_node *node, uint64 key)
 {
-	Datum *slot_ptr;
-	int chunk = GET_KEY_CHUNK(key, node->shift);
+	int idx = radix_tree_find_slot_index(node, GET_KEY_CHUNK(key, node->shift));
 
-	slot_ptr = radix_tree_find_slot_ptr(node, chunk);
-
-	return (slot_ptr == NULL) ? NULL : (radix_tree_node *) DatumGetPointer(*slot_ptr);
+	return (idx < 0) ? NULL : radix_tree_get_child(tree, node, idx);
 }
 
 /*
- * Return the address of the slot corresponding to chunk in the node, if found.
- * Otherwise return NULL.
+ * Return the index of the slot corresponding to chunk in the node, if found.
+ * Otherwise return -1.
  */
-static Datum *
-radix_tree_find_slot_ptr(radix_tree_node *node, uint8 chunk)
+static inline int
+radix_tree_find_slot_index(radix_tree_node *node, uint8 chunk)
 {
-
 	switch (node->kind)
 	{
 		case RADIX_TREE_NODE_KIND_4:
 		{
 			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
-			for (int i = 0; i < n4->n.count; i++)
-			{
-				if (n4->chunks[i] > chunk)
-					break;
-
-				if (n4->chunks[i] == chunk)
-					return &(n4->slots[i]);
-			}
-
-			return NULL;
 
-			break;
+			return search_chunk_array_4_eq(n4->chunks, chunk, n4->n.count);
 		}
 		case RADIX_TREE_NODE_KIND_16:
 		{
 			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
-			for (int i = 0; i < n16->n.count; i++)
-			{
-				if (n16->chunks[i] > chunk)
-					break;
-
-				if (n16->chunks[i] == chunk)
-					return &(n16->slots[i]);
-			}
-
-			return NULL;
 
-			break;
+			return search_chunk_array_16_eq(n16->chunks, chunk, n16->n.count);
 		}
 		case RADIX_TREE_NODE_KIND_48:
 		{
 			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
-			int pos = n48->slot_idxs[chunk] - 1;
 
-			if (pos < 0)
-				return NULL;
+			if (!radix_tree_node_48_isset(n48, chunk))
+				return -1;
 
-			return &(n48->slots[pos]);
-			break;
+			return radix_tree_node_48_slot_index(n48, chunk);
 		}
 		case RADIX_TREE_NODE_KIND_256:
 		{
 			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
 
-			return &(n256->slots[chunk]);
-			break;
+			if (!radix_tree_node_256_isset(n256, chunk))
+				return -1;
+
+			return chunk;
 		}
 	}
 
 	pg_unreachable();
 }
 
-/* Redirect from the parent to the node */
+/*
+ * Redirect from the parent to the node. The node must be fully initialized,
+ * since concurrent readers can follow the new pointer right away.
+ */
 static void
-radix_tree_replace_slot(radix_tree_node *parent, radix_tree_node *node, uint8 chunk)
+radix_tree_replace_slot(radix_tree *tree, radix_tree_node *parent,
+						radix_tree_node *node)
 {
-	Datum *slot_ptr;
+	uint8 chunk = GET_KEY_CHUNK(node->prefix, parent->shift);
+	int idx;
+
+	idx = radix_tree_find_slot_index(parent, chunk);
+	Assert(idx >= 0);
+
+	/* arena mode is not concurrent */
+	if (tree->arena)
+	{
+		radix_tree_set_slot(tree, parent, idx, PointerGetDatum(node));
+		return;
+	}
 
-	slot_ptr = radix_tree_find_slot_ptr(parent, chunk);
-	*slot_ptr = PointerGetDatum(node);
+	pg_write_barrier();
+	*((volatile Datum *) radix_tree_slot_addr(tree, parent, idx)) =
+		PointerGetDatum(node);
 }
 
 /*
- * Create a new node as the root. Subordinate nodes will be created during
- * the insertion.
+ * Link the node to the parent, or make it the root if parent is NULL, in
+ * place of the child that has the same chunk.
  */
 static void
-radix_tree_new_root(radix_tree *tree, uint64 key, Datum val)
+radix_tree_link_node(radix_tree *tree, radix_tree_node *parent,
+					 radix_tree_node *node)
 {
-	radix_tree_node_4 * n4 =
-		(radix_tree_node_4 * ) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_4);
-	int shift = key_get_shift(key);
+	if (parent == NULL)
+	{
+		pg_write_barrier();
+		tree->root = node;
+	}
+	else
+		radix_tree_replace_slot(tree, parent, node);
+}
 
-	n4->n.shift = shift;
-	tree->max_val = shift_get_max_val(shift);
-	tree->root = (radix_tree_node *) n4;
+/*
+ * Replace oldnode, a child of parent (or the root if parent is NULL), with
+ * newnode, and get rid of oldnode.
+ */
+static void
+radix_tree_replace_node(radix_tree *tree, radix_tree_node *parent,
+						radix_tree_node *oldnode, radix_tree_node *newnode)
+{
+	Assert(oldnode->prefix == newnode->prefix);
+
+	radix_tree_link_node(tree, parent, newnode);
+	radix_tree_discard_node(tree, oldnode);
+}
+
+/* Get rid of the node that has been unlinked from the tree */
+static void
+radix_tree_discard_node(radix_tree *tree, radix_tree_node *node)
+{
+	tree->cnt[node->kind]--;
+
+	if (tree->concurrent)
+		radix_tree_retire_node(tree, node);
+	else
+		radix_tree_free_node(tree, node);
+}
+
+/*
+ * Remember the node unlinked from the tree by the writer, to free it once
+ * no reader can be visiting it.
+ */
+static void
+radix_tree_retire_node(radix_tree *tree, radix_tree_node *node)
+{
+	radix_tree_retired *r;
+
+	if (tree->nretired >= tree->max_retired)
+	{
+		tree->max_retired *= 2;
+		tree->retired = repalloc(tree->retired,
+								 sizeof(radix_tree_retired) * tree->max_retired);
+	}
+
+	r = &(tree->retired[tree->nretired++]);
+	r->node = node;
+
+	/*
+	 * Readers that load the advanced epoch started after the node had been
+	 * unlinked. The atomic operation is a full barrier.
+	 */
+	r->epoch = pg_atomic_fetch_add_u64(&tree->epoch, 1);
 }
 
+/* Return a fresh copy of the node, not linked to the tree yet */
 static radix_tree_node *
-radix_tree_insert_child(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node,
-						uint64 key)
+radix_tree_node_copy(radix_tree *tree, radix_tree_node *node)
 {
-	radix_tree_node *newchild =
-		(radix_tree_node *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_4);
+	radix_tree_node *newnode = radix_tree_alloc_node(tree, node->kind,
+													 NodeIsLeaf(node));
+	uint32	handle = newnode->handle;
 
-	Assert(!NodeIsLeaf(node));
+	memcpy(newnode, node, radix_tree_node_size(tree, node->kind, NodeIsLeaf(node)));
+	newnode->handle = handle;
+
+	return newnode;
+}
+
+/*
+ * Create a leaf having only the key. Its prefix is the whole key but the
+ * lowest chunk, so it can be linked to any node on the path of the key.
+ */
+static radix_tree_node *
+radix_tree_new_leaf(radix_tree *tree, uint64 key, Datum val)
+{
+	radix_tree_node_4 *n4 =
+		(radix_tree_node_4 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_4,
+													true);
+
+	n4->n.prefix = key & ~shift_get_max_val(0);
+	n4->n.shift = 0;
+	n4->n.count = 1;
+	n4->chunks[0] = GET_KEY_CHUNK(key, 0);
+	radix_tree_set_slot(tree, (radix_tree_node *) n4, 0, val);
 
-	newchild->shift = node->shift - RADIX_TREE_NODE_FANOUT;
-	newchild->chunk = GET_KEY_CHUNK(key, node->shift);
+	return (radix_tree_node *) n4;
+}
 
-	radix_tree_insert_val(tree, parent, node, key, PointerGetDatum(newchild));
+/*
+ * The key doesn't match the prefix of the node. Return a new node-4 at the
+ * highest chunk where they differ, having the node and a new leaf for the key
+ * as children. The caller links it in place of the node, which itself is
+ * left intact.
+ */
+static radix_tree_node *
+radix_tree_split(radix_tree *tree, radix_tree_node *node, uint64 key, Datum val)
+{
+	radix_tree_node_4 *n4;
+	radix_tree_node *leaf;
+	uint64 diff = (key ^ node->prefix) & ~shift_get_max_val(node->shift);
+	int shift = key_get_shift(diff);
+	uint8 key_chunk = GET_KEY_CHUNK(key, shift);
+	uint8 node_chunk = GET_KEY_CHUNK(node->prefix, shift);
+	int key_idx = (key_chunk < node_chunk) ? 0 : 1;
+
+	Assert(diff != 0);
+	Assert(shift > node->shift);
+
+	leaf = radix_tree_new_leaf(tree, key, val);
+
+	n4 = (radix_tree_node_4 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_4,
+													 false);
+	n4->n.prefix = key & ~shift_get_max_val(shift);
+	n4->n.shift = shift;
+	n4->n.count = 2;
+	n4->chunks[key_idx] = key_chunk;
+	radix_tree_set_slot(tree, &n4->n, key_idx, PointerGetDatum(leaf));
+	n4->chunks[1 - key_idx] = node_chunk;
+	radix_tree_set_slot(tree, &n4->n, 1 - key_idx, PointerGetDatum(node));
 
-	return (radix_tree_node *) newchild;
+	return (radix_tree_node *) n4;
 }
 
 /*
- * Insert the value to the node. The node grows if it's full.
+ * Insert the value to the node. The node grows if it's full. If the node is
+ * replaced by a larger or, in concurrency mode, a modified copy, the new node
+ * is linked to the parent once it has the value.
  */
 static void
 radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node,
 					  uint64 key, Datum val)
 {
+	radix_tree_node *orig = node;
 	int chunk = GET_KEY_CHUNK(key, node->shift);
 
 	switch (node->kind)
@@ -332,24 +938,24 @@ radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 			{
 				int i;
 
-				for (i = 0; i < n4->n.count; i++)
+				/* shifting the arrays would confuse readers */
+				if (tree->concurrent)
 				{
-					if (n4->chunks[i] > chunk)
-					{
-						memmove(&(n4->chunks[i + 1]), &(n4->chunks[i]),
-								sizeof(uint8) * (n4->n.count - i));
-						memmove(&(n4->slots[i + 1]), &(n4->slots[i]),
-								sizeof(radix_tree_node *) * (n4->n.count - i));
-						break;
-					}
+					node = radix_tree_node_copy(tree, node);
+					n4 = (radix_tree_node_4 *) node;
 				}
 
+				i = search_chunk_array_4_le(n4->chunks, chunk, n4->n.count);
+				memmove(&(n4->chunks[i + 1]), &(n4->chunks[i]),
+						sizeof(uint8) * (n4->n.count - i));
+				radix_tree_copy_slots(tree, node, i + 1, node, i, n4->n.count - i);
+
 				n4->chunks[i] = chunk;
-				n4->slots[i] = val;
+				radix_tree_set_slot(tree, node, i, val);
 				break;
 			}
 
-			node = radix_tree_node_grow(tree, parent, node);
+			node = radix_tree_node_grow(tree, node);
 			Assert(node->kind == RADIX_TREE_NODE_KIND_16);
 			/* fall through */
 		}
@@ -361,24 +967,24 @@ radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 			{
 				int i;
 
-				for (i = 0; i < n16->n.count; i++)
+				/* a node grown from node-4 is not visible yet */
+				if (tree->concurrent && node == orig)
 				{
-					if (n16->chunks[i] > chunk)
-					{
-						memmove(&(n16->chunks[i + 1]), &(n16->chunks[i]),
-								sizeof(uint8) * (n16->n.count - i));
-						memmove(&(n16->slots[i + 1]), &(n16->slots[i]),
-								sizeof(radix_tree_node *) * (n16->n.count - i));
-						break;
-					}
+					node = radix_tree_node_copy(tree, node);
+					n16 = (radix_tree_node_16 *) node;
 				}
 
+				i = search_chunk_array_16_le(n16->chunks, chunk, n16->n.count);
+				memmove(&(n16->chunks[i + 1]), &(n16->chunks[i]),
+						sizeof(uint8) * (n16->n.count - i));
+				radix_tree_copy_slots(tree, node, i + 1, node, i, n16->n.count - i);
+
 				n16->chunks[i] = chunk;
-				n16->slots[i] = val;
+				radix_tree_set_slot(tree, node, i, val);
 				break;
 			}
 
-			node = radix_tree_node_grow(tree, parent, node);
+			node = radix_tree_node_grow(tree, node);
 			Assert(node->kind == RADIX_TREE_NODE_KIND_48);
 			/* fall through */
 		}
@@ -388,13 +994,27 @@ radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 
 			if (NodeHasFreeSlot(n48))
 			{
-				uint8 pos = n48->n.count + 1;
-				n48->slot_idxs[chunk] = pos;
-				n48->slots[pos - 1] = val;
+				int idx;
+
+				/* the slots are shifted, as with node-16 */
+				if (tree->concurrent && node == orig)
+				{
+					node = radix_tree_node_copy(tree, node);
+					n48 = (radix_tree_node_48 *) node;
+				}
+
+				idx = radix_tree_node_48_slot_index(n48, chunk);
+				radix_tree_copy_slots(tree, node, idx + 1, node, idx,
+									  n48->n.count - idx);
+				radix_tree_set_slot(tree, node, idx, val);
+
+				n48->isset[ISSET_WORD(chunk)] |= ISSET_BIT(chunk);
+				for (int w = ISSET_WORD(chunk) + 1; w < RADIX_TREE_ISSET_WORDS; w++)
+					n48->base[w]++;
 				break;
 			}
 
-			node = radix_tree_node_grow(tree, parent, node);
+			node = radix_tree_node_grow(tree, node);
 			Assert(node->kind == RADIX_TREE_NODE_KIND_256);
 			/* fall through */
 		}
@@ -403,19 +1023,27 @@ radix_tree_insert_val(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
 
 			Assert(NodeHasFreeSlot(n256));
-			n256->slots[chunk] = val;
+
+			/* readers must not find the chunk before the slot is set */
+			radix_tree_set_slot(tree, node, chunk, val);
+			pg_write_barrier();
+			n256->isset[ISSET_WORD(chunk)] |= ISSET_BIT(chunk);
 			break;
 		}
 	}
 
 	node->count++;
+
+	if (node != orig)
+		radix_tree_replace_node(tree, parent, orig, node);
 }
 
 /*
- * Change the node type to a larger one.
+ * Return a copy of the node with a larger node type. The caller links the
+ * new node to the tree in place of the old one.
  */
 static radix_tree_node *
-radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node *node)
+radix_tree_node_grow(radix_tree *tree, radix_tree_node *node)
 {
 	radix_tree_node *newnode;
 
@@ -428,26 +1056,15 @@ radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 		{
 			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
 			radix_tree_node_16 *new16 =
-				(radix_tree_node_16 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_16);
+				(radix_tree_node_16 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_16,
+															 NodeIsLeaf(node));
 
 			radix_tree_copy_node_common((radix_tree_node *) n4,
 										(radix_tree_node *) new16);
 
+			/* chunks are already sorted */
 			memcpy(&(new16->chunks), &(n4->chunks), sizeof(uint8) * 4);
-			memcpy(&(new16->slots), &(n4->slots), sizeof(Datum) * 4);
-
-			/* Sort slots and chunks arrays */
-			for (int i = 0; i < n4->n.count ; i++)
-			{
-				for (int j = i; j < n4->n.count; j++)
-				{
-					if (new16->chunks[i] > new16->chunks[j])
-					{
-						new16->chunks[i] = new16->chunks[j];
-						new16->slots[i] = new16->slots[j];
-					}
-				}
-			}
+			radix_tree_copy_slots(tree, &new16->n, 0, node, 0, 4);
 
 			newnode = (radix_tree_node *) new16;
 			break;
@@ -456,26 +1073,24 @@ radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 		{
 			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
 			radix_tree_node_48 *new48 =
-				(radix_tree_node_48 *) radix_tree_alloc_node(tree,RADIX_TREE_NODE_KIND_48);
+				(radix_tree_node_48 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_48,
+															 NodeIsLeaf(node));
 
 			radix_tree_copy_node_common((radix_tree_node *) n16,
 										(radix_tree_node *) new48);
 
+			/* the sorted chunks give the slots in chunk order */
 			for (int i = 0; i < n16->n.count; i++)
 			{
-				new48->slot_idxs[n16->chunks[i]] = i + 1;
-				new48->slots[i] = n16->slots[i];
-			}
-
-			/* TEST */
-			{
-				for (int i = 0; i < n16->n.count; i++)
-				{
-					uint8 chunk = n16->chunks[i];
+				uint8 chunk = n16->chunks[i];
 
-					Assert(new48->slot_idxs[chunk] != 0);
-				}
+				new48->isset[ISSET_WORD(chunk)] |= ISSET_BIT(chunk);
 			}
+			radix_tree_copy_slots(tree, &new48->n, 0, node, 0, n16->n.count);
+
+			for (int w = 1; w < RADIX_TREE_ISSET_WORDS; w++)
+				new48->base[w] = new48->base[w - 1] +
+					rt_popcount64(new48->isset[w - 1]);
 
 			newnode = (radix_tree_node *) new48;
 			break;
@@ -484,20 +1099,18 @@ radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 		{
 			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
 			radix_tree_node_256 *new256 =
-				(radix_tree_node_256 *) radix_tree_alloc_node(tree,RADIX_TREE_NODE_KIND_256);
+				(radix_tree_node_256 *) radix_tree_alloc_node(tree, RADIX_TREE_NODE_KIND_256,
+															  NodeIsLeaf(node));
 
 			radix_tree_copy_node_common((radix_tree_node *) n48,
 										(radix_tree_node *) new256);
 
-			for (int i = 0; i < 256; i++)
+			for (int i = 0, idx = 0; i < 256; i++)
 			{
-				int idx = n48->slot_idxs[i];
-
-				if (idx == 0)
-					continue;
-
-				new256->slots[i] = n48->slots[idx - 1];
+				if (radix_tree_node_48_isset(n48, i))
+					radix_tree_copy_slots(tree, &new256->n, i, node, idx++, 1);
 			}
+			memcpy(new256->isset, n48->isset, sizeof(new256->isset));
 
 			newnode = (radix_tree_node *) new256;
 			break;
@@ -507,140 +1120,732 @@ radix_tree_node_grow(radix_tree *tree, radix_tree_node *parent, radix_tree_node
 			break;
 	}
 
-	if (parent == node)
-		tree->root = newnode;
-	else
-		radix_tree_replace_slot(parent, newnode, node->chunk);
+	return newnode;
+}
 
-	tree->cnt[node->kind]--;
-	radix_tree_free_node(node);
+/*
+ * A node shrinks to the next smaller kind once it has this many slots used,
+ * so that a node doesn't shrink and grow again for every other key deleted
+ * and inserted around the boundary.
+ */
+#define RADIX_TREE_SHRINK_COUNT(kind) \
+	(radix_tree_node_info[(kind) - 1].max_slots * 3 / 4)
+
+/*
+ * Return a copy of the node with the next smaller node type. The caller links
+ * the new node to the tree in place of the old one.
+ */
+static radix_tree_node *
+radix_tree_node_shrink(radix_tree *tree, radix_tree_node *node)
+{
+	radix_tree_node *newnode;
+	int		pos = 0;
+	int		idx;
+	int		i = 0;
+	uint8	chunk;
+
+	Assert(node->kind != RADIX_TREE_NODE_KIND_4);
+	Assert(node->count <= radix_tree_node_info[node->kind - 1].max_slots);
+
+	newnode = radix_tree_alloc_node(tree, node->kind - 1, NodeIsLeaf(node));
+	radix_tree_copy_node_common(node, newnode);
+
+	/* the slots come in chunk order, as the smaller kinds keep them */
+	while ((idx = radix_tree_iter_next_slot(node, &pos, &chunk)) >= 0)
+	{
+		switch (newnode->kind)
+		{
+			case RADIX_TREE_NODE_KIND_4:
+				((radix_tree_node_4 *) newnode)->chunks[i] = chunk;
+				break;
+			case RADIX_TREE_NODE_KIND_16:
+				((radix_tree_node_16 *) newnode)->chunks[i] = chunk;
+				break;
+			case RADIX_TREE_NODE_KIND_48:
+				((radix_tree_node_48 *) newnode)->isset[ISSET_WORD(chunk)] |=
+					ISSET_BIT(chunk);
+				break;
+		}
+
+		radix_tree_copy_slots(tree, newnode, i++, node, idx, 1);
+	}
+
+	if (newnode->kind == RADIX_TREE_NODE_KIND_48)
+	{
+		radix_tree_node_48 *new48 = (radix_tree_node_48 *) newnode;
+
+		for (int w = 1; w < RADIX_TREE_ISSET_WORDS; w++)
+			new48->base[w] = new48->base[w - 1] + rt_popcount64(new48->isset[w - 1]);
+	}
 
 	return newnode;
 }
 
-radix_tree *
-radix_tree_create(MemoryContext ctx)
+static radix_tree *
+radix_tree_create_internal(MemoryContext ctx, bool arena)
 {
 	radix_tree *tree;
 	MemoryContext old_ctx;
 
 	old_ctx = MemoryContextSwitchTo(ctx);
 
-	tree = palloc(sizeof(radix_tree));
-	tree->max_val = 0;
+	tree = palloc0(sizeof(radix_tree));
 	tree->root = NULL;
 	tree->context = ctx;
 	tree->num_entries = 0;
+	tree->arena = arena;
+	tree->concurrent = false;
+	tree->readers = NULL;
+	tree->max_readers = 0;
+	tree->retired = NULL;
+	tree->nretired = 0;
+	tree->max_retired = 0;
+	pg_atomic_init_u64(&tree->epoch, 1);
+
+	tree->mem_used = 0;
+	tree->mem_limit = 0;
+	tree->limit_callback = NULL;
+	tree->limit_arg = NULL;
+	tree->limit_reached = false;
 
 	/* stats */
 	tree->nkeys = 0;
 
-	for (int i = 0; i < RADIX_TREE_NODE_KIND_COUNT; i++)
-		tree->slabs[i] = SlabContextCreate(ctx,
-										   radix_tree_node_info[i].name,
-										   SLAB_DEFAULT_BLOCK_SIZE,
-										   radix_tree_node_info[i].size);
+	if (arena)
+	{
+		tree->arena_context = AllocSetContextCreate(ctx, "radix tree arena",
+													ALLOCSET_DEFAULT_SIZES);
+		tree->arena_nblocks = 0;
+		tree->arena_maxblocks = 16;
+		tree->arena_blocks = MemoryContextAlloc(tree->arena_context,
+												sizeof(char *) * tree->arena_maxblocks);
+		/* the first allocation adds a block */
+		tree->arena_freeoff = RADIX_TREE_ARENA_BLOCK_SIZE;
+		tree->arena_carved = 0;
+	}
+	else
+	{
+		for (int i = 0; i < RADIX_TREE_NODE_KIND_COUNT; i++)
+			tree->slabs[i] = SlabContextCreate(ctx,
+											   radix_tree_node_info[i].name,
+											   SLAB_DEFAULT_BLOCK_SIZE,
+											   radix_tree_node_info[i].size);
+	}
 
 	MemoryContextSwitchTo(old_ctx);
 
 	return tree;
 }
 
+radix_tree *
+radix_tree_create(MemoryContext ctx)
+{
+	return radix_tree_create_internal(ctx, false);
+}
+
+/*
+ * Create a tree in arena mode, see above. The tree cannot be used in
+ * concurrency mode.
+ */
+radix_tree *
+radix_tree_create_arena(MemoryContext ctx)
+{
+	return radix_tree_create_internal(ctx, true);
+}
+
+/*
+ * Create a tree in concurrency mode, that can be searched by up to
+ * max_readers readers while being inserted into by one writer. Readers are
+ * identified by numbers from 0 to max_readers - 1.
+ */
+radix_tree *
+radix_tree_create_concurrent(MemoryContext ctx, int max_readers)
+{
+	radix_tree *tree = radix_tree_create(ctx);
+
+	Assert(max_readers > 0);
+
+	tree->concurrent = true;
+	tree->max_readers = max_readers;
+	tree->readers = MemoryContextAllocZero(ctx,
+										   sizeof(radix_tree_reader) * max_readers);
+	for (int i = 0; i < max_readers; i++)
+		pg_atomic_init_u64(&(tree->readers[i].epoch), 0);
+
+	tree->max_retired = RADIX_TREE_RECLAIM_THRESHOLD;
+	tree->retired = MemoryContextAlloc(ctx,
+									   sizeof(radix_tree_retired) * tree->max_retired);
+
+	return tree;
+}
+
+/*
+ * Start a series of searches as the given reader. Nodes that the reader could
+ * visit are not freed until radix_tree_read_end().
+ */
+void
+radix_tree_read_begin(radix_tree *tree, int reader)
+{
+	Assert(tree->concurrent);
+	Assert(reader >= 0 && reader < tree->max_readers);
+
+	pg_atomic_write_u64(&(tree->readers[reader].epoch),
+						pg_atomic_read_u64(&tree->epoch));
+
+	/* announce our epoch before loading any node */
+	pg_memory_barrier();
+}
+
+void
+radix_tree_read_end(radix_tree *tree, int reader)
+{
+	Assert(tree->concurrent);
+	Assert(reader >= 0 && reader < tree->max_readers);
+
+	/* finish loading nodes before letting the writer free them */
+	pg_memory_barrier();
+
+	pg_atomic_write_u64(&(tree->readers[reader].epoch), 0);
+}
+
+/*
+ * Free the retired nodes that no reader can be visiting, and return the
+ * number of nodes still waiting. Only the writer may call this.
+ */
+int
+radix_tree_reclaim(radix_tree *tree)
+{
+	uint64	min_epoch = PG_UINT64_MAX;
+	int		nkept = 0;
+
+	if (!tree->concurrent)
+		return 0;
+
+	/*
+	 * We free the nodes retired before the oldest active reader started. Pairs
+	 * with the barrier in radix_tree_read_begin().
+	 */
+	pg_memory_barrier();
+	for (int i = 0; i < tree->max_readers; i++)
+	{
+		uint64	epoch = pg_atomic_read_u64(&(tree->readers[i].epoch));
+
+		if (epoch != 0 && epoch < min_epoch)
+			min_epoch = epoch;
+	}
+
+	for (int i = 0; i < tree->nretired; i++)
+	{
+		radix_tree_retired *r = &(tree->retired[i]);
+
+		if (r->epoch < min_epoch)
+			radix_tree_free_node(tree, r->node);
+		else
+			tree->retired[nkept++] = *r;
+	}
+	tree->nretired = nkept;
+
+	return nkept;
+}
+
 void
 radix_tree_destroy(radix_tree *tree)
 {
-	for (int i = 0; i < RADIX_TREE_NODE_KIND_COUNT; i++)
-		MemoryContextDelete(tree->slabs[i]);
+	if (tree->arena)
+		MemoryContextDelete(tree->arena_context);
+	else
+	{
+		for (int i = 0; i < RADIX_TREE_NODE_KIND_COUNT; i++)
+			MemoryContextDelete(tree->slabs[i]);
+	}
+
+	/* the retired nodes went with the contexts above */
+	if (tree->readers)
+		pfree(tree->readers);
+	if (tree->retired)
+		pfree(tree->retired);
 
 	pfree(tree);
 }
 
-bool
-radix_tree_insert(radix_tree *tree, uint64 key, Datum val)
+/*
+ * Build the subtree for the sorted keys, and return its top node. The top
+ * node is at the highest chunk where the keys differ, and is allocated with
+ * the final number of children, after building them.
+ */
+static radix_tree_node *
+radix_tree_build_node(radix_tree *tree, const uint64 *keys, const Datum *vals,
+					  int nkeys)
 {
-	int shift;
 	radix_tree_node *node;
-	radix_tree_node *parent = tree->root;
+	uint8	chunks[256];
+	Datum	slots[256];
+	int		nchildren = 0;
+	int		shift;
+	int		kind;
+
+	/* a single key becomes a leaf, see radix_tree_new_leaf() */
+	shift = (nkeys == 1) ? 0 : key_get_shift(keys[0] ^ keys[nkeys - 1]);
+
+	for (int start = 0, end; start < nkeys; start = end)
+	{
+		uint8 chunk = GET_KEY_CHUNK(keys[start], shift);
+
+		for (end = start + 1; end < nkeys; end++)
+		{
+			if (GET_KEY_CHUNK(keys[end], shift) != chunk)
+				break;
+		}
+
+		chunks[nchildren] = chunk;
+		if (shift == 0)
+		{
+			Assert(end - start == 1);
+			slots[nchildren] = vals[start];
+		}
+		else
+			slots[nchildren] =
+				PointerGetDatum(radix_tree_build_node(tree, &keys[start],
+													  &vals[start], end - start));
+		nchildren++;
+	}
+
+	for (kind = RADIX_TREE_NODE_KIND_4; kind < RADIX_TREE_NODE_KIND_256; kind++)
+	{
+		if (nchildren <= radix_tree_node_info[kind].max_slots)
+			break;
+	}
+
+	node = radix_tree_alloc_node(tree, kind, shift == 0);
+	node->prefix = keys[0] & ~shift_get_max_val(shift);
+	node->shift = shift;
+	node->count = nchildren;
+
+	switch (node->kind)
+	{
+		case RADIX_TREE_NODE_KIND_4:
+		{
+			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
+
+			memcpy(n4->chunks, chunks, sizeof(uint8) * nchildren);
+			for (int i = 0; i < nchildren; i++)
+				radix_tree_set_slot(tree, node, i, slots[i]);
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_16:
+		{
+			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
+
+			memcpy(n16->chunks, chunks, sizeof(uint8) * nchildren);
+			for (int i = 0; i < nchildren; i++)
+				radix_tree_set_slot(tree, node, i, slots[i]);
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_48:
+		{
+			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
+
+			/* the slots are in chunk order already */
+			for (int i = 0; i < nchildren; i++)
+			{
+				n48->isset[ISSET_WORD(chunks[i])] |= ISSET_BIT(chunks[i]);
+				radix_tree_set_slot(tree, node, i, slots[i]);
+			}
+
+			for (int w = 1; w < RADIX_TREE_ISSET_WORDS; w++)
+				n48->base[w] = n48->base[w - 1] + rt_popcount64(n48->isset[w - 1]);
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_256:
+		{
+			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
+
+			for (int i = 0; i < nchildren; i++)
+			{
+				n256->isset[ISSET_WORD(chunks[i])] |= ISSET_BIT(chunks[i]);
+				radix_tree_set_slot(tree, node, chunks[i], slots[i]);
+			}
+			break;
+		}
+	}
+
+	return node;
+}
+
+/* Call the limit callback if the next insertion could cross the limit */
+static void
+radix_tree_check_memory_limit(radix_tree *tree)
+{
+	if (tree->mem_limit > 0 && !tree->limit_reached &&
+		radix_tree_memory_usage(tree) + RADIX_TREE_MAX_INSERT_BYTES > tree->mem_limit)
+	{
+		tree->limit_reached = true;
+		tree->limit_callback(tree->limit_arg);
+	}
+}
+
+/*
+ * Load the keys, which must be in strictly ascending order, with their values
+ * to the empty tree. Unlike inserting the keys one by one, every node is built
+ * bottom-up at its final size, so there are no node grows and no descents from
+ * the root. In concurrency mode, the whole tree is published at once.
+ */
+void
+radix_tree_build_sorted(radix_tree *tree, const uint64 *keys, const Datum *vals,
+						int nkeys)
+{
+	if (tree->root != NULL)
+		elog(ERROR, "radix tree must be empty to be built from sorted keys");
+
+	for (int i = 1; i < nkeys; i++)
+	{
+		if (keys[i] <= keys[i - 1])
+			elog(ERROR, "keys are not in strictly ascending order at %d", i);
+	}
+
+	if (nkeys == 0)
+		return;
+
+	radix_tree_link_node(tree, NULL,
+						 radix_tree_build_node(tree, keys, vals, nkeys));
+
+	tree->num_entries += nkeys;
 
 	/* stats */
-	tree->nkeys++;
+	tree->nkeys += nkeys;
 
-	/* Empty tree, create the root */
-	if (!tree->root)
-		radix_tree_new_root(tree, key, val);
+	radix_tree_check_memory_limit(tree);
+}
 
-	/* Extend the tree if necessary */
-	if (key > tree->max_val)
-		radix_tree_extend(tree, key);
+/*
+ * Set the value of the key, or OR it into the value already there if
+ * or_value is true. Return true if the key is newly inserted.
+ */
+static bool
+radix_tree_insert_internal(radix_tree *tree, uint64 key, Datum val,
+						   bool or_value)
+{
+	radix_tree_node *node;
+	radix_tree_node *parent = NULL;
+	int		idx;
 
-	Assert(tree->root);
+	/* Empty tree, the first leaf becomes the root */
+	if (!tree->root)
+	{
+		radix_tree_link_node(tree, NULL, radix_tree_new_leaf(tree, key, val));
+		goto done;
+	}
 
-	shift = tree->root->shift;
 	node = tree->root;
-	while (shift > 0)
+	for (;;)
 	{
 		radix_tree_node *child;
 
-		child = radix_tree_find_child(node, key);
+		if (!radix_tree_node_match_prefix(node, key))
+		{
+			/* put a new node above the node, and link it at once */
+			radix_tree_link_node(tree, parent,
+								 radix_tree_split(tree, node, key, val));
+			goto done;
+		}
+
+		/* arrived at a leaf */
+		if (NodeIsLeaf(node))
+			break;
+
+		child = radix_tree_find_child(tree, node, key);
 
 		if (child == NULL)
-			child = radix_tree_insert_child(tree, parent, node, key);
+		{
+			/* link a new leaf right below the node */
+			child = radix_tree_new_leaf(tree, key, val);
+			radix_tree_insert_val(tree, parent, node, key,
+								  PointerGetDatum(child));
+			goto done;
+		}
 
 		parent = node;
 		node = child;
-		shift -= RADIX_TREE_NODE_FANOUT;
 	}
 
-	/* arrived at a leaf */
-	Assert(NodeIsLeaf(node));
+	idx = radix_tree_find_slot_index(node, GET_KEY_CHUNK(key, 0));
+	if (idx >= 0)
+	{
+		/* update the value in place, readers see either of the values */
+		if (or_value)
+			val |= radix_tree_get_value(node, idx);
+		*((volatile Datum *) radix_tree_slot_addr(tree, node, idx)) = val;
+
+		/* the limit may have been set since the last new key */
+		radix_tree_check_memory_limit(tree);
+
+		return false;
+	}
 
 	radix_tree_insert_val(tree, parent, node, key, val);
+
+done:
 	tree->num_entries++;
 
+	/* stats */
+	tree->nkeys++;
+
+	if (tree->nretired >= RADIX_TREE_RECLAIM_THRESHOLD)
+		radix_tree_reclaim(tree);
+
+	radix_tree_check_memory_limit(tree);
+
+	return true;
+}
+
+/*
+ * Insert the key with the value, or replace the value if the key is already
+ * there. Return true if the key is newly inserted.
+ */
+bool
+radix_tree_insert(radix_tree *tree, uint64 key, Datum val)
+{
+	return radix_tree_insert_internal(tree, key, val, false);
+}
+
+/*
+ * Like radix_tree_insert(), but OR the value into the value of the key if
+ * the key is already there, e.g. to add offsets to the bitmap of a block
+ * without searching it first.
+ */
+bool
+radix_tree_insert_or(radix_tree *tree, uint64 key, Datum val)
+{
+	return radix_tree_insert_internal(tree, key, val, true);
+}
+
+/*
+ * Remove the slot of the chunk from the node, a child of parent (or the root
+ * if parent is NULL). The node must have another slot used. An inner node
+ * left with a single child is replaced by the child, which is fine since the
+ * levels in between can be skipped, and a node that has become small enough
+ * shrinks.
+ */
+static void
+radix_tree_delete_chunk(radix_tree *tree, radix_tree_node *parent,
+						radix_tree_node *node, uint8 chunk)
+{
+	radix_tree_node *orig = node;
+	int		idx = radix_tree_find_slot_index(node, chunk);
+
+	Assert(idx >= 0);
+	Assert(node->count > 1);
+
+	/* shifting the arrays would confuse readers, as with insertion */
+	if (tree->concurrent && node->kind != RADIX_TREE_NODE_KIND_256)
+		node = radix_tree_node_copy(tree, node);
+
+	switch (node->kind)
+	{
+		case RADIX_TREE_NODE_KIND_4:
+		{
+			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
+
+			memmove(&(n4->chunks[idx]), &(n4->chunks[idx + 1]),
+					sizeof(uint8) * (n4->n.count - idx - 1));
+			radix_tree_copy_slots(tree, node, idx, node, idx + 1,
+								  n4->n.count - idx - 1);
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_16:
+		{
+			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
+
+			memmove(&(n16->chunks[idx]), &(n16->chunks[idx + 1]),
+					sizeof(uint8) * (n16->n.count - idx - 1));
+			radix_tree_copy_slots(tree, node, idx, node, idx + 1,
+								  n16->n.count - idx - 1);
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_48:
+		{
+			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
+
+			radix_tree_copy_slots(tree, node, idx, node, idx + 1,
+								  n48->n.count - idx - 1);
+
+			n48->isset[ISSET_WORD(chunk)] &= ~ISSET_BIT(chunk);
+			for (int w = ISSET_WORD(chunk) + 1; w < RADIX_TREE_ISSET_WORDS; w++)
+				n48->base[w]--;
+			break;
+		}
+		case RADIX_TREE_NODE_KIND_256:
+		{
+			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
+
+			/* the slot is left as is, readers that found the bit can use it */
+			n256->isset[ISSET_WORD(chunk)] &= ~ISSET_BIT(chunk);
+			break;
+		}
+	}
+
+	node->count--;
+
+	if (!NodeIsLeaf(node) && node->count == 1)
+	{
+		int		pos = 0;
+		uint8	child_chunk;
+
+		idx = radix_tree_iter_next_slot(node, &pos, &child_chunk);
+		radix_tree_link_node(tree, parent, radix_tree_get_child(tree, node, idx));
+
+		/* the copy was never linked */
+		if (node != orig)
+		{
+			tree->cnt[node->kind]--;
+			radix_tree_free_node(tree, node);
+		}
+		radix_tree_discard_node(tree, orig);
+		return;
+	}
+
+	if (node->kind != RADIX_TREE_NODE_KIND_4 &&
+		node->count <= RADIX_TREE_SHRINK_COUNT(node->kind))
+	{
+		radix_tree_node *newnode = radix_tree_node_shrink(tree, node);
+
+		if (node != orig)
+		{
+			tree->cnt[node->kind]--;
+			radix_tree_free_node(tree, node);
+		}
+		node = newnode;
+	}
+
+	if (node != orig)
+		radix_tree_replace_node(tree, parent, orig, node);
+}
+
+/*
+ * Delete the key. Return true if the key was found and deleted.
+ *
+ * Since an inner node always has two or more children, deleting the last
+ * key of a leaf removes the leaf from its parent, but never takes the parent
+ * away with it, so we need to remember only two nodes above the leaf.
+ */
+bool
+radix_tree_delete(radix_tree *tree, uint64 key)
+{
+	radix_tree_node *node = tree->root;
+	radix_tree_node *parent = NULL;
+	radix_tree_node *grandparent = NULL;
+
+	while (node != NULL)
+	{
+		if (!radix_tree_node_match_prefix(node, key))
+			return false;
+
+		if (NodeIsLeaf(node))
+			break;
+
+		grandparent = parent;
+		parent = node;
+		node = radix_tree_find_child(tree, node, key);
+	}
+
+	if (node == NULL ||
+		radix_tree_find_slot_index(node, GET_KEY_CHUNK(key, 0)) < 0)
+		return false;
+
+	if (node->count > 1)
+		radix_tree_delete_chunk(tree, parent, node, GET_KEY_CHUNK(key, 0));
+	else
+	{
+		/* the leaf becomes empty */
+		if (parent == NULL)
+		{
+			pg_write_barrier();
+			tree->root = NULL;
+		}
+		else
+			radix_tree_delete_chunk(tree, grandparent, parent,
+									GET_KEY_CHUNK(key, parent->shift));
+
+		radix_tree_discard_node(tree, node);
+	}
+
+	tree->num_entries--;
+
+	if (tree->nretired >= RADIX_TREE_RECLAIM_THRESHOLD)
+		radix_tree_reclaim(tree);
+
 	return true;
 }
 
+/*
+ * Set the memory limit in bytes, and the callback to be called once the next
+ * insertion could cross it. 0 means no limit.
+ */
+void
+radix_tree_set_memory_limit(radix_tree *tree, Size limit,
+							radix_tree_limit_callback callback, void *arg)
+{
+	Assert(limit == 0 || callback != NULL);
+
+	tree->mem_limit = limit;
+	tree->limit_callback = callback;
+	tree->limit_arg = arg;
+	tree->limit_reached = false;
+}
+
+/*
+ * Return the bytes used by the tree and its nodes, not counting the free
+ * space in the slabs. In arena mode, the freed nodes waiting for reuse are
+ * counted but the space not carved from the last block yet is not.
+ */
+Size
+radix_tree_memory_usage(radix_tree *tree)
+{
+	if (tree->arena)
+		return sizeof(radix_tree) + tree->arena_carved +
+			sizeof(char *) * tree->arena_maxblocks;
+
+	return sizeof(radix_tree) + tree->mem_used;
+}
+
+/*
+ * Search the key. In concurrency mode, this can be called between
+ * radix_tree_read_begin() and radix_tree_read_end() while the writer inserts.
+ */
 Datum
 radix_tree_search(radix_tree *tree, uint64 key, bool *found)
 {
 	radix_tree_node *node;
-	int shift;
 
-	if (!tree->root || key > tree->max_val)
-		goto not_found;
+	node = *((radix_tree_node * volatile *) &tree->root);
 
-	node = tree->root;
-	shift = tree->root->shift;
-	while (shift >= 0)
+	/*
+	 * The prefix of a leaf covers all the key bits above its chunk, so we
+	 * don't check the prefixes of the inner nodes at all and compare the
+	 * skipped chunks only once, at the leaf.
+	 */
+	while (node != NULL)
 	{
-		radix_tree_node *child;
+		int idx;
 
-		if (NodeIsLeaf(node))
-		{
-			Datum *slot_ptr;
-			int chunk = GET_KEY_CHUNK(key, node->shift);
+		idx = radix_tree_find_slot_index(node, GET_KEY_CHUNK(key, node->shift));
 
-			/* We reached at a leaf node, find the corresponding slot */
-			slot_ptr = radix_tree_find_slot_ptr(node, chunk);
+		if (idx < 0)
+			break;
 
-			if (slot_ptr == NULL)
-				goto not_found;
+		if (NodeIsLeaf(node))
+		{
+			if (node->prefix != (key & ~shift_get_max_val(0)))
+				break;
 
 			/* Found! */
 			*found = true;
-			return *slot_ptr;
+			return radix_tree_get_value(node, idx);
 		}
 
-		child = radix_tree_find_child(node, key);
-
-		if (child == NULL)
-			goto not_found;
-
-		node = child;
-		shift -= RADIX_TREE_NODE_FANOUT;
+		node = radix_tree_get_child(tree, node, idx);
 	}
 
-not_found:
 	*found = false;
 	return (Datum) 0;
 }
@@ -651,12 +1856,215 @@ radix_tree_num_entries(radix_tree *tree)
 	return tree->num_entries;
 }
 
+/*
+ * Iteration over all keys in ascending order.
+ *
+ * We walk the tree depth-first with an explicit stack of the nodes and the
+ * position of the next slot to visit in each. The chunk arrays of node-4 and
+ * node-16 are sorted, and node-48 and node-256 are visited in chunk order
+ * through their bitmaps, so the keys come out sorted. The key of a value is
+ * the prefix of its leaf and the chunk, so we don't need to carry the key
+ * bits down the stack.
+ *
+ * The tree must not be modified during iteration, except in concurrency mode
+ * where the iteration can run between radix_tree_read_begin() and
+ * radix_tree_read_end() like a search. Keys inserted meanwhile may or may not
+ * be returned then.
+ */
+#define RADIX_TREE_MAX_LEVEL	(64 / RADIX_TREE_NODE_FANOUT)
+
+struct radix_tree_iter
+{
+	radix_tree *tree;
+	int		depth;
+	radix_tree_node *stack[RADIX_TREE_MAX_LEVEL];
+	int		pos[RADIX_TREE_MAX_LEVEL];	/* index, or chunk for node-48/256 */
+};
+
+radix_tree_iter *
+radix_tree_begin_iterate(radix_tree *tree)
+{
+	radix_tree_iter *iter = palloc0(sizeof(radix_tree_iter));
+	radix_tree_node *root;
+
+	iter->tree = tree;
+	root = *((radix_tree_node * volatile *) &tree->root);
+	if (root != NULL)
+	{
+		iter->stack[0] = root;
+		iter->depth = 1;
+	}
+
+	return iter;
+}
+
+/*
+ * Return the first chunk set in isset at or after chunk, or -1 if none.
+ */
+static inline int
+radix_tree_next_isset(const uint64 *isset, int chunk)
+{
+	for (int w = ISSET_WORD(chunk); w < RADIX_TREE_ISSET_WORDS; w++)
+	{
+		uint64	word = isset[w];
+
+		if (w == ISSET_WORD(chunk))
+			word &= ~(ISSET_BIT(chunk) - 1);
+
+		if (word != 0)
+			return w * 64 + pg_rightmost_one_pos64(word);
+	}
+
+	return -1;
+}
+
+/*
+ * Return the index of the slot at or after *pos in the node, advancing *pos
+ * past it, and set its chunk. Returns -1 if there are no more slots.
+ */
+static int
+radix_tree_iter_next_slot(radix_tree_node *node, int *pos, uint8 *chunk)
+{
+	switch (node->kind)
+	{
+		case RADIX_TREE_NODE_KIND_4:
+		{
+			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
+
+			if (*pos >= n4->n.count)
+				return -1;
+
+			*chunk = n4->chunks[*pos];
+			return (*pos)++;
+		}
+		case RADIX_TREE_NODE_KIND_16:
+		{
+			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
+
+			if (*pos >= n16->n.count)
+				return -1;
+
+			*chunk = n16->chunks[*pos];
+			return (*pos)++;
+		}
+		case RADIX_TREE_NODE_KIND_48:
+		{
+			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
+			int		next;
+
+			if (*pos >= 256 || (next = radix_tree_next_isset(n48->isset, *pos)) < 0)
+				return -1;
+
+			*pos = next + 1;
+			*chunk = next;
+			return radix_tree_node_48_slot_index(n48, next);
+		}
+		case RADIX_TREE_NODE_KIND_256:
+		{
+			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
+			int		next;
+
+			if (*pos >= 256 || (next = radix_tree_next_isset(n256->isset, *pos)) < 0)
+				return -1;
+
+			*pos = next + 1;
+			*chunk = next;
+			return next;
+		}
+	}
+
+	pg_unreachable();
+}
+
+/*
+ * Return the next key and its value. Returns false if there are no more
+ * keys.
+ */
+bool
+radix_tree_iterate_next(radix_tree_iter *iter, uint64 *key_p, Datum *value_p)
+{
+	while (iter->depth > 0)
+	{
+		int		level = iter->depth - 1;
+		radix_tree_node *node = iter->stack[level];
+		int		idx;
+		uint8	chunk;
+
+		idx = radix_tree_iter_next_slot(node, &iter->pos[level], &chunk);
+
+		if (idx < 0)
+		{
+			/* no more slots in this node */
+			iter->depth--;
+			continue;
+		}
+
+		if (NodeIsLeaf(node))
+		{
+			*key_p = node->prefix | chunk;
+			*value_p = radix_tree_get_value(node, idx);
+			return true;
+		}
+
+		Assert(iter->depth < RADIX_TREE_MAX_LEVEL);
+		iter->stack[iter->depth] = radix_tree_get_child(iter->tree, node, idx);
+		iter->pos[iter->depth] = 0;
+		iter->depth++;
+	}
+
+	return false;
+}
+
+void
+radix_tree_end_iterate(radix_tree_iter *iter)
+{
+	pfree(iter);
+}
+
+/*
+ * Collect the depth of the leaves below the node, which is the number of
+ * nodes a search visits to find a key there.
+ */
+static void
+radix_tree_stats_depth(radix_tree *tree, radix_tree_node *node, int depth,
+					   int *max_depth, uint64 *sum_depth, uint64 *nvals)
+{
+	int		pos = 0;
+	int		idx;
+	uint8	chunk;
+
+	if (NodeIsLeaf(node))
+	{
+		*max_depth = Max(*max_depth, depth);
+		*sum_depth += (uint64) depth * node->count;
+		*nvals += node->count;
+		return;
+	}
+
+	while ((idx = radix_tree_iter_next_slot(node, &pos, &chunk)) >= 0)
+		radix_tree_stats_depth(tree, radix_tree_get_child(tree, node, idx),
+							   depth + 1, max_depth, sum_depth, nvals);
+}
+
+/*
+ * The height is the largest number of nodes that a search visits, and the
+ * average depth is the number of nodes visited to find a key, averaged over
+ * the stored keys.
+ */
 void
 radix_tree_stats(radix_tree *tree)
 {
-	elog(NOTICE, "nkeys = %lu, height = %u, n4 = %d(%lu), n16 = %d(%lu), n48 = %d(%lu), n256 = %d(%lu)",
+	int		max_depth = 0;
+	uint64	sum_depth = 0;
+	uint64	nvals = 0;
+
+	if (tree->root)
+		radix_tree_stats_depth(tree, tree->root, 1, &max_depth, &sum_depth, &nvals);
+
+	elog(NOTICE, "nkeys = %lu, height = %d, avg depth = %.2f, n4 = %d(%lu), n16 = %d(%lu), n48 = %d(%lu), n256 = %d(%lu)",
 		 tree->nkeys,
-		 tree->root->shift / RADIX_TREE_NODE_FANOUT,
+		 max_depth,
+		 nvals > 0 ? (double) sum_depth / nvals : 0,
 		 tree->cnt[0], tree->cnt[0] * sizeof(radix_tree_node_4),
 		 tree->cnt[1], tree->cnt[1] * sizeof(radix_tree_node_16),
 		 tree->cnt[2], tree->cnt[2] * sizeof(radix_tree_node_48),
@@ -686,104 +2094,36 @@ radix_tree_print_slot(StringInfo buf, uint8 chunk, Datum slot, int idx, bool is_
 }
 
 static void
-radix_tree_dump_node(radix_tree_node *node, int level, StringInfo buf)
+radix_tree_dump_node(radix_tree *tree, radix_tree_node *node, int level,
+					 StringInfo buf)
 {
 	bool is_leaf = NodeIsLeaf(node);
+	int pos = 0;
+	int idx;
+	uint8 chunk;
 
-	appendStringInfo(buf, "[\"%s\" type %d, cnt %u, shift %u, chunk \"%X\"] chunks:\n",
+	appendStringInfo(buf, "[\"%s\" type %d, cnt %u, shift %u, prefix \"%lX\"] chunks:\n",
 					 NodeIsLeaf(node) ? "LEAF" : "INTR",
 					 (node->kind == RADIX_TREE_NODE_KIND_4) ? 4 :
 					 (node->kind == RADIX_TREE_NODE_KIND_16) ? 16 :
 					 (node->kind == RADIX_TREE_NODE_KIND_48) ? 48 : 256,
-					 node->count, node->shift, node->chunk);
+					 node->count, node->shift, node->prefix);
 
-	switch (node->kind)
+	while ((idx = radix_tree_iter_next_slot(node, &pos, &chunk)) >= 0)
 	{
-		case RADIX_TREE_NODE_KIND_4:
-		{
-			radix_tree_node_4 *n4 = (radix_tree_node_4 *) node;
-
-			for (int i = 0; i < n4->n.count; i++)
-			{
-				radix_tree_print_slot(buf, n4->chunks[i], n4->slots[i], i, is_leaf, level);
+		radix_tree_print_slot(buf, chunk,
+							  is_leaf ? radix_tree_get_value(node, idx) : (Datum) 0,
+							  idx, is_leaf, level);
 
-				if (!is_leaf)
-				{
-					StringInfoData buf2;
-
-					initStringInfo(&buf2);
-					radix_tree_dump_node((radix_tree_node *) n4->slots[i], level + 1, &buf2);
-					appendStringInfo(buf, "%s", buf2.data);
-				}
-			}
-			break;
-		}
-		case RADIX_TREE_NODE_KIND_16:
+		if (!is_leaf)
 		{
-			radix_tree_node_16 *n16 = (radix_tree_node_16 *) node;
+			StringInfoData buf2;
 
-			for (int i = 0; i < n16->n.count; i++)
-			{
-				radix_tree_print_slot(buf, n16->chunks[i], n16->slots[i], i, is_leaf, level);
-
-				if (!is_leaf)
-				{
-					StringInfoData buf2;
-
-					initStringInfo(&buf2);
-					radix_tree_dump_node((radix_tree_node *) n16->slots[i], level + 1, &buf2);
-					appendStringInfo(buf, "%s", buf2.data);
-				}
-			}
-			break;
-		}
-		case RADIX_TREE_NODE_KIND_48:
-		{
-			radix_tree_node_48 *n48 = (radix_tree_node_48 *) node;
-
-			for (int i = 0; i < 256; i++)
-			{
-				int pos = n48->slot_idxs[i] - 1;
-
-				if (pos < 0)
-					continue;
-
-				radix_tree_print_slot(buf, i, n48->slots[pos], i, is_leaf, level);
-
-				if (!is_leaf)
-				{
-					StringInfoData buf2;
-
-					initStringInfo(&buf2);
-					radix_tree_dump_node((radix_tree_node *) n48->slots[pos], level + 1, &buf2);
-					appendStringInfo(buf, "%s", buf2.data);
-				}
-			}
-			break;
+			initStringInfo(&buf2);
+			radix_tree_dump_node(tree, radix_tree_get_child(tree, node, idx),
+								 level + 1, &buf2);
+			appendStringInfo(buf, "%s", buf2.data);
 		}
-		case RADIX_TREE_NODE_KIND_256:
-		{
-			radix_tree_node_256 *n256 = (radix_tree_node_256 *) node;
-
-			for (int i = 0; i < 256; i++)
-			{
-				if (n256->slots[i] == (Datum) 0)
-					continue;
-
-				radix_tree_print_slot(buf, i, n256->slots[i], i, is_leaf, level);
-
-				if (!is_leaf)
-				{
-					StringInfoData buf2;
-
-					initStringInfo(&buf2);
-					radix_tree_dump_node((radix_tree_node *) n256->slots[i], level + 1, &buf2);
-					appendStringInfo(buf, "%s", buf2.data);
-				}
-			}
-			break;
-		}
-			break;
 	}
 }
 
@@ -795,8 +2135,8 @@ radix_tree_dump(radix_tree *tree)
 	initStringInfo(&buf);
 
 	elog(NOTICE, "-----------------------------------------------------------");
-	elog(NOTICE, "max_val = %lu", tree->max_val);
-	radix_tree_dump_node(tree->root, 0, &buf);
+	if (tree->root)
+		radix_tree_dump_node(tree, tree->root, 0, &buf);
 	elog(NOTICE, "\n%s", buf.data);
 	elog(NOTICE, "-----------------------------------------------------------");
 }
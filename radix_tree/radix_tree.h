@@ -4,11 +4,30 @@
 #include "postgres.h"
 
 typedef struct radix_tree radix_tree;
+typedef struct radix_tree_iter radix_tree_iter;
+typedef void (*radix_tree_limit_callback) (void *arg);
 
 extern radix_tree *radix_tree_create(MemoryContext ctx);
+extern radix_tree *radix_tree_create_arena(MemoryContext ctx);
+extern radix_tree *radix_tree_create_concurrent(MemoryContext ctx, int max_readers);
+extern void radix_tree_read_begin(radix_tree *tree, int reader);
+extern void radix_tree_read_end(radix_tree *tree, int reader);
+extern int radix_tree_reclaim(radix_tree *tree);
 extern bool radix_tree_insert(radix_tree *rt, uint64 key, Datum val);
+extern bool radix_tree_insert_or(radix_tree *tree, uint64 key, Datum val);
+extern bool radix_tree_delete(radix_tree *tree, uint64 key);
+extern void radix_tree_build_sorted(radix_tree *tree, const uint64 *keys,
+									const Datum *vals, int nkeys);
+extern void radix_tree_set_memory_limit(radix_tree *tree, Size limit,
+										radix_tree_limit_callback callback,
+										void *arg);
+extern Size radix_tree_memory_usage(radix_tree *tree);
 extern void radix_tree_dump(radix_tree *rt);
 extern Datum radix_tree_search(radix_tree *rt, uint64 key, bool *found);
+extern radix_tree_iter *radix_tree_begin_iterate(radix_tree *tree);
+extern bool radix_tree_iterate_next(radix_tree_iter *iter, uint64 *key_p,
+									Datum *value_p);
+extern void radix_tree_end_iterate(radix_tree_iter *iter);
 extern void radix_tree_destroy(radix_tree *tree);
 extern void radix_tree_stats(radix_tree *tree);
 
@@ -16,6 +16,23 @@
 
 #include "radix_tree.h"
 
+/* the template instantiations compared with radix_tree in test_template() */
+#define RT_PREFIX rt_test
+#define RT_VALUE_TYPE Datum
+#define RT_USE_STATS
+#define RT_SCOPE static inline
+#define RT_DECLARE
+#define RT_DEFINE
+#include "radix_tree_template.h"
+
+#define RT_PREFIX rt_test32
+#define RT_VALUE_TYPE uint64
+#define RT_KEY_BITS 32
+#define RT_SCOPE static inline
+#define RT_DECLARE
+#define RT_DEFINE
+#include "radix_tree_template.h"
+
 PG_MODULE_MAGIC;
 
 PG_FUNCTION_INFO_V1(run_test);
@@ -132,6 +149,639 @@ test_set(uint64 *keys, int nkeys)
 	radix_tree_destroy(tree);
 }
 
+/*
+ * Insert every other key so that leaves become node-48 and node-256, and
+ * check that the keys in between are not found.
+ */
+static void
+test_absent(int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	bool found;
+
+	elog(NOTICE, "absent key test ...");
+
+	for (uint64 i = 0; i < n; i += 2)
+		radix_tree_insert(tree, i, Int32GetDatum(100));
+
+	for (uint64 i = 0; i < n; i++)
+	{
+		radix_tree_search(tree, i, &found);
+
+		if (found != (i % 2 == 0))
+			elog(ERROR, "key %lu is %s", i, found ? "found" : "not found");
+	}
+
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Insert keys differing only in the highest and the lowest chunk, so that the
+ * levels in between are skipped, and check that keys differing in a skipped
+ * chunk are not found.
+ */
+static void
+test_prefix(int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	bool found;
+
+	elog(NOTICE, "prefix test ...");
+
+	for (uint64 i = 0; i < n; i++)
+		radix_tree_insert(tree, (i << 56) | i, Int32GetDatum(100));
+
+	for (uint64 i = 0; i < n; i++)
+	{
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			uint64 key = ((i << 56) | i) ^ (UINT64CONST(1) << shift);
+
+			radix_tree_search(tree, (i << 56) | i, &found);
+			if (!found)
+				elog(ERROR, "key %016lX is not found", (i << 56) | i);
+
+			/* flipping one bit never gives another inserted key */
+			radix_tree_search(tree, key, &found);
+			if (found)
+				elog(ERROR, "key %016lX is found", key);
+		}
+	}
+
+	radix_tree_stats(tree);
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Build a tree from sorted keys with gaps of various widths, and check that
+ * every key has its value and the keys in the gaps are not found.
+ */
+static void
+test_build_sorted(int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	uint64 *keys = (uint64 *) palloc(sizeof(uint64) * n);
+	Datum *vals = (Datum *) palloc(sizeof(Datum) * n);
+	uint64 key = 0;
+	bool found;
+
+	elog(NOTICE, "build sorted test ...");
+
+	for (int i = 0; i < n; i++)
+	{
+		keys[i] = key;
+		vals[i] = Int32GetDatum(i);
+
+		/* mostly dense, with a sparse stretch now and then */
+		key += (i % 1000 == 999) ? (rand_uint64() >> 20) + 1 : (rand() % 3) + 1;
+	}
+
+	radix_tree_build_sorted(tree, keys, vals, n);
+
+	for (int i = 0; i < n; i++)
+	{
+		Datum val = radix_tree_search(tree, keys[i], &found);
+
+		if (!found || DatumGetInt32(val) != i)
+			elog(ERROR, "key %016lX is %s", keys[i],
+				 found ? "found with a wrong value" : "not found");
+
+		if (i + 1 < n && keys[i] + 1 < keys[i + 1])
+		{
+			radix_tree_search(tree, keys[i] + 1, &found);
+			if (found)
+				elog(ERROR, "key %016lX is found", keys[i] + 1);
+		}
+	}
+
+	radix_tree_stats(tree);
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Insert keys with gaps of various widths in random order, and check that
+ * iteration returns all of them in ascending order with their values.
+ */
+static void
+test_iterate(int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	radix_tree_iter *iter;
+	uint64 *keys = (uint64 *) palloc(sizeof(uint64) * n);
+	int *order = (int *) palloc(sizeof(int) * n);
+	uint64 key = 0;
+	Datum val;
+
+	elog(NOTICE, "iterate test ...");
+
+	/* an empty tree has no keys */
+	iter = radix_tree_begin_iterate(tree);
+	if (radix_tree_iterate_next(iter, &key, &val))
+		elog(ERROR, "key %016lX is returned from an empty tree", key);
+	radix_tree_end_iterate(iter);
+
+	for (int i = 0; i < n; i++)
+	{
+		keys[i] = key;
+		order[i] = i;
+
+		key += (i % 1000 == 999) ? (rand_uint64() >> 20) + 1 : (rand() % 3) + 1;
+	}
+
+	for (int i = n - 1; i > 0; i--)
+	{
+		int j = rand() % (i + 1);
+		int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (int i = 0; i < n; i++)
+		radix_tree_insert(tree, keys[order[i]], Int32GetDatum(order[i]));
+
+	iter = radix_tree_begin_iterate(tree);
+	for (int i = 0; i < n; i++)
+	{
+		if (!radix_tree_iterate_next(iter, &key, &val))
+			elog(ERROR, "iteration ended after %d keys, expected %d", i, n);
+
+		if (key != keys[i] || DatumGetInt32(val) != i)
+			elog(ERROR, "iteration returned key %016lX value %d, expected key %016lX value %d",
+				 key, DatumGetInt32(val), keys[i], i);
+	}
+	if (radix_tree_iterate_next(iter, &key, &val))
+		elog(ERROR, "key %016lX is returned after all keys", key);
+	radix_tree_end_iterate(iter);
+
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Concurrency mode test. We can't run readers concurrently here, so emulate
+ * readers stalled in the middle of searches and check that the nodes replaced
+ * meanwhile are kept until they finish.
+ */
+static void
+test_concurrent(int n)
+{
+	radix_tree *tree = radix_tree_create_concurrent(CurrentMemoryContext, 2);
+	int nkept;
+	bool found;
+
+	elog(NOTICE, "concurrent test ...");
+
+	radix_tree_read_begin(tree, 0);
+
+	/* grows nodes 4 -> 16 -> 48 -> 256, replacing them in the tree */
+	for (uint64 i = 0; i < n; i++)
+		radix_tree_insert(tree, i, Int32GetDatum(100));
+
+	nkept = radix_tree_reclaim(tree);
+	if (nkept == 0)
+		elog(ERROR, "nodes retired while reader 0 is active were freed");
+
+	/* a reader started after the replacements doesn't need them */
+	radix_tree_read_begin(tree, 1);
+	radix_tree_read_end(tree, 0);
+
+	nkept = radix_tree_reclaim(tree);
+	if (nkept != 0)
+		elog(ERROR, "%d nodes retired before reader 1 started are kept", nkept);
+
+	for (uint64 i = n; i < n * 2; i++)
+		radix_tree_insert(tree, i, Int32GetDatum(100));
+
+	/* concurrent searches see all keys inserted so far */
+	for (uint64 i = 0; i < n * 2; i++)
+	{
+		Datum ret = radix_tree_search(tree, i, &found);
+
+		if (!found || DatumGetInt32(ret) != 100)
+			elog(ERROR, "key %lu not found by reader 1", i);
+	}
+
+	if (radix_tree_reclaim(tree) == 0)
+		elog(ERROR, "nodes retired while reader 1 is active were freed");
+
+	radix_tree_read_end(tree, 1);
+
+	nkept = radix_tree_reclaim(tree);
+	if (nkept != 0)
+		elog(ERROR, "%d nodes are kept after all readers finished", nkept);
+
+	radix_tree_destroy(tree);
+}
+
+static int
+uint64_comparator(const void *a, const void *b)
+{
+	uint64 x = *((const uint64 *) a);
+	uint64 y = *((const uint64 *) b);
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Insert the same random keys to a tree in arena mode and a normal tree, and
+ * check that searches and iteration give the same results. Then build an
+ * arena tree from the sorted keys and search them all.
+ */
+static void
+test_arena(uint64 mask, int n)
+{
+	radix_tree *arena = radix_tree_create_arena(CurrentMemoryContext);
+	radix_tree *normal = radix_tree_create(CurrentMemoryContext);
+	radix_tree_iter *iter_a;
+	radix_tree_iter *iter_n;
+	uint64 *keys = (uint64 *) palloc(sizeof(uint64) * n);
+	Datum *vals = (Datum *) palloc(sizeof(Datum) * n);
+	uint64	key_a, key_n;
+	Datum	val_a, val_n;
+	int		nkeys = 0;
+	bool	found;
+
+	elog(NOTICE, "arena test with mask %016lX ...", mask);
+
+	for (int i = 0; i < n; i++)
+	{
+		uint64 key = rand_uint64() & mask;
+
+		radix_tree_search(normal, key, &found);
+		if (found)
+			continue;
+
+		keys[nkeys++] = key;
+		radix_tree_insert(arena, key, Int64GetDatum(key + 1));
+		radix_tree_insert(normal, key, Int64GetDatum(key + 1));
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		/* stored keys and random ones, mostly absent */
+		uint64 key = (i % 2 == 0 && i < nkeys) ? keys[i] : rand_uint64() & mask;
+		bool	found_n;
+
+		val_a = radix_tree_search(arena, key, &found);
+		val_n = radix_tree_search(normal, key, &found_n);
+
+		if (found != found_n || (found && val_a != val_n))
+			elog(ERROR, "key %016lX is %s in the arena tree but %s in the normal tree",
+				 key, found ? "found" : "not found", found_n ? "found" : "not found");
+	}
+
+	iter_a = radix_tree_begin_iterate(arena);
+	iter_n = radix_tree_begin_iterate(normal);
+	while (radix_tree_iterate_next(iter_n, &key_n, &val_n))
+	{
+		if (!radix_tree_iterate_next(iter_a, &key_a, &val_a))
+			elog(ERROR, "iteration over the arena tree ended before key %016lX", key_n);
+
+		if (key_a != key_n || val_a != val_n)
+			elog(ERROR, "iteration returned key %016lX from the arena tree, expected %016lX",
+				 key_a, key_n);
+	}
+	if (radix_tree_iterate_next(iter_a, &key_a, &val_a))
+		elog(ERROR, "iteration over the arena tree returned extra key %016lX", key_a);
+	radix_tree_end_iterate(iter_a);
+	radix_tree_end_iterate(iter_n);
+
+	elog(NOTICE, "%d keys in %zu bytes in arena mode, %zu bytes in normal mode",
+		 nkeys, radix_tree_memory_usage(arena), radix_tree_memory_usage(normal));
+
+	radix_tree_destroy(arena);
+	radix_tree_destroy(normal);
+
+	qsort(keys, nkeys, sizeof(uint64), uint64_comparator);
+	for (int i = 0; i < nkeys; i++)
+		vals[i] = Int64GetDatum(keys[i] + 1);
+
+	arena = radix_tree_create_arena(CurrentMemoryContext);
+	radix_tree_build_sorted(arena, keys, vals, nkeys);
+
+	for (int i = 0; i < nkeys; i++)
+	{
+		val_a = radix_tree_search(arena, keys[i], &found);
+
+		if (!found || val_a != vals[i])
+			elog(ERROR, "key %016lX built in the arena tree is %s", keys[i],
+				 found ? "found with a wrong value" : "not found");
+	}
+
+	radix_tree_destroy(arena);
+}
+
+/*
+ * Insert keys, OR more bits into some and replace the values of others, then
+ * delete them in rounds, checking after each round that the deleted keys are
+ * gone and the others have their values. Once all keys are deleted, the tree
+ * must have no nodes left.
+ */
+static void
+test_delete(uint64 mask, int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	uint64 *keys = (uint64 *) palloc(sizeof(uint64) * n);
+	Datum *vals = (Datum *) palloc(sizeof(Datum) * n);
+	bool *deleted = (bool *) palloc0(sizeof(bool) * n);
+	Size	empty_size = radix_tree_memory_usage(tree);
+	int		nkeys = 0;
+	bool	found;
+
+	elog(NOTICE, "delete test with mask %016lX ...", mask);
+
+	while (nkeys < n)
+	{
+		uint64 key = rand_uint64() & mask;
+
+		if (!radix_tree_insert_or(tree, key, Int64GetDatum(1)))
+			continue;	/* already there */
+
+		keys[nkeys] = key;
+		vals[nkeys] = Int64GetDatum(1);
+		nkeys++;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		if (i % 3 == 0)
+		{
+			if (radix_tree_insert_or(tree, keys[i], Int64GetDatum(4)))
+				elog(ERROR, "key %016lX is inserted again", keys[i]);
+			vals[i] |= Int64GetDatum(4);
+		}
+		else if (i % 3 == 1)
+		{
+			if (radix_tree_insert(tree, keys[i], Int64GetDatum(i)))
+				elog(ERROR, "key %016lX is inserted again", keys[i]);
+			vals[i] = Int64GetDatum(i);
+		}
+	}
+
+	/* delete every 8th key, then every 4th, and so on, to shrink the nodes */
+	for (int step = 8; step >= 1; step /= 2)
+	{
+		for (int i = 0; i < n; i += step)
+		{
+			bool	ret = radix_tree_delete(tree, keys[i]);
+
+			if (ret == deleted[i])
+				elog(ERROR, "deleting key %016lX returned %s", keys[i],
+					 ret ? "true" : "false");
+			deleted[i] = true;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			Datum val = radix_tree_search(tree, keys[i], &found);
+
+			if (found == deleted[i] || (found && val != vals[i]))
+				elog(ERROR, "key %016lX is %s after deleting every %dth key",
+					 keys[i],
+					 !found ? "not found" : deleted[i] ? "found" : "found with a wrong value",
+					 step);
+		}
+	}
+
+	if (radix_tree_memory_usage(tree) != empty_size)
+		elog(ERROR, "empty tree uses %zu bytes, expected %zu",
+			 radix_tree_memory_usage(tree), empty_size);
+
+	radix_tree_destroy(tree);
+}
+
+static void
+test_memory_limit_reached(void *arg)
+{
+	*((bool *) arg) = true;
+}
+
+/*
+ * Insert keys until the memory limit callback tells us to stop, and check
+ * that the limit is not crossed by then and the keys are all there.
+ */
+static void
+test_memory_limit(Size limit)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	bool	reached = false;
+	uint64	nkeys = 0;
+	bool	found;
+
+	elog(NOTICE, "memory limit test ...");
+
+	radix_tree_set_memory_limit(tree, limit, test_memory_limit_reached,
+								&reached);
+
+	/* sparse keys make the leaves small, so that it takes many insertions */
+	while (!reached)
+	{
+		radix_tree_insert(tree, nkeys * 997, Int64GetDatum(nkeys));
+		nkeys++;
+
+		if (radix_tree_memory_usage(tree) > limit)
+			elog(ERROR, "memory usage %zu crossed the limit %zu without the callback",
+				 radix_tree_memory_usage(tree), limit);
+	}
+
+	for (uint64 i = 0; i < nkeys; i++)
+	{
+		Datum ret = radix_tree_search(tree, i * 997, &found);
+
+		if (!found || DatumGetInt64(ret) != i)
+			elog(ERROR, "key %lu inserted before the memory limit is not found",
+				 i * 997);
+	}
+
+	/* the callback is called only once */
+	reached = false;
+	radix_tree_insert(tree, nkeys * 997, Int64GetDatum(nkeys));
+	if (reached)
+		elog(ERROR, "memory limit callback is called again");
+
+	elog(NOTICE, "inserted %lu keys in %zu bytes", nkeys,
+		 radix_tree_memory_usage(tree));
+
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Insert the same keys to the template instantiations and to radix_tree, and
+ * check that the specialized trees find the same keys with the same values,
+ * updated in place, and iterate over them in the same order.
+ */
+static void
+test_template(uint64 mask, int n)
+{
+	radix_tree *tree = radix_tree_create(CurrentMemoryContext);
+	rt_test_radix_tree *t64 = rt_test_create(CurrentMemoryContext);
+	rt_test32_radix_tree *t32 = rt_test32_create(CurrentMemoryContext);
+	radix_tree_iter *iter;
+	rt_test_iter *iter64;
+	rt_test32_iter *iter32;
+	uint64	nkeys = 0;
+	uint64	key;
+	Datum	val;
+	bool	found;
+
+	elog(NOTICE, "template test with mask %016lX ...", mask);
+
+	for (int i = 0; i < n; i++)
+	{
+		bool	isnew;
+
+		key = rand_uint64() & mask;
+
+		isnew = radix_tree_insert(tree, key, Int64GetDatum(key));
+		if (rt_test_set(t64, key, Int64GetDatum(key)) != isnew)
+			elog(ERROR, "setting key %016lX returned %s", key,
+				 isnew ? "false" : "true");
+		rt_test32_set(t32, (uint32) key, key);
+
+		if (isnew)
+			nkeys++;
+	}
+
+	/* update every 3rd key in place */
+	iter = radix_tree_begin_iterate(tree);
+	for (int i = 0; radix_tree_iterate_next(iter, &key, &val); i++)
+	{
+		if (i % 3 != 0)
+			continue;
+		if (rt_test_set(t64, key, Int64GetDatum(~key)))
+			elog(ERROR, "key %016lX is inserted again", key);
+	}
+	radix_tree_end_iterate(iter);
+
+	if (rt_test_num_entries(t64) != nkeys)
+		elog(ERROR, "template tree has " UINT64_FORMAT " keys, expected " UINT64_FORMAT,
+			 rt_test_num_entries(t64), nkeys);
+
+	iter = radix_tree_begin_iterate(tree);
+	iter64 = rt_test_begin_iterate(t64);
+	for (int i = 0; radix_tree_iterate_next(iter, &key, &val); i++)
+	{
+		Datum	expected = (i % 3 == 0) ? Int64GetDatum(~key) : val;
+		uint64	key64;
+		Datum	val64;
+
+		if (!rt_test_search(t64, key, &val64) || val64 != expected)
+			elog(ERROR, "key %016lX is not found in the template tree", key);
+		radix_tree_search(tree, key + 1, &found);
+		if (rt_test_search(t64, key + 1, &val64) != found)
+			elog(ERROR, "key %016lX is found only in %s", key + 1,
+				 found ? "radix_tree" : "the template tree");
+
+		if (!rt_test_iterate_next(iter64, &key64, &val64) ||
+			key64 != key || val64 != expected)
+			elog(ERROR, "template tree iterates %016lX, expected %016lX",
+				 key64, key);
+	}
+	if (rt_test_iterate_next(iter64, &key, &val))
+		elog(ERROR, "template tree iterates extra key %016lX", key);
+	rt_test_end_iterate(iter64);
+	radix_tree_end_iterate(iter);
+
+	/* 32-bit keys are the low halves, in ascending order */
+	iter32 = rt_test32_begin_iterate(t32);
+	{
+		uint32	key32;
+		uint32	prev = 0;
+		uint64	val32;
+
+		for (int i = 0; rt_test32_iterate_next(iter32, &key32, &val32); i++)
+		{
+			if ((i > 0 && key32 <= prev) || (uint32) val32 != key32)
+				elog(ERROR, "32-bit template tree iterates %08X after %08X",
+					 key32, prev);
+			if (!rt_test32_search(t32, key32, &val32))
+				elog(ERROR, "key %08X is not found in the 32-bit template tree",
+					 key32);
+			prev = key32;
+		}
+	}
+	rt_test32_end_iterate(iter32);
+
+	rt_test_stats(t64);
+	rt_test32_stats(t32);
+
+	rt_test_free(t64);
+	rt_test32_free(t32);
+	radix_tree_destroy(tree);
+}
+
+/*
+ * Build template trees from nparts parts of random keys and merge them, and
+ * check that the merged tree has the same keys and values as a tree built in
+ * a single pass. The parts are consecutive ranges of the sorted keys, or
+ * every nparts'th key if interleaved, whose nodes are merged and grow.
+ */
+static void
+test_template_merge(uint64 mask, int n, int nparts, bool interleaved)
+{
+	rt_test_radix_tree *whole = rt_test_create(CurrentMemoryContext);
+	rt_test_radix_tree **parts;
+	rt_test_iter *iter_w;
+	rt_test_iter *iter_m;
+	uint64	   *keys = (uint64 *) palloc(sizeof(uint64) * n);
+	uint64		key_w, key_m;
+	Datum		val_w, val_m;
+
+	elog(NOTICE, "template merge test with mask %016lX, %d %s parts ...",
+		 mask, nparts, interleaved ? "interleaved" : "disjoint");
+
+	for (int i = 0; i < n; i++)
+	{
+		keys[i] = rand_uint64() & mask;
+		rt_test_set(whole, keys[i], Int64GetDatum(keys[i]));
+	}
+
+	if (!interleaved)
+		qsort(keys, n, sizeof(uint64), uint64_comparator);
+
+	parts = (rt_test_radix_tree **) palloc(sizeof(rt_test_radix_tree *) * nparts);
+	for (int p = 0; p < nparts; p++)
+		parts[p] = rt_test_create(CurrentMemoryContext);
+
+	/* a key drawn twice may go to two parts */
+	for (int i = 0; i < n; i++)
+	{
+		int			p = interleaved ? i % nparts : (int) ((int64) i * nparts / n);
+
+		rt_test_set(parts[p], keys[i], Int64GetDatum(keys[i]));
+	}
+
+	for (int p = 1; p < nparts; p++)
+		rt_test_merge(parts[0], parts[p]);
+
+	if (rt_test_num_entries(parts[0]) != rt_test_num_entries(whole))
+		elog(ERROR, "merged tree has " UINT64_FORMAT " keys, expected " UINT64_FORMAT,
+			 rt_test_num_entries(parts[0]), rt_test_num_entries(whole));
+
+	iter_w = rt_test_begin_iterate(whole);
+	iter_m = rt_test_begin_iterate(parts[0]);
+	while (rt_test_iterate_next(iter_w, &key_w, &val_w))
+	{
+		if (!rt_test_iterate_next(iter_m, &key_m, &val_m))
+			elog(ERROR, "iteration over the merged tree ended before key %016lX", key_w);
+
+		if (key_m != key_w || val_m != val_w)
+			elog(ERROR, "iteration returned key %016lX from the merged tree, expected %016lX",
+				 key_m, key_w);
+	}
+	if (rt_test_iterate_next(iter_m, &key_m, &val_m))
+		elog(ERROR, "iteration over the merged tree returned extra key %016lX", key_m);
+	rt_test_end_iterate(iter_w);
+	rt_test_end_iterate(iter_m);
+
+	rt_test_stats(parts[0]);
+
+	rt_test_free(whole);
+	rt_test_free(parts[0]);
+	pfree(parts);
+	pfree(keys);
+}
+
 Datum
 run_test(PG_FUNCTION_ARGS)
 {
@@ -155,6 +805,32 @@ run_test(PG_FUNCTION_ARGS)
 
 	test_sequence(10000000);
 
+	test_absent(100);
+	test_absent(1000);
+
+	test_prefix(256);
+
+	test_build_sorted(1000000);
+
+	test_iterate(1000000);
+
+	test_concurrent(100000);
+
+	test_memory_limit(1024 * 1024);
+
+	test_arena(0xFFFFFFFFFFFFFFFF, 100000);
+	test_arena(0x0000000000FFFFFF, 100000);
+
+	test_delete(0xFFFFFFFFFFFFFFFF, 100000);
+	test_delete(0x00000000000FFFFF, 100000);
+
+	test_template(0xFFFFFFFFFFFFFFFF, 100000);
+	test_template(0x000000FF00FFFFFF, 100000);
+
+	test_template_merge(0xFFFFFFFFFFFFFFFF, 100000, 4, false);
+	test_template_merge(0x000000FF00FFFFFF, 100000, 4, true);
+	test_template_merge(0x00000000000000FF, 256, 8, true);
+
 	uint64 keys[] = {
 		0x00000000000000AA,
 		0x0000000000AA00AA,
@@ -0,0 +1,1170 @@
+/*-------------------------------------------------------------------------
+ *
+ * radix_tree_template.h
+ *	  Radix tree specialized to the given key width and value type, generated
+ *	  at compile time in the style of lib/simplehash.h.
+ *
+ * The tree is the one of radix_tree.c, with the same node kinds (4, 16, 48
+ * and 256 slots), path compression and lazy expansion, but the keys are of
+ * RT_KEY_BITS bits and the leaves hold values of RT_VALUE_TYPE by value
+ * rather than Datums. All functions are generated for the instantiation, so
+ * the compiler can inline the node searches into the hot path. It has none
+ * of the arena, concurrency and memory limit modes of radix_tree.c, and keys
+ * cannot be deleted.
+ *
+ * Trees built separately, say for disjoint key ranges, can be merged by
+ * foo_merge(), grafting the subtrees of one to the other rather than
+ * inserting the keys again.
+ *
+ * Usage notes:
+ *
+ *	  To generate a radix tree and associated functions for a use case
+ *	  several macros have to be #define'ed before this file is included.
+ *	  Including the file #undef's all those, so a new radix tree can be
+ *	  generated afterwards.
+ *	  The relevant parameters are:
+ *	  - RT_PREFIX - prefix for all symbol names generated. A prefix of "foo"
+ *		will result in radix tree type "foo_radix_tree" and functions like
+ *		"foo_create"/"foo_set"/"foo_search" and so forth.
+ *	  - RT_VALUE_TYPE - type of the values. A value takes a slot as large as
+ *		the larger of a pointer and the value, so it should be at most 8
+ *		bytes.
+ *	  - RT_KEY_BITS - width of the keys, 32 or 64 (the default). 32-bit keys
+ *		make the node headers half the size and the tree at most 4 levels
+ *		high.
+ *	  - RT_USE_STATS - if defined, count the keys inserted and the nodes of
+ *		each kind, reported by foo_stats(). That costs a few increments on
+ *		every insertion, so it's typically defined only with
+ *		USE_ASSERT_CHECKING.
+ *	  - RT_DECLARE - if defined, type declarations and function prototypes
+ *		are generated
+ *	  - RT_DEFINE - if defined, function definitions are generated
+ *	  - RT_SCOPE - in which scope (e.g. extern, static inline) do function
+ *		declarations reside
+ *
+ *	  For example, a tree mapping 32-bit keys to 64-bit bitmaps local to a
+ *	  file:
+ *
+ *		#define RT_PREFIX tidtree
+ *		#define RT_VALUE_TYPE uint64
+ *		#define RT_KEY_BITS 32
+ *		#define RT_SCOPE static inline
+ *		#define RT_DECLARE
+ *		#define RT_DEFINE
+ *		#include "radix_tree_template.h"
+ *
+ * Portions Copyright (c) 1996-2021, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "port/pg_bitutils.h"
+#include "utils/memutils.h"
+
+/* helpers */
+#define RT_MAKE_PREFIX(a) CppConcat(a,_)
+#define RT_MAKE_NAME(name) RT_MAKE_NAME_(RT_MAKE_PREFIX(RT_PREFIX),name)
+#define RT_MAKE_NAME_(a,b) CppConcat(a,b)
+
+#ifndef RT_KEY_BITS
+#define RT_KEY_BITS 64
+#endif
+
+#if RT_KEY_BITS == 64
+#define RT_KEY_TYPE uint64
+#define RT_KEY_LEFTMOST_ONE_POS(k) pg_leftmost_one_pos64(k)
+#elif RT_KEY_BITS == 32
+#define RT_KEY_TYPE uint32
+#define RT_KEY_LEFTMOST_ONE_POS(k) pg_leftmost_one_pos32(k)
+#else
+#error "RT_KEY_BITS must be 32 or 64"
+#endif
+
+/* name macros for: */
+
+/* type declarations */
+#define RT_RADIX_TREE RT_MAKE_NAME(radix_tree)
+#define RT_ITER RT_MAKE_NAME(iter)
+#define RT_NODE RT_MAKE_NAME(node)
+#define RT_NODE_4 RT_MAKE_NAME(node_4)
+#define RT_NODE_16 RT_MAKE_NAME(node_16)
+#define RT_NODE_48 RT_MAKE_NAME(node_48)
+#define RT_NODE_256 RT_MAKE_NAME(node_256)
+#define RT_SLOT RT_MAKE_NAME(slot)
+
+/* function declarations */
+#define RT_CREATE RT_MAKE_NAME(create)
+#define RT_FREE RT_MAKE_NAME(free)
+#define RT_SET RT_MAKE_NAME(set)
+#define RT_SEARCH RT_MAKE_NAME(search)
+#define RT_NUM_ENTRIES RT_MAKE_NAME(num_entries)
+#define RT_MEMORY_USAGE RT_MAKE_NAME(memory_usage)
+#define RT_BEGIN_ITERATE RT_MAKE_NAME(begin_iterate)
+#define RT_ITERATE_NEXT RT_MAKE_NAME(iterate_next)
+#define RT_END_ITERATE RT_MAKE_NAME(end_iterate)
+#define RT_MERGE RT_MAKE_NAME(merge)
+#define RT_STATS RT_MAKE_NAME(stats)
+
+/* internal helper functions (no externally visible prototypes) */
+#define RT_NODE_INFO RT_MAKE_NAME(node_info)
+#define RT_KEY_GET_SHIFT RT_MAKE_NAME(key_get_shift)
+#define RT_SHIFT_GET_MAX_VAL RT_MAKE_NAME(shift_get_max_val)
+#define RT_ALLOC_NODE RT_MAKE_NAME(alloc_node)
+#define RT_FREE_NODE RT_MAKE_NAME(free_node)
+#define RT_FIND_SLOT RT_MAKE_NAME(find_slot)
+#define RT_NEW_LEAF RT_MAKE_NAME(new_leaf)
+#define RT_SPLIT RT_MAKE_NAME(split)
+#define RT_REPLACE_CHILD RT_MAKE_NAME(replace_child)
+#define RT_NODE_GROW RT_MAKE_NAME(node_grow)
+#define RT_ADD_SLOT RT_MAKE_NAME(add_slot)
+#define RT_INSERT_SLOT RT_MAKE_NAME(insert_slot)
+#define RT_GRAFT RT_MAKE_NAME(graft)
+#define RT_ITER_NEXT_SLOT RT_MAKE_NAME(iter_next_slot)
+
+#define RT_MAX_SHIFT	(((RT_KEY_BITS - 1) / RTT_NODE_FANOUT) * RTT_NODE_FANOUT)
+#define RT_MAX_LEVEL	(RT_KEY_BITS / RTT_NODE_FANOUT)
+
+#define RT_NODE_IS_LEAF(n) (((RT_NODE *) (n))->shift == 0)
+#define RT_GET_KEY_CHUNK(key, shift) \
+	((uint8) (((key) >> (shift)) & RTT_CHUNK_MASK))
+
+/* generate forward declarations necessary to use the radix tree */
+#ifdef RT_DECLARE
+
+typedef struct RT_RADIX_TREE RT_RADIX_TREE;
+typedef struct RT_ITER RT_ITER;
+
+RT_SCOPE RT_RADIX_TREE *RT_CREATE(MemoryContext ctx);
+RT_SCOPE void RT_FREE(RT_RADIX_TREE *tree);
+RT_SCOPE bool RT_SET(RT_RADIX_TREE *tree, RT_KEY_TYPE key, RT_VALUE_TYPE value);
+RT_SCOPE bool RT_SEARCH(RT_RADIX_TREE *tree, RT_KEY_TYPE key,
+						RT_VALUE_TYPE *value_p);
+RT_SCOPE uint64 RT_NUM_ENTRIES(RT_RADIX_TREE *tree);
+RT_SCOPE Size RT_MEMORY_USAGE(RT_RADIX_TREE *tree);
+RT_SCOPE RT_ITER *RT_BEGIN_ITERATE(RT_RADIX_TREE *tree);
+RT_SCOPE bool RT_ITERATE_NEXT(RT_ITER *iter, RT_KEY_TYPE *key_p,
+							  RT_VALUE_TYPE *value_p);
+RT_SCOPE void RT_END_ITERATE(RT_ITER *iter);
+RT_SCOPE void RT_MERGE(RT_RADIX_TREE *tree, RT_RADIX_TREE *src);
+RT_SCOPE void RT_STATS(RT_RADIX_TREE *tree);
+
+#endif							/* RT_DECLARE */
+
+
+/* generate implementation of the radix tree */
+#ifdef RT_DEFINE
+
+/*
+ * Helpers shared by all instantiations, defined only once per translation
+ * unit.
+ */
+#ifndef RADIX_TREE_TEMPLATE_ONCE
+#define RADIX_TREE_TEMPLATE_ONCE
+
+#if defined(__SSE2__)
+#include <emmintrin.h>			/* x86 SSE2 intrinsics */
+#define RTT_USE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RTT_USE_NEON
+#endif
+
+#define RTT_NODE_FANOUT	8
+#define RTT_CHUNK_MASK	((1 << RTT_NODE_FANOUT) - 1)
+
+#define RTT_NODE_KIND_4		0
+#define RTT_NODE_KIND_16	1
+#define RTT_NODE_KIND_48	2
+#define RTT_NODE_KIND_256	3
+#define RTT_NODE_KIND_COUNT	4
+
+#define RTT_ISSET_WORDS		(256 / 64)
+#define RTT_ISSET_WORD(chunk)	((chunk) / 64)
+#define RTT_ISSET_BIT(chunk)	(UINT64CONST(1) << ((chunk) % 64))
+
+static inline int
+rtt_popcount64(uint64 word)
+{
+#ifdef HAVE__BUILTIN_POPCOUNT
+	return __builtin_popcountll(word);
+#else
+	return pg_popcount64(word);
+#endif
+}
+
+/*
+ * Return the mask of the chunks of the sorted chunk array of count elements
+ * equal to match (eq) or greater than or equal to match (ge), bit i standing
+ * for the i'th chunk. nchunks is the size of the array, 4 or 16.
+ */
+static inline uint32
+rtt_chunks_mask(const uint8 *chunks, uint8 match, int count, int nchunks,
+				bool ge)
+{
+	uint32		mask = 0;
+
+#if defined(RTT_USE_SSE2)
+	__m128i		haystack;
+	__m128i		spread = _mm_set1_epi8(match);
+
+	if (nchunks == 4)
+	{
+		uint32		v;
+
+		memcpy(&v, chunks, sizeof(uint32));
+		haystack = _mm_cvtsi32_si128((int) v);
+	}
+	else
+		haystack = _mm_loadu_si128((const __m128i *) chunks);
+
+	/* there is no unsigned byte comparison, but min(v, m) == m iff v >= m */
+	if (ge)
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(haystack, spread),
+												spread));
+	else
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(haystack, spread));
+#elif defined(RTT_USE_NEON)
+	static const uint8 weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+	};
+	uint8x16_t	haystack;
+	uint8x16_t	cmp;
+	uint8x16_t	masked;
+
+	if (nchunks == 4)
+	{
+		uint32		v;
+
+		memcpy(&v, chunks, sizeof(uint32));
+		haystack = vreinterpretq_u8_u32(vsetq_lane_u32(v, vdupq_n_u32(0), 0));
+	}
+	else
+		haystack = vld1q_u8(chunks);
+
+	cmp = ge ? vcgeq_u8(haystack, vdupq_n_u8(match)) :
+		vceqq_u8(haystack, vdupq_n_u8(match));
+
+	/* NEON has no movemask, so weight each lane by its bit and add them up */
+	masked = vandq_u8(cmp, vld1q_u8(weights));
+	mask = vaddv_u8(vget_low_u8(masked)) |
+		((uint32) vaddv_u8(vget_high_u8(masked)) << 8);
+#else
+	for (int i = 0; i < count; i++)
+	{
+		if (ge ? chunks[i] >= match : chunks[i] == match)
+			mask |= 1 << i;
+	}
+#endif
+
+	return mask & ((1 << count) - 1);
+}
+
+/* the index of chunk in the sorted chunk array, or -1 if not found */
+static inline int
+rtt_search_chunks_eq(const uint8 *chunks, uint8 match, int count, int nchunks)
+{
+	uint32		mask = rtt_chunks_mask(chunks, match, count, nchunks, false);
+
+	return mask ? pg_rightmost_one_pos32(mask) : -1;
+}
+
+/* the index where chunk goes in the sorted chunk array */
+static inline int
+rtt_search_chunks_ge(const uint8 *chunks, uint8 match, int count, int nchunks)
+{
+	uint32		mask = rtt_chunks_mask(chunks, match, count, nchunks, true);
+
+	return mask ? pg_rightmost_one_pos32(mask) : count;
+}
+
+/* Return the first chunk set in isset at or after chunk, or -1 if none */
+static inline int
+rtt_next_isset(const uint64 *isset, int chunk)
+{
+	for (int w = RTT_ISSET_WORD(chunk); w < RTT_ISSET_WORDS; w++)
+	{
+		uint64		word = isset[w];
+
+		if (w == RTT_ISSET_WORD(chunk))
+			word &= ~(RTT_ISSET_BIT(chunk) - 1);
+
+		if (word != 0)
+			return w * 64 + pg_rightmost_one_pos64(word);
+	}
+
+	return -1;
+}
+
+#endif							/* RADIX_TREE_TEMPLATE_ONCE */
+
+/*
+ * Every node stores the key bits above its own chunk as prefix (the lower
+ * bits are zero), so the levels between a node and its parent that would
+ * have a single child are skipped, see radix_tree.c. Leaves are the nodes
+ * with shift 0.
+ */
+typedef struct RT_NODE
+{
+	RT_KEY_TYPE prefix;
+	uint16		count;			/* up to 256 */
+	uint8		shift;
+	uint8		kind;
+} RT_NODE;
+
+/* a slot holds a child in an inner node, and a value in a leaf */
+typedef union RT_SLOT
+{
+	RT_NODE    *child;
+	RT_VALUE_TYPE value;
+} RT_SLOT;
+
+typedef struct RT_NODE_4
+{
+	RT_NODE		n;
+
+	uint8		chunks[4];
+	RT_SLOT		slots[4];
+} RT_NODE_4;
+
+typedef struct RT_NODE_16
+{
+	RT_NODE		n;
+
+	uint8		chunks[16];
+	RT_SLOT		slots[16];
+} RT_NODE_16;
+
+/*
+ * node-48 keeps its slots in chunk order, the slot of a chunk being found
+ * by counting the chunks present before it.
+ */
+typedef struct RT_NODE_48
+{
+	RT_NODE		n;
+
+	uint64		isset[RTT_ISSET_WORDS];
+	uint8		base[RTT_ISSET_WORDS];
+	RT_SLOT		slots[48];
+} RT_NODE_48;
+
+typedef struct RT_NODE_256
+{
+	RT_NODE		n;
+
+	/* a slot can be used even for a zero value */
+	uint64		isset[RTT_ISSET_WORDS];
+	RT_SLOT		slots[256];
+} RT_NODE_256;
+
+static const struct
+{
+	const char *name;
+	int			max_slots;
+	Size		size;
+}			RT_NODE_INFO[RTT_NODE_KIND_COUNT] =
+{
+	{"radix tree node 4", 4, sizeof(RT_NODE_4)},
+	{"radix tree node 16", 16, sizeof(RT_NODE_16)},
+	{"radix tree node 48", 48, sizeof(RT_NODE_48)},
+	{"radix tree node 256", 256, sizeof(RT_NODE_256)},
+};
+
+struct RT_RADIX_TREE
+{
+	RT_NODE    *root;
+	MemoryContext slabs[RTT_NODE_KIND_COUNT];
+	uint64		num_entries;
+	uint64		mem_used;		/* bytes of the nodes */
+
+#ifdef RT_USE_STATS
+	uint64		nkeys;			/* keys set, new or not */
+	int32		cnt[RTT_NODE_KIND_COUNT];
+#endif
+};
+
+/* Return the shift that is satisfied to store the given key */
+static inline int
+RT_KEY_GET_SHIFT(RT_KEY_TYPE key)
+{
+	return (key == 0)
+		? 0
+		: (RT_KEY_LEFTMOST_ONE_POS(key) / RTT_NODE_FANOUT) * RTT_NODE_FANOUT;
+}
+
+/* Return the max value stored in a node with the given shift */
+static inline RT_KEY_TYPE
+RT_SHIFT_GET_MAX_VAL(int shift)
+{
+	if (shift == RT_MAX_SHIFT)
+		return ~(RT_KEY_TYPE) 0;
+
+	return ((RT_KEY_TYPE) 1 << (shift + RTT_NODE_FANOUT)) - 1;
+}
+
+/* Allocate a zeroed node of the kind */
+static inline RT_NODE *
+RT_ALLOC_NODE(RT_RADIX_TREE *tree, int kind)
+{
+	RT_NODE    *node;
+
+	node = (RT_NODE *) MemoryContextAllocZero(tree->slabs[kind],
+											  RT_NODE_INFO[kind].size);
+	node->kind = kind;
+	tree->mem_used += RT_NODE_INFO[kind].size;
+
+#ifdef RT_USE_STATS
+	tree->cnt[kind]++;
+#endif
+
+	return node;
+}
+
+static inline void
+RT_FREE_NODE(RT_RADIX_TREE *tree, RT_NODE *node)
+{
+	tree->mem_used -= RT_NODE_INFO[node->kind].size;
+
+#ifdef RT_USE_STATS
+	tree->cnt[node->kind]--;
+#endif
+
+	pfree(node);
+}
+
+/*
+ * Return the slot of the chunk in the node, or NULL if the chunk is not
+ * present.
+ */
+static inline RT_SLOT *
+RT_FIND_SLOT(RT_NODE *node, uint8 chunk)
+{
+	switch (node->kind)
+	{
+		case RTT_NODE_KIND_4:
+			{
+				RT_NODE_4  *n4 = (RT_NODE_4 *) node;
+				int			idx = rtt_search_chunks_eq(n4->chunks, chunk,
+													   n4->n.count, 4);
+
+				return (idx < 0) ? NULL : &n4->slots[idx];
+			}
+		case RTT_NODE_KIND_16:
+			{
+				RT_NODE_16 *n16 = (RT_NODE_16 *) node;
+				int			idx = rtt_search_chunks_eq(n16->chunks, chunk,
+													   n16->n.count, 16);
+
+				return (idx < 0) ? NULL : &n16->slots[idx];
+			}
+		case RTT_NODE_KIND_48:
+			{
+				RT_NODE_48 *n48 = (RT_NODE_48 *) node;
+				int			w = RTT_ISSET_WORD(chunk);
+
+				if ((n48->isset[w] & RTT_ISSET_BIT(chunk)) == 0)
+					return NULL;
+
+				return &n48->slots[n48->base[w] +
+								   rtt_popcount64(n48->isset[w] &
+												  (RTT_ISSET_BIT(chunk) - 1))];
+			}
+		case RTT_NODE_KIND_256:
+			{
+				RT_NODE_256 *n256 = (RT_NODE_256 *) node;
+
+				if ((n256->isset[RTT_ISSET_WORD(chunk)] & RTT_ISSET_BIT(chunk)) == 0)
+					return NULL;
+
+				return &n256->slots[chunk];
+			}
+	}
+
+	pg_unreachable();
+}
+
+/* Create a leaf having only the key */
+static RT_NODE *
+RT_NEW_LEAF(RT_RADIX_TREE *tree, RT_KEY_TYPE key, RT_VALUE_TYPE value)
+{
+	RT_NODE_4  *n4 = (RT_NODE_4 *) RT_ALLOC_NODE(tree, RTT_NODE_KIND_4);
+
+	n4->n.prefix = key & ~RT_SHIFT_GET_MAX_VAL(0);
+	n4->n.shift = 0;
+	n4->n.count = 1;
+	n4->chunks[0] = RT_GET_KEY_CHUNK(key, 0);
+	n4->slots[0].value = value;
+
+	return &n4->n;
+}
+
+/*
+ * The key doesn't match the prefix of the node. Return a new node-4 at the
+ * highest chunk where they differ, having the node and a new leaf for the
+ * key as children.
+ */
+static RT_NODE *
+RT_SPLIT(RT_RADIX_TREE *tree, RT_NODE *node, RT_KEY_TYPE key,
+		 RT_VALUE_TYPE value)
+{
+	RT_NODE_4  *n4;
+	RT_KEY_TYPE diff = (key ^ node->prefix) & ~RT_SHIFT_GET_MAX_VAL(node->shift);
+	int			shift = RT_KEY_GET_SHIFT(diff);
+	uint8		key_chunk = RT_GET_KEY_CHUNK(key, shift);
+	uint8		node_chunk = RT_GET_KEY_CHUNK(node->prefix, shift);
+	int			key_idx = (key_chunk < node_chunk) ? 0 : 1;
+
+	Assert(diff != 0);
+	Assert(shift > node->shift);
+
+	n4 = (RT_NODE_4 *) RT_ALLOC_NODE(tree, RTT_NODE_KIND_4);
+	n4->n.prefix = key & ~RT_SHIFT_GET_MAX_VAL(shift);
+	n4->n.shift = shift;
+	n4->n.count = 2;
+	n4->chunks[key_idx] = key_chunk;
+	n4->slots[key_idx].child = RT_NEW_LEAF(tree, key, value);
+	n4->chunks[1 - key_idx] = node_chunk;
+	n4->slots[1 - key_idx].child = node;
+
+	return &n4->n;
+}
+
+/*
+ * Link newnode to the parent, or make it the root if parent is NULL, in place
+ * of oldnode, which may have been freed already. newnode is at the same chunk
+ * of the parent, whether it's a copy or an ancestor of oldnode.
+ */
+static inline void
+RT_REPLACE_CHILD(RT_RADIX_TREE *tree, RT_NODE *parent, RT_NODE *oldnode,
+				 RT_NODE *newnode)
+{
+	RT_SLOT    *slot;
+
+	if (parent == NULL)
+	{
+		tree->root = newnode;
+		return;
+	}
+
+	slot = RT_FIND_SLOT(parent, RT_GET_KEY_CHUNK(newnode->prefix, parent->shift));
+	Assert(slot != NULL && slot->child == oldnode);
+	slot->child = newnode;
+}
+
+/* Return a copy of the full node with the next larger node kind */
+static RT_NODE *
+RT_NODE_GROW(RT_RADIX_TREE *tree, RT_NODE *node)
+{
+	RT_NODE    *newnode;
+
+	Assert(node->count == RT_NODE_INFO[node->kind].max_slots);
+
+	newnode = RT_ALLOC_NODE(tree, node->kind + 1);
+	newnode->prefix = node->prefix;
+	newnode->shift = node->shift;
+	newnode->count = node->count;
+
+	switch (node->kind)
+	{
+		case RTT_NODE_KIND_4:
+			{
+				RT_NODE_4  *n4 = (RT_NODE_4 *) node;
+				RT_NODE_16 *new16 = (RT_NODE_16 *) newnode;
+
+				/* chunks are already sorted */
+				memcpy(new16->chunks, n4->chunks, sizeof(uint8) * 4);
+				memcpy(new16->slots, n4->slots, sizeof(RT_SLOT) * 4);
+				break;
+			}
+		case RTT_NODE_KIND_16:
+			{
+				RT_NODE_16 *n16 = (RT_NODE_16 *) node;
+				RT_NODE_48 *new48 = (RT_NODE_48 *) newnode;
+
+				/* the sorted chunks give the slots in chunk order */
+				for (int i = 0; i < 16; i++)
+					new48->isset[RTT_ISSET_WORD(n16->chunks[i])] |=
+						RTT_ISSET_BIT(n16->chunks[i]);
+				memcpy(new48->slots, n16->slots, sizeof(RT_SLOT) * 16);
+
+				for (int w = 1; w < RTT_ISSET_WORDS; w++)
+					new48->base[w] = new48->base[w - 1] +
+						rtt_popcount64(new48->isset[w - 1]);
+				break;
+			}
+		case RTT_NODE_KIND_48:
+			{
+				RT_NODE_48 *n48 = (RT_NODE_48 *) node;
+				RT_NODE_256 *new256 = (RT_NODE_256 *) newnode;
+				int			idx = 0;
+
+				for (int i = 0; i < 256; i++)
+				{
+					if (n48->isset[RTT_ISSET_WORD(i)] & RTT_ISSET_BIT(i))
+						new256->slots[i] = n48->slots[idx++];
+				}
+				memcpy(new256->isset, n48->isset, sizeof(new256->isset));
+				break;
+			}
+		default:
+			elog(ERROR, "radix tree node_256 cannot be grown");
+	}
+
+	return newnode;
+}
+
+/*
+ * Add the slot for the chunk, which must not be present, to the node. A full
+ * node is replaced by a larger one first, which is freed. Returns the node
+ * having the slot, for the caller to link in place of the given one.
+ */
+static RT_NODE *
+RT_ADD_SLOT(RT_RADIX_TREE *tree, RT_NODE *node, uint8 chunk, RT_SLOT slot)
+{
+	if (node->count == RT_NODE_INFO[node->kind].max_slots)
+	{
+		RT_NODE    *newnode = RT_NODE_GROW(tree, node);
+
+		RT_FREE_NODE(tree, node);
+		node = newnode;
+	}
+
+	switch (node->kind)
+	{
+		case RTT_NODE_KIND_4:
+			{
+				RT_NODE_4  *n4 = (RT_NODE_4 *) node;
+				int			i = rtt_search_chunks_ge(n4->chunks, chunk,
+													 n4->n.count, 4);
+
+				memmove(&n4->chunks[i + 1], &n4->chunks[i],
+						sizeof(uint8) * (n4->n.count - i));
+				memmove(&n4->slots[i + 1], &n4->slots[i],
+						sizeof(RT_SLOT) * (n4->n.count - i));
+				n4->chunks[i] = chunk;
+				n4->slots[i] = slot;
+				break;
+			}
+		case RTT_NODE_KIND_16:
+			{
+				RT_NODE_16 *n16 = (RT_NODE_16 *) node;
+				int			i = rtt_search_chunks_ge(n16->chunks, chunk,
+													 n16->n.count, 16);
+
+				memmove(&n16->chunks[i + 1], &n16->chunks[i],
+						sizeof(uint8) * (n16->n.count - i));
+				memmove(&n16->slots[i + 1], &n16->slots[i],
+						sizeof(RT_SLOT) * (n16->n.count - i));
+				n16->chunks[i] = chunk;
+				n16->slots[i] = slot;
+				break;
+			}
+		case RTT_NODE_KIND_48:
+			{
+				RT_NODE_48 *n48 = (RT_NODE_48 *) node;
+				int			w = RTT_ISSET_WORD(chunk);
+				int			idx;
+
+				idx = n48->base[w] +
+					rtt_popcount64(n48->isset[w] & (RTT_ISSET_BIT(chunk) - 1));
+				memmove(&n48->slots[idx + 1], &n48->slots[idx],
+						sizeof(RT_SLOT) * (n48->n.count - idx));
+				n48->slots[idx] = slot;
+
+				n48->isset[w] |= RTT_ISSET_BIT(chunk);
+				for (w++; w < RTT_ISSET_WORDS; w++)
+					n48->base[w]++;
+				break;
+			}
+		case RTT_NODE_KIND_256:
+			{
+				RT_NODE_256 *n256 = (RT_NODE_256 *) node;
+
+				n256->slots[chunk] = slot;
+				n256->isset[RTT_ISSET_WORD(chunk)] |= RTT_ISSET_BIT(chunk);
+				break;
+			}
+	}
+
+	node->count++;
+
+	return node;
+}
+
+/* Same as RT_ADD_SLOT, but link the new node to the parent if grown */
+static inline void
+RT_INSERT_SLOT(RT_RADIX_TREE *tree, RT_NODE *parent, RT_NODE *node,
+			   uint8 chunk, RT_SLOT slot)
+{
+	RT_NODE    *newnode = RT_ADD_SLOT(tree, node, chunk, slot);
+
+	if (newnode != node)
+		RT_REPLACE_CHILD(tree, parent, node, newnode);
+}
+
+RT_SCOPE RT_RADIX_TREE *
+RT_CREATE(MemoryContext ctx)
+{
+	RT_RADIX_TREE *tree;
+
+	tree = (RT_RADIX_TREE *) MemoryContextAllocZero(ctx, sizeof(RT_RADIX_TREE));
+
+	for (int i = 0; i < RTT_NODE_KIND_COUNT; i++)
+		tree->slabs[i] = SlabContextCreate(ctx,
+										   RT_NODE_INFO[i].name,
+										   SLAB_DEFAULT_BLOCK_SIZE,
+										   RT_NODE_INFO[i].size);
+
+	return tree;
+}
+
+RT_SCOPE void
+RT_FREE(RT_RADIX_TREE *tree)
+{
+	for (int i = 0; i < RTT_NODE_KIND_COUNT; i++)
+		MemoryContextDelete(tree->slabs[i]);
+
+	pfree(tree);
+}
+
+/*
+ * Set the value of the key, inserting the key if it's not there yet.
+ * Returns true if the key is newly inserted.
+ */
+RT_SCOPE bool
+RT_SET(RT_RADIX_TREE *tree, RT_KEY_TYPE key, RT_VALUE_TYPE value)
+{
+	RT_NODE    *node;
+	RT_NODE    *parent = NULL;
+	RT_SLOT    *slot;
+	RT_SLOT		newslot;
+
+#ifdef RT_USE_STATS
+	tree->nkeys++;
+#endif
+
+	/* Empty tree, the first leaf becomes the root */
+	if (tree->root == NULL)
+	{
+		tree->root = RT_NEW_LEAF(tree, key, value);
+		tree->num_entries++;
+		return true;
+	}
+
+	node = tree->root;
+	for (;;)
+	{
+		if ((key & ~RT_SHIFT_GET_MAX_VAL(node->shift)) != node->prefix)
+		{
+			/* put a new node above the node */
+			RT_REPLACE_CHILD(tree, parent, node, RT_SPLIT(tree, node, key, value));
+			tree->num_entries++;
+			return true;
+		}
+
+		/* arrived at a leaf */
+		if (RT_NODE_IS_LEAF(node))
+			break;
+
+		slot = RT_FIND_SLOT(node, RT_GET_KEY_CHUNK(key, node->shift));
+		if (slot == NULL)
+		{
+			/* link a new leaf right below the node */
+			newslot.child = RT_NEW_LEAF(tree, key, value);
+			RT_INSERT_SLOT(tree, parent, node,
+						   RT_GET_KEY_CHUNK(key, node->shift), newslot);
+			tree->num_entries++;
+			return true;
+		}
+
+		parent = node;
+		node = slot->child;
+	}
+
+	slot = RT_FIND_SLOT(node, RT_GET_KEY_CHUNK(key, 0));
+	if (slot != NULL)
+	{
+		slot->value = value;
+		return false;
+	}
+
+	newslot.value = value;
+	RT_INSERT_SLOT(tree, parent, node, RT_GET_KEY_CHUNK(key, 0), newslot);
+	tree->num_entries++;
+
+	return true;
+}
+
+/*
+ * Search the key, and set *value_p to its value if found. The prefix of a
+ * leaf covers all the key bits above its chunk, so the prefixes of the inner
+ * nodes are not checked and the skipped chunks are compared only at the
+ * leaf.
+ */
+RT_SCOPE bool
+RT_SEARCH(RT_RADIX_TREE *tree, RT_KEY_TYPE key, RT_VALUE_TYPE *value_p)
+{
+	RT_NODE    *node = tree->root;
+
+	while (node != NULL)
+	{
+		RT_SLOT    *slot = RT_FIND_SLOT(node, RT_GET_KEY_CHUNK(key, node->shift));
+
+		if (slot == NULL)
+			return false;
+
+		if (RT_NODE_IS_LEAF(node))
+		{
+			if (node->prefix != (key & ~RT_SHIFT_GET_MAX_VAL(0)))
+				return false;
+
+			*value_p = slot->value;
+			return true;
+		}
+
+		node = slot->child;
+	}
+
+	return false;
+}
+
+RT_SCOPE uint64
+RT_NUM_ENTRIES(RT_RADIX_TREE *tree)
+{
+	return tree->num_entries;
+}
+
+/*
+ * Return the bytes used by the tree and its nodes, not counting the free
+ * space in the slabs.
+ */
+RT_SCOPE Size
+RT_MEMORY_USAGE(RT_RADIX_TREE *tree)
+{
+	return sizeof(RT_RADIX_TREE) + tree->mem_used;
+}
+
+/*
+ * Iteration over all keys in ascending order, walking the tree depth-first
+ * as radix_tree_iterate_next() does. The tree must not be modified during
+ * iteration.
+ */
+struct RT_ITER
+{
+	int			depth;
+	RT_NODE    *stack[RT_MAX_LEVEL];
+	int			pos[RT_MAX_LEVEL];	/* index, or chunk for node-48/256 */
+};
+
+RT_SCOPE RT_ITER *
+RT_BEGIN_ITERATE(RT_RADIX_TREE *tree)
+{
+	RT_ITER    *iter = (RT_ITER *) palloc0(sizeof(RT_ITER));
+
+	if (tree->root != NULL)
+	{
+		iter->stack[0] = tree->root;
+		iter->depth = 1;
+	}
+
+	return iter;
+}
+
+/*
+ * Return the slot at or after *pos in the node, advancing *pos past it, and
+ * set its chunk. Returns NULL if there are no more slots.
+ */
+static inline RT_SLOT *
+RT_ITER_NEXT_SLOT(RT_NODE *node, int *pos, uint8 *chunk)
+{
+	switch (node->kind)
+	{
+		case RTT_NODE_KIND_4:
+			{
+				RT_NODE_4  *n4 = (RT_NODE_4 *) node;
+
+				if (*pos >= n4->n.count)
+					return NULL;
+
+				*chunk = n4->chunks[*pos];
+				return &n4->slots[(*pos)++];
+			}
+		case RTT_NODE_KIND_16:
+			{
+				RT_NODE_16 *n16 = (RT_NODE_16 *) node;
+
+				if (*pos >= n16->n.count)
+					return NULL;
+
+				*chunk = n16->chunks[*pos];
+				return &n16->slots[(*pos)++];
+			}
+		case RTT_NODE_KIND_48:
+		case RTT_NODE_KIND_256:
+			{
+				/* both have the bitmap of present chunks right after the header */
+				const uint64 *isset = (node->kind == RTT_NODE_KIND_48) ?
+					((RT_NODE_48 *) node)->isset : ((RT_NODE_256 *) node)->isset;
+				int			next;
+
+				if (*pos >= 256 || (next = rtt_next_isset(isset, *pos)) < 0)
+					return NULL;
+
+				*pos = next + 1;
+				*chunk = next;
+				return RT_FIND_SLOT(node, next);
+			}
+	}
+
+	pg_unreachable();
+}
+
+/*
+ * Return the next key and its value. Returns false if there are no more
+ * keys.
+ */
+RT_SCOPE bool
+RT_ITERATE_NEXT(RT_ITER *iter, RT_KEY_TYPE *key_p, RT_VALUE_TYPE *value_p)
+{
+	while (iter->depth > 0)
+	{
+		int			level = iter->depth - 1;
+		RT_NODE    *node = iter->stack[level];
+		RT_SLOT    *slot;
+		uint8		chunk;
+
+		slot = RT_ITER_NEXT_SLOT(node, &iter->pos[level], &chunk);
+
+		if (slot == NULL)
+		{
+			/* no more slots in this node */
+			iter->depth--;
+			continue;
+		}
+
+		if (RT_NODE_IS_LEAF(node))
+		{
+			*key_p = node->prefix | chunk;
+			*value_p = slot->value;
+			return true;
+		}
+
+		Assert(iter->depth < RT_MAX_LEVEL);
+		iter->stack[iter->depth] = slot->child;
+		iter->pos[iter->depth] = 0;
+		iter->depth++;
+	}
+
+	return false;
+}
+
+RT_SCOPE void
+RT_END_ITERATE(RT_ITER *iter)
+{
+	pfree(iter);
+}
+
+/*
+ * Merge the subtree of src into the subtree of node, and return the node to
+ * link in place of node. The nodes of src are linked to the merged subtree
+ * as they are, but for the ones at the same positions as nodes of the
+ * subtree, whose slots are added to the latter. With disjoint key ranges,
+ * these are only the nodes on the paths to the keys at the boundary.
+ */
+static RT_NODE *
+RT_GRAFT(RT_RADIX_TREE *tree, RT_NODE *node, RT_NODE *src)
+{
+	int			shift = Max(node->shift, src->shift);
+	RT_KEY_TYPE diff = (node->prefix ^ src->prefix) & ~RT_SHIFT_GET_MAX_VAL(shift);
+	RT_SLOT    *slot;
+	RT_SLOT		newslot;
+	uint8		chunk;
+
+	if (diff != 0)
+	{
+		/* they differ above both, so put a new node-4 above them */
+		RT_NODE_4  *n4 = (RT_NODE_4 *) RT_ALLOC_NODE(tree, RTT_NODE_KIND_4);
+		int			newshift = RT_KEY_GET_SHIFT(diff);
+		uint8		node_chunk = RT_GET_KEY_CHUNK(node->prefix, newshift);
+		uint8		src_chunk = RT_GET_KEY_CHUNK(src->prefix, newshift);
+		int			src_idx = (src_chunk < node_chunk) ? 0 : 1;
+
+		n4->n.prefix = node->prefix & ~RT_SHIFT_GET_MAX_VAL(newshift);
+		n4->n.shift = newshift;
+		n4->n.count = 2;
+		n4->chunks[src_idx] = src_chunk;
+		n4->slots[src_idx].child = src;
+		n4->chunks[1 - src_idx] = node_chunk;
+		n4->slots[1 - src_idx].child = node;
+
+		return &n4->n;
+	}
+
+	if (node->shift > src->shift)
+	{
+		/* src goes below node */
+		chunk = RT_GET_KEY_CHUNK(src->prefix, node->shift);
+		slot = RT_FIND_SLOT(node, chunk);
+		if (slot != NULL)
+			slot->child = RT_GRAFT(tree, slot->child, src);
+		else
+		{
+			newslot.child = src;
+			node = RT_ADD_SLOT(tree, node, chunk, newslot);
+		}
+
+		return node;
+	}
+
+	if (src->shift > node->shift)
+	{
+		/* node goes below src */
+		chunk = RT_GET_KEY_CHUNK(node->prefix, src->shift);
+		slot = RT_FIND_SLOT(src, chunk);
+		if (slot != NULL)
+			slot->child = RT_GRAFT(tree, node, slot->child);
+		else
+		{
+			newslot.child = node;
+			src = RT_ADD_SLOT(tree, src, chunk, newslot);
+		}
+
+		return src;
+	}
+
+	/* the same position, move the slots of src to node */
+	{
+		int			pos = 0;
+
+		while ((slot = RT_ITER_NEXT_SLOT(src, &pos, &chunk)) != NULL)
+		{
+			RT_SLOT    *nodeslot = RT_FIND_SLOT(node, chunk);
+
+			if (nodeslot == NULL)
+				node = RT_ADD_SLOT(tree, node, chunk, *slot);
+			else if (RT_NODE_IS_LEAF(node))
+			{
+				/* the key is in both, src wins */
+				nodeslot->value = slot->value;
+				tree->num_entries--;
+			}
+			else
+				nodeslot->child = RT_GRAFT(tree, nodeslot->child, slot->child);
+		}
+
+		RT_FREE_NODE(tree, src);
+	}
+
+	return node;
+}
+
+/*
+ * Move the keys of src to tree, and free src. The value in src wins for a
+ * key in both. The nodes stay in the slabs of src, which become children
+ * of the ones of tree, and are linked to tree as they are but for the ones
+ * at the same positions as nodes of tree, so merging trees of disjoint key
+ * ranges, like ones built for consecutive block ranges, takes
+ * O(height * fanout) regardless of the number of keys.
+ */
+RT_SCOPE void
+RT_MERGE(RT_RADIX_TREE *tree, RT_RADIX_TREE *src)
+{
+	for (int i = 0; i < RTT_NODE_KIND_COUNT; i++)
+	{
+		MemoryContextSetParent(src->slabs[i], tree->slabs[i]);
+#ifdef RT_USE_STATS
+		tree->cnt[i] += src->cnt[i];
+#endif
+	}
+
+#ifdef RT_USE_STATS
+	tree->nkeys += src->nkeys;
+#endif
+	tree->mem_used += src->mem_used;
+	tree->num_entries += src->num_entries;
+
+	if (tree->root == NULL)
+		tree->root = src->root;
+	else if (src->root != NULL)
+		tree->root = RT_GRAFT(tree, tree->root, src->root);
+
+	pfree(src);
+}
+
+RT_SCOPE void
+RT_STATS(RT_RADIX_TREE *tree)
+{
+#ifdef RT_USE_STATS
+	elog(NOTICE, "num_entries = %lu, nkeys = %lu, mem = %zu, n4 = %d(%zu), n16 = %d(%zu), n48 = %d(%zu), n256 = %d(%zu)",
+		 tree->num_entries, tree->nkeys, RT_MEMORY_USAGE(tree),
+		 tree->cnt[0], tree->cnt[0] * sizeof(RT_NODE_4),
+		 tree->cnt[1], tree->cnt[1] * sizeof(RT_NODE_16),
+		 tree->cnt[2], tree->cnt[2] * sizeof(RT_NODE_48),
+		 tree->cnt[3], tree->cnt[3] * sizeof(RT_NODE_256));
+#else
+	elog(NOTICE, "num_entries = %lu, mem = %zu",
+		 tree->num_entries, RT_MEMORY_USAGE(tree));
+#endif
+}
+
+#endif							/* RT_DEFINE */
+
+
+/* undefine external parameters, so next radix tree can be defined */
+#undef RT_PREFIX
+#undef RT_VALUE_TYPE
+#undef RT_KEY_BITS
+#undef RT_USE_STATS
+#undef RT_SCOPE
+#undef RT_DECLARE
+#undef RT_DEFINE
+
+/* undefine locally declared macros */
+#undef RT_MAKE_PREFIX
+#undef RT_MAKE_NAME
+#undef RT_MAKE_NAME_
+#undef RT_KEY_TYPE
+#undef RT_KEY_LEFTMOST_ONE_POS
+#undef RT_MAX_SHIFT
+#undef RT_MAX_LEVEL
+#undef RT_NODE_IS_LEAF
+#undef RT_GET_KEY_CHUNK
+
+/* types */
+#undef RT_RADIX_TREE
+#undef RT_ITER
+#undef RT_NODE
+#undef RT_NODE_4
+#undef RT_NODE_16
+#undef RT_NODE_48
+#undef RT_NODE_256
+#undef RT_SLOT
+
+/* external function names */
+#undef RT_CREATE
+#undef RT_FREE
+#undef RT_SET
+#undef RT_SEARCH
+#undef RT_NUM_ENTRIES
+#undef RT_MEMORY_USAGE
+#undef RT_BEGIN_ITERATE
+#undef RT_ITERATE_NEXT
+#undef RT_END_ITERATE
+#undef RT_MERGE
+#undef RT_STATS
+
+/* internal function names */
+#undef RT_NODE_INFO
+#undef RT_KEY_GET_SHIFT
+#undef RT_SHIFT_GET_MAX_VAL
+#undef RT_ALLOC_NODE
+#undef RT_FREE_NODE
+#undef RT_FIND_SLOT
+#undef RT_NEW_LEAF
+#undef RT_SPLIT
+#undef RT_REPLACE_CHILD
+#undef RT_NODE_GROW
+#undef RT_ADD_SLOT
+#undef RT_INSERT_SLOT
+#undef RT_GRAFT
+#undef RT_ITER_NEXT_SLOT